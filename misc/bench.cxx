@@ -0,0 +1,841 @@
+/*
+ * Recorder pipeline benchmarks.
+ *
+ * Runs the capture session from src/ against miniaudio's
+ * null backend, which delivers silence at real-time pace,
+ * so results reflect the writer side rather than hardware.
+ *
+ * Build (from misc/):
+ *   g++ -std=c++17 -O2 -I../src bench.cxx -o bench -lpthread -ldl -lm
+ * Run:
+ *   ./bench [seconds per step]
+ */
+#define MINIAUDIO_IMPLEMENTATION
+#include "miniaudio.h"
+#include "rec_session.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+static double cpu_seconds() {
+	/*
+	 * Process CPU time, user + system.
+	 */
+#if defined(_WIN32)
+	return (double)clock() / CLOCKS_PER_SEC;
+#else
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+static void bench_devices(ma_context* context, rec_layout layout, int seconds) {
+	/*
+	 * Opens 1, 2, 4... null capture devices
+	 * at 96 kHz stereo and reports whether
+	 * the writers kept up. A step "sustains"
+	 * when no frame was dropped from any ring.
+	 */
+	printf("== devices (%s): 96000 Hz, 2 ch, %d s per step ==\n", layout == REC_LAYOUT_MERGED ? "merged" : "separate", seconds);
+	printf("%8s %12s %10s %10s %s\n", "devices", "frames", "dropped", "cpu %", "");
+	for (ma_uint32 count = 1; count <= REC_MAX_INPUTS; count *= 2) {
+		rec_config config = rec_config_init(ma_format_f32, 2, 96000);
+		rec_session* session = new rec_session();
+		config.input_count = count;
+		config.layout = layout;
+		std::string path = "bench_devices.wav";
+		double cpu0 = cpu_seconds();
+		if (rec_session_start(session, context, &config, path.c_str()) != MA_SUCCESS) {
+			printf("%8u failed to start\n", count);
+			delete session;
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::seconds(seconds));
+		rec_session_uninit(session);
+		double cpu = cpu_seconds() - cpu0;
+		ma_uint64 frames = 0, dropped = 0;
+		for (ma_uint32 i = 0; i < count; i++) {
+			frames += session->inputs[i].frames_written.load();
+			dropped += session->inputs[i].frames_dropped.load();
+		}
+		for (ma_uint32 i = 0; i < (layout == REC_LAYOUT_MERGED ? 1 : count); i++) {
+			remove(session->inputs[i].path.c_str());
+		}
+		printf("%8u %12llu %10llu %10.1f %s\n", count, (unsigned long long)frames, (unsigned long long)dropped,
+			100.0 * cpu / seconds, dropped == 0 ? "sustained" : "OVERRUN");
+		delete session;
+	}
+}
+
+static void bench_burst(ma_context* context, int seconds) {
+	/*
+	 * Burst mode: capture to RAM, then time
+	 * the parallel flush at stop.
+	 */
+	printf("== burst: 192000 Hz, 2 ch, %d s capture ==\n", seconds);
+	printf("%8s %10s %10s %12s\n", "devices", "MB", "flush ms", "MB/s");
+	for (ma_uint32 count = 1; count <= 4; count *= 2) {
+		rec_config config = rec_config_init(ma_format_f32, 2, 192000);
+		rec_session* session = new rec_session();
+		config.input_count = count;
+		config.burst_budget = (size_t)count * (seconds + 1) * 192000 * 8;
+		if (rec_session_start(session, context, &config, "bench_burst.wav") != MA_SUCCESS) {
+			printf("%8u failed to start\n", count);
+			delete session;
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::seconds(seconds));
+		int full = rec_session_full(session);
+		auto t0 = std::chrono::steady_clock::now();
+		rec_session_uninit(session);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+		double mb = 0;
+		for (ma_uint32 i = 0; i < count; i++) {
+			mb += session->inputs[i].frames_written.load() * 8 / 1048576.0;
+			remove(session->inputs[i].path.c_str());
+		}
+		printf("%8u %10.1f %10.1f %12.0f%s\n", count, mb, ms, mb / (ms / 1000.0), full ? " (budget exceeded)" : "");
+		delete session;
+	}
+}
+
+static const char* rec_sink_label(const rec_output* out, rec_sink_kind kind) {
+	/*
+	 * How the asynchronous sinks ended up
+	 * writing on this system.
+	 */
+	if (!out->sink_used || (kind != REC_SINK_ASYNC && kind != REC_SINK_DIRECT)) return "";
+	if (kind == REC_SINK_DIRECT && out->sink.drop_cache) return out->sink.uring_ok ? "io_uring, cache dropped" : "pwrite thread, cache dropped";
+	if (kind == REC_SINK_DIRECT) return out->sink.uring_ok ? "io_uring, O_DIRECT" : "pwrite thread, O_DIRECT";
+	return out->sink.uring_ok ? "io_uring" : "pwrite thread";
+}
+
+static void bench_sink(rec_sink_kind kind, const char* name) {
+	/*
+	 * Writer-thread cost of getting encoded
+	 * audio to disk: 10 minutes of 48 kHz
+	 * stereo float through one output, as
+	 * fast as it goes. Thread CPU time is
+	 * what the writer itself spends; the
+	 * slowest writes are what a capture
+	 * ring has to absorb.
+	 */
+	const ma_uint32 chunk = REC_WRITE_CHUNK;
+	const ma_uint64 total = 48000ull * 600;
+	ma_encoder_config config = ma_encoder_config_init(ma_encoding_format_wav, ma_format_f32, 2, 48000);
+	rec_output* out = new rec_output();
+	float* buf = (float*)calloc((size_t)chunk * 2, sizeof(float));
+	std::vector<double> lat;
+	lat.reserve((size_t)(total / chunk) + 1);
+	if (rec_output_open(out, "bench_sink.wav", &config, REC_WAV_PCM, 0, kind) != MA_SUCCESS) {
+		printf("%-8s failed to open\n", name);
+		delete out;
+		free(buf);
+		return;
+	}
+	// Closing resets the sink, so ask first
+	const char* label = rec_sink_label(out, kind);
+	double cpu0 = rec_thread_cpu_seconds();
+	auto t0 = std::chrono::steady_clock::now();
+	for (ma_uint64 done = 0; done < total; done += chunk) {
+		auto w0 = std::chrono::steady_clock::now();
+		rec_output_write(out, buf, chunk);
+		lat.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - w0).count());
+	}
+	double cpu_write = rec_thread_cpu_seconds() - cpu0;
+	ma_result result = rec_output_close(out);
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	std::sort(lat.begin(), lat.end());
+	printf("%-8s %14.3f %10.2f %10.0f %10.3f %10.3f %10.2f %s\n", name, 1000.0 * cpu_write / 600.0, wall,
+		total * 8 / 1048576.0 / wall, lat[lat.size() / 2], lat[lat.size() * 99 / 100], lat.back(),
+		result != MA_SUCCESS ? ma_result_description(result) : label);
+	remove("bench_sink.wav");
+	delete out;
+	free(buf);
+}
+
+static void bench_sync(rec_sync_policy policy, ma_uint32 interval_ms, ma_uint64 mb, const char* name, int seconds) {
+	/*
+	 * Durability policies: 48 kHz stereo
+	 * float through the asynchronous sink,
+	 * paced at 32 times real time, with the
+	 * sync thread running alongside. The
+	 * worst single write shows whether syncs
+	 * ever hold up the writer.
+	 */
+	const ma_uint32 chunk = REC_WRITE_CHUNK;
+	const double pace = 48000.0 * 32;
+	ma_encoder_config config = ma_encoder_config_init(ma_encoding_format_wav, ma_format_f32, 2, 48000);
+	rec_output* out = new rec_output();
+	rec_syncer* y = new rec_syncer();
+	float* buf = (float*)calloc((size_t)chunk * 2, sizeof(float));
+	rec_syncer_init(y, policy, interval_ms, mb * 1024 * 1024);
+	if (rec_output_open(out, "bench_sync.wav", &config, REC_WAV_PCM, 0, REC_SINK_ASYNC) != MA_SUCCESS) {
+		printf("%-10s failed to open\n", name);
+		delete out;
+		delete y;
+		free(buf);
+		return;
+	}
+	rec_output_durable(out, y);
+	rec_syncer_start(y);
+	auto t0 = std::chrono::steady_clock::now();
+	double worst = 0;
+	for (ma_uint64 done = 0; done < (ma_uint64)(pace * seconds); done += chunk) {
+		auto w0 = std::chrono::steady_clock::now();
+		rec_output_write(out, buf, chunk);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - w0).count();
+		if (ms > worst) worst = ms;
+		std::this_thread::sleep_until(t0 + std::chrono::duration<double>((done + chunk) / pace));
+	}
+	rec_syncer_stop(y);
+	rec_output_close(out);
+	printf("%-10s %8llu %8llu %10.2f %10.2f %10.2f %12.2f\n", name, (unsigned long long)y->requests, (unsigned long long)y->rounds,
+		rec_syncer_percentile(y, 0.5), rec_syncer_percentile(y, 0.99), y->max_ms, worst);
+	remove("bench_sync.wav");
+	delete out;
+	delete y;
+	free(buf);
+}
+
+static void bench_fanout_sink(void* user, const rec_block* b) {
+	*(volatile float*)user = *(const float*)b->data;
+}
+
+static void bench_fanout() {
+	/*
+	 * Producer cost per block as sinks are
+	 * added: publishing shared blocks against
+	 * copying every block once per sink.
+	 * Blocks are REC_WRITE_CHUNK frames of
+	 * 8-channel float; sinks read one sample,
+	 * so only the hand-over is measured.
+	 */
+	const ma_uint32 ch = 8;
+	const int blocks = 20000;
+	const size_t bytes = (size_t)REC_WRITE_CHUNK * ch * sizeof(float);
+	float* src = (float*)calloc((size_t)REC_WRITE_CHUNK * ch, sizeof(float));
+	float* copies = (float*)calloc((size_t)REC_WRITE_CHUNK * ch * REC_FANOUT_MAX_SINKS, sizeof(float));
+	float sink_out[REC_FANOUT_MAX_SINKS];
+	printf("== fan-out: %u frames x %u ch f32 per block (%zu KB) ==\n", REC_WRITE_CHUNK, ch, bytes / 1024);
+	printf("%8s %16s %16s %10s\n", "sinks", "shared us/block", "copied us/block", "waits");
+	for (ma_uint32 count = 1; count <= REC_FANOUT_MAX_SINKS; count *= 2) {
+		rec_fanout* f = new rec_fanout();
+		rec_fanout_init(f, 0, ch * sizeof(float), REC_WRITE_CHUNK);
+		for (ma_uint32 k = 0; k < count; k++) rec_fanout_add(f, "bench", REC_DROP_NONE, 16, bench_fanout_sink, &sink_out[k]);
+		if (rec_fanout_start(f) != MA_SUCCESS) {
+			printf("%8u failed to start\n", count);
+			delete f;
+			break;
+		}
+		double cpu0 = rec_thread_cpu_seconds();
+		for (int i = 0; i < blocks; i++) {
+			rec_block* b = rec_fanout_acquire(f);
+			memcpy(b->data, src, bytes);
+			rec_fanout_publish(f, b, REC_WRITE_CHUNK);
+		}
+		double shared = rec_thread_cpu_seconds() - cpu0;
+		rec_fanout_uninit(f);
+		cpu0 = rec_thread_cpu_seconds();
+		for (int i = 0; i < blocks; i++) {
+			for (ma_uint32 k = 0; k < count; k++) memcpy(copies + (size_t)REC_WRITE_CHUNK * ch * k, src, bytes);
+		}
+		double copied = rec_thread_cpu_seconds() - cpu0;
+		printf("%8u %16.2f %16.2f %10llu\n", count, 1e6 * shared / blocks, 1e6 * copied / blocks, (unsigned long long)f->waits);
+		delete f;
+	}
+	free(src);
+	free(copies);
+}
+
+static void bench_asrc() {
+	/*
+	 * Drift-compensating resampler throughput
+	 * at a ratio of +100 ppm, in multiples of
+	 * real time at 48 kHz.
+	 */
+	const ma_uint32 chunk = REC_WRITE_CHUNK;
+	printf("== asrc: cubic, 48000 Hz, +100 ppm ==\n");
+	printf("%8s %14s\n", "channels", "x real time");
+	for (ma_uint32 ch = 1; ch <= 16; ch *= 2) {
+		rec_asrc a;
+		if (rec_asrc_init(&a, ch, chunk) != MA_SUCCESS) break;
+		a.ratio = 1.0001;
+		float* in = (float*)calloc((size_t)chunk * 2 * ch, sizeof(float));
+		float* out = (float*)calloc((size_t)chunk * ch, sizeof(float));
+		for (size_t i = 0; i < (size_t)chunk * 2 * ch; i++) in[i] = (float)sin(i * 0.01);
+		ma_uint64 frames = 0;
+		auto t0 = std::chrono::steady_clock::now();
+		double secs = 0;
+		while (secs < 1.0) {
+			for (int k = 0; k < 64; k++) {
+				rec_asrc_push(&a, in, rec_asrc_needed(&a, chunk));
+				rec_asrc_process(&a, out, chunk, ch);
+				frames += chunk;
+			}
+			secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		}
+		printf("%8u %14.0f\n", ch, frames / secs / 48000.0);
+		free(in);
+		free(out);
+		rec_asrc_uninit(&a);
+	}
+}
+
+static void bench_resample() {
+	/*
+	 * Proxy resampler throughput, mono, in
+	 * multiples of real time at the input
+	 * rate.
+	 */
+	const ma_uint32 chunk = REC_WRITE_CHUNK;
+	const ma_uint32 rates[][2] = {{48000, 16000}, {44100, 16000}, {96000, 16000}, {48000, 8000}};
+	printf("== resample: windowed sinc, mono ==\n");
+	printf("%14s %8s %14s\n", "rates", "taps", "x real time");
+	for (const ma_uint32* r : rates) {
+		rec_resampler rs;
+		if (rec_resampler_init(&rs, r[0], r[1], chunk) != MA_SUCCESS) continue;
+		float* in = (float*)calloc(chunk, sizeof(float));
+		float* out = (float*)calloc(rec_resampler_max_out(&rs), sizeof(float));
+		for (ma_uint32 i = 0; i < chunk; i++) in[i] = (float)sin(i * 0.01);
+		ma_uint64 frames = 0;
+		auto t0 = std::chrono::steady_clock::now();
+		double secs = 0;
+		while (secs < 1.0) {
+			for (int k = 0; k < 64; k++) {
+				rec_resampler_process(&rs, in, chunk, out);
+				frames += chunk;
+			}
+			secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		}
+		std::string label = std::to_string(r[0]) + ">" + std::to_string(r[1]);
+		printf("%14s %8u %14.0f\n", label.c_str(), rs.taps, frames / secs / r[0]);
+		free(in);
+		free(out);
+		rec_resampler_uninit(&rs);
+	}
+}
+
+static ma_result bench_count_write(void* user, const void* data, size_t bytes) {
+	*(ma_uint64*)user += bytes;
+	(void)data;
+	return MA_SUCCESS;
+}
+
+static ma_result bench_count_seek(void* user, ma_uint64 offset) {
+	(void)user;
+	(void)offset;
+	return MA_SUCCESS;
+}
+
+static void bench_flac() {
+	/*
+	 * FLAC encoding of 24-bit audio, in
+	 * multiples of real time, as workers are
+	 * added. The input is tones over a noise
+	 * floor, which compresses much like music.
+	 */
+	const ma_uint32 configs[][2] = {{2, 48000}, {2, 96000}, {8, 48000}, {8, 96000}};
+	const ma_uint32 workers[] = {0, 1, 2, 4};
+	const ma_uint32 seconds = 20;
+	printf("== flac: s24, %u s of audio ==\n", seconds);
+	printf("%8s %8s %8s %14s %8s %8s\n", "channels", "rate", "workers", "x real time", "ratio", "waits");
+	for (const ma_uint32* c : configs) {
+		const ma_uint32 ch = c[0], rate = c[1];
+		const ma_uint64 frames = (ma_uint64)rate * seconds;
+		ma_uint8* pcm = (ma_uint8*)malloc((size_t)frames * ch * 3);
+		ma_uint32 seed = 1;
+		for (ma_uint64 i = 0; i < frames; i++) {
+			for (ma_uint32 k = 0; k < ch; k++) {
+				seed = seed * 1664525 + 1013904223;
+				double v = 0.3 * sin(i * (0.01 + 0.003 * k)) + 0.1 * sin(i * 0.0007 * (k + 1)) + ((ma_int32)(seed >> 8) - 0x800000) / 8388608.0 * 0.001;
+				ma_int32 s = (ma_int32)(v * 8388607);
+				ma_uint8* p = pcm + (i * ch + k) * 3;
+				p[0] = (ma_uint8)s;
+				p[1] = (ma_uint8)(s >> 8);
+				p[2] = (ma_uint8)(s >> 16);
+			}
+		}
+		for (ma_uint32 w : workers) {
+			ma_uint64 bytes = 0;
+			rec_flac* f = new rec_flac();
+			if (rec_flac_init(f, bench_count_write, bench_count_seek, &bytes, ma_format_s24, ch, rate, w) != MA_SUCCESS) {
+				delete f;
+				break;
+			}
+			auto t0 = std::chrono::steady_clock::now();
+			for (ma_uint64 i = 0; i < frames; i += REC_WRITE_CHUNK) {
+				ma_uint64 n = frames - i < REC_WRITE_CHUNK ? frames - i : REC_WRITE_CHUNK;
+				rec_flac_write(f, pcm + i * ch * 3, n);
+			}
+			rec_flac_uninit(f);
+			double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			printf("%8u %8u %8u %14.1f %8.3f %8llu\n", ch, rate, w, seconds / secs, (double)bytes / (frames * ch * 3), (unsigned long long)f->waits);
+			delete f;
+		}
+		free(pcm);
+	}
+}
+
+static void bench_wavcodec() {
+	/*
+	 * The compact WAV codecs on one thread,
+	 * from 16-bit and float input: how many
+	 * 48 kHz channels one core keeps up with.
+	 */
+	const rec_wav_codec codecs[] = {REC_WAV_IMA_ADPCM, REC_WAV_MULAW, REC_WAV_ALAW};
+	const char* names[] = {"", "ima adpcm", "mu-law", "a-law"};
+	const ma_format formats[] = {ma_format_s16, ma_format_f32};
+	const ma_uint32 ch = 2, rate = 48000, seconds = 60;
+	const ma_uint64 frames = (ma_uint64)rate * seconds;
+	printf("== wav codecs: %u ch, %u Hz, %u s of audio ==\n", ch, rate, seconds);
+	printf("%-10s %6s %14s %14s %8s\n", "codec", "input", "Msamples/s", "channels/core", "ratio");
+	float* f32 = (float*)malloc((size_t)frames * ch * sizeof(float));
+	ma_int16* s16 = (ma_int16*)malloc((size_t)frames * ch * sizeof(ma_int16));
+	for (ma_uint64 i = 0; i < frames * ch; i++) {
+		f32[i] = (float)(0.3 * sin(i * 0.013) + 0.1 * sin(i * 0.0021));
+		s16[i] = (ma_int16)(f32[i] * 32767);
+	}
+	for (rec_wav_codec codec : codecs) {
+		for (ma_format format : formats) {
+			ma_uint64 bytes = 0;
+			const void* pcm = format == ma_format_s16 ? (const void*)s16 : (const void*)f32;
+			const size_t bpf = ma_get_bytes_per_frame(format, ch);
+			rec_wavc* w = new rec_wavc();
+			if (rec_wavc_init(w, bench_count_write, bench_count_seek, &bytes, codec, format, ch, rate) != MA_SUCCESS) {
+				delete w;
+				continue;
+			}
+			double cpu0 = cpu_seconds();
+			for (ma_uint64 i = 0; i < frames; i += REC_WRITE_CHUNK) {
+				ma_uint64 n = frames - i < REC_WRITE_CHUNK ? frames - i : REC_WRITE_CHUNK;
+				rec_wavc_write(w, (const ma_uint8*)pcm + i * bpf, n);
+			}
+			rec_wavc_uninit(w);
+			double secs = cpu_seconds() - cpu0;
+			double msps = frames * ch / secs / 1e6;
+			printf("%-10s %6s %14.1f %14.0f %8.3f\n", names[codec], format == ma_format_s16 ? "s16" : "f32", msps,
+				msps * 1e6 / rate, (double)bytes / (frames * ch * 2));
+			delete w;
+		}
+	}
+	free(f32);
+	free(s16);
+}
+
+static ma_result bench_file_write(void* user, const void* data, size_t bytes) {
+	return fwrite(data, 1, bytes, (FILE*)user) == bytes ? MA_SUCCESS : MA_IO_ERROR;
+}
+
+static ma_result bench_file_seek(void* user, ma_uint64 offset) {
+	return fseek((FILE*)user, (long)offset, SEEK_SET) == 0 ? MA_SUCCESS : MA_IO_ERROR;
+}
+
+static void bench_archive() {
+	/*
+	 * An hour of 24-bit stereo as an archive:
+	 * how long a read at a random position
+	 * takes, and conversion to WAV.
+	 */
+	const ma_uint32 ch = 2, rate = 48000, seconds = 3600, chunk = 48000;
+	const ma_uint64 frames = (ma_uint64)rate * seconds;
+	printf("== archive: s24, %u ch, %u Hz, %u s of audio ==\n", ch, rate, seconds);
+	ma_uint8* pcm = (ma_uint8*)malloc((size_t)chunk * ch * 3);
+	FILE* file = fopen("bench_archive.rca", "wb");
+	rec_archive* a = new rec_archive();
+	if (file == NULL || rec_archive_init(a, bench_file_write, bench_file_seek, file, ma_format_s24, ch, rate, 0, 1, rec_flac_default_workers()) != MA_SUCCESS) {
+		printf("Failed to create the archive.\n");
+		if (file != NULL) fclose(file);
+		delete a;
+		free(pcm);
+		return;
+	}
+	auto t0 = std::chrono::steady_clock::now();
+	ma_uint32 seed = 1;
+	for (ma_uint64 i = 0; i < frames; i += chunk) {
+		for (ma_uint32 k = 0; k < chunk * ch; k++) {
+			seed = seed * 1664525 + 1013904223;
+			double v = 0.3 * sin((i * ch + k) * 0.005) + ((ma_int32)(seed >> 8) - 0x800000) / 8388608.0 * 0.001;
+			ma_int32 s = (ma_int32)(v * 8388607);
+			pcm[k * 3] = (ma_uint8)s;
+			pcm[k * 3 + 1] = (ma_uint8)(s >> 8);
+			pcm[k * 3 + 2] = (ma_uint8)(s >> 16);
+		}
+		rec_archive_write(a, pcm, chunk);
+	}
+	rec_archive_uninit(a);
+	fclose(file);
+	double write_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	delete a;
+	rec_archive_reader r;
+	t0 = std::chrono::steady_clock::now();
+	if (rec_archive_open(&r, "bench_archive.rca") != MA_SUCCESS) {
+		printf("Failed to open the archive.\n");
+		free(pcm);
+		return;
+	}
+	double open_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	const int reads = 200;
+	t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < reads; i++) {
+		seed = seed * 1664525 + 1013904223;
+		rec_archive_read(&r, seed % (frames - 4800), pcm, 4800, NULL);
+	}
+	double read_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() / reads;
+	printf("written at %.1fx real time, %.1f MB, ratio %.3f\n", seconds / write_s, r.size / 1e6, (double)r.size / (frames * ch * 3));
+	printf("open %.3f ms, random 100 ms read %.3f ms (%u-frame blocks)\n", open_ms, read_ms, r.block_frames);
+	rec_archive_close(&r);
+	t0 = std::chrono::steady_clock::now();
+	ma_result result = rec_archive_to_wav("bench_archive.rca", "bench_archive.wav");
+	double wav_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	if (result == MA_SUCCESS) printf("to WAV at %.1fx real time\n", seconds / wav_s);
+	remove("bench_archive.rca");
+	remove("bench_archive.wav");
+	free(pcm);
+}
+
+static void bench_meter() {
+	/*
+	 * Level metering as the writers run it,
+	 * per chunk: input samples per second
+	 * and the share of a core at 48 kHz.
+	 */
+	const ma_format formats[] = {ma_format_f32, ma_format_s16, ma_format_s24};
+	const char* names[] = {"f32", "s16", "s24"};
+	const ma_uint32 channels[] = {2, 8, 32};
+	const ma_uint32 rate = 48000, seconds = 600;
+	printf("== meter: %u s of audio per case, %u-frame chunks ==\n", seconds, REC_WRITE_CHUNK);
+	printf("%6s %8s %14s %12s\n", "format", "channels", "Msamples/s", "% of core");
+	for (int k = 0; k < 3; k++) {
+		for (ma_uint32 ch : channels) {
+			float* f32 = (float*)malloc((size_t)REC_WRITE_CHUNK * ch * sizeof(float));
+			void* pcm = malloc((size_t)REC_WRITE_CHUNK * ch * 4);
+			for (ma_uint32 i = 0; i < REC_WRITE_CHUNK * ch; i++) f32[i] = (float)(0.5 * sin(i * 0.01));
+			ma_pcm_convert(pcm, formats[k], f32, ma_format_f32, (ma_uint64)REC_WRITE_CHUNK * ch, ma_dither_mode_none);
+			rec_level_feed feed;
+			rec_level_feed_init(&feed);
+			rec_meter m;
+			rec_meter_init(&m, &feed, NULL, formats[k], ch, rate, REC_WRITE_CHUNK);
+			const ma_uint64 chunks = (ma_uint64)rate * seconds / REC_WRITE_CHUNK;
+			double cpu0 = cpu_seconds();
+			for (ma_uint64 i = 0; i < chunks; i++) rec_meter_push(&m, pcm, REC_WRITE_CHUNK);
+			double secs = cpu_seconds() - cpu0;
+			rec_meter_uninit(&m);
+			double msps = chunks * REC_WRITE_CHUNK * ch / secs / 1e6;
+			printf("%6s %8u %14.1f %12.3f\n", names[k], ch, msps, 100.0 * rate * ch / (msps * 1e6));
+			free(f32);
+			free(pcm);
+		}
+	}
+}
+
+static double bench_wave_draw(rec_wave* w, int columns) {
+	/*
+	 * What rec_wave_view does for the whole
+	 * take, in microseconds.
+	 */
+	const ma_uint64 total = rec_wave_frames(w);
+	const ma_uint32 level = rec_wave_level_for(total / columns);
+	const ma_uint64 bucket = rec_wave_bucket_frames(level), count = rec_wave_count(w, level);
+	const int reps = 1000;
+	int sink = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	for (int r = 0; r < reps; r++) {
+		for (int px = 0; px < columns; px++) {
+			rec_wave_bucket b;
+			ma_uint64 first = total * px / columns / bucket, last = (total * (px + 1) / columns + bucket - 1) / bucket;
+			if (rec_wave_fold(w, level, first, last > first ? last : first + 1, count, &b)) sink += b.max;
+		}
+	}
+	double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count() / reps;
+	return sink == 12345 ? 0 : us;
+}
+
+static void bench_wave() {
+	/*
+	 * Building the waveform pyramid as the
+	 * writers do, then drawing a 240-column
+	 * overview of a short and a long take.
+	 */
+	const ma_uint32 ch = 2, rate = 48000;
+	const ma_uint32 takes[] = {10, 3600};
+	float* f32 = (float*)malloc((size_t)REC_WRITE_CHUNK * ch * sizeof(float));
+	for (ma_uint32 i = 0; i < REC_WRITE_CHUNK * ch; i++) f32[i] = (float)(0.5 * sin(i * 0.01));
+	printf("== wave: f32 stereo at %u Hz, %u-frame chunks ==\n", rate, REC_WRITE_CHUNK);
+	printf("%8s %14s %12s %12s\n", "take s", "Msamples/s", "% of core", "draw us");
+	for (ma_uint32 seconds : takes) {
+		rec_wave w;
+		if (rec_wave_init(&w) != MA_SUCCESS) break;
+		const ma_uint64 chunks = (ma_uint64)rate * seconds / REC_WRITE_CHUNK;
+		double cpu0 = cpu_seconds();
+		for (ma_uint64 i = 0; i < chunks; i++) rec_wave_push(&w, f32, REC_WRITE_CHUNK, ch);
+		double secs = cpu_seconds() - cpu0;
+		double msps = chunks * REC_WRITE_CHUNK * ch / secs / 1e6;
+		printf("%8u %14.1f %12.3f %12.1f\n", seconds, msps, 100.0 * rate * ch / (msps * 1e6), bench_wave_draw(&w, 240));
+		rec_wave_uninit(&w);
+	}
+	free(f32);
+}
+
+static void bench_preview() {
+	/*
+	 * The writer's copy into a minute's
+	 * preview, as a share of a core, with and
+	 * without a reader following it.
+	 */
+	const ma_uint32 ch = 2, rate = 48000, seconds = 600;
+	const ma_uint64 chunks = (ma_uint64)rate * seconds / REC_WRITE_CHUNK;
+	float* f32 = (float*)malloc((size_t)REC_WRITE_CHUNK * ch * sizeof(float));
+	for (ma_uint32 i = 0; i < REC_WRITE_CHUNK * ch; i++) f32[i] = (float)(0.5 * sin(i * 0.01));
+	printf("== preview: f32 stereo at %u Hz, 60 s kept, %u-frame chunks ==\n", rate, REC_WRITE_CHUNK);
+	printf("%8s %14s %12s %12s\n", "reader", "Msamples/s", "% of core", "frames read");
+	for (int reader = 0; reader < 2; reader++) {
+		rec_preview p;
+		if (rec_preview_init(&p, ma_format_f32, ch, rate, 60, REC_WRITE_CHUNK) != MA_SUCCESS) break;
+		std::atomic<int> done(0);
+		ma_uint64 read_frames = 0;
+		std::thread t;
+		if (reader) {
+			t = std::thread([&] {
+				float* out = (float*)malloc((size_t)REC_PLAYER_CHUNK * ch * sizeof(float));
+				ma_uint64 frame = 0;
+				while (!done.load()) {
+					ma_uint32 got;
+					ma_result result = rec_preview_read(&p, frame, out, REC_PLAYER_CHUNK, &got);
+					if (result == MA_OUT_OF_RANGE) frame = rec_preview_oldest(&p, rec_preview_committed(&p));
+					else if (got == 0) std::this_thread::yield();
+					frame += got;
+					read_frames += got;
+				}
+				free(out);
+			});
+		}
+		double cpu0 = cpu_seconds();
+		auto t0 = std::chrono::steady_clock::now();
+		for (ma_uint64 i = 0; i < chunks; i++) rec_preview_push(&p, f32, REC_WRITE_CHUNK);
+		double secs = reader ? std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() : cpu_seconds() - cpu0;
+		done.store(1);
+		if (t.joinable()) t.join();
+		double msps = chunks * REC_WRITE_CHUNK * ch / secs / 1e6;
+		printf("%8s %14.1f %12.3f %12llu\n", reader ? "yes" : "no", msps, 100.0 * rate * ch / (msps * 1e6), (unsigned long long)read_frames);
+		rec_preview_uninit(&p);
+	}
+	free(f32);
+}
+
+static void bench_spectrum() {
+	/*
+	 * The analyzer sink on f32 stereo blocks
+	 * of a sweep: CPU per second of audio,
+	 * most of it the decimation and the FFTs.
+	 */
+	const ma_uint32 ch = 2, rates[] = {44100, 48000, 96000}, seconds = 60;
+	printf("== spectrum: f32 stereo, %u-point FFT, %u bands ==\n", REC_SPECTRUM_SIZE, REC_SPECTRUM_BANDS);
+	printf("%8s %12s %12s %12s\n", "rate", "analyses/s", "us each", "% of core");
+	float* f32 = (float*)malloc((size_t)REC_WRITE_CHUNK * ch * sizeof(float));
+	for (ma_uint32 rate : rates) {
+		static rec_spectrum a;
+		static rec_spectrum_feed feed;
+		rec_spectrum_feed_init(&feed);
+		if (rec_spectrum_init(&a, &feed, ma_format_f32, ch, rate, REC_WRITE_CHUNK) != MA_SUCCESS) break;
+		rec_block b;
+		b.data = (ma_uint8*)f32;
+		b.frames = REC_WRITE_CHUNK;
+		const ma_uint64 chunks = (ma_uint64)rate * seconds / REC_WRITE_CHUNK;
+		double cpu = 0;
+		for (ma_uint64 i = 0; i < chunks; i++) {
+			for (ma_uint32 k = 0; k < REC_WRITE_CHUNK; k++) {
+				double t = (double)(i * REC_WRITE_CHUNK + k) / rate;
+				f32[k * ch] = f32[k * ch + 1] = (float)(0.5 * sin(2 * 3.14159265358979 * (20.0 + 200.0 * t) * t));
+			}
+			b.position = i * REC_WRITE_CHUNK;
+			double cpu0 = cpu_seconds();
+			rec_spectrum_consume(&a, &b);
+			cpu += cpu_seconds() - cpu0;
+		}
+		double audio = (double)chunks * REC_WRITE_CHUNK / rate;
+		printf("%8u %12.1f %12.1f %12.3f\n", rate, a.analyses / audio, cpu / a.analyses * 1e6, 100.0 * cpu / audio);
+		rec_spectrum_uninit(&a);
+	}
+	free(f32);
+}
+
+static void bench_chain() {
+	/*
+	 * The insert chain on stereo batches of
+	 * noise, in f32 and in s16 (converted
+	 * around it): each stage's own share of
+	 * a core, as the session report gives it.
+	 * The AGC aims high enough to keep the
+	 * limiter working.
+	 */
+	const ma_uint32 ch = 2, rate = 48000, seconds = 60;
+	const ma_format formats[] = {ma_format_f32, ma_format_s16};
+	rec_insert inserts[] = {rec_insert_init(REC_INSERT_HPF), rec_insert_init(REC_INSERT_PEAK), rec_insert_init(REC_INSERT_GAIN), rec_insert_init(REC_INSERT_GATE),
+		rec_insert_init(REC_INSERT_AGC), rec_insert_init(REC_INSERT_LIMITER)};
+	const ma_uint32 count = sizeof(inserts) / sizeof(inserts[0]);
+	inserts[1].gain_db = 3.0;
+	inserts[2].gain_db = -6.0;
+	inserts[4].gain_db = -6.0;
+	printf("== chain: stereo, %u Hz, batches of %u ==\n", rate, REC_WRITE_CHUNK);
+	ma_uint8* pcm = (ma_uint8*)malloc((size_t)REC_WRITE_CHUNK * ch * sizeof(float));
+	for (ma_format format : formats) {
+		static rec_chain c;
+		if (rec_chain_init(&c, inserts, count, format, ch, rate, REC_WRITE_CHUNK) != MA_SUCCESS) break;
+		ma_noise_config nc = ma_noise_config_init(format, ch, ma_noise_type_pink, 0, 0.2);
+		ma_noise noise;
+		ma_noise_init(&nc, NULL, &noise);
+		const ma_uint64 chunks = (ma_uint64)rate * seconds / REC_WRITE_CHUNK;
+		double cpu = 0;
+		for (ma_uint64 i = 0; i < chunks; i++) {
+			ma_noise_read_pcm_frames(&noise, pcm, REC_WRITE_CHUNK, NULL);
+			// A gain change every second
+			if (i % (rate / REC_WRITE_CHUNK) == 0) rec_chain_set_gain(&c, (i / (rate / REC_WRITE_CHUNK)) % 2 ? -6.0 : 0.0);
+			double cpu0 = cpu_seconds();
+			rec_chain_process(&c, pcm, REC_WRITE_CHUNK);
+			cpu += cpu_seconds() - cpu0;
+		}
+		printf("%s: %.3f%% of a core in all, %u frames late\n", ma_get_format_name(format), 100.0 * cpu / seconds, rec_chain_latency(&c));
+		rec_chain_report(&c, "  ");
+		rec_chain_uninit(&c);
+		ma_noise_uninit(&noise, NULL);
+	}
+	free(pcm);
+}
+
+static void bench_loudness() {
+	/*
+	 * The loudness sink on f32 stereo blocks
+	 * of noise: CPU per second of audio at
+	 * each rate, most of it the oversampled
+	 * true peak.
+	 */
+	const ma_uint32 ch = 2, rates[] = {44100, 48000, 96000}, seconds = 60;
+	printf("== loudness: f32 stereo, blocks of %u ==\n", REC_WRITE_CHUNK);
+	printf("%8s %8s %12s %12s\n", "rate", "factor", "% of core", "integrated");
+	float* f32 = (float*)malloc((size_t)REC_WRITE_CHUNK * ch * sizeof(float));
+	for (ma_uint32 rate : rates) {
+		static rec_loudness l;
+		if (rec_loudness_init(&l, NULL, ma_format_f32, ch, ch, rate, REC_WRITE_CHUNK) != MA_SUCCESS) break;
+		ma_noise_config nc = ma_noise_config_init(ma_format_f32, ch, ma_noise_type_pink, 0, 0.2);
+		ma_noise noise;
+		ma_noise_init(&nc, NULL, &noise);
+		rec_block b;
+		b.data = (ma_uint8*)f32;
+		b.frames = REC_WRITE_CHUNK;
+		const ma_uint64 chunks = (ma_uint64)rate * seconds / REC_WRITE_CHUNK;
+		double cpu = 0;
+		for (ma_uint64 i = 0; i < chunks; i++) {
+			ma_noise_read_pcm_frames(&noise, f32, REC_WRITE_CHUNK, NULL);
+			b.position = i * REC_WRITE_CHUNK;
+			double cpu0 = cpu_seconds();
+			rec_loudness_consume(&l, &b);
+			cpu += cpu_seconds() - cpu0;
+		}
+		const ma_uint32 factor = l.factor;
+		rec_loudness_uninit(&l);
+		double audio = (double)chunks * REC_WRITE_CHUNK / rate;
+		printf("%8u %8u %12.3f %12.1f\n", rate, factor, 100.0 * cpu / audio, l.final.integrated);
+		ma_noise_uninit(&noise, NULL);
+	}
+	free(f32);
+}
+
+static void bench_player(ma_context* context) {
+	/*
+	 * An hour of f32 stereo WAV: time from
+	 * opening to the first frames played, and
+	 * from each seek to audio at the new place.
+	 */
+	const ma_uint32 ch = 2, rate = 48000, seconds = 3600, chunk = 48000;
+	printf("== player: f32 WAV, %u ch, %u Hz, %u s ==\n", ch, rate, seconds);
+	ma_encoder_config config = ma_encoder_config_init(ma_encoding_format_wav, ma_format_f32, ch, rate);
+	ma_encoder encoder;
+	if (ma_encoder_init_file("bench_player.wav", &config, &encoder) != MA_SUCCESS) {
+		printf("Failed to create the file.\n");
+		return;
+	}
+	float* pcm = (float*)malloc((size_t)chunk * ch * sizeof(float));
+	for (ma_uint32 k = 0; k < chunk * ch; k++) pcm[k] = (float)(0.3 * sin(k * 0.005));
+	for (ma_uint32 i = 0; i < seconds; i++) ma_encoder_write_pcm_frames(&encoder, pcm, chunk, NULL);
+	ma_encoder_uninit(&encoder);
+	free(pcm);
+	rec_player* p = new rec_player();
+	auto t0 = std::chrono::steady_clock::now();
+	if (rec_player_open(p, context, "bench_player.wav") != MA_SUCCESS || rec_player_play(p) != MA_SUCCESS) {
+		printf("Failed to play the file.\n");
+		delete p;
+		remove("bench_player.wav");
+		return;
+	}
+	while (rec_player_position(p) == 0) std::this_thread::sleep_for(std::chrono::microseconds(200));
+	double start_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	printf("open to first audio: %.1f ms\n", start_ms);
+	double worst = 0, total = 0;
+	const int seeks = 20;
+	ma_uint32 seed = 7;
+	for (int i = 0; i < seeks; i++) {
+		seed = seed * 1664525 + 1013904223;
+		ma_uint64 target = (ma_uint64)(seed % seconds) * rate;
+		t0 = std::chrono::steady_clock::now();
+		rec_player_seek(p, target);
+		while (rec_player_position(p) <= target) std::this_thread::sleep_for(std::chrono::microseconds(200));
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+		total += ms;
+		if (ms > worst) worst = ms;
+	}
+	printf("seek to audio: %.1f ms mean, %.1f ms worst over %d seeks; %llu underruns\n", total / seeks, worst, seeks, (unsigned long long)p->underruns.load());
+	rec_player_close(p);
+	delete p;
+	remove("bench_player.wav");
+}
+
+int main(int argc, char** argv) {
+	ma_backend backends[] = { ma_backend_null };
+	ma_context context;
+	int seconds = argc > 1 ? atoi(argv[1]) : 3;
+	if (seconds <= 0) seconds = 3;
+	if (ma_context_init(backends, 1, NULL, &context) != MA_SUCCESS) {
+		printf("Failed to initialize null backend.\n");
+		return 1;
+	}
+	bench_devices(&context, REC_LAYOUT_SEPARATE, seconds);
+	bench_devices(&context, REC_LAYOUT_MERGED, seconds);
+	bench_burst(&context, seconds);
+	printf("== sinks: 600 s of 48000 Hz, 2 ch, f32 ==\n");
+	printf("%-8s %14s %10s %10s %10s %10s %10s\n", "sink", "writer ms/s", "wall s", "MB/s", "p50 ms", "p99 ms", "max ms");
+	bench_sink(REC_SINK_STDIO, "stdio");
+	bench_sink(REC_SINK_ASYNC, "async");
+	bench_sink(REC_SINK_MMAP, "mmap");
+	bench_sink(REC_SINK_DIRECT, "direct");
+	printf("== durability: 48000 Hz, 2 ch, f32 at 32x real time, async sink, %d s per step ==\n", seconds);
+	printf("%-10s %8s %8s %10s %10s %10s %12s\n", "policy", "asked", "synced", "p50 ms <", "p99 ms <", "max ms", "worst write");
+	bench_sync(REC_SYNC_NONE, 0, 0, "none", seconds);
+	bench_sync(REC_SYNC_INTERVAL, 100, 0, "100 ms", seconds);
+	bench_sync(REC_SYNC_INTERVAL, 1000, 0, "1000 ms", seconds);
+	bench_sync(REC_SYNC_BYTES, 0, 4, "4 MB", seconds);
+	bench_sync(REC_SYNC_BYTES, 0, 64, "64 MB", seconds);
+	bench_fanout();
+	bench_asrc();
+	bench_resample();
+	bench_flac();
+	bench_wavcodec();
+	bench_archive();
+	bench_meter();
+	bench_wave();
+	bench_preview();
+	bench_spectrum();
+	bench_chain();
+	bench_loudness();
+	bench_player(&context);
+	ma_context_uninit(&context);
+	return 0;
+}
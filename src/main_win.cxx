@@ -4,10 +4,13 @@
 #define MINIAUDIO_IMPLEMENTATION
 
 #include "miniaudio.h"
+#include "rec_session.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
 #include <thread>
+#include <mutex>
+#include <atomic>
 
 #if defined(_WIN32)
 // Sleep()
@@ -25,17 +28,107 @@
 #include <FL/filename.H>
 #include <FL/Fl_File_Chooser.H>
 #include <FL/fl_message.H>
-#include <FL/Fl_Output.H>
 #include <FL/Fl_Pixmap.H>
+#include "rec_widgets.h"
 // Pixmaps:
 #include "xhk.xpm"
 #include "recbtn.xpm"
 #include "stopbtn.xpm"
 
-int rec_stopped = 0;
-int rec_success = 0;
+// Set by the UI thread and the recording thread, read by both
+std::atomic<int> rec_stopped(0);
+std::atomic<int> rec_success(0);
 int time_elapsed = 0;
-static Fl_Output* time_out;
+static rec_time_display* time_out;
+static rec_level_meter* level_meter;
+static rec_wave_view* wave_view;
+static rec_spectrum_view* spectrum_view;
+static rec_loudness_display* loudness_display;
+// Widget refresh while recording; stopped, timeout_cb doesn't run
+#define UI_TICK (1.0 / 30)
+static int ticking = 0;
+
+// Capture devices offered in the Inputs menu
+static ma_context context;
+static int context_ok = 0;
+static ma_device_info* capture_infos = NULL;
+static ma_uint32 capture_count = 0;
+static int input_selected[REC_MAX_INPUTS];
+static int merge_inputs = 0;
+static int compensate_drift = 1;
+// Burst mode memory budget, MB; 0 records straight to disk
+static long burst_budget_mb = 0;
+// Memory each input may use to ride out a disk stall, MB
+static long spool_cap_mb = 256;
+// Scratch directory for stalls that outgrow memory; empty for none
+static std::string spill_dir;
+// How encoder output reaches the disk; see rec_sink.h
+#if defined(_WIN32)
+static rec_sink_kind write_mode = REC_SINK_STDIO;
+#else
+static rec_sink_kind write_mode = REC_SINK_ASYNC;
+#endif
+// Durability policy while recording; see rec_sync.h
+static rec_sync_policy sync_policy = REC_SYNC_NONE;
+static long sync_interval_ms = 1000;
+static long sync_mb = 16;
+// Where a recording continues when its disk runs low; empty to stop instead
+static std::string alt_dir;
+// Second copy of every recording goes here; empty for none
+static std::string mirror_dir;
+// WAV, or FLAC recorded as 24-bit
+static ma_encoding_format file_format = ma_encoding_format_wav;
+// With WAV: PCM, or a compact codec recorded from 16-bit
+static rec_wav_codec wav_codec = REC_WAV_PCM;
+// With FLAC: one-second blocks in an indexed archive, or 0 for a FLAC file
+static ma_uint32 archive_ms = 0;
+// Sample rate of the mono proxy written next to each file; 0 for none
+static ma_uint32 proxy_rate = 0;
+// Set by the recording thread when free space gets low; shown by timeout_cb
+static int disk_low = 0;
+// Likewise once the take has continued in the alternate directory
+static int disk_moved = 0;
+// Levels published by the recording's writers, read by timeout_cb
+static rec_level_feed level_feeds[REC_MAX_INPUTS];
+static ma_uint32 level_count = 0;
+// Rate of the audio behind level_feeds, for the elapsed time
+static ma_uint32 level_rate = 0;
+// Waveform overviews the writers build, or loaded from a file, drawn by wave_view
+static rec_wave waves[REC_MAX_INPUTS];
+static ma_uint32 wave_lanes = 0;
+// Write a .peaks sidecar with every file
+static int write_peaks = 1;
+// The recording being played back, or NULL; UI thread only
+static rec_player* player = NULL;
+// Skip for the Back and Forward commands, seconds
+#define PLAYER_SKIP 5
+// The end of the take being recorded, for Preview; only the first input's is allocated
+static rec_preview previews[REC_MAX_INPUTS];
+#define PREVIEW_SECONDS 60
+// Spectrum of the recording, published by its analyzer; shown while spectrum_shown
+static rec_spectrum_feed spectrum_feed;
+static int spectrum_on = 0;
+static int spectrum_shown = 0;
+// Loudness of each file, published by its meter; the first one's shown while loudness_shown
+static rec_loudness_feed loudness_feeds[REC_MAX_INPUTS];
+static int loudness_on = 1;
+static int loudness_shown = 0;
+// Inserts for the next recording; the gain also applies at once to one with a gain stage
+static int hpf_on = 0;
+static int gate_on = 0;
+static int agc_on = 0;
+static int limiter_on = 0;
+static double input_gain_db = 0;
+/*
+ * Set by Record, cleared once the recording
+ * thread's rec_session_uninit() has returned:
+ * until then the waves, previews and feeds
+ * are its writers', and nothing resets them.
+ */
+static std::atomic<int> rec_alive(0);
+// The session being recorded, for the Mark command
+static rec_session* active_session = NULL;
+static std::mutex active_lock;
 
 static Fl_Pixmap image_xhk((const char**)xhk_xpm);
 static Fl_Pixmap image_rec((const char**)recbtn_xpm);
@@ -51,6 +144,17 @@ static void reset_cb() {
 	time_elapsed = 0;
 	rec_success = 0;
 	rec_stopped = 0;
+	disk_low = 0;
+	disk_moved = 0;
+	level_count = 0;
+	wave_lanes = 0;
+	spectrum_shown = 0;
+	loudness_shown = 0;
+	time_out->value(0, 0);
+	level_meter->bars(0);
+	wave_view->update(waves, 0);
+	spectrum_view->update(NULL);
+	loudness_display->update(NULL);
 }
 
 static void about(const std::string& name, const std::string& title, const std::string& description, const std::string& version, const std::string& copyright) {
@@ -69,14 +173,6 @@ static void about_cb() {
 	about("Sound Recorder", "About", "\nA simple, barebones sound recorder\nfor XHaskell\n\n(Press 'Reset' after each session\nto record again.)", "1.0.0", "Copyright (c) 2023 searemind.\nAll rights reserved.");
 }
 
-// Audio recording logic from miniaudio simple_capture.c
-static void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount) {
-	ma_encoder* pEncoder = (ma_encoder*)pDevice->pUserData;
-	MA_ASSERT(pEncoder != NULL);
-	ma_encoder_write_pcm_frames(pEncoder, pInput, frameCount, NULL);
-	(void)pOutput;
-}
-
 static void stop_cb(Fl_Widget* w, void*) {
 	/*
 	 * Callback function for Stop button
@@ -90,38 +186,145 @@ static void stop_cb(Fl_Widget* w, void*) {
 	}
 }
 
+static void timeout_cb(void*);
+
+static void ticker_start(void*) {
+	/*
+	 * Runs on the UI thread, via Fl::awake()
+	 * when recording starts and stops; a tick
+	 * now, and more while recording.
+	 */
+	if (ticking) return;
+	ticking = 1;
+	Fl::add_timeout(0, timeout_cb);
+}
+
+static void error_alert(void* message) {
+	/*
+	 * Runs on the UI thread, via Fl::awake()
+	 * from the recording thread.
+	 */
+	fl_alert("%s", (const char*)message);
+}
+
 // Audio recording logic from miniaudio simple_capture.c
-static void minaud_rec(const char* result_file) {
+static void minaud_rec(std::string result_file) {
 	ma_result result;
-	ma_encoder_config encoderConfig;
-	ma_encoder encoder;
-	ma_device_config deviceConfig;
-	ma_device device;
-
-	encoderConfig = ma_encoder_config_init(ma_encoding_format_wav, ma_format_f32, 2, 44100);
-	if (ma_encoder_init_file(result_file, &encoderConfig, &encoder) != MA_SUCCESS) {
-		printf("Failed to initialize output file.\n");
-	}
-	deviceConfig = ma_device_config_init(ma_device_type_capture);
-	deviceConfig.capture.format = encoder.config.format;
-	deviceConfig.capture.channels = encoder.config.channels;
-	deviceConfig.sampleRate = encoder.config.sampleRate;
-	deviceConfig.dataCallback = data_callback;
-	deviceConfig.pUserData = &encoder;
-	result = ma_device_init(NULL, &deviceConfig, &device);
-	if (result != MA_SUCCESS) {
-		printf("Failed to initialize capture device.\n");
+	ma_format format = ma_format_f32;
+	if (file_format == ma_encoding_format_flac) format = ma_format_s24;
+	else if (wav_codec != REC_WAV_PCM) format = ma_format_s16;
+	rec_config config = rec_config_init(format, 2, 44100);
+	rec_session* session = new rec_session();
+
+	/*
+	 * Every input ticked in the Inputs menu
+	 * is recorded; with none ticked, the
+	 * default capture device is used.
+	 */
+	config.layout = merge_inputs ? REC_LAYOUT_MERGED : REC_LAYOUT_SEPARATE;
+	config.encoding = file_format;
+	config.wav_codec = wav_codec;
+	config.archive_ms = archive_ms;
+	config.levels = level_feeds;
+	config.waves = waves;
+	config.drift_compensation = compensate_drift;
+	config.burst_budget = (size_t)burst_budget_mb * 1024 * 1024;
+	config.spool_mem_cap = (size_t)spool_cap_mb * 1024 * 1024;
+	config.spill_dir = spill_dir.empty() ? NULL : spill_dir.c_str();
+	config.sink = write_mode;
+	config.sync_policy = sync_policy;
+	config.sync_interval_ms = (ma_uint32)sync_interval_ms;
+	config.sync_bytes = (ma_uint64)sync_mb * 1024 * 1024;
+	config.space_alt_dir = alt_dir.empty() ? NULL : alt_dir.c_str();
+	config.mirror_dir = mirror_dir.empty() ? NULL : mirror_dir.c_str();
+	config.proxy_rate = proxy_rate;
+	config.peaks = write_peaks;
+	config.input_count = 0;
+	for (ma_uint32 i = 0; i < capture_count && i < REC_MAX_INPUTS; i++) {
+		if (input_selected[i]) config.input_ids[config.input_count++] = &capture_infos[i].id;
+	}
+	if (config.input_count == 0) {
+		config.input_ids[0] = NULL;
+		config.input_count = 1;
+	}
+	level_count = config.input_count;
+	wave_lanes = config.input_count;
+	level_rate = config.sample_rate;
+	/*
+	 * Only the first input can be previewed,
+	 * so only it gets a ring (a minute of
+	 * audio, 23 MB for f32 stereo at 48 kHz).
+	 * record_cb freed the last take's; one
+	 * that fails to allocate isn't previewed.
+	 */
+	if (rec_preview_init(&previews[0], format, config.channels, config.sample_rate, PREVIEW_SECONDS, REC_WRITE_CHUNK) != MA_SUCCESS) rec_preview_uninit(&previews[0]);
+	config.previews = previews;
+	config.spectrum = spectrum_on ? &spectrum_feed : NULL;
+	config.loudness = loudness_on ? loudness_feeds : NULL;
+	// Rumble off first, so the gate isn't opened by it
+	if (hpf_on) config.inserts[config.insert_count++] = rec_insert_init(REC_INSERT_HPF);
+	if (input_gain_db != 0) {
+		config.inserts[config.insert_count] = rec_insert_init(REC_INSERT_GAIN);
+		config.inserts[config.insert_count++].gain_db = input_gain_db;
+	}
+	if (gate_on) config.inserts[config.insert_count++] = rec_insert_init(REC_INSERT_GATE);
+	// Levelled first, so the limiter has the last word on peaks
+	if (agc_on) config.inserts[config.insert_count++] = rec_insert_init(REC_INSERT_AGC);
+	if (limiter_on) config.inserts[config.insert_count++] = rec_insert_init(REC_INSERT_LIMITER);
+	double seconds_free;
+	if (rec_space_preflight(&config, result_file.c_str(), &seconds_free) == MA_SUCCESS) {
+		printf("Disk space for about %.1f hours of recording.\n", seconds_free / 3600.0);
+		if (seconds_free < config.space_warn_seconds) disk_low = 1;
+	}
+	result = rec_session_start(session, context_ok ? &context : NULL, &config, result_file.c_str());
+	if (result == MA_NO_SPACE) {
+		printf("Not enough disk space to record to %s.\n", result_file.c_str());
+		Fl::awake(error_alert, (void*)"Not enough disk space to start recording.");
+		delete session;
+		return;
+	}
+	if (result == MA_OUT_OF_MEMORY && burst_budget_mb > 0) {
+		printf("Burst budget of %ld MB is too small or can't be allocated.\n", burst_budget_mb);
+		Fl::awake(error_alert, (void*)"The burst budget is too small or can't be allocated.");
+		delete session;
+		return;
+	}
+	if (result == MA_INVALID_ARGS && !mirror_dir.empty()) {
+		printf("The mirror directory must differ from the recording's.\n");
+		Fl::awake(error_alert, (void*)"The mirror directory must differ from the recording's.");
+		delete session;
+		return;
+	}
+	if (result == MA_FORMAT_NOT_SUPPORTED && file_format == ma_encoding_format_flac) {
+		printf("FLAC files hold at most %d channels.\n", REC_FLAC_MAX_CHANNELS);
+		Fl::awake(error_alert, (void*)"Too many channels for one FLAC file; record WAV or merge fewer inputs.");
+		delete session;
+		return;
+	}
+	if (result == MA_FORMAT_NOT_SUPPORTED && wav_codec == REC_WAV_IMA_ADPCM) {
+		printf("IMA ADPCM files hold at most 2 channels.\n");
+		Fl::awake(error_alert, (void*)"Too many channels for one IMA ADPCM file; record separate files or another format.");
+		delete session;
+		return;
 	}
-	result = ma_device_start(&device);
 	if (result != MA_SUCCESS) {
-		ma_device_uninit(&device);
-		printf("Failed to start device.\n");
+		printf("Failed to start recording: %s\n", ma_result_description(result));
+		delete session;
+		return;
 	}
 	printf("Recording...\n");
+	if (rec_session_latency(session) > 0) printf("The inserts delay the take by %.1f ms.\n", 1000.0 * rec_session_latency(session) / config.sample_rate);
+	int mirror_health = 0;
+	{
+		std::lock_guard<std::mutex> guard(active_lock);
+		active_session = session;
+	}
+	rec_success = 1;
+	Fl::awake(ticker_start, NULL);
 	/*
 	 * Infinite loop which determines length
-	 * of recording; sets timer value in global
-	 * variable to display in Fl_Output widget.
+	 * of recording; counts whole seconds in
+	 * time_elapsed for timeout_cb.
 	 */
 	while (1) {
 		rec_success = 1;
@@ -134,6 +337,28 @@ static void minaud_rec(const char* result_file) {
 		if (rec_stopped == 1) {
 			break;
 		}
+		if (rec_session_full(session)) {
+			printf("Burst budget of %ld MB exceeded, recording stopped.\n", burst_budget_mb);
+			Fl::awake(error_alert, (void*)"The burst buffer is full; recording stopped and saved.");
+			break;
+		}
+		if (rec_session_space(session) == REC_SPACE_WARN && !disk_low) {
+			printf("Disk space low: about %.0f s of recording left.\n", session->space_seconds.load());
+			disk_low = 1;
+		}
+		if (rec_session_rotations(session) > 0 && !disk_moved) {
+			printf("Disk space low, continuing in %s\n", alt_dir.c_str());
+			disk_moved = 1;
+		}
+		if (rec_session_mirror_health(session) > mirror_health) {
+			mirror_health = rec_session_mirror_health(session);
+			printf(mirror_health == 1 ? "Mirror is falling behind.\n" : "Mirror has lost audio or failed; the primary recording continues.\n");
+		}
+		if (rec_session_space(session) == REC_SPACE_LOW) {
+			printf("Disk almost full, recording stopped.\n");
+			Fl::awake(error_alert, (void*)"The disk is almost full; recording stopped and saved.");
+			break;
+		}
 	}
 	/*
 	 * Set rec_success = 0 so that
@@ -141,8 +366,22 @@ static void minaud_rec(const char* result_file) {
 	 * does not cause creation of pop-up.
 	*/
 	rec_success = 0;
-	ma_device_uninit(&device);
-	ma_encoder_uninit(&encoder);
+	{
+		std::lock_guard<std::mutex> guard(active_lock);
+		active_session = NULL;
+	}
+	rec_session_uninit(session);
+	// A last tick shows where the recording ended
+	Fl::awake(ticker_start, NULL);
+	rec_session_report(session);
+	delete session;
+}
+
+static void player_close() {
+	if (player == NULL) return;
+	rec_player_close(player);
+	delete player;
+	player = NULL;
 }
 
 static void record_cb(Fl_Widget* w, void*) {
@@ -154,6 +393,10 @@ static void record_cb(Fl_Widget* w, void*) {
 	 * recording logic in a separate detached
 	 * thread.
 	 */
+	if (rec_alive) {
+		fl_alert("A recording is still running or being saved.");
+		return;
+	}
 	Fl_File_Chooser* saveFileDialog = new Fl_File_Chooser("", "", Fl_File_Chooser::CREATE, "Choose File");
 	saveFileDialog->filter("All Files (*)");
 
@@ -162,7 +405,7 @@ static void record_cb(Fl_Widget* w, void*) {
 #else
 	saveFileDialog->directory((std::string(getenv("HOME"))).c_str());
 #endif
-	saveFileDialog->value("recording.wav");
+	saveFileDialog->value(archive_ms > 0 ? "recording.rca" : file_format == ma_encoding_format_flac ? "recording.flac" : "recording.wav");
 	saveFileDialog->show();
 	/*
 	 * while loop is used to prevent choice
@@ -172,9 +415,34 @@ static void record_cb(Fl_Widget* w, void*) {
 	 */
 	while (saveFileDialog->shown()) Fl::wait();
 	const char* result_file = saveFileDialog->value();
-	if (saveFileDialog->value() != NULL) {
+	// Another press while the chooser was open may have started one
+	if (saveFileDialog->value() != NULL && !rec_alive) {
 		printf("%s\n", result_file);
-		std::thread rec_t(minaud_rec, result_file);
+		rec_alive = 1;
+		// Here, on the UI thread, so timeout_cb never reads a feed mid-reset
+		level_count = 0;
+		wave_lanes = 0;
+		wave_view->update(waves, 0);
+		rec_spectrum_feed_init(&spectrum_feed);
+		spectrum_shown = spectrum_on;
+		loudness_shown = loudness_on;
+		// A preview of the last take goes with it
+		if (player != NULL && player->live != NULL) {
+			player_close();
+			wave_view->playhead(REC_WAVE_NO_HEAD);
+		}
+		for (ma_uint32 i = 0; i < REC_MAX_INPUTS; i++) {
+			rec_level_feed_init(&level_feeds[i]);
+			rec_loudness_feed_init(&loudness_feeds[i]);
+			// A wave that failed to allocate is left without pages, and stays empty
+			rec_wave_uninit(&waves[i]);
+			if (rec_wave_init(&waves[i]) != MA_SUCCESS) waves[i].full = 1;
+			rec_preview_uninit(&previews[i]);
+		}
+		std::thread rec_t([](std::string path) {
+			minaud_rec(path);
+			rec_alive = 0;
+		}, std::string(result_file));
 		rec_t.detach();
 	} else printf("Cancelled\n");
 }
@@ -191,19 +459,468 @@ static void menubar_cb(Fl_Widget *w, void*) {
 	if (strcmp(item->label(), "&About") == 0) {
 		about_cb();
 	}
+	if (strcmp(item->label(), "&Mark") == 0) {
+		/*
+		 * Under the "On marker" durability
+		 * policy, everything recorded so far
+		 * is synced to disk.
+		 */
+		std::lock_guard<std::mutex> guard(active_lock);
+		if (active_session != NULL) rec_session_mark(active_session);
+	}
 	if (strcmp(item->label(), "&Quit") == 0) {
 		w->window()->hide();
 	}
 }
 
+static void input_cb(Fl_Widget *w, void* data) {
+	/*
+	 * Callback function for the device
+	 * toggles in the Inputs menu
+	 */
+	Fl_Menu_Bar *bar = (Fl_Menu_Bar*)w;
+	const Fl_Menu_Item *item = bar->mvalue();
+	input_selected[(intptr_t)data] = item->value() != 0;
+}
+
+static void merge_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for the
+	 * "Merge into one file" toggle
+	 */
+	Fl_Menu_Bar *bar = (Fl_Menu_Bar*)w;
+	merge_inputs = bar->mvalue()->value() != 0;
+}
+
+static void drift_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for the
+	 * "Compensate clock drift" toggle
+	 */
+	Fl_Menu_Bar *bar = (Fl_Menu_Bar*)w;
+	compensate_drift = bar->mvalue()->value() != 0;
+}
+
+static void burst_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for "Burst to RAM...":
+	 * asks for the memory budget in MB.
+	 */
+	const char* value = fl_input("Memory budget for burst recording, in MB\n(0 records straight to disk):", std::to_string(burst_budget_mb).c_str());
+	if (value != NULL) burst_budget_mb = atol(value) > 0 ? atol(value) : 0;
+}
+
+static void spill_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for "Spill directory...":
+	 * where audio goes if the disk stalls for
+	 * longer than memory can cover. Best on a
+	 * different volume from the recording.
+	 * Cancelling clears it.
+	 */
+	Fl_File_Chooser* dirDialog = new Fl_File_Chooser(spill_dir.c_str(), "", Fl_File_Chooser::DIRECTORY, "Choose Spill Directory");
+	dirDialog->show();
+	while (dirDialog->shown()) Fl::wait();
+	spill_dir = dirDialog->value() != NULL ? dirDialog->value() : "";
+	printf("Spill directory: %s\n", spill_dir.empty() ? "(none)" : spill_dir.c_str());
+	delete dirDialog;
+}
+
+static void alt_dir_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for "Alternate
+	 * directory...": where a recording
+	 * carries on when its disk runs low,
+	 * ideally another volume. Cancelling
+	 * clears it, and recording stops instead.
+	 */
+	Fl_File_Chooser* dirDialog = new Fl_File_Chooser(alt_dir.c_str(), "", Fl_File_Chooser::DIRECTORY, "Choose Alternate Directory");
+	dirDialog->show();
+	while (dirDialog->shown()) Fl::wait();
+	alt_dir = dirDialog->value() != NULL ? dirDialog->value() : "";
+	printf("Alternate directory: %s\n", alt_dir.empty() ? "(none)" : alt_dir.c_str());
+	delete dirDialog;
+}
+
+static void mirror_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for "Mirror to...":
+	 * a second volume that gets a copy of
+	 * every file. Cancelling turns mirroring
+	 * off.
+	 */
+	Fl_File_Chooser* dirDialog = new Fl_File_Chooser(mirror_dir.c_str(), "", Fl_File_Chooser::DIRECTORY, "Choose Mirror Directory");
+	dirDialog->show();
+	while (dirDialog->shown()) Fl::wait();
+	mirror_dir = dirDialog->value() != NULL ? dirDialog->value() : "";
+	printf("Mirror directory: %s\n", mirror_dir.empty() ? "(none)" : mirror_dir.c_str());
+	delete dirDialog;
+}
+
+static void proxy_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for the
+	 * "Speech proxy" toggle
+	 */
+	Fl_Menu_Bar *bar = (Fl_Menu_Bar*)w;
+	proxy_rate = bar->mvalue()->value() != 0 ? 16000 : 0;
+}
+
+static void insert_cb(Fl_Widget *w, void* data) {
+	/*
+	 * Callback function for the Inserts
+	 * toggles; data is the rec_insert_kind.
+	 */
+	Fl_Menu_Bar *bar = (Fl_Menu_Bar*)w;
+	int on = bar->mvalue()->value() != 0;
+	switch ((intptr_t)data) {
+	case REC_INSERT_HPF: hpf_on = on; break;
+	case REC_INSERT_AGC: agc_on = on; break;
+	case REC_INSERT_LIMITER: limiter_on = on; break;
+	default: gate_on = on; break;
+	}
+}
+
+static void gain_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for "Input gain...":
+	 * asks for the gain in dB. A recording
+	 * started with a gain moves to the new
+	 * one smoothly.
+	 */
+	const char* value = fl_input("Input gain in dB, applied before the file is written\n(changes while recording only if the take started with a gain):", std::to_string((int)input_gain_db).c_str());
+	if (value == NULL) return;
+	input_gain_db = atof(value);
+	std::lock_guard<std::mutex> guard(active_lock);
+	if (active_session != NULL) rec_session_set_gain(active_session, input_gain_db);
+}
+
+static void spectrum_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for the "Spectrum
+	 * analyzer" toggle; from the next
+	 * recording.
+	 */
+	Fl_Menu_Bar *bar = (Fl_Menu_Bar*)w;
+	spectrum_on = bar->mvalue()->value() != 0;
+}
+
+static void loudness_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for the "Loudness"
+	 * toggle; from the next recording.
+	 */
+	Fl_Menu_Bar *bar = (Fl_Menu_Bar*)w;
+	loudness_on = bar->mvalue()->value() != 0;
+}
+
+static void peaks_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for the
+	 * "Peak files" toggle
+	 */
+	Fl_Menu_Bar *bar = (Fl_Menu_Bar*)w;
+	write_peaks = bar->mvalue()->value() != 0;
+}
+
+static int overview_show(const std::string& path) {
+	/*
+	 * A finished recording's overview, from
+	 * its .peaks sidecar or, the first time,
+	 * by scanning it. Not while recording,
+	 * whose writers own the waves.
+	 */
+	level_count = 0;
+	wave_lanes = 0;
+	wave_view->update(waves, 0);
+	for (ma_uint32 i = 0; i < REC_MAX_INPUTS; i++) {
+		rec_wave_uninit(&waves[i]);
+		if (rec_wave_init(&waves[i]) != MA_SUCCESS) waves[i].full = 1;
+	}
+	unsigned cores = std::thread::hardware_concurrency();
+	rec_peaks_info info;
+	auto t0 = std::chrono::steady_clock::now();
+	ma_result result = rec_peaks_open(path.c_str(), waves, REC_MAX_INPUTS, cores > 0 ? cores : 1, &info);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	if (result != MA_SUCCESS) {
+		printf("Failed to read %s: %s\n", path.c_str(), ma_result_description(result));
+		return 0;
+	}
+	printf("Overview of %s, %.1f s: %s in %.1f ms\n", path.c_str(), info.sample_rate > 0 ? (double)info.frames / info.sample_rate : 0.0,
+		info.scanned ? "scanned" : "loaded", ms);
+	wave_lanes = info.lanes;
+	wave_view->update(waves, (int)wave_lanes);
+	return 1;
+}
+
+static void overview_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for "Show
+	 * waveform...". Not until the last
+	 * session has flushed its waves.
+	 */
+	if (rec_alive) {
+		fl_alert("Stop recording first.");
+		return;
+	}
+	Fl_File_Chooser* openDialog = new Fl_File_Chooser("", "*.{wav,flac,rca}", Fl_File_Chooser::SINGLE, "Choose Recording");
+	openDialog->show();
+	while (openDialog->shown()) Fl::wait();
+	if (openDialog->value() != NULL && !overview_show(openDialog->value())) fl_alert("Could not read the recording.");
+	delete openDialog;
+}
+
+static void play_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for "Play file...":
+	 * plays a recording from the start, its
+	 * waveform shown unless a session still
+	 * holds the waves.
+	 */
+	Fl_File_Chooser* openDialog = new Fl_File_Chooser("", "*.{wav,flac,rca}", Fl_File_Chooser::SINGLE, "Choose Recording");
+	openDialog->show();
+	while (openDialog->shown()) Fl::wait();
+	if (openDialog->value() != NULL) {
+		std::string path = openDialog->value();
+		player_close();
+		player = new rec_player();
+		ma_result result = rec_player_open(player, context_ok ? &context : NULL, path.c_str());
+		if (result != MA_SUCCESS) {
+			printf("Failed to play %s: %s\n", path.c_str(), ma_result_description(result));
+			fl_alert("Could not play the recording: %s", ma_result_description(result));
+			delete player;
+			player = NULL;
+		} else {
+			if (!rec_alive) overview_show(path);
+			rec_player_play(player);
+			ticker_start(NULL);
+		}
+	}
+	delete openDialog;
+}
+
+static void preview_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for "Preview last
+	 * minute": plays the first input's take
+	 * while it records, from a minute back,
+	 * and follows it to its end.
+	 */
+	if (rec_success != 1 || previews[0].data == NULL) {
+		fl_alert("Start recording first.");
+		return;
+	}
+	player_close();
+	player = new rec_player();
+	ma_result result = rec_player_open_live(player, context_ok ? &context : NULL, &previews[0], PREVIEW_SECONDS);
+	if (result != MA_SUCCESS) {
+		printf("Failed to preview: %s\n", ma_result_description(result));
+		fl_alert("Could not preview the recording: %s", ma_result_description(result));
+		delete player;
+		player = NULL;
+		return;
+	}
+	rec_player_play(player);
+	ticker_start(NULL);
+}
+
+static void playback_cb(Fl_Widget *w, void* data) {
+	/*
+	 * Callback function for the Playback
+	 * commands; data is the skip in seconds
+	 * for Back and Forward, 0 to pause or
+	 * resume, or -1 to stop.
+	 */
+	if (player == NULL) return;
+	intptr_t skip = (intptr_t)data;
+	if (skip == -1) {
+		player_close();
+		time_out->value(time_elapsed, disk_low);
+		wave_view->playhead(REC_WAVE_NO_HEAD);
+		return;
+	}
+	if (skip == 0) {
+		if (rec_player_playing(player)) rec_player_pause(player);
+		else {
+			// From the top once it has played through
+			if (rec_player_done(player)) rec_player_seek(player, 0);
+			rec_player_play(player);
+		}
+	} else {
+		ma_int64 frame = (ma_int64)rec_player_position(player) + (ma_int64)skip * player->sample_rate;
+		rec_player_seek(player, frame > 0 ? (ma_uint64)frame : 0);
+	}
+	ticker_start(NULL);
+}
+
+static void wave_cb(Fl_Widget *w, void*) {
+	/*
+	 * A click on the waveform: playback, if
+	 * any, continues from there. While
+	 * recording, only a preview can seek.
+	 */
+	if (player == NULL || (rec_success == 1 && player->live == NULL)) return;
+	rec_player_seek(player, ((rec_wave_view*)w)->picked());
+	ticker_start(NULL);
+}
+
+static void format_cb(Fl_Widget *w, void* data) {
+	/*
+	 * Callback function for the
+	 * File format radio items
+	 */
+	file_format = (ma_encoding_format)(intptr_t)data;
+	wav_codec = REC_WAV_PCM;
+	archive_ms = 0;
+}
+
+static void archive_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for the Archive
+	 * item in File format: FLAC in blocks
+	 * with an index, for review tools
+	 */
+	file_format = ma_encoding_format_flac;
+	wav_codec = REC_WAV_PCM;
+	archive_ms = 1000;
+}
+
+static void convert_cb(Fl_Widget *w, void*) {
+	/*
+	 * Callback function for "Convert archive
+	 * to WAV...": writes "take.wav" next to
+	 * "take.rca".
+	 */
+	Fl_File_Chooser* openDialog = new Fl_File_Chooser("", "*.rca", Fl_File_Chooser::SINGLE, "Choose Archive");
+	openDialog->show();
+	while (openDialog->shown()) Fl::wait();
+	if (openDialog->value() != NULL) {
+		std::string path = openDialog->value();
+		size_t dot = path.find_last_of('.');
+		std::string wav = (dot == std::string::npos ? path : path.substr(0, dot)) + ".wav";
+		ma_result result = rec_archive_to_wav(path.c_str(), wav.c_str());
+		if (result == MA_SUCCESS) printf("Converted to %s\n", wav.c_str());
+		else {
+			printf("Failed to convert %s: %s\n", path.c_str(), ma_result_description(result));
+			fl_alert("Could not convert the archive: %s", ma_result_description(result));
+		}
+	}
+	delete openDialog;
+}
+
+static void codec_cb(Fl_Widget *w, void* data) {
+	/*
+	 * Callback function for the compact
+	 * WAV codecs in File format
+	 */
+	file_format = ma_encoding_format_wav;
+	wav_codec = (rec_wav_codec)(intptr_t)data;
+	archive_ms = 0;
+}
+
+static void write_mode_cb(Fl_Widget *w, void* data) {
+	/*
+	 * Callback function for the
+	 * Write mode radio items
+	 */
+	write_mode = (rec_sink_kind)(intptr_t)data;
+}
+
+static void durability_cb(Fl_Widget *w, void* data) {
+	/*
+	 * Callback function for the Durability
+	 * radio items; the timed and size
+	 * policies ask for their period.
+	 */
+	sync_policy = (rec_sync_policy)(intptr_t)data;
+	const char* value = NULL;
+	if (sync_policy == REC_SYNC_INTERVAL) {
+		value = fl_input("Sync recordings to disk every how many milliseconds?", std::to_string(sync_interval_ms).c_str());
+		if (value != NULL && atol(value) > 0) sync_interval_ms = atol(value);
+	}
+	if (sync_policy == REC_SYNC_BYTES) {
+		value = fl_input("Sync recordings to disk after how many MB?", std::to_string(sync_mb).c_str());
+		if (value != NULL && atol(value) > 0) sync_mb = atol(value);
+	}
+}
+
+static void inputs_menu_init(Fl_Menu_Bar* menu) {
+	/*
+	 * Lists the capture devices under Inputs,
+	 * the system default ticked. Menu labels
+	 * treat '/' and '&' specially, so those
+	 * are escaped in device names.
+	 */
+	ma_device_info* playback_infos;
+	ma_uint32 playback_count;
+	if (ma_context_init(NULL, 0, NULL, &context) != MA_SUCCESS) return;
+	context_ok = 1;
+	if (ma_context_get_devices(&context, &playback_infos, &playback_count, &capture_infos, &capture_count) != MA_SUCCESS) {
+		capture_count = 0;
+		return;
+	}
+	for (ma_uint32 i = 0; i < capture_count && i < REC_MAX_INPUTS; i++) {
+		std::string label("&Inputs/");
+		for (const char* c = capture_infos[i].name; *c; c++) {
+			if (*c == '/' || *c == '\\') label += '\\';
+			if (*c == '&') label += '&';
+			label += *c;
+		}
+		input_selected[i] = capture_infos[i].isDefault;
+		menu->add(label.c_str(), 0, input_cb, (void*)(intptr_t)i, FL_MENU_TOGGLE | (input_selected[i] ? FL_MENU_VALUE : 0) | (i + 1 == capture_count ? FL_MENU_DIVIDER : 0));
+	}
+	menu->add("&Inputs/&Merge into one file", 0, merge_cb, NULL, FL_MENU_TOGGLE);
+	menu->add("&Inputs/&Compensate clock drift", 0, drift_cb, NULL, FL_MENU_TOGGLE | FL_MENU_VALUE);
+}
+
 static void timeout_cb(void*) {
-	/* Special Callback function for
-	 * timer, redraws value in Fl_Output
-	 * recursively
+	/*
+	 * Timer callback: feeds the widgets, which
+	 * redraw only what changed. Every UI_TICK
+	 * while recording; once stopped it lets
+	 * the timer lapse until ticker_start().
+	 */
+	double seconds = time_elapsed;
+	int playing = 0;
+	ma_uint32 bars = 0;
+	for (ma_uint32 i = 0; i < level_count; i++) {
+		const rec_levels* l = rec_level_feed_read(&level_feeds[i]);
+		// Audio metered is finer than the recording thread's count
+		if (i == 0 && l->position > 0 && level_rate > 0) seconds = (double)l->position / level_rate;
+		bars += l->channels;
+	}
+	/*
+	 * Playback, when not recording, shows its
+	 * position and stops at the end. A
+	 * preview of the take shows its playhead
+	 * only, the time staying the recording's.
+	 */
+	if (player != NULL && (rec_success != 1 || player->live != NULL)) {
+		if (rec_player_playing(player) && rec_player_done(player)) rec_player_pause(player);
+		playing = rec_player_playing(player);
+		if (rec_success != 1) seconds = (double)rec_player_position(player) / player->sample_rate;
+		wave_view->playhead(rec_player_position(player));
+	}
+	// Red while the disk is running low
+	time_out->value(seconds, disk_low);
+	time_out->tooltip(disk_moved ? "Continuing in the alternate directory" : NULL);
+	/*
+	 * Held peak of every channel, inputs in
+	 * order; a lamp once any clipped.
 	 */
-	time_out->value((std::string("Time (sec): ") + (std::to_string(time_elapsed))).c_str());
-	Fl::redraw();
-	Fl::repeat_timeout(1, timeout_cb);
+	level_meter->bars((int)bars);
+	int bar = 0;
+	for (ma_uint32 i = 0; i < level_count; i++) {
+		const rec_levels* l = rec_level_feed_read(&level_feeds[i]);
+		for (ma_uint32 c = 0; c < l->channels; c++) {
+			level_meter->level(bar++, l->peak[c], l->held[c], l->clips[c] > 0);
+		}
+	}
+	wave_view->update(waves, (int)wave_lanes);
+	spectrum_view->update(spectrum_shown ? rec_spectrum_feed_read(&spectrum_feed) : NULL);
+	loudness_display->update(loudness_shown ? rec_loudness_feed_read(&loudness_feeds[0]) : NULL);
+	if (rec_success == 1 || playing) Fl::repeat_timeout(UI_TICK, timeout_cb);
+	else ticking = 0;
 }
 
 static void window_center_on_screen(Fl_Window* win) {
@@ -220,13 +937,52 @@ int main(int argc, char **argv) {
 	 * Program entry-point.
 	 */
 	Fl::scheme("gtk+");
-	Fl_Window *window = new Fl_Window(250,150, "Recorder");
+	Fl_Window *window = new Fl_Window(250,300, "Recorder");
 	
 	Fl_Menu_Bar *menu = new Fl_Menu_Bar(0,0,250,25);
 	{
 		menu->add("&Reset", "^r", menubar_cb);
 		menu->add("&Quit", "^w", menubar_cb);
+		menu->add("&Mark", "^m", menubar_cb);
 		menu->add("&About", 0, menubar_cb);
+		menu->add("&Options/&Burst to RAM...", 0, burst_cb);
+		menu->add("&Options/&Spill directory...", 0, spill_cb);
+		menu->add("&Options/&Alternate directory...", 0, alt_dir_cb);
+		menu->add("&Options/&Mirror to...", 0, mirror_cb);
+		menu->add("&Options/Speech &proxy (16 kHz mono)", 0, proxy_cb, NULL, FL_MENU_TOGGLE);
+		menu->add("&Options/&File format/&WAV", 0, format_cb, (void*)(intptr_t)ma_encoding_format_wav, FL_MENU_RADIO | FL_MENU_VALUE);
+		menu->add("&Options/&File format/&FLAC (24-bit)", 0, format_cb, (void*)(intptr_t)ma_encoding_format_flac, FL_MENU_RADIO);
+		menu->add("&Options/&File format/&IMA ADPCM (4:1)", 0, codec_cb, (void*)(intptr_t)REC_WAV_IMA_ADPCM, FL_MENU_RADIO);
+		menu->add("&Options/&File format/&mu-law (2:1)", 0, codec_cb, (void*)(intptr_t)REC_WAV_MULAW, FL_MENU_RADIO);
+		menu->add("&Options/&File format/A-&law (2:1)", 0, codec_cb, (void*)(intptr_t)REC_WAV_ALAW, FL_MENU_RADIO);
+		menu->add("&Options/&File format/&Archive (indexed FLAC)", 0, archive_cb, NULL, FL_MENU_RADIO);
+		menu->add("&Options/&Convert archive to WAV...", 0, convert_cb);
+		menu->add("&Options/&Peak files (.peaks)", 0, peaks_cb, NULL, FL_MENU_TOGGLE | FL_MENU_VALUE);
+		menu->add("&Options/S&how waveform...", 0, overview_cb);
+		menu->add("&Options/Spectrum anal&yzer", 0, spectrum_cb, NULL, FL_MENU_TOGGLE);
+		menu->add("&Options/&Loudness (EBU R128)", 0, loudness_cb, NULL, FL_MENU_TOGGLE | FL_MENU_VALUE);
+		menu->add("&Options/&Inserts/&High-pass 80 Hz", 0, insert_cb, (void*)(intptr_t)REC_INSERT_HPF, FL_MENU_TOGGLE);
+		menu->add("&Options/&Inserts/Input &gain...", 0, gain_cb);
+		menu->add("&Options/&Inserts/&Noise gate", 0, insert_cb, (void*)(intptr_t)REC_INSERT_GATE, FL_MENU_TOGGLE);
+		menu->add("&Options/&Inserts/&Automatic gain", 0, insert_cb, (void*)(intptr_t)REC_INSERT_AGC, FL_MENU_TOGGLE);
+		menu->add("&Options/&Inserts/&Limiter at -1 dBFS", 0, insert_cb, (void*)(intptr_t)REC_INSERT_LIMITER, FL_MENU_TOGGLE);
+		menu->add("&Playback/&Play file...", "^p", play_cb);
+		menu->add("&Playback/Preview &last minute", "^l", preview_cb);
+		menu->add("&Playback/Pause or &resume", 0, playback_cb, (void*)(intptr_t)0);
+		menu->add("&Playback/&Back 5 s", FL_CTRL + FL_Left, playback_cb, (void*)(intptr_t)-PLAYER_SKIP);
+		menu->add("&Playback/&Forward 5 s", FL_CTRL + FL_Right, playback_cb, (void*)(intptr_t)PLAYER_SKIP);
+		menu->add("&Playback/&Stop", 0, playback_cb, (void*)(intptr_t)-1);
+#if !defined(_WIN32)
+		menu->add("&Options/&Write mode/&Standard", 0, write_mode_cb, (void*)(intptr_t)REC_SINK_STDIO, FL_MENU_RADIO);
+		menu->add("&Options/&Write mode/&Asynchronous", 0, write_mode_cb, (void*)(intptr_t)REC_SINK_ASYNC, FL_MENU_RADIO | FL_MENU_VALUE);
+		menu->add("&Options/&Write mode/&Memory-mapped", 0, write_mode_cb, (void*)(intptr_t)REC_SINK_MMAP, FL_MENU_RADIO);
+		menu->add("&Options/&Write mode/&Direct (bypass cache)", 0, write_mode_cb, (void*)(intptr_t)REC_SINK_DIRECT, FL_MENU_RADIO);
+#endif
+		menu->add("&Options/&Durability/&None (sync at close)", 0, durability_cb, (void*)(intptr_t)REC_SYNC_NONE, FL_MENU_RADIO | FL_MENU_VALUE);
+		menu->add("&Options/&Durability/&Timed...", 0, durability_cb, (void*)(intptr_t)REC_SYNC_INTERVAL, FL_MENU_RADIO);
+		menu->add("&Options/&Durability/By &size...", 0, durability_cb, (void*)(intptr_t)REC_SYNC_BYTES, FL_MENU_RADIO);
+		menu->add("&Options/&Durability/On &marker", 0, durability_cb, (void*)(intptr_t)REC_SYNC_MARKER, FL_MENU_RADIO);
+		inputs_menu_init(menu);
 	}
 	// XHaskell logo display
 	Fl_Box* image_box = new Fl_Box(5, 30, 60, 55);
@@ -236,7 +992,9 @@ int main(int argc, char **argv) {
 	title_label_box->labelfont(1);
 	title_label_box->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE);
 	
-	time_out = new Fl_Output(70, 55, 120, 25);
+	time_out = new rec_time_display(70, 55, 120, 25);
+	// Peak levels while recording
+	level_meter = new rec_level_meter(75, 100, 100, 40);
 
 	Fl_Button* record_button = new Fl_Button(10, 100, 60, 40, "Record");
 	record_button->image(image_rec);
@@ -245,6 +1003,15 @@ int main(int argc, char **argv) {
 	Fl_Button* stop_button = new Fl_Button(180, 100, 60, 40, "Stop");
 	stop_button->image(image_stop);
 	stop_button->callback(stop_cb);
+
+	// Waveform of the recording so far; the wheel zooms
+	wave_view = new rec_wave_view(5, 148, 240, 62);
+	wave_view->callback(wave_cb);
+
+	// Spectrum of the first input, with the analyzer on
+	spectrum_view = new rec_spectrum_view(5, 215, 240, 60);
+	// Loudness of the first file, written into it at close
+	loudness_display = new rec_loudness_display(5, 278, 240, 18);
 	
 	window->end();
 
@@ -259,7 +1026,12 @@ int main(int argc, char **argv) {
 
 	window_center_on_screen(window);
 	window->show(argc, argv);
-	// Starts timeout_cb
-	Fl::add_timeout(0.009, timeout_cb);
-	return Fl::run();
+	// Lets the recording thread post alerts with Fl::awake()
+	Fl::lock();
+	// Draws the idle state; recording restarts the ticks
+	ticker_start(NULL);
+	int ret = Fl::run();
+	player_close();
+	if (context_ok) ma_context_uninit(&context);
+	return ret;
 }
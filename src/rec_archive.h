@@ -0,0 +1,600 @@
+/*
+ * Block-indexed archive (.rca).
+ *
+ * For review tools that open multi-hour takes at any
+ * point. Audio is cut into blocks of a fixed number of
+ * frames, a multiple of REC_FLAC_BLOCK. Each block is a
+ * run of FLAC frames from rec_flac, so it decodes on its
+ * own. An index of every block follows the audio, with an
+ * optional peak and RMS per channel, so finding any frame
+ * is one lookup and an overview needs no decoding.
+ *
+ * Layout, little-endian:
+ *   header  REC_ARCHIVE_HEADER bytes: magic, flags,
+ *           channels, bits, rate, frames per block,
+ *           total frames, the index offset and the FLAC
+ *           STREAMINFO the blocks were coded with
+ *   blocks  FLAC frames, back to back
+ *   index   one fixed-size entry per block: offset,
+ *           bytes and frames, then peak and RMS per
+ *           channel as floats when summaries are on
+ *   footer  the index offset, the entry size and magic
+ *
+ * The header's index offset stays 0 until close, so an
+ * interrupted take is recognisable as one. Readers map
+ * the file and decode a block straight from the mapping
+ * with ma_decoder, behind a STREAMINFO made for it.
+ */
+#ifndef REC_ARCHIVE_H
+#define REC_ARCHIVE_H
+
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define REC_ARCHIVE_MAGIC "RCA1"
+#define REC_ARCHIVE_INDEX_MAGIC "RCAI"
+#define REC_ARCHIVE_VERSION 1
+#define REC_ARCHIVE_HEADER 80
+#define REC_ARCHIVE_FOOTER 16
+#define REC_ARCHIVE_SUMMARIES 1
+// Frames per block unless asked otherwise: about a second at 48 kHz
+#define REC_ARCHIVE_BLOCK (12 * REC_FLAC_BLOCK)
+
+typedef struct rec_archive {
+	rec_flac_write_proc on_write;
+	rec_flac_seek_proc on_seek;
+	void* user;
+	rec_flac flac;
+	ma_format format;
+	ma_uint32 channels;
+	ma_uint32 sample_rate;
+	ma_uint32 block_frames;
+	int summaries;
+	// The encoder's metadata is kept for the header, not written
+	int in_metadata;
+	ma_uint8 streaminfo[34];
+	ma_uint64 flac_frames;
+	// Serialized index entries, grown by doubling
+	ma_uint8* index;
+	size_t stride;
+	ma_uint64 block_count;
+	ma_uint64 block_cap;
+	// Running summary of the block being filled
+	float* peak;
+	double* sum_sq;
+	ma_uint32 fill;
+	ma_uint64 block;
+	ma_uint64 frames;
+	size_t header_bytes;
+	ma_uint64 pos;		// file position, past the header
+	ma_uint64 bytes_written;	// blocks, index and footer
+	ma_result result;
+} rec_archive;
+
+static inline void rec_archive_put(ma_uint8* p, size_t pos, ma_uint64 value, int bytes) {
+	for (int i = 0; i < bytes; i++) p[pos + i] = (ma_uint8)(value >> (8 * i));
+}
+
+static inline ma_uint64 rec_archive_get(const ma_uint8* p, size_t pos, int bytes) {
+	ma_uint64 value = 0;
+	for (int i = bytes - 1; i >= 0; i--) value = (value << 8) | p[pos + i];
+	return value;
+}
+
+static inline void rec_archive_header(const rec_archive* a, ma_uint8* p, ma_uint64 index_offset) {
+	memset(p, 0, REC_ARCHIVE_HEADER);
+	memcpy(p, REC_ARCHIVE_MAGIC, 4);
+	rec_archive_put(p, 4, REC_ARCHIVE_VERSION, 2);
+	rec_archive_put(p, 6, a->summaries ? REC_ARCHIVE_SUMMARIES : 0, 2);
+	rec_archive_put(p, 8, a->channels, 2);
+	rec_archive_put(p, 10, ma_get_bytes_per_sample(a->format) * 8, 2);
+	rec_archive_put(p, 12, a->sample_rate, 4);
+	rec_archive_put(p, 16, a->block_frames, 4);
+	rec_archive_put(p, 24, a->frames, 8);
+	rec_archive_put(p, 32, index_offset, 8);
+	memcpy(p + 40, a->streaminfo, 34);
+}
+
+static inline ma_uint8* rec_archive_entry(rec_archive* a, ma_uint64 block) {
+	/*
+	 * The index entry for a block, growing
+	 * the index when it is new. NULL when
+	 * out of memory.
+	 */
+	if (block >= a->block_cap) {
+		ma_uint64 cap = a->block_cap > 0 ? a->block_cap * 2 : 1024;
+		while (cap <= block) cap *= 2;
+		ma_uint8* grown = (ma_uint8*)ma_realloc(a->index, (size_t)cap * a->stride, NULL);
+		if (grown == NULL) return NULL;
+		memset(grown + (size_t)a->block_cap * a->stride, 0, (size_t)(cap - a->block_cap) * a->stride);
+		a->index = grown;
+		a->block_cap = cap;
+	}
+	if (block >= a->block_count) a->block_count = block + 1;
+	return a->index + (size_t)block * a->stride;
+}
+
+static inline ma_result rec_archive_flac_write(void* user, const void* data, size_t bytes) {
+	/*
+	 * From the encoder: its metadata, kept
+	 * for the header, or one FLAC frame. A
+	 * frame that starts a block opens its
+	 * index entry.
+	 */
+	rec_archive* a = (rec_archive*)user;
+	if (a->in_metadata) {
+		if (bytes >= 8 + 34) memcpy(a->streaminfo, (const ma_uint8*)data + 8, 34);
+		a->in_metadata = 0;
+		return MA_SUCCESS;
+	}
+	const ma_uint64 block = a->flac_frames / (a->block_frames / REC_FLAC_BLOCK);
+	ma_uint8* e = rec_archive_entry(a, block);
+	if (e == NULL) return MA_OUT_OF_MEMORY;
+	if (a->flac_frames % (a->block_frames / REC_FLAC_BLOCK) == 0) rec_archive_put(e, 0, a->header_bytes + a->pos, 8);
+	rec_archive_put(e, 8, rec_archive_get(e, 8, 4) + bytes, 4);
+	a->flac_frames++;
+	ma_result result = a->on_write(a->user, data, bytes);
+	a->pos += bytes;
+	a->bytes_written += bytes;
+	return result;
+}
+
+static inline ma_result rec_archive_flac_seek(void* user, ma_uint64 offset) {
+	// Only ever back to the metadata, to rewrite it; anywhere else is unsupported
+	if (offset != 0) return MA_INVALID_OPERATION;
+	((rec_archive*)user)->in_metadata = 1;
+	return MA_SUCCESS;
+}
+
+static inline void rec_archive_summarize(rec_archive* a, const ma_uint8* src, ma_uint32 n) {
+	/*
+	 * Peak and sum of squares per channel,
+	 * full scale being 1.
+	 */
+	const ma_uint32 ch = a->channels;
+	const ma_uint32 bps = ma_get_bytes_per_sample(a->format);
+	const size_t stride = (size_t)ch * bps;
+	for (ma_uint32 c = 0; c < ch; c++) {
+		const ma_uint8* s = src + (size_t)c * bps;
+		ma_int32 peak = 0;
+		double sum = 0;
+		for (ma_uint32 i = 0; i < n; i++, s += stride) {
+			ma_int32 v;
+			if (a->format == ma_format_s16) v = (ma_int16)(s[0] | (s[1] << 8));
+			else if (a->format == ma_format_s24) v = (ma_int32)(((ma_uint32)s[0] << 8) | ((ma_uint32)s[1] << 16) | ((ma_uint32)s[2] << 24)) >> 8;
+			else v = (ma_int32)s[0] - 128;
+			v = v < 0 ? -v : v;
+			peak = v > peak ? v : peak;
+			sum += (double)v * v;
+		}
+		const double full = (double)(1 << (bps * 8 - 1));
+		if (peak / full > a->peak[c]) a->peak[c] = (float)(peak / full);
+		a->sum_sq[c] += sum / (full * full);
+	}
+}
+
+static inline ma_result rec_archive_close_block(rec_archive* a) {
+	/*
+	 * Stores the running summary in the
+	 * block's entry and starts the next.
+	 */
+	ma_uint8* e = rec_archive_entry(a, a->block);
+	if (e == NULL) return MA_OUT_OF_MEMORY;
+	for (ma_uint32 c = 0; c < a->channels; c++) {
+		float rms = a->fill > 0 ? (float)sqrt(a->sum_sq[c] / a->fill) : 0.0f;
+		memcpy(e + 16 + c * 8, &a->peak[c], 4);
+		memcpy(e + 16 + c * 8 + 4, &rms, 4);
+		a->peak[c] = 0;
+		a->sum_sq[c] = 0;
+	}
+	a->fill = 0;
+	a->block++;
+	return MA_SUCCESS;
+}
+
+static inline ma_result rec_archive_init(rec_archive* a, rec_flac_write_proc on_write, rec_flac_seek_proc on_seek, void* user,
+	ma_format format, ma_uint32 channels, ma_uint32 sample_rate, ma_uint32 block_frames, int summaries, ma_uint32 workers) {
+	/*
+	 * block_frames is rounded to whole FLAC
+	 * frames; 0 takes REC_ARCHIVE_BLOCK.
+	 * Writes the provisional header.
+	 */
+	a->on_write = on_write;
+	a->on_seek = on_seek;
+	a->user = user;
+	a->format = format;
+	a->channels = channels;
+	a->sample_rate = sample_rate;
+	if (block_frames == 0) block_frames = REC_ARCHIVE_BLOCK;
+	a->block_frames = (block_frames + REC_FLAC_BLOCK / 2) / REC_FLAC_BLOCK * REC_FLAC_BLOCK;
+	if (a->block_frames == 0) a->block_frames = REC_FLAC_BLOCK;
+	a->summaries = summaries;
+	a->in_metadata = 1;
+	memset(a->streaminfo, 0, sizeof(a->streaminfo));
+	a->flac_frames = 0;
+	a->index = NULL;
+	a->stride = 16 + (summaries ? (size_t)channels * 8 : 0);
+	a->block_count = a->block_cap = 0;
+	a->peak = NULL;
+	a->sum_sq = NULL;
+	a->fill = 0;
+	a->block = 0;
+	a->frames = 0;
+	a->pos = a->bytes_written = 0;
+	a->result = MA_SUCCESS;
+	a->flac.queue[0].samples = NULL;
+	if (summaries) {
+		a->peak = (float*)ma_calloc(channels * sizeof(float), NULL);
+		a->sum_sq = (double*)ma_calloc(channels * sizeof(double), NULL);
+		if (a->peak == NULL || a->sum_sq == NULL) {
+			ma_free(a->peak, NULL);
+			ma_free(a->sum_sq, NULL);
+			return MA_OUT_OF_MEMORY;
+		}
+	}
+	ma_uint8 header[REC_ARCHIVE_HEADER];
+	rec_archive_header(a, header, 0);
+	a->header_bytes = REC_ARCHIVE_HEADER;
+	ma_result result = a->on_write(a->user, header, REC_ARCHIVE_HEADER);
+	if (result == MA_SUCCESS) result = rec_flac_init(&a->flac, rec_archive_flac_write, rec_archive_flac_seek, a, format, channels, sample_rate, workers);
+	if (result != MA_SUCCESS) {
+		ma_free(a->peak, NULL);
+		ma_free(a->sum_sq, NULL);
+		a->peak = NULL;
+		a->sum_sq = NULL;
+		return result;
+	}
+	return MA_SUCCESS;
+}
+
+static inline ma_result rec_archive_write(rec_archive* a, const void* frames, ma_uint64 count) {
+	/*
+	 * Interleaved frames in the archive's
+	 * format. Summaries are cut at the same
+	 * block edges as the audio.
+	 */
+	const size_t bpf = ma_get_bytes_per_frame(a->format, a->channels);
+	const ma_uint8* src = (const ma_uint8*)frames;
+	while (count > 0 && a->result == MA_SUCCESS) {
+		ma_uint32 n = a->block_frames - a->fill;
+		if (n > count) n = (ma_uint32)count;
+		if (a->summaries) rec_archive_summarize(a, src, n);
+		a->result = rec_flac_write(&a->flac, src, n);
+		a->fill += n;
+		a->frames += n;
+		src += (size_t)n * bpf;
+		count -= n;
+		if (a->fill == a->block_frames && a->result == MA_SUCCESS) {
+			if (a->summaries) a->result = rec_archive_close_block(a);
+			else a->fill = 0;
+		}
+	}
+	return a->result;
+}
+
+static inline ma_result rec_archive_uninit(rec_archive* a) {
+	/*
+	 * Flushes the encoder, then writes the
+	 * index and footer and rewrites the
+	 * header. Returns the first error seen.
+	 */
+	ma_result result = rec_flac_uninit(&a->flac);
+	if (a->result == MA_SUCCESS) a->result = result;
+	if (a->result == MA_SUCCESS && a->summaries && a->fill > 0) a->result = rec_archive_close_block(a);
+	if (a->result == MA_SUCCESS) {
+		// Every block is full but the last
+		for (ma_uint64 b = 0; b < a->block_count; b++) {
+			ma_uint64 first = b * a->block_frames;
+			ma_uint64 n = a->frames - first < a->block_frames ? a->frames - first : a->block_frames;
+			rec_archive_put(a->index + (size_t)b * a->stride, 12, n, 4);
+		}
+		const ma_uint64 index_offset = a->header_bytes + a->pos;
+		ma_uint8 footer[REC_ARCHIVE_FOOTER];
+		rec_archive_put(footer, 0, index_offset, 8);
+		rec_archive_put(footer, 8, a->stride, 4);
+		memcpy(footer + 12, REC_ARCHIVE_INDEX_MAGIC, 4);
+		if (a->block_count > 0) a->result = a->on_write(a->user, a->index, (size_t)a->block_count * a->stride);
+		if (a->result == MA_SUCCESS) a->result = a->on_write(a->user, footer, REC_ARCHIVE_FOOTER);
+		a->bytes_written += (size_t)a->block_count * a->stride + REC_ARCHIVE_FOOTER;
+		ma_uint8 header[REC_ARCHIVE_HEADER];
+		rec_archive_header(a, header, index_offset);
+		if (a->result == MA_SUCCESS) a->result = a->on_seek(a->user, 0);
+		if (a->result == MA_SUCCESS) a->result = a->on_write(a->user, header, REC_ARCHIVE_HEADER);
+	}
+	ma_free(a->index, NULL);
+	ma_free(a->peak, NULL);
+	ma_free(a->sum_sq, NULL);
+	a->index = NULL;
+	a->peak = NULL;
+	a->sum_sq = NULL;
+	return a->result;
+}
+
+/*
+ * Reading. The file is mapped read-only; blocks are
+ * decoded on demand into a one-block cache.
+ */
+typedef struct rec_archive_reader {
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+	const ma_uint8* base;
+	size_t size;
+	ma_format format;
+	ma_uint32 channels;
+	ma_uint32 sample_rate;
+	ma_uint32 block_frames;
+	ma_uint64 frames;
+	ma_uint64 block_count;
+	int summaries;
+	const ma_uint8* index;
+	size_t stride;
+	// The last block decoded, and s32 for the decoder to fill
+	ma_uint8* cache;
+	ma_int32* wide;
+	ma_uint64 cached_block;
+	ma_uint32 cached_frames;
+} rec_archive_reader;
+
+typedef struct rec_archive_block_info {
+	ma_uint64 offset;
+	ma_uint32 bytes;
+	ma_uint32 frames;
+	ma_uint64 first_frame;
+} rec_archive_block_info;
+
+static inline void rec_archive_close(rec_archive_reader* r) {
+	ma_free(r->cache, NULL);
+	ma_free(r->wide, NULL);
+	r->cache = NULL;
+	r->wide = NULL;
+#if defined(_WIN32)
+	if (r->base != NULL) UnmapViewOfFile(r->base);
+	if (r->mapping != NULL) CloseHandle(r->mapping);
+	if (r->file != INVALID_HANDLE_VALUE) CloseHandle(r->file);
+	r->mapping = NULL;
+	r->file = INVALID_HANDLE_VALUE;
+#else
+	if (r->base != NULL) munmap((void*)r->base, r->size);
+	if (r->fd >= 0) close(r->fd);
+	r->fd = -1;
+#endif
+	r->base = NULL;
+}
+
+static inline ma_result rec_archive_open(rec_archive_reader* r, const char* path) {
+	/*
+	 * Maps the file and checks the header
+	 * against the footer. A take that was
+	 * never closed has no index and gives
+	 * MA_INVALID_FILE.
+	 */
+	memset(r, 0, sizeof(*r));
+	r->cached_block = ~(ma_uint64)0;
+#if defined(_WIN32)
+	r->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (r->file == INVALID_HANDLE_VALUE) return MA_DOES_NOT_EXIST;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(r->file, &size) || size.QuadPart < REC_ARCHIVE_HEADER + REC_ARCHIVE_FOOTER) {
+		rec_archive_close(r);
+		return MA_INVALID_FILE;
+	}
+	r->size = (size_t)size.QuadPart;
+	r->mapping = CreateFileMappingA(r->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (r->mapping != NULL) r->base = (const ma_uint8*)MapViewOfFile(r->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (r->base == NULL) {
+		rec_archive_close(r);
+		return MA_IO_ERROR;
+	}
+#else
+	r->fd = open(path, O_RDONLY);
+	if (r->fd < 0) return rec_result_from_errno(errno);
+	struct stat st;
+	if (fstat(r->fd, &st) != 0 || st.st_size < REC_ARCHIVE_HEADER + REC_ARCHIVE_FOOTER) {
+		rec_archive_close(r);
+		return MA_INVALID_FILE;
+	}
+	r->size = (size_t)st.st_size;
+	void* p = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (p == MAP_FAILED) {
+		rec_archive_close(r);
+		return rec_result_from_errno(errno);
+	}
+	r->base = (const ma_uint8*)p;
+#endif
+	const ma_uint8* h = r->base;
+	const ma_uint8* f = r->base + r->size - REC_ARCHIVE_FOOTER;
+	const ma_uint64 index_offset = rec_archive_get(h, 32, 8);
+	r->stride = (size_t)rec_archive_get(f, 8, 4);
+	r->channels = (ma_uint32)rec_archive_get(h, 8, 2);
+	const ma_uint32 bits = (ma_uint32)rec_archive_get(h, 10, 2);
+	r->format = bits == 8 ? ma_format_u8 : bits == 16 ? ma_format_s16 : bits == 24 ? ma_format_s24 : ma_format_unknown;
+	r->sample_rate = (ma_uint32)rec_archive_get(h, 12, 4);
+	r->block_frames = (ma_uint32)rec_archive_get(h, 16, 4);
+	r->frames = rec_archive_get(h, 24, 8);
+	r->summaries = (rec_archive_get(h, 6, 2) & REC_ARCHIVE_SUMMARIES) != 0;
+	if (memcmp(h, REC_ARCHIVE_MAGIC, 4) != 0 || memcmp(f + 12, REC_ARCHIVE_INDEX_MAGIC, 4) != 0 ||
+		index_offset == 0 || index_offset != rec_archive_get(f, 0, 8) || index_offset > r->size - REC_ARCHIVE_FOOTER ||
+		r->format == ma_format_unknown || r->channels == 0 || r->block_frames == 0 ||
+		r->stride != 16 + (r->summaries ? (size_t)r->channels * 8 : 0)) {
+		rec_archive_close(r);
+		return MA_INVALID_FILE;
+	}
+	r->index = r->base + index_offset;
+	r->block_count = (r->size - REC_ARCHIVE_FOOTER - index_offset) / r->stride;
+	if (r->block_count != (r->frames + r->block_frames - 1) / r->block_frames) {
+		rec_archive_close(r);
+		return MA_INVALID_FILE;
+	}
+	r->cache = (ma_uint8*)ma_malloc((size_t)r->block_frames * ma_get_bytes_per_frame(r->format, r->channels), NULL);
+	r->wide = (ma_int32*)ma_malloc((size_t)r->block_frames * r->channels * sizeof(ma_int32), NULL);
+	if (r->cache == NULL || r->wide == NULL) {
+		rec_archive_close(r);
+		return MA_OUT_OF_MEMORY;
+	}
+	return MA_SUCCESS;
+}
+
+static inline rec_archive_block_info rec_archive_block(const rec_archive_reader* r, ma_uint64 block) {
+	const ma_uint8* e = r->index + (size_t)block * r->stride;
+	rec_archive_block_info info;
+	info.offset = rec_archive_get(e, 0, 8);
+	info.bytes = (ma_uint32)rec_archive_get(e, 8, 4);
+	info.frames = (ma_uint32)rec_archive_get(e, 12, 4);
+	info.first_frame = block * r->block_frames;
+	return info;
+}
+
+static inline void rec_archive_summary(const rec_archive_reader* r, ma_uint64 block, ma_uint32 channel, float* peak, float* rms) {
+	/*
+	 * Straight from the index; zeros when
+	 * the archive has no summaries.
+	 */
+	*peak = *rms = 0;
+	if (!r->summaries) return;
+	const ma_uint8* e = r->index + (size_t)block * r->stride + 16 + channel * 8;
+	memcpy(peak, e, 4);
+	memcpy(rms, e + 4, 4);
+}
+
+/*
+ * One block as a FLAC stream for ma_decoder: a
+ * STREAMINFO of its own, then its frames, read in place.
+ */
+typedef struct rec_archive_view {
+	ma_uint8 head[4 + 4 + 34];
+	const ma_uint8* data;
+	size_t size;
+	size_t pos;
+} rec_archive_view;
+
+static inline ma_result rec_archive_view_read(ma_decoder* decoder, void* out, size_t bytes, size_t* read) {
+	rec_archive_view* v = (rec_archive_view*)decoder->pUserData;
+	const size_t total = sizeof(v->head) + v->size;
+	size_t n = 0;
+	while (n < bytes && v->pos < total) {
+		size_t k;
+		if (v->pos < sizeof(v->head)) {
+			k = sizeof(v->head) - v->pos;
+			if (k > bytes - n) k = bytes - n;
+			memcpy((ma_uint8*)out + n, v->head + v->pos, k);
+		} else {
+			k = total - v->pos;
+			if (k > bytes - n) k = bytes - n;
+			memcpy((ma_uint8*)out + n, v->data + (v->pos - sizeof(v->head)), k);
+		}
+		n += k;
+		v->pos += k;
+	}
+	*read = n;
+	return n == 0 && bytes > 0 ? MA_AT_END : MA_SUCCESS;
+}
+
+static inline ma_result rec_archive_view_seek(ma_decoder* decoder, ma_int64 offset, ma_seek_origin origin) {
+	rec_archive_view* v = (rec_archive_view*)decoder->pUserData;
+	const ma_int64 total = (ma_int64)(sizeof(v->head) + v->size);
+	ma_int64 pos = origin == ma_seek_origin_start ? offset : origin == ma_seek_origin_current ? (ma_int64)v->pos + offset : total + offset;
+	if (pos < 0 || pos > total) return MA_BAD_SEEK;
+	v->pos = (size_t)pos;
+	return MA_SUCCESS;
+}
+
+static inline ma_result rec_archive_decode(rec_archive_reader* r, ma_uint64 block) {
+	/*
+	 * Decodes a block into the cache, unless
+	 * it is there already.
+	 */
+	if (block == r->cached_block) return MA_SUCCESS;
+	if (block >= r->block_count) return MA_INVALID_ARGS;
+	const rec_archive_block_info info = rec_archive_block(r, block);
+	if (info.offset + info.bytes > r->size) return MA_INVALID_FILE;
+	rec_archive_view v;
+	memcpy(v.head, "fLaC", 4);
+	// The only metadata block, the last
+	v.head[4] = 0x80;
+	v.head[5] = 0;
+	v.head[6] = 0;
+	v.head[7] = 34;
+	memcpy(v.head + 8, r->base + 40, 34);
+	// Its length is the block's; there is no MD5 for it
+	v.head[8 + 13] = (ma_uint8)(v.head[8 + 13] & 0xF0);
+	for (int i = 0; i < 4; i++) v.head[8 + 14 + i] = (ma_uint8)(info.frames >> (8 * (3 - i)));
+	memset(v.head + 8 + 18, 0, 16);
+	v.data = r->base + info.offset;
+	v.size = info.bytes;
+	v.pos = 0;
+	// miniaudio's FLAC decoder gives s24 as f32, so s32 it is, narrowed exactly here
+	ma_decoder_config config = ma_decoder_config_init(ma_format_s32, r->channels, r->sample_rate);
+	config.encodingFormat = ma_encoding_format_flac;
+	ma_decoder decoder;
+	ma_result result = ma_decoder_init(rec_archive_view_read, rec_archive_view_seek, &v, &config, &decoder);
+	if (result != MA_SUCCESS) return result;
+	ma_uint64 got = 0;
+	result = ma_decoder_read_pcm_frames(&decoder, r->wide, info.frames, &got);
+	ma_decoder_uninit(&decoder);
+	ma_pcm_convert(r->cache, r->format, r->wide, ma_format_s32, got * r->channels, ma_dither_mode_none);
+	if (got != info.frames) {
+		r->cached_block = ~(ma_uint64)0;
+		return result != MA_SUCCESS ? result : MA_INVALID_FILE;
+	}
+	r->cached_block = block;
+	r->cached_frames = info.frames;
+	return MA_SUCCESS;
+}
+
+static inline ma_result rec_archive_read(rec_archive_reader* r, ma_uint64 frame, void* out, ma_uint64 count, ma_uint64* read) {
+	/*
+	 * count frames from any position; only
+	 * the blocks they fall in are decoded.
+	 */
+	const size_t bpf = ma_get_bytes_per_frame(r->format, r->channels);
+	ma_uint64 done = 0;
+	ma_result result = MA_SUCCESS;
+	while (done < count && frame < r->frames) {
+		result = rec_archive_decode(r, frame / r->block_frames);
+		if (result != MA_SUCCESS) break;
+		ma_uint32 skip = (ma_uint32)(frame % r->block_frames);
+		ma_uint64 n = r->cached_frames - skip;
+		if (n > count - done) n = count - done;
+		memcpy((ma_uint8*)out + done * bpf, r->cache + (size_t)skip * bpf, (size_t)n * bpf);
+		done += n;
+		frame += n;
+	}
+	if (read != NULL) *read = done;
+	return result;
+}
+
+static inline ma_result rec_archive_to_wav(const char* path, const char* wav_path) {
+	/*
+	 * Decodes block by block into a WAV in
+	 * the archive's format.
+	 */
+	rec_archive_reader r;
+	ma_result result = rec_archive_open(&r, path);
+	if (result != MA_SUCCESS) return result;
+	ma_encoder_config config = ma_encoder_config_init(ma_encoding_format_wav, r.format, r.channels, r.sample_rate);
+	ma_encoder encoder;
+	result = ma_encoder_init_file(wav_path, &config, &encoder);
+	if (result == MA_SUCCESS) {
+		for (ma_uint64 b = 0; b < r.block_count && result == MA_SUCCESS; b++) {
+			result = rec_archive_decode(&r, b);
+			if (result == MA_SUCCESS) result = ma_encoder_write_pcm_frames(&encoder, r.cache, r.cached_frames, NULL);
+		}
+		ma_encoder_uninit(&encoder);
+	}
+	rec_archive_close(&r);
+	return result;
+}
+
+#endif
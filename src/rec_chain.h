@@ -0,0 +1,636 @@
+/*
+ * Insert chain: processing applied to each input before
+ * it is written.
+ *
+ * A chain is a fixed list of stages, all allocated when
+ * the session starts: miniaudio's biquad filters (high
+ * and low pass, peaking EQ, low shelf), a gain that moves
+ * smoothly to a new setting, a noise gate, an automatic
+ * gain control and a look-ahead limiter. The writer
+ * thread runs it over every batch it takes from the ring,
+ * in place, stage after stage, so each stage's loop stays
+ * hot over a whole batch. The gain stages work out a gain
+ * per frame first, then apply it in a loop of 8 lanes for
+ * the compiler to vectorize.
+ *
+ * The AGC follows the mean square of each batch, summed
+ * over 8 lanes, and steers its gain slowly towards a
+ * target level; below a threshold it holds still, so it
+ * doesn't bring up the room between phrases. The limiter
+ * is a brickwall: it delays the audio through a line of
+ * its own, works out the gain each frame needs to stay
+ * under the ceiling, takes the smallest over the
+ * look-ahead with van Herk's running minimum and eases
+ * into it with an average over the same span, so the gain
+ * is down by the time a peak leaves the line. The delay
+ * is the chain's latency; the last look-ahead of a take
+ * stays in the line.
+ *
+ * Other formats than f32 are converted to f32 around the
+ * chain. Every stage times itself, and the session
+ * report shows each one's share of a core, its average
+ * and slowest batch, and the latency it adds.
+ */
+#ifndef REC_CHAIN_H
+#define REC_CHAIN_H
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+
+#define REC_CHAIN_MAX 8
+// Time constant of a gain change, ms
+#define REC_GAIN_SMOOTH_MS 20.0
+// A gate closes this far below where it opens
+#define REC_GATE_HYSTERESIS_DB 4.0
+// Time constant of the level the AGC follows, ms
+#define REC_AGC_WINDOW_MS 400.0
+
+typedef enum rec_insert_kind {
+	REC_INSERT_HPF,		// frequency, order
+	REC_INSERT_LPF,		// frequency, order
+	REC_INSERT_PEAK,	// frequency, gain_db, q
+	REC_INSERT_LOSHELF,	// frequency, gain_db, q as the shelf slope
+	REC_INSERT_GAIN,	// gain_db; rec_chain_set_gain() moves it
+	REC_INSERT_GATE,	// threshold_db, range_db, attack_ms, hold_ms, release_ms
+	// gain_db as the target level (dBFS RMS), range_db as the most it boosts or cuts,
+	// threshold_db as the level it holds below, attack_ms down, release_ms up
+	REC_INSERT_AGC,
+	// threshold_db as the ceiling (dBFS), attack_ms as the look-ahead, release_ms
+	REC_INSERT_LIMITER
+} rec_insert_kind;
+
+/*
+ * A stage as configured; each kind reads only the fields
+ * listed against it.
+ */
+typedef struct rec_insert {
+	rec_insert_kind kind;
+	double frequency;
+	ma_uint32 order;
+	double gain_db;
+	double q;
+	double threshold_db;	// the gate opens above it
+	double range_db;	// a closed gate's gain, below 0
+	double attack_ms;
+	double hold_ms;
+	double release_ms;
+} rec_insert;
+
+typedef struct rec_stage {
+	rec_insert insert;
+	union {
+		ma_hpf hpf;
+		ma_lpf lpf;
+		ma_peak2 peak;
+		ma_loshelf2 shelf;
+	};
+	int filter_ok;
+	std::atomic<float> target;	// the gain's setting, linear
+	float gain;		// gain or gate: as of the last frame
+	// Gate, linear and per frame
+	float open_level;
+	float close_level;
+	float floor;
+	float attack;
+	float release;
+	ma_uint32 hold;
+	ma_uint32 held;		// frames left before it may close
+	// AGC: the mean square it follows
+	float level;
+	/*
+	 * Limiter: the look-ahead's worth of the
+	 * last batch followed by this one, of the
+	 * audio, the gain each frame needs and
+	 * the released gain; then room for the
+	 * running minimum.
+	 */
+	ma_uint32 lookahead;	// frames, its latency
+	float ceiling;
+	float* line;
+	float* need;
+	float* released;
+	float* prefix;
+	float* suffix;
+	// Writer only; read after the writer has stopped
+	ma_uint64 ns;
+	ma_uint64 peak_ns;	// the slowest batch
+	ma_uint64 frames;
+	ma_uint64 batches;
+} rec_stage;
+
+typedef struct rec_chain {
+	rec_stage stages[REC_CHAIN_MAX];
+	ma_uint32 count;
+	ma_format format;
+	ma_uint32 channels;
+	ma_uint32 sample_rate;
+	ma_uint32 max_frames;
+	float* scratch;		// a batch as f32, for other formats
+	float* gains;		// per frame
+} rec_chain;
+
+static inline rec_insert rec_insert_init(rec_insert_kind kind) {
+	/*
+	 * Defaults for every field: a
+	 * Butterworth second order, a gentle
+	 * gate, an AGC aiming at -20 dBFS, a
+	 * limiter at -1 dBFS looking 5 ms ahead.
+	 */
+	rec_insert insert;
+	memset(&insert, 0, sizeof(insert));
+	insert.kind = kind;
+	insert.frequency = kind == REC_INSERT_LPF ? 16000.0 : kind == REC_INSERT_HPF ? 80.0 : 1000.0;
+	insert.order = 2;
+	insert.q = 0.707;
+	insert.threshold_db = -50.0;
+	insert.range_db = -40.0;
+	insert.attack_ms = 1.0;
+	insert.hold_ms = 100.0;
+	insert.release_ms = 150.0;
+	if (kind == REC_INSERT_AGC) {
+		insert.gain_db = -20.0;
+		insert.range_db = 20.0;
+		insert.attack_ms = 300.0;
+		insert.release_ms = 3000.0;
+	} else if (kind == REC_INSERT_LIMITER) {
+		insert.threshold_db = -1.0;
+		insert.attack_ms = 5.0;
+		insert.release_ms = 100.0;
+	}
+	return insert;
+}
+
+static inline const char* rec_insert_name(rec_insert_kind kind) {
+	switch (kind) {
+	case REC_INSERT_HPF: return "high-pass";
+	case REC_INSERT_LPF: return "low-pass";
+	case REC_INSERT_PEAK: return "peak EQ";
+	case REC_INSERT_LOSHELF: return "low shelf";
+	case REC_INSERT_GAIN: return "gain";
+	case REC_INSERT_GATE: return "gate";
+	case REC_INSERT_AGC: return "AGC";
+	case REC_INSERT_LIMITER: return "limiter";
+	}
+	return "?";
+}
+
+static inline float rec_db_to_gain(double db) {
+	return (float)pow(10.0, db / 20.0);
+}
+
+static inline float rec_smoothing(double ms, ma_uint32 sample_rate) {
+	/*
+	 * Per-frame coefficient of a one-pole
+	 * smoother with time constant ms.
+	 */
+	if (ms <= 0) return 1.0f;
+	return (float)(1.0 - exp(-1000.0 / (ms * sample_rate)));
+}
+
+static inline void rec_chain_uninit(rec_chain* c) {
+	/*
+	 * Frees the filters and buffers; the
+	 * stages' timings stay readable.
+	 */
+	for (ma_uint32 i = 0; i < c->count; i++) {
+		rec_stage* st = &c->stages[i];
+		ma_free(st->line, NULL);
+		ma_free(st->need, NULL);
+		ma_free(st->released, NULL);
+		ma_free(st->prefix, NULL);
+		ma_free(st->suffix, NULL);
+		st->line = st->need = st->released = st->prefix = st->suffix = NULL;
+		if (!st->filter_ok) continue;
+		switch (st->insert.kind) {
+		case REC_INSERT_HPF: ma_hpf_uninit(&st->hpf, NULL); break;
+		case REC_INSERT_LPF: ma_lpf_uninit(&st->lpf, NULL); break;
+		case REC_INSERT_PEAK: ma_peak2_uninit(&st->peak, NULL); break;
+		case REC_INSERT_LOSHELF: ma_loshelf2_uninit(&st->shelf, NULL); break;
+		default: break;
+		}
+		st->filter_ok = 0;
+	}
+	ma_free(c->scratch, NULL);
+	ma_free(c->gains, NULL);
+	c->scratch = NULL;
+	c->gains = NULL;
+}
+
+static inline ma_result rec_chain_init(rec_chain* c, const rec_insert* inserts, ma_uint32 count, ma_format format, ma_uint32 channels, ma_uint32 sample_rate, ma_uint32 max_frames) {
+	/*
+	 * max_frames is the most one call to
+	 * rec_chain_process() takes. With no
+	 * inserts the chain does nothing.
+	 */
+	ma_result result = MA_SUCCESS;
+	c->count = 0;
+	c->format = format;
+	c->channels = channels;
+	c->sample_rate = sample_rate;
+	c->max_frames = max_frames;
+	c->scratch = NULL;
+	c->gains = NULL;
+	if (count > REC_CHAIN_MAX) return MA_INVALID_ARGS;
+	if (count == 0) return MA_SUCCESS;
+	c->gains = (float*)ma_malloc((size_t)max_frames * sizeof(float), NULL);
+	if (format != ma_format_f32) c->scratch = (float*)ma_malloc((size_t)max_frames * channels * sizeof(float), NULL);
+	if (c->gains == NULL || (format != ma_format_f32 && c->scratch == NULL)) {
+		rec_chain_uninit(c);
+		return MA_OUT_OF_MEMORY;
+	}
+	for (ma_uint32 i = 0; i < count; i++) {
+		rec_stage* st = &c->stages[i];
+		const rec_insert* in = &inserts[i];
+		st->insert = *in;
+		st->filter_ok = 0;
+		st->gain = 1.0f;
+		st->target.store(1.0f);
+		st->ns = st->peak_ns = st->frames = st->batches = 0;
+		st->line = st->need = st->released = st->prefix = st->suffix = NULL;
+		st->lookahead = 0;
+		c->count = i + 1;
+		switch (in->kind) {
+		case REC_INSERT_HPF: {
+			ma_hpf_config config = ma_hpf_config_init(ma_format_f32, channels, sample_rate, in->frequency, in->order);
+			result = ma_hpf_init(&config, NULL, &st->hpf);
+			break;
+		}
+		case REC_INSERT_LPF: {
+			ma_lpf_config config = ma_lpf_config_init(ma_format_f32, channels, sample_rate, in->frequency, in->order);
+			result = ma_lpf_init(&config, NULL, &st->lpf);
+			break;
+		}
+		case REC_INSERT_PEAK: {
+			ma_peak2_config config = ma_peak2_config_init(ma_format_f32, channels, sample_rate, in->gain_db, in->q, in->frequency);
+			result = ma_peak2_init(&config, NULL, &st->peak);
+			break;
+		}
+		case REC_INSERT_LOSHELF: {
+			ma_loshelf2_config config = ma_loshelf2_config_init(ma_format_f32, channels, sample_rate, in->gain_db, in->q, in->frequency);
+			result = ma_loshelf2_init(&config, NULL, &st->shelf);
+			break;
+		}
+		case REC_INSERT_GAIN:
+			st->gain = rec_db_to_gain(in->gain_db);
+			st->target.store(st->gain);
+			st->attack = rec_smoothing(REC_GAIN_SMOOTH_MS, sample_rate);
+			break;
+		case REC_INSERT_GATE:
+			// Shut until the signal first crosses the threshold
+			st->open_level = rec_db_to_gain(in->threshold_db);
+			st->close_level = rec_db_to_gain(in->threshold_db - REC_GATE_HYSTERESIS_DB);
+			st->floor = in->range_db < 0 ? rec_db_to_gain(in->range_db) : 1.0f;
+			st->attack = rec_smoothing(in->attack_ms, sample_rate);
+			st->release = rec_smoothing(in->release_ms, sample_rate);
+			st->hold = (ma_uint32)(in->hold_ms * sample_rate / 1000.0);
+			st->held = 0;
+			st->gain = st->floor;
+			break;
+		case REC_INSERT_AGC:
+			// Unity, until the first batch gives it a level
+			st->level = -1.0f;
+			st->attack = rec_smoothing(in->attack_ms, sample_rate);
+			st->release = rec_smoothing(in->release_ms, sample_rate);
+			break;
+		case REC_INSERT_LIMITER: {
+			st->lookahead = (ma_uint32)(in->attack_ms * sample_rate / 1000.0);
+			if (st->lookahead == 0) st->lookahead = 1;
+			st->ceiling = rec_db_to_gain(in->threshold_db);
+			st->release = rec_smoothing(in->release_ms, sample_rate);
+			const size_t span = (size_t)st->lookahead + max_frames;
+			st->line = (float*)ma_malloc(span * channels * sizeof(float), NULL);
+			st->need = (float*)ma_malloc(span * sizeof(float), NULL);
+			st->released = (float*)ma_malloc(span * sizeof(float), NULL);
+			st->prefix = (float*)ma_malloc(span * sizeof(float), NULL);
+			st->suffix = (float*)ma_malloc(span * sizeof(float), NULL);
+			if (st->line == NULL || st->need == NULL || st->released == NULL || st->prefix == NULL || st->suffix == NULL) {
+				result = MA_OUT_OF_MEMORY;
+				break;
+			}
+			// The line starts silent, needing no reduction
+			memset(st->line, 0, (size_t)st->lookahead * channels * sizeof(float));
+			for (ma_uint32 k = 0; k < st->lookahead; k++) st->need[k] = st->released[k] = 1.0f;
+			break;
+		}
+		default:
+			result = MA_INVALID_ARGS;
+			break;
+		}
+		if (result != MA_SUCCESS) {
+			// filter_ok is still 0; only this stage's buffers go
+			rec_chain_uninit(c);
+			return result;
+		}
+		st->filter_ok = in->kind <= REC_INSERT_LOSHELF;
+	}
+	return MA_SUCCESS;
+}
+
+static inline void rec_chain_apply(float* x, const float* gains, ma_uint32 frames, ma_uint32 channels) {
+	/*
+	 * A gain per frame. Mono and stereo get
+	 * loops of their own the compiler can
+	 * vectorize over 8 lanes.
+	 */
+	if (channels == 1) {
+		ma_uint32 f = 0;
+		for (; f + 8 <= frames; f += 8) {
+			for (ma_uint32 j = 0; j < 8; j++) x[f + j] *= gains[f + j];
+		}
+		for (; f < frames; f++) x[f] *= gains[f];
+	} else if (channels == 2) {
+		ma_uint32 f = 0;
+		for (; f + 8 <= frames; f += 8) {
+			for (ma_uint32 j = 0; j < 8; j++) {
+				x[2 * (f + j)] *= gains[f + j];
+				x[2 * (f + j) + 1] *= gains[f + j];
+			}
+		}
+		for (; f < frames; f++) {
+			x[2 * f] *= gains[f];
+			x[2 * f + 1] *= gains[f];
+		}
+	} else {
+		for (ma_uint32 f = 0; f < frames; f++) {
+			for (ma_uint32 c = 0; c < channels; c++) x[(size_t)f * channels + c] *= gains[f];
+		}
+	}
+}
+
+static inline void rec_chain_scale(float* x, float gain, ma_uint32 samples) {
+	ma_uint32 i = 0;
+	for (; i + 8 <= samples; i += 8) {
+		for (ma_uint32 j = 0; j < 8; j++) x[i + j] *= gain;
+	}
+	for (; i < samples; i++) x[i] *= gain;
+}
+
+static inline void rec_chain_gain(rec_chain* c, rec_stage* st, float* x, ma_uint32 frames) {
+	/*
+	 * A steady gain is one multiply per
+	 * sample; a change ramps, a frame at a
+	 * time, until it is within a step of the
+	 * setting.
+	 */
+	const float target = st->target.load(std::memory_order_relaxed);
+	if (st->gain == target) {
+		if (target != 1.0f) rec_chain_scale(x, target, frames * c->channels);
+		return;
+	}
+	float g = st->gain;
+	for (ma_uint32 f = 0; f < frames; f++) {
+		g += (target - g) * st->attack;
+		c->gains[f] = g;
+	}
+	if (fabsf(g - target) < 1e-5f * target) g = target;
+	st->gain = g;
+	rec_chain_apply(x, c->gains, frames, c->channels);
+}
+
+static inline void rec_chain_gate(rec_chain* c, rec_stage* st, float* x, ma_uint32 frames) {
+	/*
+	 * The loudest channel of each frame
+	 * first, then the gate's gain frame by
+	 * frame: open at once above the threshold,
+	 * held open, then closing once below it
+	 * by the hysteresis.
+	 */
+	const ma_uint32 ch = c->channels;
+	float* level = c->gains;
+	for (ma_uint32 f = 0; f < frames; f++) {
+		float m = 0;
+		for (ma_uint32 k = 0; k < ch; k++) {
+			float v = fabsf(x[(size_t)f * ch + k]);
+			m = v > m ? v : m;
+		}
+		level[f] = m;
+	}
+	float g = st->gain;
+	ma_uint32 held = st->held;
+	for (ma_uint32 f = 0; f < frames; f++) {
+		if (level[f] >= st->open_level || (held > 0 && level[f] >= st->close_level)) held = st->hold + 1;
+		float target;
+		if (held > 0) {
+			held--;
+			target = 1.0f;
+		} else target = st->floor;
+		g += (target - g) * (target > g ? st->attack : st->release);
+		level[f] = g;
+	}
+	st->gain = g;
+	st->held = held;
+	rec_chain_apply(x, c->gains, frames, ch);
+}
+
+static inline void rec_chain_agc(rec_chain* c, rec_stage* st, float* x, ma_uint32 frames) {
+	/*
+	 * The batch's mean square, over 8 lanes,
+	 * moves the level; above the threshold
+	 * the gain it wants brings that level to
+	 * the target, within the range, and it
+	 * ramps there frame by frame: down at the
+	 * attack's pace, up at the release's.
+	 */
+	const rec_insert* in = &st->insert;
+	const ma_uint32 samples = frames * c->channels;
+	float lanes[8] = {0};
+	ma_uint32 i = 0;
+	for (; i + 8 <= samples; i += 8) {
+		for (ma_uint32 j = 0; j < 8; j++) lanes[j] += x[i + j] * x[i + j];
+	}
+	float square = 0;
+	for (ma_uint32 j = 0; j < 8; j++) square += lanes[j];
+	for (; i < samples; i++) square += x[i] * x[i];
+	square /= samples;
+	if (st->level < 0) st->level = square;
+	else st->level += (square - st->level) * (float)(1.0 - exp(-1000.0 * frames / (REC_AGC_WINDOW_MS * c->sample_rate)));
+	if (st->level > 0) {
+		const double level_db = 10.0 * log10(st->level);
+		if (level_db >= in->threshold_db) {
+			double db = in->gain_db - level_db;
+			if (db > in->range_db) db = in->range_db;
+			if (db < -in->range_db) db = -in->range_db;
+			st->target.store(rec_db_to_gain(db), std::memory_order_relaxed);
+		}
+	}
+	const float target = st->target.load(std::memory_order_relaxed);
+	if (st->gain == target) {
+		if (target != 1.0f) rec_chain_scale(x, target, samples);
+		return;
+	}
+	const float pace = target < st->gain ? st->attack : st->release;
+	float g = st->gain;
+	for (ma_uint32 f = 0; f < frames; f++) {
+		g += (target - g) * pace;
+		c->gains[f] = g;
+	}
+	if (fabsf(g - target) < 1e-5f * target) g = target;
+	st->gain = g;
+	rec_chain_apply(x, c->gains, frames, c->channels);
+}
+
+static inline void rec_chain_limiter(rec_chain* c, rec_stage* st, float* x, ma_uint32 frames) {
+	/*
+	 * The batch goes in behind the look-ahead
+	 * and as much comes out in front, so a
+	 * frame is the look-ahead late. Each
+	 * buffer holds the look-ahead before the
+	 * batch, and is moved down after.
+	 */
+	const ma_uint32 ch = c->channels;
+	const ma_uint32 ahead = st->lookahead;
+	const ma_uint32 span = ahead + frames;
+	float* need = st->need;
+	float* peak = need + ahead;
+	memcpy(st->line + (size_t)ahead * ch, x, (size_t)frames * ch * sizeof(float));
+	/*
+	 * The loudest channel of each frame, then
+	 * the gain that brings it to the ceiling.
+	 */
+	if (ch == 1) {
+		for (ma_uint32 f = 0; f < frames; f++) peak[f] = fabsf(x[f]);
+	} else if (ch == 2) {
+		ma_uint32 f = 0;
+		for (; f + 8 <= frames; f += 8) {
+			for (ma_uint32 j = 0; j < 8; j++) {
+				float a = fabsf(x[2 * (f + j)]);
+				float b = fabsf(x[2 * (f + j) + 1]);
+				peak[f + j] = a > b ? a : b;
+			}
+		}
+		for (; f < frames; f++) {
+			float a = fabsf(x[2 * f]);
+			float b = fabsf(x[2 * f + 1]);
+			peak[f] = a > b ? a : b;
+		}
+	} else {
+		for (ma_uint32 f = 0; f < frames; f++) {
+			float m = 0;
+			for (ma_uint32 k = 0; k < ch; k++) {
+				float v = fabsf(x[(size_t)f * ch + k]);
+				m = v > m ? v : m;
+			}
+			peak[f] = m;
+		}
+	}
+	const float ceiling = st->ceiling;
+	ma_uint32 f = 0;
+	for (; f + 8 <= frames; f += 8) {
+		for (ma_uint32 j = 0; j < 8; j++) peak[f + j] = peak[f + j] > ceiling ? ceiling / peak[f + j] : 1.0f;
+	}
+	for (; f < frames; f++) peak[f] = peak[f] > ceiling ? ceiling / peak[f] : 1.0f;
+	/*
+	 * van Herk's running minimum over the
+	 * look-ahead and the frame: minima from
+	 * the start and from the end of each run
+	 * of that length, so any window is the
+	 * smaller of two lookups.
+	 */
+	const ma_uint32 width = ahead + 1;
+	for (ma_uint32 s = 0; s < span; s += width) {
+		const ma_uint32 e = s + width < span ? s + width : span;
+		st->prefix[s] = need[s];
+		for (ma_uint32 k = s + 1; k < e; k++) st->prefix[k] = need[k] < st->prefix[k - 1] ? need[k] : st->prefix[k - 1];
+		st->suffix[e - 1] = need[e - 1];
+		for (ma_uint32 k = e - 1; k-- > s;) st->suffix[k] = need[k] < st->suffix[k + 1] ? need[k] : st->suffix[k + 1];
+	}
+	/*
+	 * Down at once, back up at the release's
+	 * pace, then averaged over the look-ahead:
+	 * each released gain is at most what the
+	 * frame leaving the line needs, so the
+	 * average is too.
+	 */
+	float* released = st->released;
+	double sum = 0;
+	for (ma_uint32 k = 0; k < ahead; k++) sum += released[k];
+	float g = st->gain;
+	for (f = 0; f < frames; f++) {
+		const float m = st->suffix[f] < st->prefix[f + ahead] ? st->suffix[f] : st->prefix[f + ahead];
+		g = m < g ? m : g + (m - g) * st->release;
+		released[ahead + f] = g;
+		sum += g - released[f];
+		const float average = (float)(sum / ahead);
+		c->gains[f] = average < need[f] ? average : need[f];
+	}
+	st->gain = g;
+	rec_chain_apply(st->line, c->gains, frames, ch);
+	memcpy(x, st->line, (size_t)frames * ch * sizeof(float));
+	memmove(st->line, st->line + (size_t)frames * ch, (size_t)ahead * ch * sizeof(float));
+	memmove(need, need + frames, (size_t)ahead * sizeof(float));
+	memmove(released, released + frames, (size_t)ahead * sizeof(float));
+}
+
+static inline void rec_chain_process(rec_chain* c, void* data, ma_uint32 frames) {
+	/*
+	 * Writer thread: frames in the chain's
+	 * format, in place.
+	 */
+	if (c->count == 0 || frames == 0) return;
+	float* x = (float*)data;
+	if (c->format != ma_format_f32) {
+		ma_pcm_convert(c->scratch, ma_format_f32, data, c->format, (ma_uint64)frames * c->channels, ma_dither_mode_none);
+		x = c->scratch;
+	}
+	for (ma_uint32 i = 0; i < c->count; i++) {
+		rec_stage* st = &c->stages[i];
+		auto t0 = std::chrono::steady_clock::now();
+		switch (st->insert.kind) {
+		case REC_INSERT_HPF: ma_hpf_process_pcm_frames(&st->hpf, x, x, frames); break;
+		case REC_INSERT_LPF: ma_lpf_process_pcm_frames(&st->lpf, x, x, frames); break;
+		case REC_INSERT_PEAK: ma_peak2_process_pcm_frames(&st->peak, x, x, frames); break;
+		case REC_INSERT_LOSHELF: ma_loshelf2_process_pcm_frames(&st->shelf, x, x, frames); break;
+		case REC_INSERT_GAIN: rec_chain_gain(c, st, x, frames); break;
+		case REC_INSERT_GATE: rec_chain_gate(c, st, x, frames); break;
+		case REC_INSERT_AGC: rec_chain_agc(c, st, x, frames); break;
+		case REC_INSERT_LIMITER: rec_chain_limiter(c, st, x, frames); break;
+		}
+		ma_uint64 ns = (ma_uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+		st->ns += ns;
+		if (ns > st->peak_ns) st->peak_ns = ns;
+		st->frames += frames;
+		st->batches++;
+	}
+	if (c->format != ma_format_f32) ma_pcm_convert(data, c->format, x, ma_format_f32, (ma_uint64)frames * c->channels, ma_dither_mode_triangle);
+}
+
+static inline void rec_chain_set_gain(rec_chain* c, double db) {
+	/*
+	 * Any thread: every gain stage moves to
+	 * db over about REC_GAIN_SMOOTH_MS.
+	 */
+	for (ma_uint32 i = 0; i < c->count; i++) {
+		if (c->stages[i].insert.kind == REC_INSERT_GAIN) c->stages[i].target.store(rec_db_to_gain(db), std::memory_order_relaxed);
+	}
+}
+
+static inline ma_uint32 rec_chain_latency(const rec_chain* c) {
+	/*
+	 * Frames the chain holds back: the
+	 * limiters' look-ahead.
+	 */
+	ma_uint32 frames = 0;
+	for (ma_uint32 i = 0; i < c->count; i++) frames += c->stages[i].lookahead;
+	return frames;
+}
+
+static inline void rec_chain_report(const rec_chain* c, const char* prefix) {
+	/*
+	 * Each stage's CPU time against the audio
+	 * it processed, per batch on average and
+	 * at the slowest, and any delay it adds.
+	 */
+	for (ma_uint32 i = 0; i < c->count; i++) {
+		const rec_stage* st = &c->stages[i];
+		if (st->frames == 0) continue;
+		double audio = st->frames / (double)c->sample_rate;
+		printf("%s%s: %.3f%% of a core, %.1f us a batch, slowest %.1f us", prefix, rec_insert_name(st->insert.kind), 100.0 * st->ns / 1e9 / audio, st->ns / 1e3 / st->batches, st->peak_ns / 1e3);
+		if (st->lookahead > 0) printf(", adds %.1f ms", 1000.0 * st->lookahead / c->sample_rate);
+		printf("\n");
+	}
+}
+
+#endif
@@ -0,0 +1,382 @@
+/*
+ * Signal processing used on the recorder's writer threads.
+ *
+ * Nothing in here runs in the audio callback; all buffers
+ * are allocated when a session starts.
+ *
+ * Included once from main_win.cxx, after miniaudio.h.
+ */
+#ifndef REC_DSP_H
+#define REC_DSP_H
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Asynchronous sample-rate converter.
+ *
+ * Resamples a secondary device onto the master device's
+ * clock by a ratio close to 1. The ratio is steered by a
+ * PI loop on the secondary's backlog relative to the
+ * master's, so the tracks stay sample-aligned over hours.
+ * Interpolation is 4-point cubic Hermite; the per-frame
+ * weights are computed in a separate pass the compiler
+ * can vectorize.
+ */
+#define REC_ASRC_MAX_PPM 5000.0
+// Loop natural frequency (rad/s) and fill-level smoothing (s)
+#define REC_ASRC_OMEGA 0.02
+#define REC_ASRC_SMOOTH 4.0
+
+typedef struct rec_asrc {
+	ma_uint32 channels;
+	ma_uint32 max_out;
+	float* buf;		// interleaved input, cap frames
+	ma_uint32 cap;
+	ma_uint32 frames;	// valid frames in buf
+	double pos;		// read position in buf, >= 1
+	double ratio;		// input frames per output frame
+	// Loop state, errors in seconds of backlog
+	int locked;
+	double target;
+	double err_lp;
+	double integ;
+	// Per-output-frame scratch
+	ma_uint32* idx;
+	float* w;		// 4 weights per frame
+} rec_asrc;
+
+static inline void rec_asrc_uninit(rec_asrc* a) {
+	ma_free(a->buf, NULL);
+	ma_free(a->idx, NULL);
+	ma_free(a->w, NULL);
+	memset(a, 0, sizeof(*a));
+}
+
+static inline ma_result rec_asrc_init(rec_asrc* a, ma_uint32 channels, ma_uint32 max_out) {
+	/*
+	 * max_out is the most frames asked
+	 * for in one rec_asrc_process() call.
+	 */
+	memset(a, 0, sizeof(*a));
+	a->channels = channels;
+	a->max_out = max_out;
+	a->cap = (ma_uint32)(max_out * (1.0 + REC_ASRC_MAX_PPM / 1e6)) + max_out + 8;
+	a->buf = (float*)ma_malloc((size_t)a->cap * channels * sizeof(float), NULL);
+	a->idx = (ma_uint32*)ma_malloc((size_t)max_out * sizeof(ma_uint32), NULL);
+	a->w = (float*)ma_malloc((size_t)max_out * 4 * sizeof(float), NULL);
+	if (a->buf == NULL || a->idx == NULL || a->w == NULL) {
+		rec_asrc_uninit(a);
+		return MA_OUT_OF_MEMORY;
+	}
+	// One frame of silent history so interpolation can start at pos 1
+	memset(a->buf, 0, (size_t)channels * sizeof(float));
+	a->frames = 1;
+	a->pos = 1.0;
+	a->ratio = 1.0;
+	return MA_SUCCESS;
+}
+
+static inline ma_uint32 rec_asrc_room(const rec_asrc* a) {
+	/*
+	 * Input frames that can be pushed now.
+	 */
+	return a->cap - a->frames;
+}
+
+static inline ma_uint32 rec_asrc_available(const rec_asrc* a, ma_uint32 extra_in) {
+	/*
+	 * Output frames producible if extra_in
+	 * more input frames were pushed first.
+	 * Output frame k reads input frames up
+	 * to floor(pos + k * ratio) + 2.
+	 */
+	double have = (double)a->frames + extra_in - 3.0 - a->pos;
+	if (have < 0) return 0;
+	double n = floor(have / a->ratio) + 1.0;
+	return n > a->max_out ? a->max_out : (ma_uint32)n;
+}
+
+static inline ma_uint32 rec_asrc_needed(const rec_asrc* a, ma_uint32 out_frames) {
+	/*
+	 * Input frames still to be pushed before
+	 * out_frames can be produced.
+	 */
+	if (out_frames == 0) return 0;
+	ma_uint32 last = (ma_uint32)floor(a->pos + (double)(out_frames - 1) * a->ratio) + 3;
+	return last > a->frames ? last - a->frames : 0;
+}
+
+static inline void rec_asrc_push(rec_asrc* a, const float* in, ma_uint32 frames) {
+	memcpy(a->buf + (size_t)a->frames * a->channels, in, (size_t)frames * a->channels * sizeof(float));
+	a->frames += frames;
+}
+
+static inline void rec_asrc_process(rec_asrc* a, float* out, ma_uint32 out_frames, ma_uint32 out_stride) {
+	/*
+	 * Writes out_frames frames, each of
+	 * a->channels samples, out_stride
+	 * samples apart, then drops consumed
+	 * input from the front of the buffer.
+	 */
+	const ma_uint32 ch = a->channels;
+	ma_uint32* idx = a->idx;
+	float* w = a->w;
+	for (ma_uint32 k = 0; k < out_frames; k++) {
+		double p = a->pos + (double)k * a->ratio;
+		idx[k] = (ma_uint32)p;
+		float t = (float)(p - (double)idx[k]);
+		w[k * 4 + 0] = t;
+	}
+	// Catmull-Rom weights for frames idx-1 .. idx+2
+	for (ma_uint32 k = 0; k < out_frames; k++) {
+		float t = w[k * 4 + 0];
+		float t2 = t * t;
+		float t3 = t2 * t;
+		w[k * 4 + 0] = 0.5f * (-t3 + 2.0f * t2 - t);
+		w[k * 4 + 1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+		w[k * 4 + 2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+		w[k * 4 + 3] = 0.5f * (t3 - t2);
+	}
+	for (ma_uint32 k = 0; k < out_frames; k++) {
+		const float* x = a->buf + (size_t)(idx[k] - 1) * ch;
+		const float* wk = w + k * 4;
+		float* y = out + (size_t)k * out_stride;
+		for (ma_uint32 c = 0; c < ch; c++) {
+			y[c] = wk[0] * x[c] + wk[1] * x[ch + c] + wk[2] * x[2 * ch + c] + wk[3] * x[3 * ch + c];
+		}
+	}
+	a->pos += (double)out_frames * a->ratio;
+	// Keep one frame of history before the read position
+	ma_uint32 drop = (ma_uint32)a->pos - 1;
+	if (drop > 0) {
+		memmove(a->buf, a->buf + (size_t)drop * ch, (size_t)(a->frames - drop) * ch * sizeof(float));
+		a->frames -= drop;
+		a->pos -= drop;
+	}
+}
+
+static inline void rec_asrc_steer(rec_asrc* a, double backlog, double seconds, double drift_ppm) {
+	/*
+	 * backlog: this device's queued audio minus
+	 * the master's, in seconds. seconds: audio
+	 * time since the last call. drift_ppm seeds
+	 * the integrator when the loop locks, so it
+	 * starts near the right ratio instead of
+	 * slewing there. Gains give a critically
+	 * damped loop at REC_ASRC_OMEGA.
+	 */
+	if (!a->locked) {
+		a->locked = 1;
+		a->target = backlog;
+		a->err_lp = 0;
+		a->integ = drift_ppm / 1e6;
+	}
+	double err = backlog - a->target;
+	a->err_lp += (err - a->err_lp) * (seconds / (REC_ASRC_SMOOTH + seconds));
+	a->integ += REC_ASRC_OMEGA * REC_ASRC_OMEGA * a->err_lp * seconds;
+	double r = a->integ + 2.0 * REC_ASRC_OMEGA * a->err_lp;
+	if (r > REC_ASRC_MAX_PPM / 1e6) r = REC_ASRC_MAX_PPM / 1e6;
+	if (r < -REC_ASRC_MAX_PPM / 1e6) r = -REC_ASRC_MAX_PPM / 1e6;
+	a->ratio = 1.0 + r;
+}
+
+
+/*
+ * Rational-ratio resampler for fixed rate changes, such
+ * as a 16 kHz proxy of a 48 kHz or 44.1 kHz recording.
+ *
+ * Polyphase FIR: a Kaiser-windowed sinc, cut off just
+ * below the lower rate's Nyquist frequency, split into
+ * one phase per output position. Each output sample is
+ * a single dot product of contiguous input against one
+ * phase, which the compiler vectorizes. Mono; run one
+ * per channel if more are needed.
+ */
+// Sinc zero crossings either side of the centre
+#define REC_RESAMPLE_ZEROS 48
+// Passband edge, as a fraction of the lower Nyquist frequency
+#define REC_RESAMPLE_ROLLOFF 0.95
+// About 90 dB of stopband rejection
+#define REC_RESAMPLE_BETA 9.0
+#define REC_RESAMPLE_MAX_PHASES 1024
+
+typedef struct rec_resampler {
+	ma_uint32 up;		// out rate / in rate = up / down, reduced
+	ma_uint32 down;
+	ma_uint32 taps;		// per phase, a multiple of 8
+	float* coef;		// up phases of taps, each reversed
+	ma_uint32 max_in;
+	float* hist;		// input, taps - 1 of history in front
+	ma_uint32 frames;	// valid samples in hist
+	ma_uint32 pos;		// hist index of the next window
+	ma_uint32 phase;	// < up
+	ma_uint64 in_total;
+	ma_uint64 out_total;
+} rec_resampler;
+
+static inline double rec_bessel_i0(double x) {
+	/*
+	 * Modified Bessel function of the first
+	 * kind, order 0, by its power series.
+	 */
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 64 && term > sum * 1e-12; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+static inline ma_uint32 rec_gcd(ma_uint32 a, ma_uint32 b) {
+	while (b != 0) {
+		ma_uint32 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static inline void rec_resampler_uninit(rec_resampler* r) {
+	ma_free(r->coef, NULL);
+	ma_free(r->hist, NULL);
+	memset(r, 0, sizeof(*r));
+}
+
+static inline ma_uint32 rec_resampler_max_out(const rec_resampler* r) {
+	/*
+	 * Most samples one rec_resampler_process()
+	 * call can return.
+	 */
+	return (ma_uint32)(((ma_uint64)r->max_in * r->up + r->down - 1) / r->down) + 1;
+}
+
+static inline void rec_resampler_reset(rec_resampler* r) {
+	/*
+	 * Silent history in front of the first
+	 * sample, and a start offset that cancels
+	 * the filter's delay, so output sample i
+	 * lines up with input time i * down / up.
+	 * Also starts a stream over after a gap.
+	 */
+	const ma_uint32 delay = (r->up * r->taps - 1) / 2;
+	memset(r->hist, 0, (size_t)(r->taps - 1) * sizeof(float));
+	r->frames = r->taps - 1;
+	r->pos = delay / r->up;
+	r->phase = delay % r->up;
+	r->in_total = r->out_total = 0;
+}
+
+static inline ma_result rec_resampler_init_filter(rec_resampler* r, ma_uint32 rate_in, ma_uint32 rate_out, ma_uint32 max_in, ma_uint32 zeros, double beta) {
+	/*
+	 * max_in is the most samples passed to
+	 * one rec_resampler_process() call. Rates
+	 * whose reduced ratio needs more than
+	 * REC_RESAMPLE_MAX_PHASES phases are
+	 * refused. zeros and beta trade the
+	 * filter's length for its rejection.
+	 */
+	memset(r, 0, sizeof(*r));
+	if (rate_in == 0 || rate_out == 0) return MA_INVALID_ARGS;
+	ma_uint32 g = rec_gcd(rate_in, rate_out);
+	r->up = rate_out / g;
+	r->down = rate_in / g;
+	if (r->up > REC_RESAMPLE_MAX_PHASES) return MA_INVALID_ARGS;
+	const ma_uint32 wide = r->up > r->down ? r->up : r->down;
+	/*
+	 * The prototype runs at rate_in * up: its
+	 * cutoff, in cycles per sample there, and
+	 * its length, so each phase gets taps.
+	 */
+	const double fc = 0.5 * REC_RESAMPLE_ROLLOFF / wide;
+	r->taps = (ma_uint32)ceil(2.0 * zeros * wide / (REC_RESAMPLE_ROLLOFF * r->up));
+	r->taps = (r->taps + 7) & ~7u;
+	r->max_in = max_in;
+	r->coef = (float*)ma_malloc((size_t)r->up * r->taps * sizeof(float), NULL);
+	r->hist = (float*)ma_malloc(((size_t)r->taps + max_in) * sizeof(float), NULL);
+	if (r->coef == NULL || r->hist == NULL) {
+		rec_resampler_uninit(r);
+		return MA_OUT_OF_MEMORY;
+	}
+	// Centred on a whole sample, so the delay cancels exactly
+	const ma_uint32 n = r->up * r->taps;
+	const ma_uint32 delay = (n - 1) / 2;
+	const double i0_beta = rec_bessel_i0(beta);
+	const double pi = 3.14159265358979323846;
+	for (ma_uint32 k = 0; k < n; k++) {
+		double x = (double)k - delay;
+		double sinc = x == 0 ? 1.0 : sin(2.0 * pi * fc * x) / (2.0 * pi * fc * x);
+		double w = x / (delay + 1.0);
+		double h = r->up * 2.0 * fc * sinc * rec_bessel_i0(beta * sqrt(1.0 - w * w)) / i0_beta;
+		// Tap q of phase p is k = p + q * up, stored last to first
+		ma_uint32 p = k % r->up, q = k / r->up;
+		r->coef[(size_t)p * r->taps + (r->taps - 1 - q)] = (float)h;
+	}
+	rec_resampler_reset(r);
+	return MA_SUCCESS;
+}
+
+static inline ma_result rec_resampler_init(rec_resampler* r, ma_uint32 rate_in, ma_uint32 rate_out, ma_uint32 max_in) {
+	return rec_resampler_init_filter(r, rate_in, rate_out, max_in, REC_RESAMPLE_ZEROS, REC_RESAMPLE_BETA);
+}
+
+static inline float rec_dot(const float* a, const float* b, ma_uint32 n) {
+	/*
+	 * n is a multiple of 8. Eight separate
+	 * sums fill one vector register without
+	 * the compiler having to reassociate.
+	 */
+	float acc[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	for (ma_uint32 i = 0; i < n; i += 8) {
+		for (ma_uint32 j = 0; j < 8; j++) acc[j] += a[i + j] * b[i + j];
+	}
+	return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+}
+
+static inline ma_uint32 rec_resampler_process(rec_resampler* r, const float* in, ma_uint32 count, float* out) {
+	/*
+	 * Takes count <= max_in samples (silence
+	 * if in is NULL) and writes every output
+	 * sample they complete. Returns how many.
+	 */
+	if (in != NULL) memcpy(r->hist + r->frames, in, (size_t)count * sizeof(float));
+	else memset(r->hist + r->frames, 0, (size_t)count * sizeof(float));
+	r->frames += count;
+	r->in_total += count;
+	ma_uint32 produced = 0;
+	while (r->pos + r->taps <= r->frames) {
+		out[produced++] = rec_dot(r->hist + r->pos, r->coef + (size_t)r->phase * r->taps, r->taps);
+		r->phase += r->down;
+		r->pos += r->phase / r->up;
+		r->phase %= r->up;
+	}
+	ma_uint32 drop = r->pos < r->frames ? r->pos : r->frames;
+	memmove(r->hist, r->hist + drop, (size_t)(r->frames - drop) * sizeof(float));
+	r->frames -= drop;
+	r->pos -= drop;
+	r->out_total += produced;
+	return produced;
+}
+
+static inline ma_uint32 rec_resampler_flush(rec_resampler* r, float* out) {
+	/*
+	 * At the end of the stream: the output
+	 * still owed for the input taken so far,
+	 * at most rec_resampler_max_out() samples
+	 * per call. Returns 0 once complete.
+	 */
+	ma_uint64 owed = (r->in_total * r->up + r->down - 1) / r->down;
+	if (r->out_total >= owed) return 0;
+	// The padding is not input: it mustn't raise what is owed
+	ma_uint64 in_total = r->in_total;
+	ma_uint32 produced = 0;
+	while (produced == 0) produced = rec_resampler_process(r, NULL, r->max_in, out);
+	r->in_total = in_total;
+	if (r->out_total > owed) {
+		produced -= (ma_uint32)(r->out_total - owed);
+		r->out_total = owed;
+	}
+	return produced;
+}
+
+#endif
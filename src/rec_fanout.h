@@ -0,0 +1,386 @@
+/*
+ * Fan-out of one capture to several consumers.
+ *
+ * A producer (a session's writer thread) fills fixed-size
+ * blocks taken from a preallocated pool and publishes each
+ * block to every sink by pointer. Sinks only read it; the
+ * last one to release a block returns it to the pool. So
+ * the producer's cost per block is one queue push per sink,
+ * whatever the block size, and no audio is copied per sink.
+ *
+ * Every sink has its own thread, its own queue and its own
+ * drop policy, so a slow consumer only ever loses its own
+ * blocks, except under REC_DROP_NONE, where the producer
+ * waits for it.
+ *
+ * Queues are single-producer, single-consumer rings of
+ * pointers. The pool's free list is a lock-free stack that
+ * only the producer pops, so it is safe from ABA.
+ *
+ * An idle sink sleeps on a condition variable of its own,
+ * and a producer short of room sleeps on the fan-out's.
+ * Each side announces that it is going to sleep with a
+ * flag, and the other side takes the lock and wakes it
+ * only when the flag is set, so publishing to an awake
+ * sink takes no lock, and a low-priority sink that holds
+ * its lock never stalls the producer for long.
+ */
+#ifndef REC_FANOUT_H
+#define REC_FANOUT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define REC_FANOUT_MAX_SINKS 8
+
+typedef enum rec_drop_policy {
+	REC_DROP_NONE,		// the producer waits for room: nothing is lost
+	REC_DROP_NEWEST,	// a full queue skips the new block
+	REC_DROP_OLDEST		// only the newest queued block is handled
+} rec_drop_policy;
+
+typedef struct rec_block {
+	std::atomic<ma_uint32> refs;
+	ma_uint32 source;	// the fan-out's source index
+	ma_uint32 frames;
+	ma_uint64 position;	// stream position of the first frame
+	struct rec_block* next;	// free list
+	ma_uint8* data;
+} rec_block;
+
+/*
+ * Called on the sink's thread for every block it takes.
+ * The block is read-only and valid until the call returns.
+ */
+typedef void (*rec_consume_proc)(void* user, const rec_block* block);
+
+typedef struct rec_fanout_sink {
+	const char* name;
+	rec_drop_policy policy;
+	rec_consume_proc consume;
+	void* user;
+	rec_block** queue;
+	ma_uint32 depth;
+	std::atomic<ma_uint64> head;	// next to take, sink thread
+	std::atomic<ma_uint64> tail;	// next to fill, producer
+	std::thread thread;
+	// The sink thread waits here for a block, with asleep set
+	std::mutex lock;
+	std::condition_variable wake;
+	std::atomic<int> asleep;
+	std::atomic<ma_uint64> delivered;
+	std::atomic<ma_uint64> dropped;	// never queued, queue full
+	std::atomic<ma_uint64> skipped;	// queued, passed over for a newer one
+	// Sink thread only; read after rec_fanout_stop()
+	ma_uint64 peak_queued;
+	double cpu_seconds;
+} rec_fanout_sink;
+
+typedef struct rec_fanout {
+	ma_uint32 source;
+	size_t bpf;
+	ma_uint32 block_frames;
+	rec_block* blocks;
+	ma_uint8* mem;
+	ma_uint32 block_count;
+	std::atomic<rec_block*> free_list;
+	rec_fanout_sink sinks[REC_FANOUT_MAX_SINKS];
+	ma_uint32 sink_count;
+	std::atomic<int> closing;
+	// The producer waits here for a block or a queue slot, with waiting set
+	std::mutex lock;
+	std::condition_variable room;
+	std::atomic<int> waiting;
+	ma_uint64 position;
+	// Times the producer had to wait for a sink or the pool
+	ma_uint64 waits;
+} rec_fanout;
+
+static inline double rec_thread_cpu_seconds() {
+	/*
+	 * CPU time of the calling thread only.
+	 */
+#if defined(_WIN32)
+	FILETIME created, exited, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) / 1e7;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static inline void rec_fanout_init(rec_fanout* f, ma_uint32 source, size_t bpf, ma_uint32 block_frames) {
+	f->source = source;
+	f->bpf = bpf;
+	f->block_frames = block_frames;
+	f->blocks = NULL;
+	f->mem = NULL;
+	f->block_count = 0;
+	f->free_list.store(NULL);
+	f->sink_count = 0;
+	f->closing.store(0);
+	f->waiting.store(0);
+	f->position = 0;
+	f->waits = 0;
+}
+
+static inline int rec_fanout_add(rec_fanout* f, const char* name, rec_drop_policy policy, ma_uint32 depth, rec_consume_proc consume, void* user) {
+	/*
+	 * Before rec_fanout_start(). depth is the
+	 * most blocks the sink may have queued.
+	 * Returns the sink's index, or -1.
+	 */
+	if (f->sink_count == REC_FANOUT_MAX_SINKS || depth == 0) return -1;
+	rec_fanout_sink* k = &f->sinks[f->sink_count];
+	k->name = name;
+	k->policy = policy;
+	k->consume = consume;
+	k->user = user;
+	k->depth = depth;
+	k->queue = (rec_block**)ma_malloc(sizeof(rec_block*) * depth, NULL);
+	if (k->queue == NULL) return -1;
+	k->head.store(0);
+	k->tail.store(0);
+	k->asleep.store(0);
+	k->delivered.store(0);
+	k->dropped.store(0);
+	k->skipped.store(0);
+	k->peak_queued = 0;
+	k->cpu_seconds = 0;
+	return (int)f->sink_count++;
+}
+
+static inline void rec_fanout_freed(rec_fanout* f) {
+	/*
+	 * A block or a queue slot came free:
+	 * wakes the producer if it waits for one.
+	 * The fence pairs with the producer's, so
+	 * either it sees the room or we see it
+	 * waiting.
+	 */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!f->waiting.load(std::memory_order_relaxed)) return;
+	std::lock_guard<std::mutex> guard(f->lock);
+	f->room.notify_one();
+}
+
+static inline void rec_fanout_release(rec_fanout* f, rec_block* b) {
+	/*
+	 * Any thread. The last reference puts
+	 * the block back on the free list.
+	 */
+	if (b->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+	rec_block* head = f->free_list.load(std::memory_order_relaxed);
+	do {
+		b->next = head;
+	} while (!f->free_list.compare_exchange_weak(head, b, std::memory_order_release, std::memory_order_relaxed));
+	rec_fanout_freed(f);
+}
+
+static inline int rec_fanout_room(rec_fanout* f, rec_fanout_sink* k) {
+	/*
+	 * Producer: whether it can go on, a block
+	 * in the pool, or with k, a queue slot.
+	 */
+	if (k != NULL) return k->tail.load(std::memory_order_relaxed) - k->head.load(std::memory_order_acquire) < k->depth;
+	return f->free_list.load(std::memory_order_acquire) != NULL;
+}
+
+static inline void rec_fanout_wait(rec_fanout* f, rec_fanout_sink* k) {
+	/*
+	 * Producer: sleeps until rec_fanout_room()
+	 * may have changed.
+	 */
+	f->waits++;
+	std::unique_lock<std::mutex> guard(f->lock);
+	f->waiting.store(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!rec_fanout_room(f, k)) f->room.wait(guard);
+	f->waiting.store(0, std::memory_order_relaxed);
+}
+
+static inline void rec_fanout_sink_thread(rec_fanout* f, rec_fanout_sink* k) {
+	/*
+	 * Takes blocks in order until the fan-out
+	 * is closing and the queue is empty. Under
+	 * REC_DROP_OLDEST a backlog is skipped to
+	 * its newest block.
+	 */
+	double cpu0 = rec_thread_cpu_seconds();
+	for (;;) {
+		int closing = f->closing.load(std::memory_order_acquire);
+		ma_uint64 head = k->head.load(std::memory_order_relaxed);
+		ma_uint64 tail = k->tail.load(std::memory_order_acquire);
+		if (head == tail) {
+			if (closing) break;
+			// Asleep until the producer publishes or the fan-out closes
+			std::unique_lock<std::mutex> guard(k->lock);
+			k->asleep.store(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (k->tail.load(std::memory_order_relaxed) == head && !f->closing.load(std::memory_order_relaxed)) k->wake.wait(guard);
+			k->asleep.store(0, std::memory_order_relaxed);
+			continue;
+		}
+		if (tail - head > k->peak_queued) k->peak_queued = tail - head;
+		if (k->policy == REC_DROP_OLDEST && tail - head > 1) {
+			while (tail - head > 1) {
+				rec_fanout_release(f, k->queue[head % k->depth]);
+				k->skipped.fetch_add(1, std::memory_order_relaxed);
+				head++;
+			}
+			k->head.store(head, std::memory_order_release);
+			rec_fanout_freed(f);
+		}
+		rec_block* b = k->queue[head % k->depth];
+		k->consume(k->user, b);
+		rec_fanout_release(f, b);
+		k->delivered.fetch_add(1, std::memory_order_relaxed);
+		k->head.store(head + 1, std::memory_order_release);
+		rec_fanout_freed(f);
+	}
+	k->cpu_seconds = rec_thread_cpu_seconds() - cpu0;
+}
+
+static inline ma_result rec_fanout_start(rec_fanout* f) {
+	/*
+	 * Sizes the pool so every sink can fill
+	 * its queue while the producer holds one
+	 * more block, then starts the sinks.
+	 */
+	ma_uint32 count = 2;
+	for (ma_uint32 i = 0; i < f->sink_count; i++) count += f->sinks[i].depth + 1;
+	size_t stride = ((size_t)f->block_frames * f->bpf + 63) & ~(size_t)63;
+	f->blocks = (rec_block*)ma_calloc(sizeof(rec_block) * count, NULL);
+	f->mem = (ma_uint8*)ma_aligned_malloc(stride * count, 64, NULL);
+	if (f->blocks == NULL || f->mem == NULL) {
+		ma_free(f->blocks, NULL);
+		if (f->mem != NULL) ma_aligned_free(f->mem, NULL);
+		f->blocks = NULL;
+		f->mem = NULL;
+		return MA_OUT_OF_MEMORY;
+	}
+	f->block_count = count;
+	for (ma_uint32 i = 0; i < count; i++) {
+		f->blocks[i].refs.store(1);
+		f->blocks[i].source = f->source;
+		f->blocks[i].data = f->mem + stride * i;
+		rec_fanout_release(f, &f->blocks[i]);
+	}
+	for (ma_uint32 i = 0; i < f->sink_count; i++) f->sinks[i].thread = std::thread(rec_fanout_sink_thread, f, &f->sinks[i]);
+	return MA_SUCCESS;
+}
+
+static inline rec_block* rec_fanout_acquire(rec_fanout* f) {
+	/*
+	 * Producer: an empty block to fill. Waits
+	 * only if REC_DROP_NONE sinks have fallen
+	 * so far behind that the pool is empty.
+	 */
+	for (;;) {
+		rec_block* b = f->free_list.load(std::memory_order_acquire);
+		while (b != NULL && !f->free_list.compare_exchange_weak(b, b->next, std::memory_order_acquire, std::memory_order_acquire)) {}
+		if (b != NULL) {
+			b->refs.store(1, std::memory_order_relaxed);
+			b->frames = 0;
+			return b;
+		}
+		rec_fanout_wait(f, NULL);
+	}
+}
+
+static inline void rec_fanout_publish(rec_fanout* f, rec_block* b, ma_uint32 frames) {
+	/*
+	 * Producer: hands a filled block to every
+	 * sink and drops the producer's reference.
+	 */
+	b->frames = frames;
+	b->position = f->position;
+	f->position += frames;
+	for (ma_uint32 i = 0; i < f->sink_count; i++) {
+		rec_fanout_sink* k = &f->sinks[i];
+		ma_uint64 tail = k->tail.load(std::memory_order_relaxed);
+		while (k->policy == REC_DROP_NONE && !rec_fanout_room(f, k)) rec_fanout_wait(f, k);
+		if (!rec_fanout_room(f, k)) {
+			k->dropped.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		b->refs.fetch_add(1, std::memory_order_relaxed);
+		k->queue[tail % k->depth] = b;
+		k->tail.store(tail + 1, std::memory_order_release);
+		// Pairs with the sink's fence: it sees the block, or we see it asleep
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (k->asleep.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> guard(k->lock);
+			k->wake.notify_one();
+		}
+	}
+	rec_fanout_release(f, b);
+}
+
+static inline ma_uint64 rec_fanout_queued(rec_fanout* f, ma_uint32 sink) {
+	/*
+	 * Frames waiting for a sink, roughly:
+	 * every queued block counted as full.
+	 */
+	rec_fanout_sink* k = &f->sinks[sink];
+	return (k->tail.load(std::memory_order_relaxed) - k->head.load(std::memory_order_relaxed)) * f->block_frames;
+}
+
+static inline void rec_fanout_stop(rec_fanout* f) {
+	/*
+	 * After the last publish: lets every sink
+	 * finish its queue and waits for it.
+	 */
+	f->closing.store(1, std::memory_order_release);
+	for (ma_uint32 i = 0; i < f->sink_count; i++) {
+		std::lock_guard<std::mutex> guard(f->sinks[i].lock);
+		f->sinks[i].wake.notify_one();
+	}
+	for (ma_uint32 i = 0; i < f->sink_count; i++) {
+		if (f->sinks[i].thread.joinable()) f->sinks[i].thread.join();
+	}
+}
+
+static inline void rec_fanout_uninit(rec_fanout* f) {
+	/*
+	 * Frees the pool and queues; the sinks'
+	 * statistics stay readable.
+	 */
+	rec_fanout_stop(f);
+	for (ma_uint32 i = 0; i < f->sink_count; i++) {
+		ma_free(f->sinks[i].queue, NULL);
+		f->sinks[i].queue = NULL;
+	}
+	if (f->mem != NULL) ma_aligned_free(f->mem, NULL);
+	ma_free(f->blocks, NULL);
+	f->mem = NULL;
+	f->blocks = NULL;
+}
+
+static inline void rec_fanout_report(const rec_fanout* f, const char* prefix) {
+	for (ma_uint32 i = 0; i < f->sink_count; i++) {
+		const rec_fanout_sink* k = &f->sinks[i];
+		printf("%s%s: %llu blocks, %llu dropped, %llu skipped, queue peak %llu/%u, %.3f s CPU\n", prefix, k->name,
+			(unsigned long long)k->delivered.load(), (unsigned long long)k->dropped.load(), (unsigned long long)k->skipped.load(),
+			(unsigned long long)k->peak_queued, k->depth, k->cpu_seconds);
+	}
+}
+
+#endif
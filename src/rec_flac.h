@@ -0,0 +1,1094 @@
+/*
+ * Streaming FLAC encoder.
+ *
+ * miniaudio decodes FLAC, but ma_encoder only writes WAV.
+ * This encoder is driven from the same writer threads.
+ * Audio is cut into blocks of REC_FLAC_BLOCK frames. A
+ * pool of worker threads encodes each block on its own,
+ * and finished frames are written strictly in order. The
+ * calling thread only converts samples, hashes them for
+ * the MD5 signature, and writes finished frames.
+ *
+ * Each channel of a block is coded as the cheapest of:
+ * constant; verbatim; a fixed polynomial predictor; or an
+ * LPC predictor. The LPC predictor comes from Levinson-
+ * Durbin on a Tukey-windowed autocorrelation. Residuals
+ * are Rice coded in partitions of the best size. For
+ * stereo, left/side, right/side and mid/side are tried
+ * as well.
+ *
+ * The metadata is written first. It reserves a seek table
+ * of REC_FLAC_SEEKPOINTS points and REC_FLAC_PADDING bytes
+ * of padding. At close it is rewritten in place with the
+ * stream info, the MD5 and the seek points, and with any
+ * Vorbis comments set meanwhile, which take their room
+ * from the padding.
+ *
+ * Integer samples of 8, 16 or 24 bits only, and at most 8
+ * channels, as the format allows.
+ */
+#ifndef REC_FLAC_H
+#define REC_FLAC_H
+
+#include <math.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define REC_FLAC_BLOCK 4096
+#define REC_FLAC_MAX_CHANNELS 8
+#define REC_FLAC_MAX_ORDER 12
+// Bits per quantized LPC coefficient, as libFLAC uses for this block size
+#define REC_FLAC_PRECISION 12
+#define REC_FLAC_MAX_PARTITION 8
+// Blocks that may be in flight, filled, encoding or waiting to be written
+#define REC_FLAC_QUEUE 16
+#define REC_FLAC_MAX_WORKERS 16
+// Seek points reserved in the header; spacing doubles as the take grows
+#define REC_FLAC_SEEKPOINTS 1024
+// Room left after the metadata for tags added later
+#define REC_FLAC_PADDING 8192
+// The most of it Vorbis comments may take
+#define REC_FLAC_COMMENTS 1024
+#define REC_FLAC_VENDOR "recorder"
+
+typedef ma_result (*rec_flac_write_proc)(void* user, const void* data, size_t bytes);
+// Only ever seeks back into the metadata, near the start of the file
+typedef ma_result (*rec_flac_seek_proc)(void* user, ma_uint64 offset);
+
+enum rec_flac_frame_state {
+	REC_FLAC_FREE = 0,
+	REC_FLAC_QUEUED,
+	REC_FLAC_DONE
+};
+
+typedef struct rec_flac_frame {
+	ma_int32* samples;	// planar, REC_FLAC_BLOCK per channel
+	ma_uint32 frames;
+	ma_uint64 number;
+	ma_uint8* bytes;	// the encoded frame
+	size_t size;
+	int state;		// rec_flac_frame_state, under the lock
+} rec_flac_frame;
+
+typedef struct rec_flac_seekpoint {
+	ma_uint64 sample;
+	ma_uint64 offset;	// from the first frame
+	ma_uint32 frames;
+} rec_flac_seekpoint;
+
+/*
+ * Per-thread buffers for encoding one block, so workers
+ * share nothing but the queue.
+ */
+typedef struct rec_flac_scratch {
+	ma_int32* side;
+	ma_int32* mid;
+	ma_int32* shifted[REC_FLAC_MAX_CHANNELS + 2];
+	ma_int32* residual[REC_FLAC_MAX_CHANNELS + 2];
+	ma_int32* trial;
+	double* windowed;
+	double* window;		// Tukey, for a full block
+} rec_flac_scratch;
+
+typedef struct rec_flac {
+	rec_flac_write_proc on_write;
+	rec_flac_seek_proc on_seek;
+	void* user;
+	ma_format format;
+	ma_uint32 channels;
+	ma_uint32 sample_rate;
+	ma_uint32 bps;
+	rec_flac_frame queue[REC_FLAC_QUEUE];
+	ma_uint64 head;		// oldest frame not yet written
+	ma_uint64 tail;		// frame being filled
+	ma_uint64 next_job;	// next frame for a worker, under the lock
+	std::thread workers[REC_FLAC_MAX_WORKERS];
+	rec_flac_scratch scratch[REC_FLAC_MAX_WORKERS];
+	ma_uint32 worker_count;	// 0 encodes on the calling thread
+	std::mutex lock;
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+	int quit;
+	// Calling thread only
+	ma_uint32 md5_h[4];
+	ma_uint8 md5_buf[64];
+	ma_uint64 md5_len;
+	ma_uint8* md5_conv;	// u8 audio, made signed for hashing
+	size_t header_bytes;
+	ma_uint64 samples;	// frames written, per channel
+	ma_uint64 bytes_written;	// audio frames only
+	ma_uint32 min_frame;
+	ma_uint32 max_frame;
+	rec_flac_seekpoint points[REC_FLAC_SEEKPOINTS];
+	ma_uint32 point_count;
+	ma_uint64 point_spacing;
+	ma_uint64 point_next;
+	// Vorbis comments for the final metadata: each a length, then its text
+	ma_uint8 comments[REC_FLAC_COMMENTS];
+	size_t comment_bytes;
+	ma_uint32 comment_count;
+	// Times the caller waited for a worker to finish a frame
+	ma_uint64 waits;
+	ma_result result;
+} rec_flac;
+
+/*
+ * Bit writer. Values up to 32 bits are appended MSB first;
+ * whole bytes leave the accumulator at once.
+ */
+typedef struct rec_flac_bits {
+	ma_uint8* buf;
+	size_t pos;
+	ma_uint64 acc;
+	ma_uint32 n;
+} rec_flac_bits;
+
+static inline void rec_flac_put(rec_flac_bits* w, ma_uint32 value, ma_uint32 bits) {
+	if (bits == 0) return;
+	w->acc = (w->acc << bits) | (value & (0xFFFFFFFFu >> (32 - bits)));
+	w->n += bits;
+	while (w->n >= 8) {
+		w->n -= 8;
+		w->buf[w->pos++] = (ma_uint8)(w->acc >> w->n);
+	}
+}
+
+static inline void rec_flac_align(rec_flac_bits* w) {
+	if (w->n > 0) rec_flac_put(w, 0, 8 - w->n);
+}
+
+typedef struct rec_flac_crc {
+	ma_uint8 crc8[256];
+	ma_uint16 crc16[256];
+	rec_flac_crc() {
+		for (int i = 0; i < 256; i++) {
+			ma_uint8 c8 = (ma_uint8)i;
+			ma_uint16 c16 = (ma_uint16)(i << 8);
+			for (int b = 0; b < 8; b++) {
+				c8 = (ma_uint8)((c8 << 1) ^ ((c8 & 0x80) ? 0x07 : 0));
+				c16 = (ma_uint16)((c16 << 1) ^ ((c16 & 0x8000) ? 0x8005 : 0));
+			}
+			crc8[i] = c8;
+			crc16[i] = c16;
+		}
+	}
+} rec_flac_crc;
+
+static inline const rec_flac_crc* rec_flac_crc_tables() {
+	static const rec_flac_crc tables;
+	return &tables;
+}
+
+static inline ma_uint8 rec_flac_crc8(const ma_uint8* p, size_t n) {
+	const rec_flac_crc* t = rec_flac_crc_tables();
+	ma_uint8 c = 0;
+	for (size_t i = 0; i < n; i++) c = t->crc8[c ^ p[i]];
+	return c;
+}
+
+static inline ma_uint16 rec_flac_crc16(const ma_uint8* p, size_t n) {
+	const rec_flac_crc* t = rec_flac_crc_tables();
+	ma_uint16 c = 0;
+	for (size_t i = 0; i < n; i++) c = (ma_uint16)((c << 8) ^ t->crc16[(c >> 8) ^ p[i]]);
+	return c;
+}
+
+/*
+ * MD5 of the audio as little-endian signed samples, for
+ * STREAMINFO (RFC 1321).
+ */
+static inline void rec_md5_block(ma_uint32* h, const ma_uint8* p) {
+	static const ma_uint32 k[64] = {
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+	};
+	static const ma_uint8 r[64] = {
+		7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+		5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+		4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+		6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+	};
+	ma_uint32 m[16];
+	for (int i = 0; i < 16; i++) m[i] = p[i * 4] | (p[i * 4 + 1] << 8) | (p[i * 4 + 2] << 16) | ((ma_uint32)p[i * 4 + 3] << 24);
+	ma_uint32 a = h[0], b = h[1], c = h[2], d = h[3];
+	for (int i = 0; i < 64; i++) {
+		ma_uint32 f, g;
+		if (i < 16) {
+			f = (b & c) | (~b & d);
+			g = i;
+		} else if (i < 32) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) & 15;
+		} else if (i < 48) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) & 15;
+		} else {
+			f = c ^ (b | ~d);
+			g = (7 * i) & 15;
+		}
+		ma_uint32 t = d;
+		d = c;
+		c = b;
+		ma_uint32 x = a + f + k[i] + m[g];
+		b = b + ((x << r[i]) | (x >> (32 - r[i])));
+		a = t;
+	}
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+}
+
+static inline void rec_md5_update(rec_flac* f, const ma_uint8* p, size_t n) {
+	size_t have = (size_t)(f->md5_len & 63);
+	f->md5_len += n;
+	if (have > 0) {
+		size_t take = 64 - have < n ? 64 - have : n;
+		memcpy(f->md5_buf + have, p, take);
+		p += take;
+		n -= take;
+		if (have + take < 64) return;
+		rec_md5_block(f->md5_h, f->md5_buf);
+	}
+	for (; n >= 64; p += 64, n -= 64) rec_md5_block(f->md5_h, p);
+	memcpy(f->md5_buf, p, n);
+}
+
+static inline void rec_md5_final(rec_flac* f, ma_uint8* out) {
+	ma_uint64 bits = f->md5_len * 8;
+	ma_uint8 pad[72];
+	size_t n = 64 - (size_t)((f->md5_len + 8) & 63);
+	if (n == 0) n = 64;
+	memset(pad, 0, sizeof(pad));
+	pad[0] = 0x80;
+	for (int i = 0; i < 8; i++) pad[n + i] = (ma_uint8)(bits >> (8 * i));
+	rec_md5_update(f, pad, n + 8);
+	for (int i = 0; i < 16; i++) out[i] = (ma_uint8)(f->md5_h[i / 4] >> (8 * (i % 4)));
+}
+
+/*
+ * Subframe coding: a plan per channel, found by analysis
+ * and then emitted, so stereo modes can be compared
+ * without writing them.
+ */
+enum rec_flac_subframe_type {
+	REC_FLAC_CONSTANT = 0,
+	REC_FLAC_VERBATIM,
+	REC_FLAC_FIXED,
+	REC_FLAC_LPC
+};
+
+typedef struct rec_flac_sub {
+	const ma_int32* x;	// samples, wasted bits removed
+	ma_uint32 n;
+	ma_uint32 bps;		// of x
+	ma_uint32 wasted;
+	int type;
+	ma_uint32 order;
+	ma_int32 coef[REC_FLAC_MAX_ORDER];
+	int shift;
+	ma_int32* residual;	// n - order values
+	ma_uint32 porder;
+	ma_uint32 method;	// 0: 4-bit Rice parameters, 1: 5-bit
+	ma_uint8 params[1 << REC_FLAC_MAX_PARTITION];
+	ma_uint64 bits;
+} rec_flac_sub;
+
+static inline ma_uint64 rec_flac_rice_plan(rec_flac_sub* s) {
+	/*
+	 * Picks the partition order and a Rice
+	 * parameter per partition from sums of
+	 * the zigzagged residual: coarser orders
+	 * add up pairs of the finest one's sums.
+	 * Returns the residual's size in bits.
+	 */
+	const ma_uint32 n = s->n, order = s->order;
+	ma_uint32 pmax = 0;
+	while (pmax < REC_FLAC_MAX_PARTITION && (n & ((2u << pmax) - 1)) == 0 && (n >> (pmax + 1)) > order) pmax++;
+	ma_uint64 sums[1 << REC_FLAC_MAX_PARTITION];
+	const ma_uint32 psize = n >> pmax;
+	const ma_int32* r = s->residual;
+	for (ma_uint32 j = 0, i = 0; j < (1u << pmax); j++) {
+		ma_uint32 end = (j + 1) * psize - order;
+		ma_uint64 sum = 0;
+		for (; i < end; i++) sum += ((ma_uint32)r[i] << 1) ^ (ma_uint32)(r[i] >> 31);
+		sums[j] = sum;
+	}
+	ma_uint64 best = ~(ma_uint64)0;
+	for (int p = (int)pmax; p >= 0; p--) {
+		ma_uint8 params[1 << REC_FLAC_MAX_PARTITION];
+		ma_uint64 bits = 0;
+		ma_uint32 kmax = 0;
+		for (ma_uint32 j = 0; j < (1u << p); j++) {
+			ma_uint64 count = (n >> p) - (j == 0 ? order : 0);
+			ma_uint64 sum = sums[j];
+			ma_uint32 k = 0;
+			while (k < 30 && (count << (k + 1)) < sum) k++;
+			ma_uint64 cost = count * (k + 1) + (sum >> k);
+			if (k > 0 && count * k + (sum >> (k - 1)) < cost) {
+				k--;
+				cost = count * (k + 1) + (sum >> k);
+			}
+			params[j] = (ma_uint8)k;
+			if (k > kmax) kmax = k;
+			bits += cost;
+		}
+		bits += (ma_uint64)(1u << p) * (kmax > 14 ? 5 : 4);
+		if (bits < best) {
+			best = bits;
+			s->porder = (ma_uint32)p;
+			s->method = kmax > 14;
+			memcpy(s->params, params, (size_t)1 << p);
+		}
+		// Pairs of sums for the next coarser order
+		for (ma_uint32 j = 0; j < (1u << p) / 2; j++) sums[j] = sums[2 * j] + sums[2 * j + 1];
+	}
+	return best + 6;
+}
+
+static inline void rec_flac_fixed_residual(const ma_int32* x, ma_uint32 n, ma_uint32 order, ma_int32* r) {
+	for (ma_uint32 i = order; i < n; i++) {
+		ma_int32 e;
+		switch (order) {
+		case 0: e = x[i]; break;
+		case 1: e = x[i] - x[i - 1]; break;
+		case 2: e = x[i] - 2 * x[i - 1] + x[i - 2]; break;
+		case 3: e = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3]; break;
+		default: e = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4]; break;
+		}
+		r[i - order] = e;
+	}
+}
+
+static inline int rec_flac_lpc_residual(const ma_int32* x, ma_uint32 n, const ma_int32* coef, ma_uint32 order, int shift, ma_int32* r) {
+	/*
+	 * 32-bit sums when they can't overflow,
+	 * which covers 16-bit audio; 64-bit
+	 * otherwise. Returns 0 if a residual
+	 * doesn't fit in 32 bits.
+	 */
+	ma_int64 cmag = 0;
+	for (ma_uint32 j = 0; j < order; j++) cmag += coef[j] < 0 ? -(ma_int64)coef[j] : coef[j];
+	ma_int32 xmag = 0;
+	for (ma_uint32 i = 0; i < n; i++) {
+		ma_int32 a = x[i] < 0 ? -x[i] : x[i];
+		if (a > xmag) xmag = a;
+	}
+	if ((ma_int64)xmag * cmag < ((ma_int64)1 << 31)) {
+		for (ma_uint32 i = order; i < n; i++) {
+			ma_int32 sum = 0;
+			for (ma_uint32 j = 0; j < order; j++) sum += coef[j] * x[i - j - 1];
+			r[i - order] = x[i] - (sum >> shift);
+		}
+		return 1;
+	}
+	for (ma_uint32 i = order; i < n; i++) {
+		ma_int64 sum = 0;
+		for (ma_uint32 j = 0; j < order; j++) sum += (ma_int64)coef[j] * x[i - j - 1];
+		ma_int64 e = x[i] - (sum >> shift);
+		if (e > 0x3FFFFFFF || e < -0x3FFFFFFF) return 0;
+		r[i - order] = (ma_int32)e;
+	}
+	return 1;
+}
+
+static inline int rec_flac_quantize(const double* lpc, ma_uint32 order, ma_int32* coef, int* shift) {
+	/*
+	 * Scales the coefficients to REC_FLAC_PRECISION
+	 * signed bits with the largest shift that
+	 * fits, carrying the rounding error along.
+	 */
+	double cmax = 0;
+	for (ma_uint32 j = 0; j < order; j++) cmax = fabs(lpc[j]) > cmax ? fabs(lpc[j]) : cmax;
+	if (cmax <= 0) return 0;
+	int exp;
+	frexp(cmax, &exp);
+	int s = (REC_FLAC_PRECISION - 1) - exp;
+	if (s > 15) s = 15;
+	if (s < 0) return 0;
+	const ma_int32 qmax = (1 << (REC_FLAC_PRECISION - 1)) - 1, qmin = -(1 << (REC_FLAC_PRECISION - 1));
+	double err = 0;
+	for (ma_uint32 j = 0; j < order; j++) {
+		err += lpc[j] * (1 << s);
+		long q = lround(err);
+		if (q > qmax) q = qmax;
+		if (q < qmin) q = qmin;
+		err -= q;
+		coef[j] = (ma_int32)q;
+	}
+	*shift = s;
+	return 1;
+}
+
+static inline void rec_flac_analyze(rec_flac_scratch* sc, rec_flac_sub* s, const ma_int32* x, ma_uint32 n, ma_uint32 bps, ma_int32* shifted, ma_int32** slot) {
+	/*
+	 * Chooses the cheapest coding of one
+	 * channel of a block. Its residual ends
+	 * up in *slot; when LPC wins, *slot and
+	 * the trial buffer trade places.
+	 */
+	ma_int32* residual = *slot;
+	s->n = n;
+	s->wasted = 0;
+	s->order = 0;
+	s->residual = residual;
+	ma_uint32 all = 0;
+	int constant = 1;
+	for (ma_uint32 i = 0; i < n; i++) {
+		all |= (ma_uint32)x[i];
+		constant &= x[i] == x[0];
+	}
+	if (constant) {
+		s->x = x;
+		s->bps = bps;
+		s->type = REC_FLAC_CONSTANT;
+		s->bits = 8 + bps;
+		return;
+	}
+	// Low bits that are zero throughout, e.g. 16-bit audio in 24
+	while (((all >> s->wasted) & 1) == 0) s->wasted++;
+	if (s->wasted > 0) {
+		for (ma_uint32 i = 0; i < n; i++) shifted[i] = x[i] >> s->wasted;
+		x = shifted;
+		bps -= s->wasted;
+	}
+	s->x = x;
+	s->bps = bps;
+	const ma_uint64 head = 8 + s->wasted;
+	s->type = REC_FLAC_VERBATIM;
+	s->bits = head + (ma_uint64)n * bps;
+	if (n <= REC_FLAC_MAX_ORDER * 2) return;
+
+	// Fixed predictors: the order with the smallest error magnitude
+	ma_uint64 err[5] = {0, 0, 0, 0, 0};
+	for (ma_uint32 i = 4; i < n; i++) {
+		ma_int64 e0 = x[i];
+		ma_int64 e1 = e0 - x[i - 1];
+		ma_int64 e2 = e1 - (x[i - 1] - (ma_int64)x[i - 2]);
+		ma_int64 e3 = e2 - (x[i - 1] - 2 * (ma_int64)x[i - 2] + x[i - 3]);
+		ma_int64 e4 = e3 - (x[i - 1] - 3 * (ma_int64)x[i - 2] + 3 * (ma_int64)x[i - 3] - x[i - 4]);
+		err[0] += e0 < 0 ? -e0 : e0;
+		err[1] += e1 < 0 ? -e1 : e1;
+		err[2] += e2 < 0 ? -e2 : e2;
+		err[3] += e3 < 0 ? -e3 : e3;
+		err[4] += e4 < 0 ? -e4 : e4;
+	}
+	ma_uint32 fixed = 0;
+	for (ma_uint32 o = 1; o < 5; o++) {
+		if (err[o] < err[fixed]) fixed = o;
+	}
+	// Residuals of 24-bit audio at order 4 can need 29 bits
+	if (bps + fixed <= 30) {
+		s->order = fixed;
+		rec_flac_fixed_residual(x, n, fixed, residual);
+		ma_uint64 bits = head + (ma_uint64)fixed * bps + rec_flac_rice_plan(s);
+		if (bits < s->bits) {
+			s->type = REC_FLAC_FIXED;
+			s->bits = bits;
+		}
+	}
+
+	// LPC: windowed autocorrelation, then Levinson-Durbin
+	const double* w = sc->window;
+	double* xw = sc->windowed;
+	if (n == REC_FLAC_BLOCK) {
+		for (ma_uint32 i = 0; i < n; i++) xw[i] = x[i] * w[i];
+	} else {
+		// A short last block gets its own window
+		const double pi = 3.14159265358979323846;
+		const ma_uint32 taper = n / 4;
+		for (ma_uint32 i = 0; i < n; i++) {
+			double g = 1.0;
+			if (i < taper) g = 0.5 - 0.5 * cos(pi * i / taper);
+			else if (i >= n - taper) g = 0.5 - 0.5 * cos(pi * (n - 1 - i) / taper);
+			xw[i] = x[i] * g;
+		}
+	}
+	double autoc[REC_FLAC_MAX_ORDER + 1];
+	for (ma_uint32 lag = 0; lag <= REC_FLAC_MAX_ORDER; lag++) {
+		double sum = 0;
+		for (ma_uint32 i = lag; i < n; i++) sum += xw[i] * xw[i - lag];
+		autoc[lag] = sum;
+	}
+	if (autoc[0] <= 0) return;
+	double lpc[REC_FLAC_MAX_ORDER][REC_FLAC_MAX_ORDER];
+	double a[REC_FLAC_MAX_ORDER];
+	double lerr[REC_FLAC_MAX_ORDER + 1];
+	double e = autoc[0];
+	ma_uint32 max_order = REC_FLAC_MAX_ORDER;
+	for (ma_uint32 i = 0; i < REC_FLAC_MAX_ORDER; i++) {
+		double r = -autoc[i + 1];
+		for (ma_uint32 j = 0; j < i; j++) r -= a[j] * autoc[i - j];
+		r /= e;
+		a[i] = r;
+		for (ma_uint32 j = 0; j < i / 2; j++) {
+			double t = a[j];
+			a[j] += r * a[i - 1 - j];
+			a[i - 1 - j] += r * t;
+		}
+		if (i & 1) a[i / 2] += a[i / 2] * r;
+		e *= 1.0 - r * r;
+		for (ma_uint32 j = 0; j <= i; j++) lpc[i][j] = -a[j];
+		lerr[i + 1] = e;
+		if (e <= 0) {
+			max_order = i + 1;
+			break;
+		}
+	}
+	/*
+	 * Order from the predicted error: half a
+	 * bit per halving of the residual power,
+	 * against the cost of the coefficients.
+	 */
+	ma_uint32 order = 0;
+	double best = 1e300;
+	for (ma_uint32 o = 1; o <= max_order; o++) {
+		double bits_per = lerr[o] > 0 ? 0.5 * log2(lerr[o] * 0.5 / n) : 0;
+		if (bits_per < 0) bits_per = 0;
+		double total = (n - o) * bits_per + o * (bps + REC_FLAC_PRECISION);
+		if (total < best) {
+			best = total;
+			order = o;
+		}
+	}
+	ma_int32 coef[REC_FLAC_MAX_ORDER];
+	int shift;
+	if (order == 0 || !rec_flac_quantize(lpc[order - 1], order, coef, &shift)) return;
+	if (!rec_flac_lpc_residual(x, n, coef, order, shift, sc->trial)) return;
+	rec_flac_sub t = *s;
+	t.order = order;
+	t.residual = sc->trial;
+	ma_uint64 bits = head + (ma_uint64)order * bps + 4 + 5 + (ma_uint64)order * REC_FLAC_PRECISION + rec_flac_rice_plan(&t);
+	if (bits < s->bits) {
+		*s = t;
+		s->type = REC_FLAC_LPC;
+		s->bits = bits;
+		s->shift = shift;
+		memcpy(s->coef, coef, order * sizeof(ma_int32));
+		*slot = sc->trial;
+		sc->trial = residual;
+	}
+}
+
+static inline void rec_flac_emit(rec_flac_bits* w, const rec_flac_sub* s) {
+	static const ma_uint32 type_code[] = {0x00, 0x01, 0x08, 0x20};
+	ma_uint32 type = type_code[s->type];
+	if (s->type == REC_FLAC_FIXED) type |= s->order;
+	if (s->type == REC_FLAC_LPC) type |= s->order - 1;
+	rec_flac_put(w, type << 1 | (s->wasted > 0), 8);
+	// Wasted bits k follow as k - 1 in unary
+	if (s->wasted > 0) rec_flac_put(w, 1, s->wasted);
+	const ma_int32* x = s->x;
+	if (s->type == REC_FLAC_CONSTANT) {
+		rec_flac_put(w, (ma_uint32)x[0], s->bps);
+		return;
+	}
+	if (s->type == REC_FLAC_VERBATIM) {
+		for (ma_uint32 i = 0; i < s->n; i++) rec_flac_put(w, (ma_uint32)x[i], s->bps);
+		return;
+	}
+	for (ma_uint32 i = 0; i < s->order; i++) rec_flac_put(w, (ma_uint32)x[i], s->bps);
+	if (s->type == REC_FLAC_LPC) {
+		rec_flac_put(w, REC_FLAC_PRECISION - 1, 4);
+		rec_flac_put(w, (ma_uint32)s->shift, 5);
+		for (ma_uint32 j = 0; j < s->order; j++) rec_flac_put(w, (ma_uint32)s->coef[j], REC_FLAC_PRECISION);
+	}
+	rec_flac_put(w, s->method, 2);
+	rec_flac_put(w, s->porder, 4);
+	const ma_uint32 pbits = s->method ? 5 : 4;
+	const ma_int32* r = s->residual;
+	for (ma_uint32 j = 0, i = 0; j < (1u << s->porder); j++) {
+		ma_uint32 end = (j + 1) * (s->n >> s->porder) - s->order;
+		ma_uint32 k = s->params[j];
+		rec_flac_put(w, k, pbits);
+		for (; i < end; i++) {
+			ma_uint32 u = ((ma_uint32)r[i] << 1) ^ (ma_uint32)(r[i] >> 31);
+			ma_uint32 q = u >> k;
+			// Quotient in unary: q zeros, then a one carrying the low k bits
+			if (q + k + 1 <= 32) {
+				rec_flac_put(w, (1u << k) | (u & ((1u << k) - 1)), q + k + 1);
+				continue;
+			}
+			for (; q >= 32; q -= 32) rec_flac_put(w, 0, 32);
+			rec_flac_put(w, 0, q);
+			rec_flac_put(w, (1u << k) | (u & ((1u << k) - 1)), k + 1);
+		}
+	}
+}
+
+static inline ma_uint32 rec_flac_rate_code(ma_uint32 rate) {
+	switch (rate) {
+	case 88200: return 1;
+	case 176400: return 2;
+	case 192000: return 3;
+	case 8000: return 4;
+	case 16000: return 5;
+	case 22050: return 6;
+	case 24000: return 7;
+	case 32000: return 8;
+	case 44100: return 9;
+	case 48000: return 10;
+	case 96000: return 11;
+	default: return 0;	// from STREAMINFO
+	}
+}
+
+static inline void rec_flac_encode(rec_flac* f, rec_flac_scratch* sc, rec_flac_frame* fr) {
+	/*
+	 * One block into one frame: header, a
+	 * subframe per channel, CRC-16.
+	 */
+	const ma_uint32 n = fr->frames, ch = f->channels;
+	rec_flac_bits w = {fr->bytes, 0, 0, 0};
+	rec_flac_sub subs[REC_FLAC_MAX_CHANNELS + 2];
+	for (ma_uint32 c = 0; c < ch; c++) {
+		rec_flac_analyze(sc, &subs[c], fr->samples + (size_t)c * REC_FLAC_BLOCK, n, f->bps, sc->shifted[c], &sc->residual[c]);
+	}
+	ma_uint32 assignment = ch - 1;
+	const rec_flac_sub* out[REC_FLAC_MAX_CHANNELS];
+	for (ma_uint32 c = 0; c < ch; c++) out[c] = &subs[c];
+	if (ch == 2) {
+		const ma_int32* l = fr->samples;
+		const ma_int32* r = fr->samples + REC_FLAC_BLOCK;
+		for (ma_uint32 i = 0; i < n; i++) {
+			sc->side[i] = l[i] - r[i];
+			sc->mid[i] = (l[i] + r[i]) >> 1;
+		}
+		rec_flac_analyze(sc, &subs[2], sc->side, n, f->bps + 1, sc->shifted[2], &sc->residual[2]);
+		rec_flac_analyze(sc, &subs[3], sc->mid, n, f->bps, sc->shifted[3], &sc->residual[3]);
+		ma_uint64 lr = subs[0].bits + subs[1].bits, ls = subs[0].bits + subs[2].bits;
+		ma_uint64 rs = subs[1].bits + subs[2].bits, ms = subs[3].bits + subs[2].bits;
+		if (ls < lr && ls <= rs && ls <= ms) {
+			assignment = 8;
+			out[1] = &subs[2];
+		} else if (rs < lr && rs <= ms) {
+			assignment = 9;
+			out[0] = &subs[2];
+			out[1] = &subs[1];
+		} else if (ms < lr) {
+			assignment = 10;
+			out[0] = &subs[3];
+			out[1] = &subs[2];
+		}
+	}
+	rec_flac_put(&w, 0xFFF8, 16);
+	rec_flac_put(&w, n == REC_FLAC_BLOCK ? 12 : 7, 4);
+	rec_flac_put(&w, rec_flac_rate_code(f->sample_rate), 4);
+	rec_flac_put(&w, assignment, 4);
+	rec_flac_put(&w, f->bps == 8 ? 1 : f->bps == 16 ? 4 : 6, 3);
+	rec_flac_put(&w, 0, 1);
+	// Frame number, UTF-8 style
+	ma_uint64 v = fr->number;
+	if (v < 0x80) rec_flac_put(&w, (ma_uint32)v, 8);
+	else {
+		int extra = v < 0x800 ? 1 : v < 0x10000 ? 2 : v < 0x200000 ? 3 : v < 0x4000000 ? 4 : v < 0x80000000 ? 5 : 6;
+		rec_flac_put(&w, ((0xFF00u >> (extra + 1)) & 0xFF) | (ma_uint32)(v >> (6 * extra)), 8);
+		for (int i = extra - 1; i >= 0; i--) rec_flac_put(&w, 0x80 | (ma_uint32)((v >> (6 * i)) & 0x3F), 8);
+	}
+	if (n != REC_FLAC_BLOCK) rec_flac_put(&w, n - 1, 16);
+	rec_flac_put(&w, rec_flac_crc8(w.buf, w.pos), 8);
+	for (ma_uint32 c = 0; c < ch; c++) rec_flac_emit(&w, out[c]);
+	rec_flac_align(&w);
+	ma_uint16 crc = rec_flac_crc16(w.buf, w.pos);
+	rec_flac_put(&w, crc, 16);
+	fr->size = w.pos;
+}
+
+static inline void rec_flac_worker(rec_flac* f, rec_flac_scratch* sc) {
+	std::unique_lock<std::mutex> guard(f->lock);
+	for (;;) {
+		while (!f->quit && f->next_job == f->tail) f->work_cv.wait(guard);
+		if (f->next_job == f->tail) break;
+		rec_flac_frame* fr = &f->queue[f->next_job % REC_FLAC_QUEUE];
+		f->next_job++;
+		guard.unlock();
+		rec_flac_encode(f, sc, fr);
+		guard.lock();
+		fr->state = REC_FLAC_DONE;
+		f->done_cv.notify_all();
+	}
+}
+
+static inline void rec_flac_scratch_free(rec_flac_scratch* sc) {
+	ma_free(sc->side, NULL);
+	ma_free(sc->mid, NULL);
+	for (int i = 0; i < REC_FLAC_MAX_CHANNELS + 2; i++) {
+		ma_free(sc->shifted[i], NULL);
+		ma_free(sc->residual[i], NULL);
+	}
+	ma_free(sc->trial, NULL);
+	ma_free(sc->windowed, NULL);
+	ma_free(sc->window, NULL);
+	memset(sc, 0, sizeof(*sc));
+}
+
+static inline int rec_flac_scratch_alloc(rec_flac_scratch* sc, ma_uint32 channels) {
+	memset(sc, 0, sizeof(*sc));
+	const size_t block = REC_FLAC_BLOCK * sizeof(ma_int32);
+	sc->side = (ma_int32*)ma_malloc(block, NULL);
+	sc->mid = (ma_int32*)ma_malloc(block, NULL);
+	sc->trial = (ma_int32*)ma_malloc(block, NULL);
+	sc->windowed = (double*)ma_malloc(REC_FLAC_BLOCK * sizeof(double), NULL);
+	sc->window = (double*)ma_malloc(REC_FLAC_BLOCK * sizeof(double), NULL);
+	int ok = sc->side != NULL && sc->mid != NULL && sc->trial != NULL && sc->windowed != NULL && sc->window != NULL;
+	for (ma_uint32 i = 0; i < channels + 2 && i < REC_FLAC_MAX_CHANNELS + 2; i++) {
+		sc->shifted[i] = (ma_int32*)ma_malloc(block, NULL);
+		sc->residual[i] = (ma_int32*)ma_malloc(block, NULL);
+		ok = ok && sc->shifted[i] != NULL && sc->residual[i] != NULL;
+	}
+	if (!ok) return 0;
+	// Tukey window, half of it taper
+	const double pi = 3.14159265358979323846;
+	const ma_uint32 taper = REC_FLAC_BLOCK / 4;
+	for (ma_uint32 i = 0; i < REC_FLAC_BLOCK; i++) {
+		double g = 1.0;
+		if (i < taper) g = 0.5 - 0.5 * cos(pi * i / taper);
+		else if (i >= REC_FLAC_BLOCK - taper) g = 0.5 - 0.5 * cos(pi * (REC_FLAC_BLOCK - 1 - i) / taper);
+		sc->window[i] = g;
+	}
+	return 1;
+}
+
+static inline size_t rec_flac_block_header(ma_uint8* p, size_t pos, int last, ma_uint32 type, ma_uint32 length) {
+	p[pos++] = (ma_uint8)((last << 7) | type);
+	p[pos++] = (ma_uint8)(length >> 16);
+	p[pos++] = (ma_uint8)(length >> 8);
+	p[pos++] = (ma_uint8)length;
+	return pos;
+}
+
+static inline size_t rec_flac_metadata(rec_flac* f, ma_uint8* p, const ma_uint8* md5) {
+	/*
+	 * "fLaC", STREAMINFO, SEEKTABLE,
+	 * VORBIS_COMMENT and PADDING. Always the
+	 * same length, so it can be rewritten.
+	 */
+	size_t pos = 4;
+	memcpy(p, "fLaC", 4);
+	pos = rec_flac_block_header(p, pos, 0, 0, 34);
+	rec_flac_bits w = {p + pos, 0, 0, 0};
+	rec_flac_put(&w, REC_FLAC_BLOCK, 16);
+	rec_flac_put(&w, REC_FLAC_BLOCK, 16);
+	rec_flac_put(&w, f->min_frame, 24);
+	rec_flac_put(&w, f->max_frame, 24);
+	rec_flac_put(&w, f->sample_rate, 20);
+	rec_flac_put(&w, f->channels - 1, 3);
+	rec_flac_put(&w, f->bps - 1, 5);
+	rec_flac_put(&w, (ma_uint32)(f->samples >> 32), 4);
+	rec_flac_put(&w, (ma_uint32)f->samples, 32);
+	pos += w.pos;
+	memcpy(p + pos, md5, 16);
+	pos += 16;
+	pos = rec_flac_block_header(p, pos, 0, 3, REC_FLAC_SEEKPOINTS * 18);
+	for (ma_uint32 i = 0; i < REC_FLAC_SEEKPOINTS; i++) {
+		// Unused points are placeholders, which sort last
+		ma_uint64 sample = i < f->point_count ? f->points[i].sample : ~(ma_uint64)0;
+		ma_uint64 offset = i < f->point_count ? f->points[i].offset : 0;
+		ma_uint32 frames = i < f->point_count ? f->points[i].frames : 0;
+		for (int b = 7; b >= 0; b--) p[pos++] = (ma_uint8)(sample >> (8 * b));
+		for (int b = 7; b >= 0; b--) p[pos++] = (ma_uint8)(offset >> (8 * b));
+		p[pos++] = (ma_uint8)(frames >> 8);
+		p[pos++] = (ma_uint8)frames;
+	}
+	const ma_uint32 vendor = (ma_uint32)strlen(REC_FLAC_VENDOR);
+	pos = rec_flac_block_header(p, pos, 0, 4, (ma_uint32)(4 + vendor + 4 + f->comment_bytes));
+	// Vorbis comment lengths are little-endian
+	for (int b = 0; b < 4; b++) p[pos++] = (ma_uint8)(vendor >> (8 * b));
+	memcpy(p + pos, REC_FLAC_VENDOR, vendor);
+	pos += vendor;
+	for (int b = 0; b < 4; b++) p[pos++] = (ma_uint8)(f->comment_count >> (8 * b));
+	memcpy(p + pos, f->comments, f->comment_bytes);
+	pos += f->comment_bytes;
+	const ma_uint32 padding = (ma_uint32)(REC_FLAC_PADDING - f->comment_bytes);
+	pos = rec_flac_block_header(p, pos, 1, 1, padding);
+	memset(p + pos, 0, padding);
+	pos += padding;
+	return pos;
+}
+
+static inline size_t rec_flac_metadata_size() {
+	return 4 + (4 + 34) + (4 + REC_FLAC_SEEKPOINTS * 18) + (4 + 4 + strlen(REC_FLAC_VENDOR) + 4) + (4 + REC_FLAC_PADDING);
+}
+
+static inline ma_result rec_flac_comment(rec_flac* f, const char* name, const char* value) {
+	/*
+	 * "NAME=value", written with the metadata
+	 * at close. MA_NO_SPACE once comments
+	 * would take more than REC_FLAC_COMMENTS.
+	 */
+	const size_t length = strlen(name) + 1 + strlen(value);
+	if (f->comment_bytes + 4 + length > REC_FLAC_COMMENTS) return MA_NO_SPACE;
+	ma_uint8* p = f->comments + f->comment_bytes;
+	for (int b = 0; b < 4; b++) p[b] = (ma_uint8)(length >> (8 * b));
+	memcpy(p + 4, name, strlen(name));
+	p[4 + strlen(name)] = '=';
+	memcpy(p + 5 + strlen(name), value, strlen(value));
+	f->comment_bytes += 4 + length;
+	f->comment_count++;
+	return MA_SUCCESS;
+}
+
+static inline void rec_flac_seekpoint_add(rec_flac* f, ma_uint64 sample, ma_uint64 offset, ma_uint32 frames) {
+	/*
+	 * A point every point_spacing samples.
+	 * When the table is full every other
+	 * point goes and the spacing doubles, so
+	 * any length of take is covered evenly.
+	 */
+	if (sample < f->point_next) return;
+	if (f->point_count == REC_FLAC_SEEKPOINTS) {
+		for (ma_uint32 i = 0; i < REC_FLAC_SEEKPOINTS / 2; i++) f->points[i] = f->points[2 * i];
+		f->point_count = REC_FLAC_SEEKPOINTS / 2;
+		f->point_spacing *= 2;
+		f->point_next = f->points[f->point_count - 1].sample + f->point_spacing;
+		if (sample < f->point_next) return;
+	}
+	f->points[f->point_count].sample = sample;
+	f->points[f->point_count].offset = offset;
+	f->points[f->point_count].frames = frames;
+	f->point_count++;
+	f->point_next = sample + f->point_spacing;
+}
+
+static inline void rec_flac_drain(rec_flac* f, int wait) {
+	/*
+	 * Writes finished frames in order. With
+	 * wait, blocks for the oldest one first.
+	 */
+	while (f->head < f->tail) {
+		rec_flac_frame* fr = &f->queue[f->head % REC_FLAC_QUEUE];
+		{
+			std::unique_lock<std::mutex> guard(f->lock);
+			if (fr->state != REC_FLAC_DONE) {
+				if (!wait) return;
+				f->waits++;
+				while (fr->state != REC_FLAC_DONE) f->done_cv.wait(guard);
+			}
+		}
+		wait = 0;
+		ma_result result = f->on_write(f->user, fr->bytes, fr->size);
+		if (result != MA_SUCCESS && f->result == MA_SUCCESS) f->result = result;
+		rec_flac_seekpoint_add(f, fr->number * REC_FLAC_BLOCK, f->bytes_written, fr->frames);
+		f->bytes_written += fr->size;
+		if (fr->size < f->min_frame) f->min_frame = (ma_uint32)fr->size;
+		if (fr->size > f->max_frame) f->max_frame = (ma_uint32)fr->size;
+		{
+			std::lock_guard<std::mutex> guard(f->lock);
+			fr->state = REC_FLAC_FREE;
+			fr->frames = 0;
+		}
+		f->head++;
+	}
+}
+
+static inline void rec_flac_submit(rec_flac* f) {
+	/*
+	 * Hands the block being filled to the
+	 * workers, or encodes it here without
+	 * any.
+	 */
+	rec_flac_frame* fr = &f->queue[f->tail % REC_FLAC_QUEUE];
+	fr->number = f->tail;
+	if (f->worker_count == 0) {
+		rec_flac_encode(f, &f->scratch[0], fr);
+		fr->state = REC_FLAC_DONE;
+		f->tail++;
+		return;
+	}
+	std::lock_guard<std::mutex> guard(f->lock);
+	fr->state = REC_FLAC_QUEUED;
+	f->tail++;
+	f->work_cv.notify_one();
+}
+
+static inline ma_result rec_flac_uninit(rec_flac* f);
+
+static inline ma_result rec_flac_init(rec_flac* f, rec_flac_write_proc on_write, rec_flac_seek_proc on_seek, void* user,
+	ma_format format, ma_uint32 channels, ma_uint32 sample_rate, ma_uint32 workers) {
+	/*
+	 * Writes the provisional metadata and
+	 * starts that many workers (none encodes
+	 * on the calling thread).
+	 */
+	f->on_write = on_write;
+	f->on_seek = on_seek;
+	f->user = user;
+	f->format = format;
+	f->channels = channels;
+	f->sample_rate = sample_rate;
+	f->bps = format == ma_format_u8 ? 8 : format == ma_format_s16 ? 16 : format == ma_format_s24 ? 24 : 0;
+	f->worker_count = 0;
+	f->head = f->tail = f->next_job = 0;
+	f->quit = 0;
+	f->md5_h[0] = 0x67452301;
+	f->md5_h[1] = 0xefcdab89;
+	f->md5_h[2] = 0x98badcfe;
+	f->md5_h[3] = 0x10325476;
+	f->md5_len = 0;
+	f->md5_conv = NULL;
+	f->samples = f->bytes_written = 0;
+	f->min_frame = 0xFFFFFF;
+	f->max_frame = 0;
+	f->point_count = 0;
+	f->point_spacing = sample_rate;
+	f->point_next = 0;
+	f->comment_bytes = 0;
+	f->comment_count = 0;
+	f->waits = 0;
+	f->result = MA_SUCCESS;
+	for (int i = 0; i < REC_FLAC_QUEUE; i++) {
+		f->queue[i].samples = NULL;
+		f->queue[i].bytes = NULL;
+	}
+	for (int i = 0; i < REC_FLAC_MAX_WORKERS; i++) memset(&f->scratch[i], 0, sizeof(f->scratch[i]));
+	if (f->bps == 0) return MA_FORMAT_NOT_SUPPORTED;
+	if (channels == 0 || channels > REC_FLAC_MAX_CHANNELS || sample_rate == 0 || sample_rate >= (1 << 20)) return MA_INVALID_ARGS;
+	if (workers > REC_FLAC_MAX_WORKERS) workers = REC_FLAC_MAX_WORKERS;
+	// Verbatim subframes, the side channel a bit wider, plus headers
+	const size_t frame_cap = 32 + (size_t)channels * (8 + 4 + ((size_t)REC_FLAC_BLOCK * (f->bps + 1) + 7) / 8);
+	for (int i = 0; i < REC_FLAC_QUEUE; i++) {
+		f->queue[i].samples = (ma_int32*)ma_malloc((size_t)REC_FLAC_BLOCK * channels * sizeof(ma_int32), NULL);
+		f->queue[i].bytes = (ma_uint8*)ma_malloc(frame_cap, NULL);
+		f->queue[i].frames = 0;
+		f->queue[i].state = REC_FLAC_FREE;
+		if (f->queue[i].samples == NULL || f->queue[i].bytes == NULL) {
+			rec_flac_uninit(f);
+			return MA_OUT_OF_MEMORY;
+		}
+	}
+	if (format == ma_format_u8) f->md5_conv = (ma_uint8*)ma_malloc((size_t)REC_FLAC_BLOCK * channels, NULL);
+	for (ma_uint32 i = 0; i < (workers > 0 ? workers : 1); i++) {
+		if (!rec_flac_scratch_alloc(&f->scratch[i], channels) || (format == ma_format_u8 && f->md5_conv == NULL)) {
+			rec_flac_uninit(f);
+			return MA_OUT_OF_MEMORY;
+		}
+	}
+	ma_uint8* meta = (ma_uint8*)ma_malloc(rec_flac_metadata_size(), NULL);
+	if (meta == NULL) {
+		rec_flac_uninit(f);
+		return MA_OUT_OF_MEMORY;
+	}
+	ma_uint8 md5[16];
+	memset(md5, 0, sizeof(md5));
+	f->header_bytes = rec_flac_metadata(f, meta, md5);
+	f->result = f->on_write(f->user, meta, f->header_bytes);
+	ma_free(meta, NULL);
+	if (f->result != MA_SUCCESS) {
+		ma_result result = f->result;
+		rec_flac_uninit(f);
+		return result;
+	}
+	for (ma_uint32 i = 0; i < workers; i++) f->workers[i] = std::thread(rec_flac_worker, f, &f->scratch[i]);
+	f->worker_count = workers;
+	return MA_SUCCESS;
+}
+
+static inline ma_result rec_flac_write(rec_flac* f, const void* frames, ma_uint64 count) {
+	/*
+	 * Interleaved frames in the stream's
+	 * format. Blocks until a queue slot is
+	 * free when the workers fall behind.
+	 */
+	const ma_uint32 ch = f->channels;
+	const ma_uint32 bps = ma_get_bytes_per_sample(f->format);
+	const ma_uint8* src = (const ma_uint8*)frames;
+	while (count > 0) {
+		while (f->tail - f->head >= REC_FLAC_QUEUE) rec_flac_drain(f, 1);
+		rec_flac_frame* fr = &f->queue[f->tail % REC_FLAC_QUEUE];
+		ma_uint32 n = REC_FLAC_BLOCK - fr->frames;
+		if (n > count) n = (ma_uint32)count;
+		// The hash wants signed samples: only u8 differs from the input
+		if (f->format == ma_format_u8) {
+			for (size_t i = 0; i < (size_t)n * ch; i++) f->md5_conv[i] = src[i] ^ 0x80;
+			rec_md5_update(f, f->md5_conv, (size_t)n * ch);
+		} else rec_md5_update(f, src, (size_t)n * ch * bps);
+		for (ma_uint32 c = 0; c < ch; c++) {
+			ma_int32* dst = fr->samples + (size_t)c * REC_FLAC_BLOCK + fr->frames;
+			const ma_uint8* s = src + (size_t)c * bps;
+			const size_t stride = (size_t)ch * bps;
+			if (f->format == ma_format_s16) {
+				for (ma_uint32 i = 0; i < n; i++, s += stride) dst[i] = (ma_int16)(s[0] | (s[1] << 8));
+			} else if (f->format == ma_format_s24) {
+				for (ma_uint32 i = 0; i < n; i++, s += stride) dst[i] = (ma_int32)(((ma_uint32)s[0] << 8) | ((ma_uint32)s[1] << 16) | ((ma_uint32)s[2] << 24)) >> 8;
+			} else {
+				for (ma_uint32 i = 0; i < n; i++, s += stride) dst[i] = (ma_int32)s[0] - 128;
+			}
+		}
+		fr->frames += n;
+		f->samples += n;
+		src += (size_t)n * ch * bps;
+		count -= n;
+		if (fr->frames == REC_FLAC_BLOCK) {
+			rec_flac_submit(f);
+			rec_flac_drain(f, 0);
+		}
+	}
+	return f->result;
+}
+
+static inline ma_result rec_flac_uninit(rec_flac* f) {
+	/*
+	 * Encodes the last, short block, waits
+	 * for every frame, stops the workers and
+	 * rewrites the metadata with the final
+	 * stream info, MD5 and seek table. Returns
+	 * the first error seen.
+	 */
+	if (f->queue[0].samples != NULL && f->result == MA_SUCCESS) {
+		if (f->queue[f->tail % REC_FLAC_QUEUE].frames > 0) rec_flac_submit(f);
+		while (f->head < f->tail) rec_flac_drain(f, 1);
+	}
+	{
+		std::lock_guard<std::mutex> guard(f->lock);
+		f->quit = 1;
+		f->work_cv.notify_all();
+	}
+	for (ma_uint32 i = 0; i < f->worker_count; i++) f->workers[i].join();
+	f->worker_count = 0;
+	if (f->queue[0].samples != NULL && f->result == MA_SUCCESS) {
+		ma_uint8 md5[16];
+		rec_md5_final(f, md5);
+		if (f->min_frame > f->max_frame) f->min_frame = f->max_frame;
+		ma_uint8* meta = (ma_uint8*)ma_malloc(rec_flac_metadata_size(), NULL);
+		if (meta == NULL) f->result = MA_OUT_OF_MEMORY;
+		else {
+			size_t size = rec_flac_metadata(f, meta, md5);
+			f->result = f->on_seek(f->user, 0);
+			if (f->result == MA_SUCCESS) f->result = f->on_write(f->user, meta, size);
+			ma_free(meta, NULL);
+		}
+	}
+	for (int i = 0; i < REC_FLAC_QUEUE; i++) {
+		ma_free(f->queue[i].samples, NULL);
+		ma_free(f->queue[i].bytes, NULL);
+		f->queue[i].samples = NULL;
+		f->queue[i].bytes = NULL;
+	}
+	for (int i = 0; i < REC_FLAC_MAX_WORKERS; i++) rec_flac_scratch_free(&f->scratch[i]);
+	ma_free(f->md5_conv, NULL);
+	f->md5_conv = NULL;
+	return f->result;
+}
+
+static inline ma_uint32 rec_flac_default_workers() {
+	/*
+	 * Encoding keeps up with real time on
+	 * one core for typical channel counts;
+	 * a few workers absorb bursts and high
+	 * rates without crowding the machine.
+	 */
+	unsigned cores = std::thread::hardware_concurrency();
+	if (cores <= 1) return 1;
+	return cores - 1 < 4 ? cores - 1 : 4;
+}
+
+#endif
@@ -0,0 +1,592 @@
+/*
+ * Loudness and true peak, as EBU R128 measures them
+ * (ITU-R BS.1770).
+ *
+ * A fan-out sink of its own measures each file while it
+ * records, so a take's figures are ready when it stops and
+ * need no second pass over the file. Unlike the analyzer
+ * it has to see every frame, so it runs under
+ * REC_DROP_NONE like the file's own sink; it costs far
+ * less than encoding, so it doesn't hold the writer up.
+ *
+ * Each channel goes through the K-weighting filter, the
+ * standard's shelf and high-pass designed for the actual
+ * rate, in double. The weighted power of every frame is
+ * summed into 100 ms sub-blocks: momentary loudness is the
+ * last 4 of them, short-term the last 30. Every momentary
+ * block, 400 ms overlapping by 75%, goes into a histogram
+ * of REC_LOUDNESS_BIN LU bins that keeps a count and the
+ * blocks' summed power, so the gated integrated loudness
+ * is one pass over the histogram, and memory doesn't grow
+ * with the take. Short-term blocks go into another one for
+ * the loudness range.
+ *
+ * True peak is the peak of the signal oversampled 4 times
+ * (twice from 96 kHz, not at all from 192 kHz) through a
+ * polyphase FIR. Each phase is worked out for a whole
+ * block, tap by tap, so the inner loop runs over
+ * consecutive frames for the compiler to vectorize.
+ *
+ * Figures are published to a rec_loudness_feed, a triple
+ * buffer like the level feed, after every block. At close
+ * the session writes the take's into its file: Vorbis
+ * comments in FLAC, a bext chunk in WAV.
+ */
+#ifndef REC_LOUDNESS_H
+#define REC_LOUDNESS_H
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+
+// Sub-block length; momentary and short-term windows are counted in them
+#define REC_LOUDNESS_SUB_MS 100
+#define REC_LOUDNESS_MOMENTARY 4
+#define REC_LOUDNESS_SHORT_TERM 30
+// Gates, LUFS and LU
+#define REC_LOUDNESS_ABSOLUTE -70.0
+#define REC_LOUDNESS_RELATIVE -10.0
+#define REC_LOUDNESS_RANGE_RELATIVE -20.0
+// Histogram bins, LU, from the absolute gate up
+#define REC_LOUDNESS_BIN 0.01
+#define REC_LOUDNESS_BINS 10000
+// Oversampling filter: taps per phase, and its Kaiser window
+#define REC_TRUE_PEAK_TAPS 12
+#define REC_TRUE_PEAK_BETA 6.0
+// A figure there isn't enough audio for yet
+#define REC_LOUDNESS_NONE (-INFINITY)
+
+typedef struct rec_loudness_frame {
+	ma_uint64 position;	// frames measured
+	// LUFS, or REC_LOUDNESS_NONE
+	float momentary;
+	float short_term;
+	float integrated;
+	float max_momentary;
+	float max_short_term;
+	float range;		// LU, or REC_LOUDNESS_NONE
+	float true_peak;	// dBTP, of the take so far
+} rec_loudness_frame;
+
+typedef struct rec_loudness_feed {
+	rec_loudness_frame slots[3];
+	std::atomic<ma_uint32> middle;	// slot index, | REC_METER_FRESH when unread
+	ma_uint32 back;
+	ma_uint32 front;
+} rec_loudness_feed;
+
+static inline void rec_loudness_feed_init(rec_loudness_feed* f) {
+	/*
+	 * Before any session feeds it, and never
+	 * while one does.
+	 */
+	for (int i = 0; i < 3; i++) {
+		rec_loudness_frame* r = &f->slots[i];
+		r->position = 0;
+		r->momentary = r->short_term = r->integrated = REC_LOUDNESS_NONE;
+		r->max_momentary = r->max_short_term = r->true_peak = r->range = REC_LOUDNESS_NONE;
+	}
+	f->back = 0;
+	f->middle.store(1);
+	f->front = 2;
+}
+
+static inline void rec_loudness_feed_publish(rec_loudness_feed* f) {
+	ma_uint32 old = f->middle.exchange(f->back | REC_METER_FRESH, std::memory_order_acq_rel);
+	f->back = old & 3;
+}
+
+static inline const rec_loudness_frame* rec_loudness_feed_read(rec_loudness_feed* f) {
+	/*
+	 * Reader: the newest figures published.
+	 * Valid until the next call.
+	 */
+	if (f->middle.load(std::memory_order_relaxed) & REC_METER_FRESH) {
+		ma_uint32 old = f->middle.exchange(f->front, std::memory_order_acq_rel);
+		f->front = old & 3;
+	}
+	return &f->slots[f->front];
+}
+
+typedef struct rec_loudness_histogram {
+	ma_uint32 count[REC_LOUDNESS_BINS];
+	double power[REC_LOUDNESS_BINS];
+} rec_loudness_histogram;
+
+/*
+ * The sink's side; only its thread touches it once the
+ * fan-out has started, and the figures stay readable
+ * after uninit.
+ */
+typedef struct rec_loudness {
+	rec_loudness_feed* feed;
+	ma_format format;
+	ma_uint32 channels;
+	ma_uint32 sample_rate;
+	float* weights;		// per channel
+	// K-weighting: shelf then high-pass, b0 b1 b2 a1 a2 each
+	double shelf[5];
+	double highpass[5];
+	double* state;		// 4 per channel
+	float* mix;		// a block as f32
+	float* planar;		// per channel, REC_TRUE_PEAK_TAPS - 1 of history then the block
+	float* power;		// weighted, per frame
+	float* acc;		// one phase, per frame
+	float* phases;		// factor * REC_TRUE_PEAK_TAPS, each phase's taps oldest first
+	ma_uint32 factor;
+	ma_uint32 max_frames;
+	ma_uint32 stride;	// of planar
+	ma_uint32 sub_frames;
+	ma_uint32 sub_fill;
+	double sub_sum;
+	double subs[REC_LOUDNESS_SHORT_TERM];	// mean power of the latest sub-blocks
+	ma_uint64 sub_count;
+	rec_loudness_histogram* gating;	// momentary blocks
+	rec_loudness_histogram* range;	// short-term blocks
+	float peak;		// linear
+	float momentary;
+	float short_term;
+	float max_momentary;
+	float max_short_term;
+	ma_uint64 position;
+	// Set at uninit, from the histograms
+	rec_loudness_frame final;
+} rec_loudness;
+
+static inline double rec_loudness_lufs(double power) {
+	return power > 0 ? -0.691 + 10.0 * log10(power) : REC_LOUDNESS_NONE;
+}
+
+static inline float rec_true_peak_db(float peak) {
+	return peak > 0 ? 20.0f * log10f(peak) : REC_LOUDNESS_NONE;
+}
+
+static inline void rec_loudness_weights(float* weights, ma_uint32 channels, ma_uint32 group) {
+	/*
+	 * BS.1770's weight per channel, from
+	 * miniaudio's standard map for group
+	 * channels, repeated for every group: the
+	 * LFE doesn't count, surrounds count 1.41.
+	 */
+	ma_channel map[MA_MAX_CHANNELS];
+	if (group == 0 || group > MA_MAX_CHANNELS) group = channels < MA_MAX_CHANNELS ? channels : MA_MAX_CHANNELS;
+	ma_channel_map_init_standard(ma_standard_channel_map_default, map, MA_MAX_CHANNELS, group);
+	for (ma_uint32 c = 0; c < channels; c++) {
+		ma_channel pos = group > 2 ? map[c % group] : (ma_channel)MA_CHANNEL_FRONT_LEFT;
+		if (pos == MA_CHANNEL_LFE) weights[c] = 0.0f;
+		else if (pos == MA_CHANNEL_SIDE_LEFT || pos == MA_CHANNEL_SIDE_RIGHT || pos == MA_CHANNEL_BACK_LEFT || pos == MA_CHANNEL_BACK_RIGHT) weights[c] = 1.41f;
+		else weights[c] = 1.0f;
+	}
+}
+
+static inline void rec_loudness_uninit(rec_loudness* l);
+
+static inline ma_result rec_loudness_init(rec_loudness* l, rec_loudness_feed* feed, ma_format format, ma_uint32 channels, ma_uint32 group, ma_uint32 sample_rate, ma_uint32 max_frames) {
+	/*
+	 * Everything is allocated and designed
+	 * here. group is the channels of one
+	 * input, which the weights repeat over;
+	 * max_frames is the most one block holds.
+	 */
+	const ma_uint32 taps = REC_TRUE_PEAK_TAPS;
+	memset(l, 0, sizeof(*l));
+	l->feed = feed;
+	l->format = format;
+	l->channels = channels;
+	l->sample_rate = sample_rate;
+	l->max_frames = max_frames;
+	l->factor = sample_rate < 96000 ? 4 : sample_rate < 192000 ? 2 : 1;
+	l->stride = taps - 1 + max_frames;
+	l->sub_frames = sample_rate * REC_LOUDNESS_SUB_MS / 1000;
+	l->peak = 0;
+	l->momentary = l->short_term = l->max_momentary = l->max_short_term = REC_LOUDNESS_NONE;
+	l->final.momentary = l->final.short_term = l->final.integrated = REC_LOUDNESS_NONE;
+	l->final.max_momentary = l->final.max_short_term = l->final.true_peak = l->final.range = REC_LOUDNESS_NONE;
+	if (channels == 0 || l->sub_frames == 0) return MA_INVALID_ARGS;
+	l->weights = (float*)ma_malloc(channels * sizeof(float), NULL);
+	l->state = (double*)ma_malloc((size_t)channels * 4 * sizeof(double), NULL);
+	l->mix = (float*)ma_malloc((size_t)max_frames * channels * sizeof(float), NULL);
+	l->planar = (float*)ma_malloc((size_t)l->stride * channels * sizeof(float), NULL);
+	l->power = (float*)ma_malloc(max_frames * sizeof(float), NULL);
+	l->acc = (float*)ma_malloc(max_frames * sizeof(float), NULL);
+	l->phases = (float*)ma_malloc(l->factor * taps * sizeof(float), NULL);
+	l->gating = (rec_loudness_histogram*)ma_malloc(sizeof(rec_loudness_histogram), NULL);
+	l->range = (rec_loudness_histogram*)ma_malloc(sizeof(rec_loudness_histogram), NULL);
+	if (l->weights == NULL || l->state == NULL || l->mix == NULL || l->planar == NULL || l->power == NULL || l->acc == NULL ||
+		l->phases == NULL || l->gating == NULL || l->range == NULL) {
+		rec_loudness_uninit(l);
+		return MA_OUT_OF_MEMORY;
+	}
+	memset(l->state, 0, (size_t)channels * 4 * sizeof(double));
+	memset(l->planar, 0, (size_t)l->stride * channels * sizeof(float));
+	memset(l->gating, 0, sizeof(rec_loudness_histogram));
+	memset(l->range, 0, sizeof(rec_loudness_histogram));
+	rec_loudness_weights(l->weights, channels, group);
+	/*
+	 * The K-weighting pair, as BS.1770 gives
+	 * it at 48 kHz, redesigned for the rate.
+	 */
+	const double pi = 3.14159265358979323846;
+	double K = tan(pi * 1681.974450955533 / sample_rate);
+	double Q = 0.7071752369554196;
+	const double Vh = pow(10.0, 3.999843853973347 / 20.0);
+	const double Vb = pow(Vh, 0.4996667741545416);
+	double a0 = 1.0 + K / Q + K * K;
+	l->shelf[0] = (Vh + Vb * K / Q + K * K) / a0;
+	l->shelf[1] = 2.0 * (K * K - Vh) / a0;
+	l->shelf[2] = (Vh - Vb * K / Q + K * K) / a0;
+	l->shelf[3] = 2.0 * (K * K - 1.0) / a0;
+	l->shelf[4] = (1.0 - K / Q + K * K) / a0;
+	K = tan(pi * 38.13547087602444 / sample_rate);
+	Q = 0.5003270373238773;
+	a0 = 1.0 + K / Q + K * K;
+	l->highpass[0] = 1.0;
+	l->highpass[1] = -2.0;
+	l->highpass[2] = 1.0;
+	l->highpass[3] = 2.0 * (K * K - 1.0) / a0;
+	l->highpass[4] = (1.0 - K / Q + K * K) / a0;
+	/*
+	 * The oversampling filter: a Kaiser-
+	 * windowed sinc cut off at the input's
+	 * Nyquist frequency, split into phases.
+	 * Each phase is stored reversed, oldest
+	 * sample's tap first, and scaled to unit
+	 * gain.
+	 */
+	const ma_uint32 length = l->factor * taps;
+	const double i0_beta = rec_bessel_i0(REC_TRUE_PEAK_BETA);
+	for (ma_uint32 p = 0; p < l->factor; p++) {
+		double sum = 0;
+		for (ma_uint32 k = 0; k < taps; k++) {
+			const ma_uint32 i = p + l->factor * (taps - 1 - k);
+			const double t = (i - (length - 1) / 2.0) / l->factor;
+			const double r = 2.0 * i / (length - 1) - 1.0;
+			const double h = (t == 0 ? 1.0 : sin(pi * t) / (pi * t)) * rec_bessel_i0(REC_TRUE_PEAK_BETA * sqrt(1.0 - r * r)) / i0_beta;
+			l->phases[p * taps + k] = (float)h;
+			sum += h;
+		}
+		for (ma_uint32 k = 0; k < taps; k++) l->phases[p * taps + k] = (float)(l->phases[p * taps + k] / sum);
+	}
+	return MA_SUCCESS;
+}
+
+static inline void rec_loudness_histogram_add(rec_loudness_histogram* h, double power) {
+	/*
+	 * A block that passes the absolute gate.
+	 */
+	const double lufs = rec_loudness_lufs(power);
+	if (lufs < REC_LOUDNESS_ABSOLUTE) return;
+	double bin = (lufs - REC_LOUDNESS_ABSOLUTE) / REC_LOUDNESS_BIN;
+	const ma_uint32 i = bin < REC_LOUDNESS_BINS - 1 ? (ma_uint32)bin : REC_LOUDNESS_BINS - 1;
+	h->count[i]++;
+	h->power[i] += power;
+}
+
+static inline ma_uint32 rec_loudness_gate(const rec_loudness_histogram* h, double relative) {
+	/*
+	 * The first bin at or above the relative
+	 * gate: the mean power of every block,
+	 * less relative LU. REC_LOUDNESS_BINS
+	 * with no blocks.
+	 */
+	ma_uint64 count = 0;
+	double power = 0;
+	for (ma_uint32 i = 0; i < REC_LOUDNESS_BINS; i++) {
+		count += h->count[i];
+		power += h->power[i];
+	}
+	if (count == 0) return REC_LOUDNESS_BINS;
+	const double gate = rec_loudness_lufs(power / count) + relative;
+	const double bin = ceil((gate - REC_LOUDNESS_ABSOLUTE) / REC_LOUDNESS_BIN);
+	return bin <= 0 ? 0 : bin >= REC_LOUDNESS_BINS ? REC_LOUDNESS_BINS - 1 : (ma_uint32)bin;
+}
+
+static inline float rec_loudness_integrated(const rec_loudness_histogram* h) {
+	const ma_uint32 first = rec_loudness_gate(h, REC_LOUDNESS_RELATIVE);
+	ma_uint64 count = 0;
+	double power = 0;
+	for (ma_uint32 i = first; i < REC_LOUDNESS_BINS; i++) {
+		count += h->count[i];
+		power += h->power[i];
+	}
+	return count > 0 ? (float)rec_loudness_lufs(power / count) : REC_LOUDNESS_NONE;
+}
+
+static inline float rec_loudness_range(const rec_loudness_histogram* h) {
+	/*
+	 * EBU Tech 3342: from the 10th to the 95th
+	 * percentile of the gated short-term
+	 * blocks.
+	 */
+	const ma_uint32 first = rec_loudness_gate(h, REC_LOUDNESS_RANGE_RELATIVE);
+	ma_uint64 count = 0;
+	for (ma_uint32 i = first; i < REC_LOUDNESS_BINS; i++) count += h->count[i];
+	if (count == 0) return REC_LOUDNESS_NONE;
+	const double low = 0.10 * count, high = 0.95 * count;
+	ma_uint64 seen = 0;
+	ma_uint32 lo = REC_LOUDNESS_BINS, hi = first;
+	for (ma_uint32 i = first; i < REC_LOUDNESS_BINS; i++) {
+		if (h->count[i] == 0) continue;
+		seen += h->count[i];
+		if (lo == REC_LOUDNESS_BINS && seen > low) lo = i;
+		hi = i;
+		if (seen >= high) break;
+	}
+	return (float)((hi - lo) * REC_LOUDNESS_BIN);
+}
+
+static inline void rec_loudness_result(const rec_loudness* l, rec_loudness_frame* out) {
+	out->position = l->position;
+	out->momentary = l->momentary;
+	out->short_term = l->short_term;
+	out->max_momentary = l->max_momentary;
+	out->max_short_term = l->max_short_term;
+	out->integrated = rec_loudness_integrated(l->gating);
+	out->range = rec_loudness_range(l->range);
+	out->true_peak = rec_true_peak_db(l->peak);
+}
+
+static inline void rec_loudness_uninit(rec_loudness* l) {
+	/*
+	 * The take's figures go to final first,
+	 * for the file's tags and the report.
+	 */
+	if (l->gating != NULL && l->range != NULL) rec_loudness_result(l, &l->final);
+	void** buffers[] = {(void**)&l->weights, (void**)&l->state, (void**)&l->mix, (void**)&l->planar, (void**)&l->power, (void**)&l->acc,
+		(void**)&l->phases, (void**)&l->gating, (void**)&l->range};
+	for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++) {
+		ma_free(*buffers[i], NULL);
+		*buffers[i] = NULL;
+	}
+}
+
+static inline float rec_loudness_peak(const float* x, ma_uint32 count) {
+	/*
+	 * Largest magnitude, over 8 lanes.
+	 */
+	float lanes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	ma_uint32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		for (ma_uint32 j = 0; j < 8; j++) {
+			float v = fabsf(x[i + j]);
+			lanes[j] = v > lanes[j] ? v : lanes[j];
+		}
+	}
+	float peak = 0;
+	for (ma_uint32 j = 0; j < 8; j++) peak = lanes[j] > peak ? lanes[j] : peak;
+	for (; i < count; i++) peak = fabsf(x[i]) > peak ? fabsf(x[i]) : peak;
+	return peak;
+}
+
+static inline void rec_loudness_sub_block(rec_loudness* l) {
+	/*
+	 * A sub-block is complete: the momentary
+	 * and short-term windows move on by one.
+	 */
+	const double mean = l->sub_sum / l->sub_frames;
+	l->subs[l->sub_count % REC_LOUDNESS_SHORT_TERM] = mean;
+	l->sub_count++;
+	l->sub_sum = 0;
+	l->sub_fill = 0;
+	if (l->sub_count >= REC_LOUDNESS_MOMENTARY) {
+		double power = 0;
+		for (ma_uint64 i = l->sub_count - REC_LOUDNESS_MOMENTARY; i < l->sub_count; i++) power += l->subs[i % REC_LOUDNESS_SHORT_TERM];
+		power /= REC_LOUDNESS_MOMENTARY;
+		l->momentary = (float)rec_loudness_lufs(power);
+		if (l->momentary > l->max_momentary) l->max_momentary = l->momentary;
+		rec_loudness_histogram_add(l->gating, power);
+	}
+	if (l->sub_count >= REC_LOUDNESS_SHORT_TERM) {
+		double power = 0;
+		for (ma_uint32 i = 0; i < REC_LOUDNESS_SHORT_TERM; i++) power += l->subs[i];
+		power /= REC_LOUDNESS_SHORT_TERM;
+		l->short_term = (float)rec_loudness_lufs(power);
+		if (l->short_term > l->max_short_term) l->max_short_term = l->short_term;
+		rec_loudness_histogram_add(l->range, power);
+	}
+}
+
+static inline void rec_loudness_consume(void* user, const rec_block* b) {
+	/*
+	 * Loudness sink: the block, a channel at
+	 * a time, through the oversampler and the
+	 * K-weighting, then the sub-blocks it
+	 * completes, then the figures published.
+	 */
+	rec_loudness* l = (rec_loudness*)user;
+	const ma_uint32 ch = l->channels, taps = REC_TRUE_PEAK_TAPS, frames = b->frames;
+	if (frames == 0) return;
+	ma_pcm_convert(l->mix, ma_format_f32, b->data, l->format, (ma_uint64)frames * ch, ma_dither_mode_none);
+	for (ma_uint32 c = 0; c < ch; c++) {
+		float* x = l->planar + (size_t)c * l->stride;
+		float* block = x + taps - 1;
+		for (ma_uint32 f = 0; f < frames; f++) block[f] = l->mix[(size_t)f * ch + c];
+		// The samples themselves, then between them
+		float peak = rec_loudness_peak(block, frames);
+		if (l->factor > 1) {
+			for (ma_uint32 p = 0; p < l->factor; p++) {
+				const float* h = l->phases + p * taps;
+				for (ma_uint32 f = 0; f < frames; f++) l->acc[f] = h[0] * x[f];
+				for (ma_uint32 k = 1; k < taps; k++) {
+					const float g = h[k];
+					const float* src = x + k;
+					for (ma_uint32 f = 0; f < frames; f++) l->acc[f] += g * src[f];
+				}
+				float q = rec_loudness_peak(l->acc, frames);
+				peak = q > peak ? q : peak;
+			}
+		}
+		if (peak > l->peak) l->peak = peak;
+		/*
+		 * Both biquads in one pass, transposed
+		 * direct form II, squared and weighted
+		 * into the frame's power.
+		 */
+		const float w = l->weights[c];
+		double* z = l->state + (size_t)c * 4;
+		const double* s = l->shelf;
+		const double* hp = l->highpass;
+		double z0 = z[0], z1 = z[1], z2 = z[2], z3 = z[3];
+		for (ma_uint32 f = 0; f < frames; f++) {
+			const double in = block[f];
+			const double y = s[0] * in + z0;
+			z0 = s[1] * in - s[3] * y + z1;
+			z1 = s[2] * in - s[4] * y;
+			const double v = hp[0] * y + z2;
+			z2 = hp[1] * y - hp[3] * v + z3;
+			z3 = hp[2] * y - hp[4] * v;
+			const float e = (float)(v * v) * w;
+			l->power[f] = c == 0 ? e : l->power[f] + e;
+		}
+		z[0] = z0;
+		z[1] = z1;
+		z[2] = z2;
+		z[3] = z3;
+		// The block's tail is the next one's history
+		memmove(x, x + frames, (taps - 1) * sizeof(float));
+	}
+	ma_uint32 f = 0;
+	while (f < frames) {
+		ma_uint32 take = l->sub_frames - l->sub_fill;
+		if (take > frames - f) take = frames - f;
+		double sum = 0;
+		for (ma_uint32 i = 0; i < take; i++) sum += l->power[f + i];
+		l->sub_sum += sum;
+		l->sub_fill += take;
+		f += take;
+		if (l->sub_fill == l->sub_frames) rec_loudness_sub_block(l);
+	}
+	l->position = b->position + frames;
+	if (l->feed == NULL) return;
+	rec_loudness_result(l, &l->feed->slots[l->feed->back]);
+	rec_loudness_feed_publish(l->feed);
+}
+
+static inline void rec_loudness_report(const rec_loudness* l, const char* prefix) {
+	/*
+	 * The take's figures, after uninit.
+	 */
+	const rec_loudness_frame* r = &l->final;
+	if (r->position == 0) return;
+	printf("%sloudness %.1f LUFS integrated, range %.1f LU, true peak %.1f dBTP, short-term up to %.1f LUFS\n", prefix,
+		r->integrated, r->range, r->true_peak, r->max_short_term);
+}
+
+static inline ma_result rec_loudness_comments(const rec_loudness_frame* r, rec_flac* f) {
+	/*
+	 * The figures as Vorbis comments, before
+	 * the FLAC stream is closed; any there
+	 * isn't audio enough for are left out.
+	 */
+	const struct {
+		const char* name;
+		float value;
+		const char* unit;
+	} tags[] = {
+		{"LOUDNESS_INTEGRATED", r->integrated, "LUFS"},
+		{"LOUDNESS_RANGE", r->range, "LU"},
+		{"LOUDNESS_TRUE_PEAK", r->true_peak, "dBTP"},
+		{"LOUDNESS_MAX_MOMENTARY", r->max_momentary, "LUFS"},
+		{"LOUDNESS_MAX_SHORT_TERM", r->max_short_term, "LUFS"},
+	};
+	for (size_t i = 0; i < sizeof(tags) / sizeof(tags[0]); i++) {
+		if (!isfinite(tags[i].value)) continue;
+		char value[32];
+		snprintf(value, sizeof(value), "%.1f %s", tags[i].value, tags[i].unit);
+		ma_result result = rec_flac_comment(f, tags[i].name, value);
+		if (result != MA_SUCCESS) return result;
+	}
+	return MA_SUCCESS;
+}
+
+static inline ma_int64 rec_loudness_file_size(FILE* f) {
+	/*
+	 * Seeks to the end; -1 on failure. In
+	 * 64 bits, as long is 32 on Windows.
+	 */
+#if defined(_WIN32)
+	if (_fseeki64(f, 0, SEEK_END) != 0) return -1;
+	return _ftelli64(f);
+#else
+	if (fseeko(f, 0, SEEK_END) != 0) return -1;
+	return ftello(f);
+#endif
+}
+
+static inline ma_result rec_loudness_write_bext(const char* path, const rec_loudness_frame* r) {
+	/*
+	 * Appends a BWF bext chunk (version 2,
+	 * with the loudness fields) to a closed
+	 * WAV file and grows its RIFF size to
+	 * match. Values are hundredths, 0x7FFF
+	 * for none. A file whose RIFF size
+	 * doesn't end at the end of the file is
+	 * left alone.
+	 */
+	const ma_uint8 pad = 0;
+	const size_t size = 602;
+	ma_uint8 chunk[8 + 602];
+	memset(chunk, 0, sizeof(chunk));
+	memcpy(chunk, "bext", 4);
+	for (int b = 0; b < 4; b++) chunk[4 + b] = (ma_uint8)(size >> (8 * b));
+	ma_uint8* p = chunk + 8;
+	// Description, then the originator
+	memcpy(p + 256, "recorder", 8);
+	p[346] = 2;
+	const float values[] = {r->integrated, r->range, r->true_peak, r->max_momentary, r->max_short_term};
+	for (int i = 0; i < 5; i++) {
+		ma_int16 v = 0x7FFF;
+		if (isfinite(values[i]) && fabsf(values[i]) < 327.0f) v = (ma_int16)lrintf(values[i] * 100.0f);
+		p[412 + 2 * i] = (ma_uint8)((ma_uint16)v & 0xFF);
+		p[413 + 2 * i] = (ma_uint8)((ma_uint16)v >> 8);
+	}
+	FILE* file = fopen(path, "r+b");
+	if (file == NULL) return rec_result_from_errno(errno);
+	ma_result result = MA_SUCCESS;
+	ma_uint8 riff[12];
+	ma_int64 length = 0;
+	if (fread(riff, 1, 12, file) != 12 || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) result = MA_INVALID_FILE;
+	else if ((length = rec_loudness_file_size(file)) < 0) result = MA_IO_ERROR;
+	if (result == MA_SUCCESS) {
+		const ma_uint32 declared = riff[4] | (riff[5] << 8) | (riff[6] << 16) | ((ma_uint32)riff[7] << 24);
+		if ((ma_uint64)declared + 8 != (ma_uint64)length) result = MA_INVALID_FILE;
+		else if ((ma_uint64)length + 1 + sizeof(chunk) - 8 > 0xFFFFFFFFu) result = MA_TOO_BIG;
+	}
+	// Chunks start on even offsets
+	if (result == MA_SUCCESS && (length & 1)) {
+		if (fwrite(&pad, 1, 1, file) != 1) result = MA_IO_ERROR;
+		length++;
+	}
+	if (result == MA_SUCCESS && fwrite(chunk, 1, sizeof(chunk), file) != sizeof(chunk)) result = MA_IO_ERROR;
+	if (result == MA_SUCCESS) {
+		const ma_uint32 declared = (ma_uint32)(length + sizeof(chunk) - 8);
+		for (int b = 0; b < 4; b++) riff[4 + b] = (ma_uint8)(declared >> (8 * b));
+		if (fseek(file, 4, SEEK_SET) != 0 || fwrite(riff + 4, 1, 4, file) != 4) result = MA_IO_ERROR;
+	}
+	if (fclose(file) != 0 && result == MA_SUCCESS) result = MA_IO_ERROR;
+	return result;
+}
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * Level metering for the UI.
+ *
+ * A session's writer threads meter every chunk they take
+ * from the rings: peak, RMS and the count of clipped
+ * samples per channel. Nothing is measured in the audio
+ * callback. Every REC_METER_PERIOD_MS of audio the levels
+ * are published to a rec_level_feed, a triple buffer the
+ * UI reads without locks or allocation: the writer fills
+ * its own slot and swaps it with the middle one; the
+ * reader swaps the middle one with its own only when it
+ * holds something newer.
+ *
+ * Feeds belong to the caller, so the UI can keep reading
+ * one after the session that fed it is gone.
+ *
+ * The meter also feeds a rec_wave overview, if given one,
+ * from the same f32 copy of each chunk.
+ */
+#ifndef REC_METER_H
+#define REC_METER_H
+
+#include <math.h>
+#include <string.h>
+#include <atomic>
+
+// Channels metered per input; any beyond are not
+#define REC_METER_CHANNELS 32
+#define REC_METER_PERIOD_MS 20
+// Fall of the held peak, as a type I PPM: 20 dB in 1.7 s
+#define REC_METER_RELEASE_DB 11.76
+// Marks the middle slot as not yet read
+#define REC_METER_FRESH 4u
+
+typedef struct rec_levels {
+	ma_uint32 channels;
+	ma_uint64 position;	// frames metered, at the end of the period
+	// Over the last period, full scale being 1
+	float peak[REC_METER_CHANNELS];
+	float rms[REC_METER_CHANNELS];
+	// Peak with an instant attack and slow release, for readers that poll less often
+	float held[REC_METER_CHANNELS];
+	// Clipped samples since the session started
+	ma_uint64 clips[REC_METER_CHANNELS];
+} rec_levels;
+
+typedef struct rec_level_feed {
+	rec_levels slots[3];
+	std::atomic<ma_uint32> middle;	// slot index, | REC_METER_FRESH when unread
+	ma_uint32 back;		// the writer's slot
+	ma_uint32 front;	// the reader's slot
+} rec_level_feed;
+
+static inline void rec_level_feed_init(rec_level_feed* f) {
+	/*
+	 * Before any session feeds it, and never
+	 * while one does.
+	 */
+	memset(f->slots, 0, sizeof(f->slots));
+	f->back = 0;
+	f->middle.store(1);
+	f->front = 2;
+}
+
+static inline void rec_level_feed_publish(rec_level_feed* f) {
+	/*
+	 * Writer: hands over the back slot and
+	 * takes whichever the middle held.
+	 */
+	ma_uint32 old = f->middle.exchange(f->back | REC_METER_FRESH, std::memory_order_acq_rel);
+	f->back = old & 3;
+}
+
+static inline const rec_levels* rec_level_feed_read(rec_level_feed* f) {
+	/*
+	 * Reader: the newest levels published.
+	 * Valid until the next call.
+	 */
+	if (f->middle.load(std::memory_order_relaxed) & REC_METER_FRESH) {
+		ma_uint32 old = f->middle.exchange(f->front, std::memory_order_acq_rel);
+		f->front = old & 3;
+	}
+	return &f->slots[f->front];
+}
+
+/*
+ * The writer side: sums for the period in progress.
+ */
+typedef struct rec_meter {
+	rec_level_feed* feed;
+	rec_wave* wave;
+	ma_format format;
+	ma_uint32 channels;	// in the audio
+	ma_uint32 metered;	// at most REC_METER_CHANNELS
+	float clip_level;	// the format's largest magnitude, less a step
+	ma_uint32 period;
+	float release;		// per frame, as the log of a gain
+	ma_uint32 fill;
+	ma_uint64 position;
+	float* scratch;		// a chunk as f32
+	ma_uint32 scratch_frames;
+	float peak[REC_METER_CHANNELS];
+	float held[REC_METER_CHANNELS];
+	double sum_sq[REC_METER_CHANNELS];
+	ma_uint64 clips[REC_METER_CHANNELS];
+} rec_meter;
+
+static inline void rec_meter_uninit(rec_meter* m) {
+	ma_free(m->scratch, NULL);
+	m->scratch = NULL;
+	m->feed = NULL;
+	m->wave = NULL;
+}
+
+static inline ma_result rec_meter_init(rec_meter* m, rec_level_feed* feed, rec_wave* wave, ma_format format, ma_uint32 channels, ma_uint32 sample_rate, ma_uint32 max_frames) {
+	/*
+	 * max_frames is the most one call to
+	 * rec_meter_push() takes. Either the feed
+	 * or the wave may be NULL; with neither,
+	 * nothing is metered.
+	 */
+	memset(m, 0, sizeof(*m));
+	if (feed == NULL && wave == NULL) return MA_SUCCESS;
+	m->format = format;
+	m->channels = channels;
+	m->metered = channels < REC_METER_CHANNELS ? channels : REC_METER_CHANNELS;
+	m->period = sample_rate * REC_METER_PERIOD_MS / 1000;
+	if (m->period == 0) m->period = 1;
+	m->release = (float)(-REC_METER_RELEASE_DB / 20.0 * log(10.0) / sample_rate);
+	switch (format) {
+	case ma_format_u8: m->clip_level = 127.0f / 128; break;
+	case ma_format_s16: m->clip_level = 32767.0f / 32768; break;
+	case ma_format_s24: m->clip_level = 8388607.0f / 8388608; break;
+	// s32 converts to f32 a little short of full scale
+	case ma_format_s32: m->clip_level = 0.99999f; break;
+	default: m->clip_level = 1.0f; break;
+	}
+	if (format != ma_format_f32) {
+		m->scratch = (float*)ma_malloc((size_t)max_frames * channels * sizeof(float), NULL);
+		if (m->scratch == NULL) return MA_OUT_OF_MEMORY;
+		m->scratch_frames = max_frames;
+	}
+	m->feed = feed;
+	m->wave = wave;
+	return MA_SUCCESS;
+}
+
+static inline void rec_meter_kernel(const float* x, ma_uint32 samples, ma_uint32 channels, float clip_level, float* peak, double* sum_sq, ma_uint64* clips) {
+	/*
+	 * Interleaved samples. The main loop runs
+	 * over lanes of 8 frames' worth, so every
+	 * lane keeps to one channel and the inner
+	 * loop is contiguous for the compiler to
+	 * vectorize. Lanes fold into channels at
+	 * the end.
+	 */
+	float lane_peak[8 * REC_METER_CHANNELS];
+	float lane_sq[8 * REC_METER_CHANNELS];
+	float lane_clips[8 * REC_METER_CHANNELS];
+	const ma_uint32 width = 8 * channels;
+	for (ma_uint32 j = 0; j < width; j++) {
+		lane_peak[j] = 0;
+		lane_sq[j] = 0;
+		lane_clips[j] = 0;
+	}
+	ma_uint32 i = 0;
+	for (; i + width <= samples; i += width) {
+		const float* p = x + i;
+		for (ma_uint32 j = 0; j < width; j++) {
+			float a = fabsf(p[j]);
+			lane_peak[j] = a > lane_peak[j] ? a : lane_peak[j];
+			lane_sq[j] += p[j] * p[j];
+			lane_clips[j] += a >= clip_level ? 1.0f : 0.0f;
+		}
+	}
+	for (ma_uint32 j = 0; j < width; j++) {
+		ma_uint32 c = j % channels;
+		if (lane_peak[j] > peak[c]) peak[c] = lane_peak[j];
+		sum_sq[c] += lane_sq[j];
+		clips[c] += (ma_uint64)lane_clips[j];
+	}
+	// The partial lane at the end
+	for (ma_uint32 j = 0; i + j < samples; j++) {
+		ma_uint32 c = j % channels;
+		float a = fabsf(x[i + j]);
+		if (a > peak[c]) peak[c] = a;
+		sum_sq[c] += (double)x[i + j] * x[i + j];
+		if (a >= clip_level) clips[c]++;
+	}
+}
+
+static inline void rec_meter_push(rec_meter* m, const void* frames, ma_uint32 count) {
+	/*
+	 * Writer thread: meters count interleaved
+	 * frames in the input's format, publishing
+	 * whenever a period completes.
+	 */
+	if ((m->feed == NULL && m->wave == NULL) || count == 0) return;
+	const float* x = (const float*)frames;
+	if (m->format != ma_format_f32) {
+		if (count > m->scratch_frames) count = m->scratch_frames;
+		ma_pcm_convert(m->scratch, ma_format_f32, frames, m->format, (ma_uint64)count * m->channels, ma_dither_mode_none);
+		x = m->scratch;
+	}
+	rec_wave_push(m->wave, x, count, m->channels);
+	if (m->feed == NULL) return;
+	if (m->channels <= REC_METER_CHANNELS) rec_meter_kernel(x, count * m->channels, m->channels, m->clip_level, m->peak, m->sum_sq, m->clips);
+	else {
+		// Wide inputs: the first channels only, a frame at a time
+		for (ma_uint32 f = 0; f < count; f++) {
+			rec_meter_kernel(x + (size_t)f * m->channels, m->metered, m->metered, m->clip_level, m->peak, m->sum_sq, m->clips);
+		}
+	}
+	m->fill += count;
+	m->position += count;
+	if (m->fill < m->period) return;
+	rec_level_feed* feed = m->feed;
+	rec_levels* l = &feed->slots[feed->back];
+	l->channels = m->metered;
+	l->position = m->position;
+	// Chunks may overrun the period, so the release follows what was metered
+	const float release = expf(m->release * m->fill);
+	for (ma_uint32 c = 0; c < m->metered; c++) {
+		m->held[c] = m->peak[c] > m->held[c] * release ? m->peak[c] : m->held[c] * release;
+		l->peak[c] = m->peak[c];
+		l->held[c] = m->held[c];
+		l->rms[c] = (float)sqrt(m->sum_sq[c] / m->fill);
+		l->clips[c] = m->clips[c];
+		m->peak[c] = 0;
+		m->sum_sq[c] = 0;
+	}
+	m->fill = 0;
+	rec_level_feed_publish(feed);
+}
+
+static inline float rec_level_db(float level) {
+	/*
+	 * dBFS, floored at -120 for silence.
+	 */
+	return level > 1e-6f ? 20.0f * log10f(level) : -120.0f;
+}
+
+#endif
@@ -0,0 +1,385 @@
+/*
+ * Peak files (.peaks): the rec_wave pyramid of a recording,
+ * saved next to it as "take.wav.peaks".
+ *
+ * A session with peaks on writes one at close from the
+ * pyramid its writers built while recording, so it costs
+ * no reading. Opening a recording loads the sidecar if it
+ * is there and still matches the file's size. Otherwise
+ * the file is scanned in parallel, each worker decoding
+ * its own span into level 0 buckets, and the sidecar is
+ * written for next time.
+ *
+ * Layout, little-endian:
+ *   header  REC_PEAKS_HEADER bytes: magic, version,
+ *           lanes, channels, levels, rate, frames per
+ *           level 0 bucket, factor, and the size of the
+ *           recording it describes
+ *   table   per lane: frames, then the bucket count of
+ *           every level
+ *   buckets per lane, per level: min, max and RMS as
+ *           16-bit, full scale 32767
+ *
+ * A lane is an input. A merged file has one per input;
+ * any other has one, its channels folded together, as has
+ * a merged file scanned without its sidecar.
+ */
+#ifndef REC_PEAKS_H
+#define REC_PEAKS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define REC_PEAKS_MAGIC "RCPK"
+#define REC_PEAKS_VERSION 1
+#define REC_PEAKS_HEADER 32
+// Frames a scanning worker decodes per read
+#define REC_PEAKS_CHUNK 16384
+// Least a scanning worker is given, in level 0 buckets
+#define REC_PEAKS_MIN_SPAN 256
+
+typedef struct rec_peaks_info {
+	ma_uint32 lanes;
+	ma_uint32 channels;
+	ma_uint32 sample_rate;
+	ma_uint64 frames;
+	int scanned;		// built from the audio, not loaded
+} rec_peaks_info;
+
+static inline std::string rec_peaks_path(const char* path) {
+	return std::string(path) + ".peaks";
+}
+
+static inline ma_uint64 rec_peaks_file_bytes(const char* path) {
+	/*
+	 * 0 if it can't be found.
+	 */
+#if defined(_WIN32)
+	struct _stat64 st;
+	if (_stat64(path, &st) != 0) return 0;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0) return 0;
+#endif
+	return (ma_uint64)st.st_size;
+}
+
+static inline ma_result rec_peaks_write(const char* path, rec_wave* const* waves, ma_uint32 lanes, ma_uint32 channels, ma_uint32 sample_rate) {
+	/*
+	 * The sidecar of the closed recording at
+	 * path, from its lanes' waves, complete
+	 * and flushed. Written to a temporary
+	 * name first, so a reader never finds
+	 * half of one.
+	 */
+	const ma_uint64 audio_bytes = rec_peaks_file_bytes(path);
+	if (audio_bytes == 0) return MA_DOES_NOT_EXIST;
+	std::vector<ma_uint8> head(REC_PEAKS_HEADER + (size_t)lanes * (1 + REC_WAVE_LEVELS) * 8);
+	ma_uint8* h = head.data();
+	memcpy(h, REC_PEAKS_MAGIC, 4);
+	rec_archive_put(h, 4, REC_PEAKS_VERSION, 2);
+	rec_archive_put(h, 6, lanes, 2);
+	rec_archive_put(h, 8, channels, 2);
+	rec_archive_put(h, 10, REC_WAVE_LEVELS, 2);
+	rec_archive_put(h, 12, sample_rate, 4);
+	rec_archive_put(h, 16, REC_WAVE_BASE, 4);
+	rec_archive_put(h, 20, REC_WAVE_FACTOR, 4);
+	rec_archive_put(h, 24, audio_bytes, 8);
+	size_t pos = REC_PEAKS_HEADER;
+	for (ma_uint32 i = 0; i < lanes; i++) {
+		rec_archive_put(h, pos, waves[i]->frames, 8);
+		pos += 8;
+		for (ma_uint32 k = 0; k < REC_WAVE_LEVELS; k++, pos += 8) rec_archive_put(h, pos, rec_wave_count(waves[i], k), 8);
+	}
+	const std::string final_path = rec_peaks_path(path);
+	const std::string temp_path = final_path + ".part";
+	FILE* file = fopen(temp_path.c_str(), "wb");
+	if (file == NULL) return MA_ACCESS_DENIED;
+	int ok = fwrite(h, 1, head.size(), file) == head.size();
+	ma_uint8 page[REC_WAVE_PAGE * 6];
+	for (ma_uint32 i = 0; i < lanes && ok; i++) {
+		for (ma_uint32 k = 0; k < REC_WAVE_LEVELS && ok; k++) {
+			const ma_uint64 count = rec_wave_count(waves[i], k);
+			for (ma_uint64 first = 0; first < count && ok; first += REC_WAVE_PAGE) {
+				const ma_uint64 n = count - first < REC_WAVE_PAGE ? count - first : REC_WAVE_PAGE;
+				const rec_wave_bucket* b = rec_wave_at(waves[i], k, first);
+				for (ma_uint64 j = 0; j < n; j++) {
+					rec_archive_put(page, j * 6, (ma_uint16)b[j].min, 2);
+					rec_archive_put(page, j * 6 + 2, (ma_uint16)b[j].max, 2);
+					rec_archive_put(page, j * 6 + 4, (ma_uint16)b[j].rms, 2);
+				}
+				ok = fwrite(page, 6, (size_t)n, file) == n;
+			}
+		}
+	}
+	if (fclose(file) != 0) ok = 0;
+	remove(final_path.c_str());
+	if (!ok || rename(temp_path.c_str(), final_path.c_str()) != 0) {
+		remove(temp_path.c_str());
+		return MA_IO_ERROR;
+	}
+	return MA_SUCCESS;
+}
+
+static inline ma_result rec_peaks_load(const char* path, rec_wave* waves, ma_uint32 max_lanes, rec_peaks_info* info) {
+	/*
+	 * The sidecar of the recording at path
+	 * into max_lanes empty waves, fewer if it
+	 * has fewer lanes. MA_INVALID_FILE if it
+	 * is malformed or no longer matches.
+	 */
+	const std::string peaks_path = rec_peaks_path(path);
+	FILE* file = fopen(peaks_path.c_str(), "rb");
+	if (file == NULL) return MA_DOES_NOT_EXIST;
+	std::vector<ma_uint8> data;
+	ma_uint8 buffer[65536];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + got);
+	fclose(file);
+	const ma_uint8* h = data.data();
+	if (data.size() < REC_PEAKS_HEADER || memcmp(h, REC_PEAKS_MAGIC, 4) != 0 || rec_archive_get(h, 4, 2) != REC_PEAKS_VERSION ||
+		rec_archive_get(h, 10, 2) != REC_WAVE_LEVELS || rec_archive_get(h, 16, 4) != REC_WAVE_BASE || rec_archive_get(h, 20, 4) != REC_WAVE_FACTOR) {
+		return MA_INVALID_FILE;
+	}
+	if (rec_archive_get(h, 24, 8) != rec_peaks_file_bytes(path)) return MA_INVALID_FILE;
+	const ma_uint32 lanes = (ma_uint32)rec_archive_get(h, 6, 2);
+	size_t pos = REC_PEAKS_HEADER + (size_t)lanes * (1 + REC_WAVE_LEVELS) * 8;
+	if (lanes == 0 || data.size() < pos) return MA_INVALID_FILE;
+	// Every count is checked before any bucket is taken
+	ma_uint64 buckets = 0;
+	for (ma_uint32 i = 0; i < lanes; i++) {
+		for (ma_uint32 k = 0; k < REC_WAVE_LEVELS; k++) buckets += rec_archive_get(h, REC_PEAKS_HEADER + ((size_t)i * (1 + REC_WAVE_LEVELS) + 1 + k) * 8, 8);
+	}
+	if (buckets > (data.size() - pos) / 6 || data.size() - pos != buckets * 6) return MA_INVALID_FILE;
+	info->lanes = lanes < max_lanes ? lanes : max_lanes;
+	info->channels = (ma_uint32)rec_archive_get(h, 8, 2);
+	info->sample_rate = (ma_uint32)rec_archive_get(h, 12, 4);
+	info->frames = 0;
+	info->scanned = 0;
+	for (ma_uint32 i = 0; i < info->lanes; i++) {
+		const size_t entry = REC_PEAKS_HEADER + (size_t)i * (1 + REC_WAVE_LEVELS) * 8;
+		waves[i].frames = rec_archive_get(h, entry, 8);
+		if (waves[i].frames > info->frames) info->frames = waves[i].frames;
+		for (ma_uint32 k = 0; k < REC_WAVE_LEVELS; k++) {
+			const ma_uint64 count = rec_archive_get(h, entry + (1 + k) * 8, 8);
+			for (ma_uint64 j = 0; j < count; j++, pos += 6) {
+				rec_wave_bucket b;
+				b.min = (ma_int16)rec_archive_get(h, pos, 2);
+				b.max = (ma_int16)rec_archive_get(h, pos + 2, 2);
+				b.rms = (ma_int16)rec_archive_get(h, pos + 4, 2);
+				if (!rec_wave_append(&waves[i], k, &b)) return MA_OUT_OF_MEMORY;
+			}
+		}
+	}
+	return MA_SUCCESS;
+}
+
+/*
+ * Scanning. Anything ma_decoder reads, or an archive.
+ */
+typedef struct rec_peaks_source {
+	int archive;
+	ma_decoder decoder;
+	rec_archive_reader reader;
+	ma_uint8* raw;		// an archive's frames before conversion
+	ma_uint32 channels;
+	ma_uint32 sample_rate;
+	ma_uint64 frames;
+	ma_uint64 position;
+} rec_peaks_source;
+
+static inline void rec_peaks_source_close(rec_peaks_source* src) {
+	if (src->archive) rec_archive_close(&src->reader);
+	else ma_decoder_uninit(&src->decoder);
+	ma_free(src->raw, NULL);
+	src->raw = NULL;
+}
+
+static inline ma_result rec_peaks_source_open(rec_peaks_source* src, const char* path) {
+	memset(src, 0, sizeof(*src));
+	if (rec_archive_open(&src->reader, path) == MA_SUCCESS) {
+		src->archive = 1;
+		src->channels = src->reader.channels;
+		src->sample_rate = src->reader.sample_rate;
+		src->frames = src->reader.frames;
+		src->raw = (ma_uint8*)ma_malloc((size_t)REC_PEAKS_CHUNK * ma_get_bytes_per_frame(src->reader.format, src->channels), NULL);
+		if (src->raw == NULL) {
+			rec_peaks_source_close(src);
+			return MA_OUT_OF_MEMORY;
+		}
+		return MA_SUCCESS;
+	}
+	ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 0, 0);
+	ma_result result = ma_decoder_init_file(path, &config, &src->decoder);
+	if (result != MA_SUCCESS) return result;
+	src->channels = src->decoder.outputChannels;
+	src->sample_rate = src->decoder.outputSampleRate;
+	result = ma_decoder_get_length_in_pcm_frames(&src->decoder, &src->frames);
+	if (result != MA_SUCCESS) {
+		ma_decoder_uninit(&src->decoder);
+		return result;
+	}
+	return MA_SUCCESS;
+}
+
+static inline ma_result rec_peaks_source_read(rec_peaks_source* src, ma_uint64 frame, float* out, ma_uint32 count, ma_uint32* read) {
+	/*
+	 * count f32 frames from frame; seeks only
+	 * when not already there.
+	 */
+	ma_result result;
+	ma_uint64 got = 0;
+	if (src->archive) {
+		result = rec_archive_read(&src->reader, frame, src->raw, count, &got);
+		ma_pcm_convert(out, ma_format_f32, src->raw, src->reader.format, got * src->channels, ma_dither_mode_none);
+	} else {
+		if (frame != src->position) {
+			result = ma_decoder_seek_to_pcm_frame(&src->decoder, frame);
+			if (result != MA_SUCCESS) return result;
+		}
+		result = ma_decoder_read_pcm_frames(&src->decoder, out, count, &got);
+		if (result == MA_AT_END) result = MA_SUCCESS;
+	}
+	src->position = frame + got;
+	*read = (ma_uint32)got;
+	return result;
+}
+
+typedef struct rec_peaks_span {
+	const char* path;
+	ma_uint64 first;	// frame, at a bucket boundary
+	ma_uint64 last;
+	float* buckets;		// min, max and RMS for each bucket of the span
+	ma_result result;
+} rec_peaks_span;
+
+static inline void rec_peaks_scan(rec_peaks_span* span) {
+	/*
+	 * A worker: its span into level 0
+	 * buckets, on a source of its own.
+	 */
+	rec_peaks_source src;
+	span->result = rec_peaks_source_open(&src, span->path);
+	if (span->result != MA_SUCCESS) return;
+	float* x = (float*)ma_malloc((size_t)REC_PEAKS_CHUNK * src.channels * sizeof(float), NULL);
+	if (x == NULL) {
+		rec_peaks_source_close(&src);
+		span->result = MA_OUT_OF_MEMORY;
+		return;
+	}
+	float* b = span->buckets;
+	ma_uint32 fill = 0;
+	double sum_sq = 0;
+	ma_uint64 frame = span->first;
+	while (frame < span->last) {
+		ma_uint32 want = span->last - frame < REC_PEAKS_CHUNK ? (ma_uint32)(span->last - frame) : REC_PEAKS_CHUNK;
+		ma_uint32 got = 0;
+		span->result = rec_peaks_source_read(&src, frame, x, want, &got);
+		if (span->result != MA_SUCCESS) break;
+		if (got == 0) {
+			span->result = MA_INVALID_FILE;
+			break;
+		}
+		frame += got;
+		const float* p = x;
+		while (got > 0) {
+			ma_uint32 n = REC_WAVE_BASE - fill;
+			if (n > got) n = got;
+			if (fill == 0) b[0] = b[1] = p[0];
+			rec_wave_kernel(p, n * src.channels, &b[0], &b[1], &sum_sq);
+			fill += n;
+			p += (size_t)n * src.channels;
+			got -= n;
+			if (fill < REC_WAVE_BASE && frame < span->last) continue;
+			// A bucket completes, or the file ends partway through one
+			if (fill == REC_WAVE_BASE || got == 0) {
+				b[2] = (float)sqrt(sum_sq / ((double)fill * src.channels));
+				b += 3;
+				fill = 0;
+				sum_sq = 0;
+			}
+		}
+	}
+	ma_free(x, NULL);
+	rec_peaks_source_close(&src);
+}
+
+static inline ma_result rec_peaks_build(const char* path, rec_wave* wave, ma_uint32 workers, rec_peaks_info* info) {
+	/*
+	 * Scans the recording at path into one
+	 * empty wave, its span split between up
+	 * to workers threads. The buckets they
+	 * make are folded into the levels above
+	 * here, which is cheap.
+	 */
+	rec_peaks_source src;
+	ma_result result = rec_peaks_source_open(&src, path);
+	if (result != MA_SUCCESS) return result;
+	info->lanes = 1;
+	info->channels = src.channels;
+	info->sample_rate = src.sample_rate;
+	info->frames = src.frames;
+	info->scanned = 1;
+	rec_peaks_source_close(&src);
+	const ma_uint64 buckets = (info->frames + REC_WAVE_BASE - 1) / REC_WAVE_BASE;
+	if (buckets == 0) return MA_SUCCESS;
+	if (workers == 0) workers = 1;
+	if (workers > buckets / REC_PEAKS_MIN_SPAN + 1) workers = (ma_uint32)(buckets / REC_PEAKS_MIN_SPAN + 1);
+	float* data = (float*)ma_malloc((size_t)buckets * 3 * sizeof(float), NULL);
+	if (data == NULL) return MA_OUT_OF_MEMORY;
+	std::vector<rec_peaks_span> spans(workers);
+	std::vector<std::thread> threads;
+	const ma_uint64 share = (buckets + workers - 1) / workers;
+	for (ma_uint32 i = 0; i < workers; i++) {
+		rec_peaks_span* span = &spans[i];
+		span->path = path;
+		span->first = i * share * REC_WAVE_BASE;
+		span->last = (i + 1) * share * REC_WAVE_BASE;
+		if (span->last > info->frames) span->last = info->frames;
+		span->buckets = data + (size_t)i * share * 3;
+		span->result = MA_SUCCESS;
+		// The last span runs here
+		if (span->first >= span->last) continue;
+		if (i + 1 < workers) threads.push_back(std::thread(rec_peaks_scan, span));
+		else rec_peaks_scan(span);
+	}
+	for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+	for (ma_uint32 i = 0; i < workers && result == MA_SUCCESS; i++) result = spans[i].result;
+	if (result == MA_SUCCESS) {
+		for (ma_uint64 j = 0; j < buckets && !wave->full; j++) rec_wave_emit(wave, 0, data[j * 3], data[j * 3 + 1], data[j * 3 + 2]);
+		wave->frames = info->frames;
+		wave->channels = info->channels;
+		rec_wave_flush(wave);
+	}
+	ma_free(data, NULL);
+	return result;
+}
+
+static inline ma_result rec_peaks_open(const char* path, rec_wave* waves, ma_uint32 max_lanes, ma_uint32 workers, rec_peaks_info* info) {
+	/*
+	 * The overview of a finished recording
+	 * into max_lanes empty waves: from its
+	 * sidecar, or scanned into the first and
+	 * saved as one. A sidecar that can't be
+	 * saved doesn't fail the open.
+	 */
+	ma_result result = rec_peaks_load(path, waves, max_lanes, info);
+	if (result == MA_SUCCESS) return MA_SUCCESS;
+	for (ma_uint32 i = 0; i < max_lanes; i++) {
+		rec_wave_uninit(&waves[i]);
+		result = rec_wave_init(&waves[i]);
+		if (result != MA_SUCCESS) return result;
+	}
+	result = rec_peaks_build(path, &waves[0], workers, info);
+	if (result != MA_SUCCESS) return result;
+	rec_wave* lane = &waves[0];
+	if (!lane->full) rec_peaks_write(path, &lane, 1, info->channels, info->sample_rate);
+	return MA_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,461 @@
+/*
+ * Playback of recordings.
+ *
+ * The file is mapped read-only and decoded in place by
+ * ma_decoder, so opening it reads only its header however
+ * large it is; archives decode through rec_archive.h. A
+ * decoder thread keeps up to REC_PLAYER_AHEAD_MS of f32
+ * audio ahead in a ring, and the playback device's
+ * callback only copies out of the ring: no decoding, no
+ * I/O and no locks on the real-time thread.
+ *
+ * A seek is a request to the decoder thread. It has the
+ * callback drop whatever the ring holds, which the
+ * callback acknowledges on its next period, then seeks and
+ * refills from the new position. While paused there is
+ * no callback, so the thread drops the ring itself, under
+ * a lock that keeps playback from starting meanwhile.
+ *
+ * A take still recording plays from its rec_preview
+ * instead, never past the frames its writer has
+ * committed. Catching up with the writer is an underrun,
+ * not the end, until the session closes the preview.
+ *
+ * Included from rec_session.h, after rec_archive.h and
+ * rec_preview.h.
+ */
+#ifndef REC_PLAYER_H
+#define REC_PLAYER_H
+
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Decoded audio kept ahead of the device
+#define REC_PLAYER_AHEAD_MS 1000
+// Buffered before the device starts
+#define REC_PLAYER_PREFILL_MS 100
+// Frames decoded per step
+#define REC_PLAYER_CHUNK 4096
+#define REC_PLAYER_NO_SEEK (~(ma_uint64)0)
+
+typedef struct rec_player {
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+	const ma_uint8* base;
+	size_t size;
+	int archive;
+	ma_decoder decoder;
+	int decoder_ok;
+	rec_archive_reader reader;
+	rec_preview* live;	// the take recording, or NULL
+	ma_uint8* raw;		// an archive's or preview's frames before conversion
+	float* chunk;
+	ma_uint32 channels;
+	ma_uint32 sample_rate;
+	ma_uint64 frames;	// 0 if the decoder can't tell
+	ma_pcm_rb rb;
+	int rb_ok;
+	ma_device device;
+	int device_ok;
+	std::thread thread;
+	std::mutex lock;		// play and pause against a seek while paused
+	std::atomic<int> quit;
+	std::atomic<int> playing;
+	std::atomic<ma_uint64> seek_to;	// REC_PLAYER_NO_SEEK when none
+	std::atomic<int> discard;	// set by the thread, cleared once the ring is dropped
+	std::atomic<int> ended;		// the decoder has reached the end
+	std::atomic<ma_uint64> position;	// frames played, from the last seek
+	ma_uint64 decoded;		// decoder thread only: next frame to decode
+	std::atomic<ma_uint64> underruns;
+} rec_player;
+
+static inline void rec_player_drop(rec_player* p) {
+	/*
+	 * Consumer side: everything in the ring.
+	 */
+	ma_uint32 n = ma_pcm_rb_available_read(&p->rb);
+	if (n > 0) ma_pcm_rb_seek_read(&p->rb, n);
+}
+
+static inline void rec_player_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount) {
+	/*
+	 * Real-time thread: copy out of the ring,
+	 * silence for whatever it lacks.
+	 */
+	rec_player* p = (rec_player*)pDevice->pUserData;
+	const ma_uint32 bpf = ma_get_bytes_per_frame(ma_format_f32, p->channels);
+	ma_uint8* dst = (ma_uint8*)pOutput;
+	ma_uint32 remaining = frameCount;
+	if (p->discard.load(std::memory_order_acquire)) {
+		rec_player_drop(p);
+		p->discard.store(0, std::memory_order_release);
+	} else {
+		while (remaining > 0) {
+			ma_uint32 n = remaining;
+			void* src;
+			if (ma_pcm_rb_acquire_read(&p->rb, &n, &src) != MA_SUCCESS || n == 0) break;
+			memcpy(dst, src, (size_t)n * bpf);
+			ma_pcm_rb_commit_read(&p->rb, n);
+			dst += (size_t)n * bpf;
+			remaining -= n;
+		}
+		p->position.fetch_add(frameCount - remaining, std::memory_order_relaxed);
+		if (remaining > 0 && !p->ended.load(std::memory_order_acquire)) p->underruns.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (remaining > 0) memset(dst, 0, (size_t)remaining * bpf);
+	(void)pInput;
+}
+
+static inline ma_result rec_player_decode(rec_player* p, ma_uint32 count, ma_uint32* got) {
+	/*
+	 * Decoder thread: up to count frames at
+	 * p->decoded into p->chunk.
+	 */
+	ma_uint64 n = 0;
+	ma_result result;
+	if (p->live != NULL) {
+		ma_uint32 read = 0;
+		result = rec_preview_read(p->live, p->decoded, p->raw, count, &read);
+		if (result == MA_OUT_OF_RANGE) {
+			// Left behind by the writer: go on from the oldest frame still there
+			ma_uint64 oldest = rec_preview_oldest(p->live, rec_preview_committed(p->live));
+			p->position.fetch_add(oldest - p->decoded, std::memory_order_relaxed);
+			p->decoded = oldest;
+			result = rec_preview_read(p->live, p->decoded, p->raw, count, &read);
+		}
+		// At the write head it ends only with the take
+		if (result == MA_AT_END && !(p->live->closed.load(std::memory_order_acquire) && rec_preview_committed(p->live) <= p->decoded)) result = MA_SUCCESS;
+		if (result == MA_OUT_OF_RANGE) result = MA_SUCCESS;
+		n = read;
+		ma_pcm_convert(p->chunk, ma_format_f32, p->raw, p->live->format, n * p->channels, ma_dither_mode_none);
+	} else if (p->archive) {
+		result = rec_archive_read(&p->reader, p->decoded, p->raw, count, &n);
+		ma_pcm_convert(p->chunk, ma_format_f32, p->raw, p->reader.format, n * p->channels, ma_dither_mode_none);
+	} else {
+		result = ma_decoder_read_pcm_frames(&p->decoder, p->chunk, count, &n);
+		if (result == MA_AT_END) result = MA_SUCCESS;
+	}
+	p->decoded += n;
+	*got = (ma_uint32)n;
+	return result;
+}
+
+static inline void rec_player_seek_now(rec_player* p) {
+	/*
+	 * Decoder thread: has the ring dropped,
+	 * then moves the decoder to the newest
+	 * position asked for.
+	 */
+	p->discard.store(1, std::memory_order_release);
+	while (p->discard.load(std::memory_order_acquire) && !p->quit.load(std::memory_order_relaxed)) {
+		{
+			std::lock_guard<std::mutex> guard(p->lock);
+			if (!p->playing.load(std::memory_order_relaxed)) {
+				rec_player_drop(p);
+				p->discard.store(0, std::memory_order_release);
+				break;
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	ma_uint64 frame = p->seek_to.exchange(REC_PLAYER_NO_SEEK, std::memory_order_acq_rel);
+	if (p->frames > 0 && frame > p->frames) frame = p->frames;
+	if (p->live != NULL) {
+		ma_uint64 committed = rec_preview_committed(p->live);
+		ma_uint64 oldest = rec_preview_oldest(p->live, committed);
+		if (frame > committed) frame = committed;
+		if (frame < oldest) frame = oldest;
+	} else if (!p->archive && ma_decoder_seek_to_pcm_frame(&p->decoder, frame) != MA_SUCCESS) {
+		// Unseekable streams restart from the top
+		ma_decoder_seek_to_pcm_frame(&p->decoder, 0);
+		frame = 0;
+	}
+	p->decoded = frame;
+	p->position.store(frame, std::memory_order_relaxed);
+	p->ended.store(0, std::memory_order_release);
+}
+
+static inline void rec_player_thread(rec_player* p) {
+	/*
+	 * Keeps the ring full, a chunk at a time,
+	 * and carries out seeks.
+	 */
+	while (!p->quit.load(std::memory_order_acquire)) {
+		if (p->seek_to.load(std::memory_order_acquire) != REC_PLAYER_NO_SEEK) rec_player_seek_now(p);
+		ma_uint32 room = ma_pcm_rb_available_write(&p->rb);
+		if (p->ended.load(std::memory_order_relaxed) || room < REC_PLAYER_CHUNK) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+		ma_uint32 got = 0;
+		ma_result result = rec_player_decode(p, REC_PLAYER_CHUNK, &got);
+		const float* src = p->chunk;
+		ma_uint32 remaining = got;
+		while (remaining > 0) {
+			ma_uint32 n = remaining;
+			void* dst;
+			if (ma_pcm_rb_acquire_write(&p->rb, &n, &dst) != MA_SUCCESS || n == 0) break;
+			memcpy(dst, src, (size_t)n * p->channels * sizeof(float));
+			ma_pcm_rb_commit_write(&p->rb, n);
+			src += (size_t)n * p->channels;
+			remaining -= n;
+		}
+		if (result != MA_SUCCESS || (got < REC_PLAYER_CHUNK && p->live == NULL)) p->ended.store(1, std::memory_order_release);
+		// Waiting on the writer
+		else if (got == 0) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+}
+
+static inline void rec_player_unmap(rec_player* p) {
+#if defined(_WIN32)
+	if (p->base != NULL) UnmapViewOfFile(p->base);
+	if (p->mapping != NULL) CloseHandle(p->mapping);
+	if (p->file != INVALID_HANDLE_VALUE) CloseHandle(p->file);
+	p->mapping = NULL;
+	p->file = INVALID_HANDLE_VALUE;
+#else
+	if (p->base != NULL) munmap((void*)p->base, p->size);
+	if (p->fd >= 0) close(p->fd);
+	p->fd = -1;
+#endif
+	p->base = NULL;
+}
+
+static inline ma_result rec_player_map(rec_player* p, const char* path) {
+	/*
+	 * Read-only, with the kernel told to read
+	 * well ahead.
+	 */
+#if defined(_WIN32)
+	p->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (p->file == INVALID_HANDLE_VALUE) return MA_DOES_NOT_EXIST;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(p->file, &size) || size.QuadPart == 0) return MA_INVALID_FILE;
+	p->size = (size_t)size.QuadPart;
+	p->mapping = CreateFileMappingA(p->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (p->mapping != NULL) p->base = (const ma_uint8*)MapViewOfFile(p->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (p->base == NULL) return MA_IO_ERROR;
+#else
+	p->fd = open(path, O_RDONLY);
+	if (p->fd < 0) return rec_result_from_errno(errno);
+	struct stat st;
+	if (fstat(p->fd, &st) != 0 || st.st_size == 0) return MA_INVALID_FILE;
+	p->size = (size_t)st.st_size;
+	void* m = mmap(NULL, p->size, PROT_READ, MAP_SHARED, p->fd, 0);
+	if (m == MAP_FAILED) return rec_result_from_errno(errno);
+	p->base = (const ma_uint8*)m;
+	madvise(m, p->size, MADV_SEQUENTIAL);
+#endif
+	return MA_SUCCESS;
+}
+
+static inline void rec_player_close(rec_player* p) {
+	/*
+	 * Stops the device, then the thread.
+	 */
+	if (p->device_ok) ma_device_uninit(&p->device);
+	p->device_ok = 0;
+	p->quit.store(1, std::memory_order_release);
+	if (p->thread.joinable()) p->thread.join();
+	if (p->rb_ok) ma_pcm_rb_uninit(&p->rb);
+	p->rb_ok = 0;
+	if (p->decoder_ok) ma_decoder_uninit(&p->decoder);
+	p->decoder_ok = 0;
+	if (p->archive) rec_archive_close(&p->reader);
+	p->archive = 0;
+	p->live = NULL;
+	ma_free(p->raw, NULL);
+	ma_free(p->chunk, NULL);
+	p->raw = NULL;
+	p->chunk = NULL;
+	rec_player_unmap(p);
+}
+
+static inline void rec_player_reset(rec_player* p) {
+	p->base = NULL;
+#if defined(_WIN32)
+	p->file = INVALID_HANDLE_VALUE;
+	p->mapping = NULL;
+#else
+	p->fd = -1;
+#endif
+	p->archive = p->decoder_ok = p->rb_ok = p->device_ok = 0;
+	p->live = NULL;
+	p->raw = NULL;
+	p->chunk = NULL;
+	p->quit.store(0);
+	p->playing.store(0);
+	p->seek_to.store(REC_PLAYER_NO_SEEK);
+	p->discard.store(0);
+	p->ended.store(0);
+	p->position.store(0);
+	p->underruns.store(0);
+	p->decoded = 0;
+}
+
+static inline ma_result rec_player_start(rec_player* p, ma_context* context) {
+	/*
+	 * With the source open: the ring, the
+	 * playback device at the source's rate and
+	 * the decoder thread.
+	 */
+	ma_result result;
+	p->chunk = (float*)ma_malloc((size_t)REC_PLAYER_CHUNK * p->channels * sizeof(float), NULL);
+	if (p->chunk == NULL) return MA_OUT_OF_MEMORY;
+	result = ma_pcm_rb_init(ma_format_f32, p->channels, p->sample_rate * REC_PLAYER_AHEAD_MS / 1000 + REC_PLAYER_CHUNK, NULL, NULL, &p->rb);
+	if (result != MA_SUCCESS) return result;
+	p->rb_ok = 1;
+	ma_device_config deviceConfig = ma_device_config_init(ma_device_type_playback);
+	deviceConfig.playback.format = ma_format_f32;
+	deviceConfig.playback.channels = p->channels;
+	deviceConfig.sampleRate = p->sample_rate;
+	deviceConfig.dataCallback = rec_player_callback;
+	deviceConfig.pUserData = p;
+	result = ma_device_init(context, &deviceConfig, &p->device);
+	if (result != MA_SUCCESS) return result;
+	p->device_ok = 1;
+	p->thread = std::thread(rec_player_thread, p);
+	return MA_SUCCESS;
+}
+
+static inline ma_result rec_player_open(rec_player* p, ma_context* context, const char* path) {
+	/*
+	 * Maps the file, opens the default
+	 * playback device at its rate and starts
+	 * decoding ahead. Paused until
+	 * rec_player_play().
+	 */
+	ma_result result;
+	rec_player_reset(p);
+	if (rec_archive_open(&p->reader, path) == MA_SUCCESS) {
+		p->archive = 1;
+		p->channels = p->reader.channels;
+		p->sample_rate = p->reader.sample_rate;
+		p->frames = p->reader.frames;
+		p->raw = (ma_uint8*)ma_malloc((size_t)REC_PLAYER_CHUNK * ma_get_bytes_per_frame(p->reader.format, p->channels), NULL);
+		if (p->raw == NULL) {
+			result = MA_OUT_OF_MEMORY;
+			goto fail;
+		}
+	} else {
+		result = rec_player_map(p, path);
+		if (result != MA_SUCCESS) goto fail;
+		ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 0, 0);
+		result = ma_decoder_init_memory(p->base, p->size, &config, &p->decoder);
+		if (result != MA_SUCCESS) goto fail;
+		p->decoder_ok = 1;
+		p->channels = p->decoder.outputChannels;
+		p->sample_rate = p->decoder.outputSampleRate;
+		if (ma_decoder_get_length_in_pcm_frames(&p->decoder, &p->frames) != MA_SUCCESS) p->frames = 0;
+	}
+	result = rec_player_start(p, context);
+	if (result != MA_SUCCESS) goto fail;
+	return MA_SUCCESS;
+fail:
+	rec_player_close(p);
+	return result;
+}
+
+static inline ma_result rec_player_open_live(rec_player* p, ma_context* context, rec_preview* preview, ma_uint32 seconds) {
+	/*
+	 * The take a session is recording into
+	 * preview, from seconds before its write
+	 * head, or as far back as it holds. The
+	 * preview must outlive the player.
+	 */
+	ma_result result;
+	rec_player_reset(p);
+	if (preview->data == NULL) return MA_INVALID_ARGS;
+	p->live = preview;
+	p->channels = preview->channels;
+	p->sample_rate = preview->sample_rate;
+	p->frames = 0;
+	p->raw = (ma_uint8*)ma_malloc((size_t)REC_PLAYER_CHUNK * preview->bpf, NULL);
+	if (p->raw == NULL) {
+		result = MA_OUT_OF_MEMORY;
+		goto fail;
+	}
+	{
+		ma_uint64 committed = rec_preview_committed(preview);
+		ma_uint64 back = (ma_uint64)seconds * preview->sample_rate;
+		ma_uint64 oldest = rec_preview_oldest(preview, committed);
+		p->decoded = committed > back && committed - back > oldest ? committed - back : oldest;
+		p->position.store(p->decoded);
+	}
+	result = rec_player_start(p, context);
+	if (result != MA_SUCCESS) goto fail;
+	return MA_SUCCESS;
+fail:
+	rec_player_close(p);
+	return result;
+}
+
+static inline ma_result rec_player_play(rec_player* p) {
+	/*
+	 * Waits briefly for the ring to fill, so
+	 * playback doesn't open on an underrun.
+	 */
+	const ma_uint32 prefill = p->sample_rate * REC_PLAYER_PREFILL_MS / 1000;
+	for (int i = 0; i < REC_PLAYER_PREFILL_MS && ma_pcm_rb_available_read(&p->rb) < prefill && !p->ended.load(); i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	std::lock_guard<std::mutex> guard(p->lock);
+	if (p->playing.load()) return MA_SUCCESS;
+	ma_result result = ma_device_start(&p->device);
+	if (result == MA_SUCCESS) p->playing.store(1);
+	return result;
+}
+
+static inline ma_result rec_player_pause(rec_player* p) {
+	std::lock_guard<std::mutex> guard(p->lock);
+	if (!p->playing.load()) return MA_SUCCESS;
+	p->playing.store(0);
+	return ma_device_stop(&p->device);
+}
+
+static inline void rec_player_seek(rec_player* p, ma_uint64 frame) {
+	/*
+	 * Returns at once; the decoder thread
+	 * carries it out. The newest request wins.
+	 */
+	p->seek_to.store(frame, std::memory_order_release);
+}
+
+static inline ma_uint64 rec_player_position(rec_player* p) {
+	/*
+	 * Frames into the file of the audio last
+	 * handed to the device.
+	 */
+	return p->position.load(std::memory_order_relaxed);
+}
+
+static inline int rec_player_playing(rec_player* p) {
+	return p->playing.load(std::memory_order_relaxed);
+}
+
+static inline int rec_player_done(rec_player* p) {
+	/*
+	 * Everything decoded has been played, and
+	 * no seek is on its way.
+	 */
+	return p->ended.load(std::memory_order_acquire) && ma_pcm_rb_available_read(&p->rb) == 0 &&
+		p->seek_to.load(std::memory_order_acquire) == REC_PLAYER_NO_SEEK && !p->discard.load(std::memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Preview of a take while it is still recording.
+ *
+ * A rec_preview holds the last few seconds or minutes of
+ * one input, in the session's format, in a ring the writer
+ * thread copies each chunk into as it writes the file. The
+ * writer publishes a count of the frames committed after
+ * each copy, and readers never look at or past it, so they
+ * need no lock and never hold up the writer: the audio
+ * callback isn't involved at all, and the writer's cost is
+ * one memcpy of a chunk it already has in cache.
+ *
+ * The writer doesn't wait for readers either, so a reader
+ * that falls a whole ring behind loses the frames it was
+ * after. Reads check the count again after copying and
+ * report those frames as gone rather than return them
+ * torn.
+ *
+ * Previews belong to the caller, like level feeds, so one
+ * can be played to the end after its session has closed.
+ */
+#ifndef REC_PREVIEW_H
+#define REC_PREVIEW_H
+
+#include <string.h>
+#include <atomic>
+
+typedef struct rec_preview {
+	ma_uint8* data;
+	ma_format format;
+	ma_uint32 channels;
+	ma_uint32 sample_rate;
+	size_t bpf;
+	ma_uint32 capacity;	// frames
+	ma_uint32 max_push;	// most frames one push writes
+	std::atomic<ma_uint64> committed;	// frames pushed in all
+	std::atomic<int> closed;	// the session has finished with it
+} rec_preview;
+
+static inline ma_result rec_preview_init(rec_preview* p, ma_format format, ma_uint32 channels, ma_uint32 sample_rate, ma_uint32 seconds, ma_uint32 max_push) {
+	/*
+	 * Room for seconds of audio, plus the
+	 * writer's margin. max_push is the most
+	 * frames rec_preview_push() takes at once.
+	 */
+	p->format = format;
+	p->channels = channels;
+	p->sample_rate = sample_rate;
+	p->bpf = ma_get_bytes_per_frame(format, channels);
+	p->max_push = max_push;
+	p->capacity = sample_rate * seconds + 2 * max_push;
+	p->committed.store(0);
+	p->closed.store(0);
+	p->data = (ma_uint8*)ma_malloc((size_t)p->capacity * p->bpf, NULL);
+	return p->data != NULL ? MA_SUCCESS : MA_OUT_OF_MEMORY;
+}
+
+static inline void rec_preview_uninit(rec_preview* p) {
+	/*
+	 * Not while a session feeds it or a
+	 * reader reads it.
+	 */
+	ma_free(p->data, NULL);
+	p->data = NULL;
+	p->committed.store(0);
+}
+
+static inline void rec_preview_push(rec_preview* p, const void* frames, ma_uint32 count) {
+	/*
+	 * Writer thread: count frames in the
+	 * preview's format, at most max_push.
+	 */
+	if (p == NULL || p->data == NULL || count == 0) return;
+	const ma_uint64 at = p->committed.load(std::memory_order_relaxed);
+	const ma_uint32 slot = (ma_uint32)(at % p->capacity);
+	const ma_uint32 first = p->capacity - slot < count ? p->capacity - slot : count;
+	memcpy(p->data + (size_t)slot * p->bpf, frames, (size_t)first * p->bpf);
+	if (first < count) memcpy(p->data, (const ma_uint8*)frames + (size_t)first * p->bpf, (size_t)(count - first) * p->bpf);
+	p->committed.store(at + count, std::memory_order_release);
+}
+
+static inline void rec_preview_close(rec_preview* p) {
+	/*
+	 * Writer, at the end of the take.
+	 */
+	if (p != NULL) p->closed.store(1, std::memory_order_release);
+}
+
+static inline ma_uint64 rec_preview_committed(rec_preview* p) {
+	return p->committed.load(std::memory_order_acquire);
+}
+
+static inline ma_uint64 rec_preview_oldest(rec_preview* p, ma_uint64 committed) {
+	/*
+	 * The first frame still safe to read, a
+	 * push's margin inside the ring.
+	 */
+	const ma_uint64 keep = p->capacity - p->max_push;
+	return committed > keep ? committed - keep : 0;
+}
+
+static inline ma_result rec_preview_read(rec_preview* p, ma_uint64 frame, void* out, ma_uint32 count, ma_uint32* read) {
+	/*
+	 * Up to count frames from frame, never
+	 * past the committed count. MA_AT_END
+	 * with nothing read if frame is the write
+	 * head; MA_OUT_OF_RANGE if any of the
+	 * frames are gone.
+	 */
+	*read = 0;
+	const ma_uint64 committed = rec_preview_committed(p);
+	if (frame < rec_preview_oldest(p, committed)) return MA_OUT_OF_RANGE;
+	if (frame >= committed) return MA_AT_END;
+	const ma_uint32 n = committed - frame < count ? (ma_uint32)(committed - frame) : count;
+	const ma_uint32 slot = (ma_uint32)(frame % p->capacity);
+	const ma_uint32 first = p->capacity - slot < n ? p->capacity - slot : n;
+	memcpy(out, p->data + (size_t)slot * p->bpf, (size_t)first * p->bpf);
+	if (first < n) memcpy((ma_uint8*)out + (size_t)first * p->bpf, p->data, (size_t)(n - first) * p->bpf);
+	// The writer may have come round meanwhile
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (frame < rec_preview_oldest(p, rec_preview_committed(p))) return MA_OUT_OF_RANGE;
+	*read = n;
+	return MA_SUCCESS;
+}
+
+#endif
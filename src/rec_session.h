@@ -0,0 +1,2092 @@
+/*
+ * Capture session for the recorder.
+ *
+ * A session opens one or more capture devices. Each device
+ * gets its own ring buffer which the device callback fills;
+ * writer threads drain the rings into either one file per
+ * device or a single multichannel file. The audio callback
+ * never touches the disk.
+ *
+ * A mirrored session writes a second copy of every file
+ * through a separate ring and writer thread. Per-device
+ * mirrors are fed by the callback itself, so the copies
+ * are fully independent. The mirror of a merged file is
+ * fed by the merged writer: a stall on the mirror never
+ * reaches the primary, while a primary stall only delays
+ * the mirror, the backlog waiting in the device rings. In
+ * burst mode mirrors have neither: the flush writes them
+ * next to the primaries.
+ *
+ * Files are WAV through ma_encoder, or FLAC through the
+ * encoder in rec_flac.h, which compresses on worker
+ * threads of its own. WAV can also be IMA ADPCM, mu-law
+ * or A-law, through rec_wavcodec.h. FLAC can instead go
+ * into the block-indexed archive of rec_archive.h.
+ *
+ * A proxy is a low-rate mono copy of every file, such as
+ * 16 kHz for speech processing, downmixed and resampled
+ * on its own thread as the master is written.
+ *
+ * With peaks on, every file gets a .peaks sidecar at close
+ * from the waveform overview its writer built; see
+ * rec_peaks.h.
+ *
+ * The writers also keep the last part of each take in a
+ * preview the caller can play while recording; see
+ * rec_preview.h.
+ *
+ * Each input can go through a chain of filters, gain and
+ * a gate on its writer thread before anything else sees
+ * it; see rec_chain.h.
+ *
+ * A spectrum analyzer can be one more fan-out sink, on a
+ * thread of its own; see rec_spectrum.h.
+ *
+ * So can a loudness meter per file, whose figures go into
+ * the file's metadata at close; see rec_loudness.h.
+ *
+ * Included once from main_win.cxx, after miniaudio.h.
+ */
+#ifndef REC_SESSION_H
+#define REC_SESSION_H
+
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <mutex>
+
+#define REC_MAX_INPUTS 32
+// A file, a mirror and a proxy for every input
+#define REC_SYNC_MAX_FILES (REC_MAX_INPUTS * 3)
+
+#include "rec_dsp.h"
+#include "rec_chain.h"
+#include "rec_spool.h"
+#include "rec_sink.h"
+#include "rec_sync.h"
+#include "rec_fanout.h"
+#include "rec_flac.h"
+#include "rec_wavcodec.h"
+#include "rec_archive.h"
+#include "rec_wave.h"
+#include "rec_meter.h"
+#include "rec_peaks.h"
+#include "rec_preview.h"
+#include "rec_spectrum.h"
+#include "rec_loudness.h"
+#include "rec_player.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#endif
+
+// Ring buffer length per device, in seconds of audio
+#define REC_RING_SECONDS 2
+// Frames handed to the encoder per write
+#define REC_WRITE_CHUNK 4096
+// Audio captured before the drift loop locks, in seconds
+#define REC_DRIFT_SETTLE 30
+/*
+ * Ring fill, in eighths, above which the spool thread
+ * moves audio out of a ring, and the fill it leaves.
+ */
+#define REC_SPOOL_HIGH 4
+#define REC_SPOOL_LOW 2
+/*
+ * Free space never written into, so headers can still be
+ * finalized, and how often the writers look, in ms.
+ */
+#define REC_SPACE_FLOOR (16 * 1024 * 1024)
+#define REC_SPACE_CHECK 1000
+// Ring buffer length of a mirror destination, in seconds
+#define REC_MIRROR_SECONDS 10
+/*
+ * With taps, blocks of REC_WRITE_CHUNK frames a file may
+ * fall behind before its writer stops reading the ring,
+ * and how many taps a session can have.
+ */
+#define REC_FILE_BLOCKS 64
+#define REC_MAX_TAPS (REC_FANOUT_MAX_SINKS - 1)
+
+// Disk space as last seen by the writers
+enum rec_space_state {
+	REC_SPACE_OK = 0,
+	REC_SPACE_WARN,		// below space_warn_seconds
+	REC_SPACE_LOW		// below space_low_seconds: stop now
+};
+
+enum rec_layout {
+	REC_LAYOUT_SEPARATE = 0,	// one file per device
+	REC_LAYOUT_MERGED		// one file, devices side by side
+};
+
+/*
+ * An extra consumer of the captured audio, next to the
+ * file: a proxy, a meter, a network stream. It gets every
+ * block the file gets, on its own thread; see rec_fanout.h.
+ * block->source is the input index (0 for a merged file).
+ */
+typedef struct rec_tap {
+	const char* name;
+	rec_drop_policy policy;
+	ma_uint32 depth;	// blocks it may fall behind
+	rec_consume_proc consume;
+	void* user;
+} rec_tap;
+
+typedef struct rec_config {
+	ma_format format;
+	ma_uint32 channels;		// per device
+	ma_uint32 sample_rate;
+	rec_layout layout;
+	/*
+	 * ma_encoding_format_wav, or _flac for
+	 * 8, 16 or 24-bit integer formats and at
+	 * most 8 channels per file. Proxies are
+	 * always WAV.
+	 */
+	ma_encoding_format encoding;
+	/*
+	 * With WAV: PCM in the capture format, or
+	 * one of the compact codecs. IMA ADPCM is
+	 * limited to 2 channels per file, which is
+	 * all miniaudio's decoder reads.
+	 */
+	rec_wav_codec wav_codec;
+	/*
+	 * With FLAC: nonzero writes a .rca archive
+	 * instead, in blocks of about this many ms
+	 * with a peak and RMS for each.
+	 */
+	ma_uint32 archive_ms;
+	/*
+	 * REC_LAYOUT_MERGED only: resample every
+	 * device onto the first one's clock,
+	 * in float whatever the format.
+	 */
+	int drift_compensation;
+	/*
+	 * Burst mode: when non-zero, capture goes
+	 * to a preallocated buffer of this many
+	 * bytes (shared by all devices) and the
+	 * files, mirrors included, are written
+	 * after stop.
+	 */
+	size_t burst_budget;
+	/*
+	 * Overflow tiers for storage stalls: memory
+	 * cap per device in bytes, and a directory
+	 * for scratch files (NULL for none). Both
+	 * off disables spooling. Unused in burst
+	 * mode.
+	 */
+	size_t spool_mem_cap;
+	const char* spill_dir;
+	// How encoded bytes reach the disk
+	rec_sink_kind sink;
+	/*
+	 * When files are forced to stable storage
+	 * while recording; see rec_sync.h. The
+	 * interval and size only apply to their
+	 * own policy.
+	 */
+	rec_sync_policy sync_policy;
+	ma_uint32 sync_interval_ms;
+	ma_uint64 sync_bytes;
+	/*
+	 * Free-space watermarks, in seconds of
+	 * recording at the session's data rate.
+	 * Below the lower one a file continues in
+	 * space_alt_dir if set, else the session
+	 * asks to be stopped. A low mark of 0
+	 * turns the checks off.
+	 */
+	ma_uint32 space_warn_seconds;
+	ma_uint32 space_low_seconds;
+	const char* space_alt_dir;
+	/*
+	 * Mirrored output: every file is also
+	 * written, under the same name, to this
+	 * directory (ideally another volume).
+	 * NULL for none.
+	 */
+	const char* mirror_dir;
+	/*
+	 * Taps fed alongside every file. With any,
+	 * writers hand shared blocks to the file
+	 * and the taps instead of writing directly.
+	 */
+	rec_tap taps[REC_MAX_TAPS];
+	ma_uint32 tap_count;
+	/*
+	 * Sample rate of a 16-bit mono proxy
+	 * written next to every file, or 0 for
+	 * none. Takes one of the taps' places.
+	 */
+	ma_uint32 proxy_rate;
+	/*
+	 * input_count level feeds the writers
+	 * publish to, owned by the caller, or
+	 * NULL for no metering. In burst mode
+	 * nothing is metered until the flush.
+	 */
+	rec_level_feed* levels;
+	/*
+	 * input_count waveform overviews the
+	 * writers append to, owned by the caller,
+	 * or NULL; see rec_wave.h.
+	 */
+	rec_wave* waves;
+	/*
+	 * Nonzero writes a .peaks sidecar next
+	 * to every file at close, from waves or
+	 * from the session's own.
+	 */
+	int peaks;
+	/*
+	 * input_count previews of the last part
+	 * of each take, owned by the caller and
+	 * initialized in the session's format,
+	 * or NULL; see rec_preview.h.
+	 */
+	rec_preview* previews;
+	/*
+	 * Feed for the spectrum of the first
+	 * input, or of the merged file, owned by
+	 * the caller, or NULL. Takes one of the
+	 * taps' places.
+	 */
+	rec_spectrum_feed* spectrum;
+	/*
+	 * Feeds for each file's loudness, owned by
+	 * the caller, or NULL for none: one per
+	 * input, or one for the merged file. The
+	 * take's figures are written into the file
+	 * at close. Takes one of the taps' places.
+	 */
+	rec_loudness_feed* loudness;
+	/*
+	 * Inserts every input goes through, in
+	 * order, on its writer thread, before it
+	 * is metered or written. A separate
+	 * file's mirror, fed by the callback,
+	 * keeps the input as captured; a limiter
+	 * puts the file its look-ahead behind it,
+	 * see rec_session_latency().
+	 */
+	rec_insert inserts[REC_CHAIN_MAX];
+	ma_uint32 insert_count;
+	ma_uint32 input_count;
+	/*
+	 * A NULL entry selects the default
+	 * capture device.
+	 */
+	const ma_device_id* input_ids[REC_MAX_INPUTS];
+} rec_config;
+
+struct rec_session;
+
+/*
+ * One output file: an encoder, writing either through
+ * miniaudio's stdio VFS or through a rec_sink. FLAC and
+ * the compact WAV codecs go through encoders of our own
+ * instead, to a rec_sink or stdio.
+ */
+typedef struct rec_output {
+	ma_encoder_config config;
+	rec_wav_codec codec;
+	ma_uint32 archive_ms;
+	ma_encoder encoder;
+	rec_flac* flac;
+	rec_wavc* wavc;
+	rec_archive* archive;
+	FILE* file;		// our encoders without a rec_sink
+	rec_sink sink;
+	int sink_used;
+	int ok;
+	// Told about every byte written; NULL for none
+	rec_syncer* syncer;
+	/*
+	 * Disk space, writer thread only: next
+	 * check, whether the file moved to the
+	 * alternate directory, and audio not
+	 * written for want of space.
+	 */
+	std::chrono::steady_clock::time_point space_next;
+	int rotated;
+	int space_full;
+	ma_uint64 frames_skipped;
+	// Most audio seen queued for this file, in seconds
+	double lag_peak;
+	/*
+	 * Our encoders only, kept after close:
+	 * audio and coded bytes, and how often
+	 * the writer waited for the encoder.
+	 */
+	ma_uint64 pcm_bytes;
+	ma_uint64 coded_bytes;
+	ma_uint64 coder_waits;
+	// First failure seen writing or closing
+	ma_result result;
+} rec_output;
+
+/*
+ * A mirror destination: an output with its own ring and
+ * writer thread, so a slow or failed volume never holds up
+ * capture or the other copy. Frames that don't fit in the
+ * ring are lost to this copy only.
+ */
+typedef struct rec_dest {
+	ma_pcm_rb rb;
+	rec_output output;
+	std::thread writer;
+	std::string path;
+	int rb_ok;
+	// Burst mode: no ring or thread, written by the flush itself
+	int deferred;
+	// Set once nothing more will be pushed
+	std::atomic<int> closing;
+	std::atomic<ma_uint64> frames_pushed;
+	std::atomic<ma_uint64> frames_dropped;
+	std::atomic<ma_uint64> frames_written;
+	std::atomic<int> failed;
+} rec_dest;
+
+/*
+ * A proxy file: the master's blocks, downmixed to mono
+ * and resampled, on a fan-out sink of its own. Blocks it
+ * misses when it falls behind become silence, so it stays
+ * aligned with the master.
+ */
+typedef struct rec_proxy {
+	struct rec_session* session;
+	rec_output output;
+	std::string path;
+	int ok;
+	ma_format format;	// of the master
+	ma_uint32 channels;
+	rec_resampler rs;
+	float* mix;		// a block as f32, then its downmix
+	float* out;		// resampled
+	ma_int16* pcm;
+	ma_uint64 position;	// next master frame expected
+	ma_uint64 frames_silenced;
+	ma_uint64 frames_written;
+} rec_proxy;
+
+typedef struct rec_input {
+	struct rec_session* session;
+	ma_uint32 index;
+	ma_device device;
+	ma_pcm_rb rb;
+	rec_output output;		// REC_LAYOUT_SEPARATE only
+	std::thread writer;
+	std::string path;
+	int device_ok;
+	int rb_ok;
+	/*
+	 * Written by the audio callback,
+	 * read by the writer and UI threads.
+	 */
+	std::atomic<ma_uint64> frames_captured;
+	std::atomic<ma_uint64> frames_dropped;
+	std::atomic<ma_uint64> frames_written;
+	// Host time of the first and latest callbacks, ns
+	std::atomic<ma_int64> cb_first_ns;
+	std::atomic<ma_int64> cb_last_ns;
+	std::atomic<ma_uint64> cb_first_frames;
+	// Clock drift against the first device, parts per million
+	std::atomic<double> drift_ppm;
+	// Measured rate against the host clock, frames per second
+	std::atomic<double> rate_measured;
+	// Drift compensation applied by the resampler, ppm
+	std::atomic<double> asrc_ppm;
+	rec_asrc asrc;
+	int asrc_ok;
+	// Merged writer only: silence added after this input ran out at stop
+	ma_uint64 frames_padded;
+	/*
+	 * The spool thread and the writer both
+	 * consume the ring; read_lock orders them.
+	 * The audio callback never takes it.
+	 */
+	rec_spool spool;
+	int spool_ok;
+	std::mutex read_lock;
+	std::atomic<ma_uint64> spool_frames;
+	// Second copy of the file, fed by the audio callback
+	rec_dest mirror;			// REC_LAYOUT_SEPARATE only
+	rec_proxy proxy;			// REC_LAYOUT_SEPARATE only
+	// The file, the proxy and the taps, with either of the last two
+	rec_fanout fanout;
+	int fanout_ok;
+	// Writer thread only, publishing to the caller's feed
+	rec_meter meter;
+	// Writer thread only, but for its gain
+	rec_chain chain;
+	// For the sidecar, when the caller has no waves
+	rec_wave wave;
+	int wave_ok;
+	rec_preview* preview;		// the caller's, or NULL
+} rec_input;
+
+typedef struct rec_session {
+	rec_config config;
+	ma_context* context;
+	rec_input inputs[REC_MAX_INPUTS];
+	ma_uint32 input_count;
+	rec_output merged_output;	// REC_LAYOUT_MERGED only
+	std::thread merged_writer;
+	rec_dest merged_mirror;		// fed by the merged writer
+	rec_proxy merged_proxy;
+	rec_fanout merged_fanout;
+	int merged_fanout_ok;
+	rec_spectrum spectrum;		// a sink of the first fan-out
+	int spectrum_ok;
+	// A sink of each file's fan-out, by source; loudness_count of them started
+	rec_loudness loudness[REC_MAX_INPUTS];
+	ma_uint32 loudness_count;
+	std::thread spooler;
+	rec_syncer syncer;
+	std::atomic<int> stopping;
+	// A rec_space_state, and the recording time left at last check
+	std::atomic<int> space_state;
+	std::atomic<double> space_seconds;
+	// Files that continued in space_alt_dir so far
+	std::atomic<int> rotations;
+	// Burst mode buffer, carved into one ring per device
+	void* burst_mem;
+	size_t burst_size;
+	size_t burst_share;
+	int burst_huge;
+	// Set once capture runs; the burst flush happens at uninit
+	int burst_pending;
+	// Set by the first callback to overflow its share; capture stops there
+	std::atomic<int> burst_full;
+} rec_session;
+
+static inline void* rec_burst_alloc(size_t bytes, size_t* mapped, int* huge) {
+	/*
+	 * Memory for burst mode. Huge pages keep
+	 * TLB misses down when the callback walks
+	 * gigabytes; every page is faulted in here
+	 * so capture never takes a page fault.
+	 * Falls back to normal pages when huge
+	 * pages aren't available.
+	 */
+	void* p = NULL;
+	*huge = 0;
+#if defined(_WIN32)
+	SIZE_T large = GetLargePageMinimum();
+	if (large > 0) {
+		*mapped = (bytes + large - 1) / large * large;
+		p = VirtualAlloc(NULL, *mapped, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (p != NULL) *huge = 1;
+	}
+	if (p == NULL) {
+		*mapped = bytes;
+		p = VirtualAlloc(NULL, *mapped, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (p == NULL) return NULL;
+	}
+	for (size_t i = 0; i < *mapped; i += 4096) ((volatile char*)p)[i] = 0;
+#else
+	const size_t huge_page = 2 * 1024 * 1024;
+	int populate = 0;
+	*mapped = (bytes + huge_page - 1) / huge_page * huge_page;
+#if defined(MAP_HUGETLB) && defined(MAP_POPULATE)
+	p = mmap(NULL, *mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+	if (p != MAP_FAILED) {
+		*huge = 1;
+		populate = 1;
+	}
+#else
+	p = MAP_FAILED;
+#endif
+	if (p == MAP_FAILED) {
+		p = mmap(NULL, *mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) return NULL;
+#if defined(MADV_HUGEPAGE)
+		// Transparent huge pages, if the kernel allows them
+		if (madvise(p, *mapped, MADV_HUGEPAGE) == 0) *huge = 1;
+#endif
+	}
+	if (!populate) {
+		for (size_t i = 0; i < *mapped; i += 4096) ((volatile char*)p)[i] = 0;
+	}
+	// Best effort: keep it out of swap for the session
+	mlock(p, *mapped);
+#endif
+	return p;
+}
+
+static inline void rec_burst_free(void* p, size_t mapped) {
+#if defined(_WIN32)
+	(void)mapped;
+	VirtualFree(p, 0, MEM_RELEASE);
+#else
+	munlock(p, mapped);
+	munmap(p, mapped);
+#endif
+}
+
+static inline rec_config rec_config_init(ma_format format, ma_uint32 channels, ma_uint32 sample_rate) {
+	rec_config config;
+	memset(&config, 0, sizeof(config));
+	config.format = format;
+	config.channels = channels;
+	config.sample_rate = sample_rate;
+	config.layout = REC_LAYOUT_SEPARATE;
+	config.encoding = ma_encoding_format_wav;
+	config.wav_codec = REC_WAV_PCM;
+	config.drift_compensation = 1;
+	config.sync_policy = REC_SYNC_NONE;
+	config.sync_interval_ms = 1000;
+	config.sync_bytes = 16 * 1024 * 1024;
+	config.space_warn_seconds = 600;
+	config.space_low_seconds = 30;
+	config.input_count = 1;
+	return config;
+}
+
+static inline std::string rec_input_path(const char* path, ma_uint32 index, ma_uint32 count) {
+	/*
+	 * "take.wav" stays as it is for a single
+	 * device; with several devices each file
+	 * gets a suffix: "take-1.wav", "take-2.wav"...
+	 */
+	std::string base(path);
+	if (count <= 1) return base;
+	std::string ext;
+	size_t dot = base.find_last_of('.');
+	size_t sep = base.find_last_of("/\\");
+	if (dot != std::string::npos && (sep == std::string::npos || dot > sep)) {
+		ext = base.substr(dot);
+		base = base.substr(0, dot);
+	}
+	return base + "-" + std::to_string(index + 1) + ext;
+}
+
+static inline ma_result rec_output_file_write(void* user, const void* data, size_t bytes) {
+	rec_output* out = (rec_output*)user;
+#if !defined(_WIN32)
+	if (out->sink_used) return rec_sink_write(&out->sink, data, bytes);
+#endif
+	return fwrite(data, 1, bytes, out->file) == bytes ? MA_SUCCESS : MA_IO_ERROR;
+}
+
+static inline ma_result rec_output_file_seek(void* user, ma_uint64 offset) {
+	rec_output* out = (rec_output*)user;
+#if !defined(_WIN32)
+	if (out->sink_used) return rec_sink_seek(&out->sink, (ma_int64)offset, ma_seek_origin_start);
+#endif
+	return fseek(out->file, (long)offset, SEEK_SET) == 0 ? MA_SUCCESS : MA_IO_ERROR;
+}
+
+static inline ma_result rec_output_coder_init(rec_output* out) {
+	/*
+	 * FLAC, an archive or a compact WAV
+	 * codec; each writes its header at once.
+	 */
+	ma_result result;
+	if (out->archive_ms > 0) {
+		out->archive = new rec_archive();
+		result = rec_archive_init(out->archive, rec_output_file_write, rec_output_file_seek, out,
+			out->config.format, out->config.channels, out->config.sampleRate,
+			(ma_uint32)((ma_uint64)out->config.sampleRate * out->archive_ms / 1000), 1, rec_flac_default_workers());
+		if (result != MA_SUCCESS) {
+			delete out->archive;
+			out->archive = NULL;
+		}
+		return result;
+	}
+	if (out->config.encodingFormat == ma_encoding_format_flac) {
+		out->flac = new rec_flac();
+		result = rec_flac_init(out->flac, rec_output_file_write, rec_output_file_seek, out,
+			out->config.format, out->config.channels, out->config.sampleRate, rec_flac_default_workers());
+		if (result != MA_SUCCESS) {
+			delete out->flac;
+			out->flac = NULL;
+		}
+		return result;
+	}
+	out->wavc = new rec_wavc();
+	result = rec_wavc_init(out->wavc, rec_output_file_write, rec_output_file_seek, out,
+		out->codec, out->config.format, out->config.channels, out->config.sampleRate);
+	if (result != MA_SUCCESS) {
+		delete out->wavc;
+		out->wavc = NULL;
+	}
+	return result;
+}
+
+static inline ma_result rec_output_open(rec_output* out, const char* path, const ma_encoder_config* config, rec_wav_codec codec, ma_uint32 archive_ms, rec_sink_kind kind) {
+	/*
+	 * codec only applies to WAV and
+	 * archive_ms to FLAC; proxies pass
+	 * REC_WAV_PCM and 0.
+	 */
+	ma_result result;
+	if (config->encodingFormat != ma_encoding_format_wav) codec = REC_WAV_PCM;
+	if (config->encodingFormat != ma_encoding_format_flac) archive_ms = 0;
+	const int own = config->encodingFormat == ma_encoding_format_flac || codec != REC_WAV_PCM;
+	out->config = *config;
+	out->codec = codec;
+	out->archive_ms = archive_ms;
+	out->flac = NULL;
+	out->wavc = NULL;
+	out->archive = NULL;
+	out->file = NULL;
+	out->ok = 0;
+	out->sink_used = 0;
+	out->syncer = NULL;
+	out->space_next = std::chrono::steady_clock::now();
+	out->rotated = out->space_full = 0;
+	out->frames_skipped = 0;
+	out->lag_peak = 0;
+	out->pcm_bytes = out->coded_bytes = out->coder_waits = 0;
+	out->result = MA_SUCCESS;
+#if !defined(_WIN32)
+	if (kind != REC_SINK_STDIO) {
+		result = rec_sink_open(&out->sink, path, kind);
+		if (result != MA_SUCCESS) return result;
+		// Our encoders write their headers through the sink at once
+		out->sink_used = 1;
+		if (own) result = rec_output_coder_init(out);
+		else result = ma_encoder_init(rec_sink_on_write, rec_sink_on_seek, &out->sink, config, &out->encoder);
+		if (result != MA_SUCCESS) {
+			rec_sink_close(&out->sink);
+			out->sink_used = 0;
+			remove(path);
+			return result;
+		}
+		out->ok = 1;
+		return MA_SUCCESS;
+	}
+#endif
+	(void)kind;
+	if (own) {
+		out->file = fopen(path, "wb");
+		if (out->file == NULL) return rec_result_from_errno(errno);
+		result = rec_output_coder_init(out);
+		if (result != MA_SUCCESS) {
+			fclose(out->file);
+			out->file = NULL;
+			remove(path);
+			return result;
+		}
+	} else {
+		result = ma_encoder_init_file(path, config, &out->encoder);
+		if (result != MA_SUCCESS) return result;
+	}
+	out->ok = 1;
+	return MA_SUCCESS;
+}
+
+static inline void rec_output_write(rec_output* out, const void* frames, ma_uint32 count) {
+	/*
+	 * Remembers the first failure; the
+	 * writer carries on regardless.
+	 */
+	ma_result result;
+	ma_uint64 bytes = (ma_uint64)count * ma_get_bytes_per_frame(out->config.format, out->config.channels);
+	if (out->flac != NULL) {
+		ma_uint64 before = out->flac->bytes_written;
+		result = rec_flac_write(out->flac, frames, count);
+		out->pcm_bytes += bytes;
+		// Only what reached the file counts towards a sync
+		bytes = out->flac->bytes_written - before;
+	} else if (out->wavc != NULL) {
+		ma_uint64 before = out->wavc->bytes_written;
+		result = rec_wavc_write(out->wavc, frames, count);
+		out->pcm_bytes += bytes;
+		bytes = out->wavc->bytes_written - before;
+	} else if (out->archive != NULL) {
+		ma_uint64 before = out->archive->bytes_written;
+		result = rec_archive_write(out->archive, frames, count);
+		out->pcm_bytes += bytes;
+		bytes = out->archive->bytes_written - before;
+	} else result = ma_encoder_write_pcm_frames(&out->encoder, frames, count, NULL);
+	if (result != MA_SUCCESS && out->result == MA_SUCCESS) out->result = result;
+	if (out->syncer != NULL) rec_syncer_wrote(out->syncer, bytes);
+}
+
+static inline rec_sync_handle rec_output_sync_handle(rec_output* out) {
+	/*
+	 * The descriptor a sync goes to. Files
+	 * opened by the encoder are miniaudio's
+	 * default VFS: a Win32 HANDLE or a FILE*.
+	 * Our encoders' files are always a FILE*.
+	 */
+#if !defined(_WIN32)
+	if (out->sink_used) return out->sink.fd;
+	if (out->file != NULL) return fileno(out->file);
+	return fileno((FILE*)out->encoder.data.vfs.file);
+#else
+	if (out->file != NULL) return (HANDLE)_get_osfhandle(_fileno(out->file));
+#if defined(MA_USE_WIN32_FILEIO)
+	return (HANDLE)out->encoder.data.vfs.file;
+#else
+	return (HANDLE)_get_osfhandle(_fileno((FILE*)out->encoder.data.vfs.file));
+#endif
+#endif
+}
+
+static inline void rec_output_durable(rec_output* out, rec_syncer* y) {
+	/*
+	 * Hands an open output to the session's
+	 * sync thread.
+	 */
+	if (!out->ok || y->policy == REC_SYNC_NONE) return;
+	// One that doesn't fit is counted in the sync report
+	if (rec_syncer_add(y, rec_output_sync_handle(out)) == MA_SUCCESS) out->syncer = y;
+}
+
+static inline ma_result rec_output_close(rec_output* out) {
+	/*
+	 * Finalizes the header, then flushes
+	 * and closes the sink, if there is one.
+	 */
+	if (!out->ok) return out->result;
+	if (out->flac != NULL) {
+		ma_result result = rec_flac_uninit(out->flac);
+		if (result != MA_SUCCESS && out->result == MA_SUCCESS) out->result = result;
+		out->coded_bytes += out->flac->header_bytes + out->flac->bytes_written;
+		out->coder_waits += out->flac->waits;
+		delete out->flac;
+		out->flac = NULL;
+	} else if (out->wavc != NULL) {
+		ma_result result = rec_wavc_uninit(out->wavc);
+		if (result != MA_SUCCESS && out->result == MA_SUCCESS) out->result = result;
+		out->coded_bytes += out->wavc->header_bytes + out->wavc->bytes_written;
+		delete out->wavc;
+		out->wavc = NULL;
+	} else if (out->archive != NULL) {
+		ma_result result = rec_archive_uninit(out->archive);
+		if (result != MA_SUCCESS && out->result == MA_SUCCESS) out->result = result;
+		out->coded_bytes += out->archive->header_bytes + out->archive->bytes_written;
+		out->coder_waits += out->archive->flac.waits;
+		delete out->archive;
+		out->archive = NULL;
+	} else ma_encoder_uninit(&out->encoder);
+#if !defined(_WIN32)
+	if (out->sink_used) {
+		ma_result result = rec_sink_close(&out->sink);
+		if (result != MA_SUCCESS && out->result == MA_SUCCESS) out->result = result;
+	}
+#endif
+	if (out->file != NULL) {
+		if (fclose(out->file) != 0 && out->result == MA_SUCCESS) out->result = MA_IO_ERROR;
+		out->file = NULL;
+	}
+	out->ok = 0;
+	return out->result;
+}
+
+static inline std::string rec_space_dir(const char* path) {
+	/*
+	 * The directory a file is or will be in.
+	 */
+	std::string d(path);
+	size_t sep = d.find_last_of("/\\");
+	if (sep == std::string::npos) return ".";
+	return sep == 0 ? d.substr(0, 1) : d.substr(0, sep);
+}
+
+static inline ma_result rec_space_free(const char* path, ma_uint64* bytes) {
+	/*
+	 * Bytes available to this user on the
+	 * volume path is on.
+	 */
+	std::string dir = rec_space_dir(path);
+#if defined(_WIN32)
+	ULARGE_INTEGER avail;
+	if (!GetDiskFreeSpaceExA(dir.c_str(), &avail, NULL, NULL)) return MA_ERROR;
+	*bytes = avail.QuadPart;
+#else
+	struct statvfs st;
+	if (statvfs(dir.c_str(), &st) != 0) return rec_result_from_errno(errno);
+	*bytes = (ma_uint64)st.f_bavail * st.f_frsize;
+#endif
+	return MA_SUCCESS;
+}
+
+static inline double rec_space_rate(const rec_config* config) {
+	/*
+	 * Bytes per second the whole session
+	 * writes; every file is assumed to share
+	 * one volume.
+	 */
+	return (double)config->sample_rate * ma_get_bytes_per_frame(config->format, config->channels) * config->input_count;
+}
+
+static inline ma_result rec_space_preflight(const rec_config* config, const char* path, double* seconds) {
+	/*
+	 * Seconds of recording the volume holding
+	 * path has room for, above the floor.
+	 */
+	ma_uint64 avail;
+	ma_result result = rec_space_free(path, &avail);
+	if (result != MA_SUCCESS) return result;
+	*seconds = avail > REC_SPACE_FLOOR ? (avail - REC_SPACE_FLOOR) / rec_space_rate(config) : 0;
+	return MA_SUCCESS;
+}
+
+static inline std::string rec_spill_path(const char* dir, const char* path, ma_uint32 index) {
+	/*
+	 * Scratch file for a device's spool:
+	 * "<dir>/take.wav.spill-1".
+	 */
+	std::string name(path);
+	size_t sep = name.find_last_of("/\\");
+	if (sep != std::string::npos) name = name.substr(sep + 1);
+	std::string d(dir);
+	if (!d.empty() && d[d.size() - 1] != '/' && d[d.size() - 1] != '\\') d += '/';
+	return d + name + ".spill-" + std::to_string(index + 1);
+}
+
+static inline std::string rec_rotate_path(const char* dir, const char* path) {
+	/*
+	 * Where a file continues when its volume
+	 * runs low: "<dir>/take-cont.wav".
+	 */
+	std::string name(path);
+	size_t sep = name.find_last_of("/\\");
+	if (sep != std::string::npos) name = name.substr(sep + 1);
+	std::string ext;
+	size_t dot = name.find_last_of('.');
+	if (dot != std::string::npos) {
+		ext = name.substr(dot);
+		name = name.substr(0, dot);
+	}
+	std::string d(dir);
+	if (!d.empty() && d[d.size() - 1] != '/' && d[d.size() - 1] != '\\') d += '/';
+	return d + name + "-cont" + ext;
+}
+
+static inline void rec_space_raise(rec_session* s, int state) {
+	int now = s->space_state.load(std::memory_order_relaxed);
+	while (now < state && !s->space_state.compare_exchange_weak(now, state)) {}
+}
+
+static inline int rec_output_rotate(rec_session* s, rec_output* out, std::string* path) {
+	/*
+	 * Finalizes the file and carries on in
+	 * a new one in the alternate directory.
+	 * Returns 0 if there is nowhere to go.
+	 */
+	ma_encoder_config config = out->config;
+	rec_syncer* syncer = out->syncer;
+	std::string next = rec_rotate_path(s->config.space_alt_dir, path->c_str());
+	ma_uint64 avail;
+	if (rec_space_free(next.c_str(), &avail) != MA_SUCCESS || avail < REC_SPACE_FLOOR + rec_space_rate(&s->config) * s->config.space_low_seconds) return 0;
+	if (syncer != NULL) rec_syncer_remove(syncer, rec_output_sync_handle(out));
+	ma_result closed = rec_output_close(out);
+	if (closed == MA_SUCCESS && syncer != NULL) rec_sync_path(path->c_str());
+	ma_uint64 skipped = out->frames_skipped;
+	ma_uint64 pcm = out->pcm_bytes, coded = out->coded_bytes, waits = out->coder_waits;
+	double lag = out->lag_peak;
+	ma_result result = rec_output_open(out, next.c_str(), &config, out->codec, out->archive_ms, s->config.sink);
+	out->frames_skipped = skipped;
+	out->lag_peak = lag;
+	// Coded totals cover both files
+	out->pcm_bytes = pcm;
+	out->coded_bytes = coded;
+	out->coder_waits = waits;
+	out->rotated = 1;
+	if (result != MA_SUCCESS) {
+		out->result = result;
+		return 0;
+	}
+	if (closed != MA_SUCCESS) out->result = closed;
+	if (syncer != NULL) rec_output_durable(out, syncer);
+	*path = next;
+	s->rotations.fetch_add(1, std::memory_order_relaxed);
+	return 1;
+}
+
+static inline int rec_space_watch(rec_session* s, rec_output* out, std::string* path, int primary) {
+	/*
+	 * Writer threads, before each write:
+	 * once every REC_SPACE_CHECK ms, compare
+	 * free space with the watermarks. Below
+	 * the floor nothing more is written, so
+	 * the file can still be finalized; the
+	 * return value says whether to write.
+	 * Mirrors only observe the floor: their
+	 * volume never stops the session.
+	 */
+	if (s->config.space_low_seconds == 0 || !out->ok) return out->ok;
+	auto now = std::chrono::steady_clock::now();
+	if (now < out->space_next) return !out->space_full;
+	out->space_next = now + std::chrono::milliseconds(REC_SPACE_CHECK);
+	ma_uint64 avail;
+	if (rec_space_free(path->c_str(), &avail) != MA_SUCCESS) return !out->space_full;
+	// A mapped file's reservation is space it will still write into
+	if (out->sink_used) avail += rec_sink_headroom(&out->sink);
+	double left = avail > REC_SPACE_FLOOR ? (avail - REC_SPACE_FLOOR) / rec_space_rate(&s->config) : 0;
+	out->space_full = avail < REC_SPACE_FLOOR;
+	if (!primary) return !out->space_full;
+	s->space_seconds.store(left, std::memory_order_relaxed);
+	if (left < s->config.space_low_seconds && s->config.space_alt_dir != NULL && !out->rotated) {
+		if (rec_output_rotate(s, out, path)) return 1;
+	}
+	if (left < s->config.space_low_seconds) rec_space_raise(s, REC_SPACE_LOW);
+	else if (left < s->config.space_warn_seconds) rec_space_raise(s, REC_SPACE_WARN);
+	// A failed rotation may have closed it
+	return out->ok && !out->space_full;
+}
+
+static inline std::string rec_mirror_path(const char* dir, const char* path) {
+	/*
+	 * The same file name, in dir.
+	 */
+	std::string name(path);
+	size_t sep = name.find_last_of("/\\");
+	if (sep != std::string::npos) name = name.substr(sep + 1);
+	std::string d(dir);
+	if (!d.empty() && d[d.size() - 1] != '/' && d[d.size() - 1] != '\\') d += '/';
+	return d + name;
+}
+
+static inline void rec_dest_push(rec_dest* d, const void* frames, ma_uint32 count) {
+	/*
+	 * Producer side, lock-free: the audio
+	 * callback or the merged writer. Never
+	 * waits for the destination.
+	 */
+	const ma_uint32 bpf = ma_get_bytes_per_frame(ma_pcm_rb_get_format(&d->rb), ma_pcm_rb_get_channels(&d->rb));
+	const ma_uint8* src = (const ma_uint8*)frames;
+	ma_uint32 remaining = count;
+	while (remaining > 0) {
+		ma_uint32 n = remaining;
+		void* dst;
+		if (ma_pcm_rb_acquire_write(&d->rb, &n, &dst) != MA_SUCCESS || n == 0) break;
+		memcpy(dst, src, (size_t)n * bpf);
+		ma_pcm_rb_commit_write(&d->rb, n);
+		src += (size_t)n * bpf;
+		remaining -= n;
+	}
+	if (remaining > 0) d->frames_dropped.fetch_add(remaining, std::memory_order_relaxed);
+	d->frames_pushed.fetch_add(count, std::memory_order_release);
+}
+
+static inline void rec_dest_writer(rec_session* s, rec_dest* d) {
+	/*
+	 * Writer thread for a mirror: drains its
+	 * ring into its file until closing and
+	 * empty. A failed file is still drained,
+	 * so the producer never backs up.
+	 */
+	const ma_uint32 bpf = ma_get_bytes_per_frame(ma_pcm_rb_get_format(&d->rb), ma_pcm_rb_get_channels(&d->rb));
+	const double sr = ma_pcm_rb_get_sample_rate(&d->rb);
+	void* buf = ma_malloc((size_t)REC_WRITE_CHUNK * bpf, NULL);
+	if (buf == NULL) {
+		d->failed.store(1);
+		return;
+	}
+	for (;;) {
+		int closing = d->closing.load(std::memory_order_acquire);
+		ma_uint32 n = 0;
+		while (n < REC_WRITE_CHUNK) {
+			ma_uint32 got = REC_WRITE_CHUNK - n;
+			void* src;
+			if (ma_pcm_rb_acquire_read(&d->rb, &got, &src) != MA_SUCCESS || got == 0) break;
+			memcpy((ma_uint8*)buf + (size_t)n * bpf, src, (size_t)got * bpf);
+			ma_pcm_rb_commit_read(&d->rb, got);
+			n += got;
+		}
+		if (n == 0) {
+			if (closing) break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+		double lag = (ma_pcm_rb_available_read(&d->rb) + n) / sr;
+		if (lag > d->output.lag_peak) d->output.lag_peak = lag;
+		if (rec_space_watch(s, &d->output, &d->path, 0)) rec_output_write(&d->output, buf, n);
+		else d->output.frames_skipped += n;
+		if (d->output.result != MA_SUCCESS || !d->output.ok || d->output.space_full) d->failed.store(1, std::memory_order_relaxed);
+		d->frames_written.fetch_add(n, std::memory_order_relaxed);
+	}
+	ma_free(buf, NULL);
+}
+
+static inline ma_result rec_dest_open(rec_session* s, rec_dest* d, const char* path, const ma_encoder_config* config) {
+	/*
+	 * Ring, file and writer thread; in burst
+	 * mode only the file. A mirror that can't
+	 * be opened is marked failed rather than
+	 * failing the session.
+	 */
+	ma_result result;
+	d->path = path;
+	d->deferred = 0;
+	d->closing.store(0);
+	d->failed.store(0);
+	d->frames_pushed.store(0);
+	d->frames_dropped.store(0);
+	d->frames_written.store(0);
+	if (s->burst_mem != NULL) result = rec_output_open(&d->output, path, config, s->config.wav_codec, s->config.archive_ms, s->config.sink);
+	else result = ma_pcm_rb_init(config->format, config->channels, config->sampleRate * REC_MIRROR_SECONDS, NULL, NULL, &d->rb);
+	if (result == MA_SUCCESS && s->burst_mem != NULL) {
+		d->deferred = 1;
+		return MA_SUCCESS;
+	}
+	if (result == MA_SUCCESS) {
+		ma_pcm_rb_set_sample_rate(&d->rb, config->sampleRate);
+		result = rec_output_open(&d->output, path, config, s->config.wav_codec, s->config.archive_ms, s->config.sink);
+		if (result != MA_SUCCESS) ma_pcm_rb_uninit(&d->rb);
+	}
+	if (result != MA_SUCCESS) {
+		// Reported, but the primary records regardless
+		d->output.result = result;
+		d->failed.store(1);
+		return result;
+	}
+	d->rb_ok = 1;
+	d->writer = std::thread(rec_dest_writer, s, d);
+	return MA_SUCCESS;
+}
+
+static inline void rec_dest_write(rec_session* s, rec_dest* d, const void* frames, ma_uint32 count) {
+	/*
+	 * Burst mode, from the writer flushing
+	 * the buffer: a deferred mirror is
+	 * written there and then, so nothing
+	 * reaches either disk during capture.
+	 */
+	if (!d->deferred) return;
+	d->frames_pushed.fetch_add(count, std::memory_order_relaxed);
+	if (rec_space_watch(s, &d->output, &d->path, 0)) rec_output_write(&d->output, frames, count);
+	else d->output.frames_skipped += count;
+	if (d->output.result != MA_SUCCESS || !d->output.ok || d->output.space_full) d->failed.store(1, std::memory_order_relaxed);
+	d->frames_written.fetch_add(count, std::memory_order_relaxed);
+}
+
+static inline void rec_dest_stop(rec_dest* d) {
+	/*
+	 * After the last push: lets the writer
+	 * finish the ring and waits for it.
+	 */
+	d->closing.store(1, std::memory_order_release);
+	if (d->writer.joinable()) d->writer.join();
+}
+
+static inline void rec_dest_close(rec_dest* d) {
+	rec_dest_stop(d);
+	if (rec_output_close(&d->output) == MA_SUCCESS && d->output.syncer != NULL) rec_sync_path(d->path.c_str());
+	if (d->rb_ok) ma_pcm_rb_uninit(&d->rb);
+	d->rb_ok = 0;
+}
+
+static inline int rec_dest_health(rec_dest* d) {
+	/*
+	 * 0 healthy, 1 more than half its ring
+	 * behind, 2 lost audio or failed.
+	 */
+	if (d->path.empty()) return 0;
+	if (d->failed.load(std::memory_order_relaxed) || d->frames_dropped.load(std::memory_order_relaxed) > 0) return 2;
+	if (!d->rb_ok) return 0;
+	return ma_pcm_rb_available_read(&d->rb) > ma_pcm_rb_get_subbuffer_size(&d->rb) / 2 ? 1 : 0;
+}
+
+static inline void rec_proxy_reset(rec_proxy* p) {
+	p->path.clear();
+	p->ok = 0;
+	p->output.ok = 0;
+	p->output.syncer = NULL;
+	p->output.result = MA_SUCCESS;
+	p->output.frames_skipped = 0;
+	p->mix = p->out = NULL;
+	p->pcm = NULL;
+}
+
+static inline std::string rec_proxy_path(const char* path, ma_uint32 rate) {
+	/*
+	 * "take.wav" at 16000 Hz becomes
+	 * "take-16k.wav". Proxies are always
+	 * WAV, so "take.flac" does too.
+	 */
+	std::string base(path);
+	size_t dot = base.find_last_of('.');
+	size_t sep = base.find_last_of("/\\");
+	if (dot != std::string::npos && (sep == std::string::npos || dot > sep)) base = base.substr(0, dot);
+	return base + "-" + (rate % 1000 == 0 ? std::to_string(rate / 1000) + "k" : std::to_string(rate)) + ".wav";
+}
+
+static inline void rec_proxy_close(rec_proxy* p) {
+	/*
+	 * After its sink has stopped: writes the
+	 * resampler's tail and closes the file.
+	 */
+	if (p->ok && p->output.ok) {
+		ma_uint32 n;
+		while ((n = rec_resampler_flush(&p->rs, p->out)) > 0) {
+			ma_pcm_f32_to_s16(p->pcm, p->out, n, ma_dither_mode_triangle);
+			rec_output_write(&p->output, p->pcm, n);
+			p->frames_written += n;
+		}
+	}
+	if (rec_output_close(&p->output) == MA_SUCCESS && p->output.syncer != NULL) rec_sync_path(p->path.c_str());
+	if (p->ok) rec_resampler_uninit(&p->rs);
+	ma_free(p->mix, NULL);
+	ma_free(p->out, NULL);
+	ma_free(p->pcm, NULL);
+	p->mix = p->out = NULL;
+	p->pcm = NULL;
+	p->ok = 0;
+}
+
+static inline ma_result rec_proxy_open(rec_session* s, rec_proxy* p, const char* master, ma_uint32 channels) {
+	/*
+	 * Everything is allocated here; the sink
+	 * thread only converts and writes.
+	 */
+	ma_result result;
+	ma_encoder_config encoderConfig = ma_encoder_config_init(ma_encoding_format_wav, ma_format_s16, 1, s->config.proxy_rate);
+	p->session = s;
+	p->path = rec_proxy_path(master, s->config.proxy_rate);
+	p->format = s->config.format;
+	p->channels = channels;
+	p->position = 0;
+	p->frames_silenced = 0;
+	p->frames_written = 0;
+	result = rec_resampler_init(&p->rs, s->config.sample_rate, s->config.proxy_rate, REC_WRITE_CHUNK);
+	if (result != MA_SUCCESS) return result;
+	p->ok = 1;
+	p->mix = (float*)ma_malloc((size_t)REC_WRITE_CHUNK * channels * sizeof(float), NULL);
+	p->out = (float*)ma_malloc((size_t)rec_resampler_max_out(&p->rs) * sizeof(float), NULL);
+	p->pcm = (ma_int16*)ma_malloc((size_t)rec_resampler_max_out(&p->rs) * sizeof(ma_int16), NULL);
+	if (p->mix == NULL || p->out == NULL || p->pcm == NULL) return MA_OUT_OF_MEMORY;
+	return rec_output_open(&p->output, p->path.c_str(), &encoderConfig, REC_WAV_PCM, 0, s->config.sink);
+}
+
+static inline void rec_proxy_feed(rec_proxy* p, const float* mono, ma_uint32 frames) {
+	ma_uint32 n = rec_resampler_process(&p->rs, mono, frames, p->out);
+	if (n == 0) return;
+	ma_pcm_f32_to_s16(p->pcm, p->out, n, ma_dither_mode_triangle);
+	if (rec_space_watch(p->session, &p->output, &p->path, 0)) rec_output_write(&p->output, p->pcm, n);
+	else p->output.frames_skipped += n;
+	p->frames_written += n;
+}
+
+static inline void rec_proxy_consume(void* user, const rec_block* b) {
+	/*
+	 * Proxy sink: converts the block to f32
+	 * in place in mix, averages its channels
+	 * into the front of mix, and resamples.
+	 */
+	rec_proxy* p = (rec_proxy*)user;
+	const ma_uint32 ch = p->channels;
+	while (p->position < b->position) {
+		ma_uint64 gap = b->position - p->position;
+		ma_uint32 n = gap > REC_WRITE_CHUNK ? REC_WRITE_CHUNK : (ma_uint32)gap;
+		memset(p->mix, 0, (size_t)n * sizeof(float));
+		rec_proxy_feed(p, p->mix, n);
+		p->frames_silenced += n;
+		p->position += n;
+	}
+	ma_pcm_convert(p->mix, ma_format_f32, b->data, p->format, (ma_uint64)b->frames * ch, ma_dither_mode_none);
+	if (ch > 1) {
+		const float gain = 1.0f / ch;
+		for (ma_uint32 f = 0; f < b->frames; f++) {
+			const float* x = p->mix + (size_t)f * ch;
+			float sum = 0;
+			for (ma_uint32 c = 0; c < ch; c++) sum += x[c];
+			// Frame f's samples start at or after f, so nothing unread is overwritten
+			p->mix[f] = sum * gain;
+		}
+	}
+	rec_proxy_feed(p, p->mix, b->frames);
+	p->position += b->frames;
+}
+
+static inline void rec_proxy_report(const rec_proxy* p, const char* prefix) {
+	if (p->path.empty()) return;
+	const rec_config* config = &p->session->config;
+	printf("%sproxy %s: %.1f s at %u Hz", prefix, p->path.c_str(), p->frames_written / (double)config->proxy_rate, config->proxy_rate);
+	if (p->frames_silenced > 0) printf(", %.2f s missed and left silent", p->frames_silenced / (double)config->sample_rate);
+	if (p->output.frames_skipped > 0) printf(", %llu frames not written (disk full)", (unsigned long long)p->output.frames_skipped);
+	if (p->output.result != MA_SUCCESS) printf(", failed: %s", ma_result_description(p->output.result));
+	printf("\n");
+}
+
+static inline void rec_capture_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount) {
+	/*
+	 * Real-time thread: copy into the ring
+	 * and count what didn't fit. No locks,
+	 * no allocation, no I/O. In burst mode
+	 * the first overflow ends capture for
+	 * every device, so the takes end at the
+	 * same point instead of with holes.
+	 */
+	rec_input* in = (rec_input*)pDevice->pUserData;
+	rec_session* s = in->session;
+	const ma_uint32 bpf = ma_get_bytes_per_frame(pDevice->capture.format, pDevice->capture.channels);
+	const ma_uint8* src = (const ma_uint8*)pInput;
+	ma_uint32 remaining = frameCount;
+	while (remaining > 0 && !s->burst_full.load(std::memory_order_relaxed)) {
+		ma_uint32 n = remaining;
+		void* dst;
+		if (ma_pcm_rb_acquire_write(&in->rb, &n, &dst) != MA_SUCCESS || n == 0) break;
+		memcpy(dst, src, (size_t)n * bpf);
+		ma_pcm_rb_commit_write(&in->rb, n);
+		src += (size_t)n * bpf;
+		remaining -= n;
+	}
+	if (remaining > 0) {
+		in->frames_dropped.fetch_add(remaining, std::memory_order_relaxed);
+		if (s->burst_mem != NULL) s->burst_full.store(1, std::memory_order_relaxed);
+	}
+	if (in->mirror.rb_ok) rec_dest_push(&in->mirror, pInput, frameCount);
+	ma_int64 now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	if (in->cb_first_ns.load(std::memory_order_relaxed) == 0) {
+		in->cb_first_frames.store(frameCount, std::memory_order_relaxed);
+		in->cb_first_ns.store(now, std::memory_order_relaxed);
+	}
+	in->frames_captured.fetch_add(frameCount, std::memory_order_release);
+	in->cb_last_ns.store(now, std::memory_order_release);
+	(void)pOutput;
+}
+
+static inline double rec_input_rate(rec_input* in) {
+	/*
+	 * Device clock against the host clock:
+	 * frames delivered between the first and
+	 * latest callbacks over the time between
+	 * them. Timestamping in the callback keeps
+	 * the error to scheduling jitter rather
+	 * than a whole callback period. Retries if
+	 * a callback lands between the two loads.
+	 */
+	for (;;) {
+		ma_uint64 frames = in->frames_captured.load(std::memory_order_acquire);
+		ma_int64 last = in->cb_last_ns.load(std::memory_order_acquire);
+		if (frames != in->frames_captured.load(std::memory_order_acquire)) continue;
+		ma_int64 first = in->cb_first_ns.load(std::memory_order_relaxed);
+		if (first == 0 || last <= first) return 0;
+		return (double)(frames - in->cb_first_frames.load(std::memory_order_relaxed)) * 1e9 / (double)(last - first);
+	}
+}
+
+static inline void rec_update_drift(rec_session* s) {
+	/*
+	 * Drift of each device against device 0,
+	 * both measured on the same host clock.
+	 * Settles to a few ppm over tens of
+	 * seconds.
+	 */
+	double master = rec_input_rate(&s->inputs[0]);
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		rec_input* in = &s->inputs[i];
+		double rate = rec_input_rate(in);
+		in->rate_measured.store(rate, std::memory_order_relaxed);
+		if (master > 0 && rate > 0) {
+			in->drift_ppm.store((rate / master - 1.0) * 1e6, std::memory_order_relaxed);
+		}
+	}
+}
+
+static inline ma_uint64 rec_input_available(rec_input* in) {
+	/*
+	 * Frames the writer can read: spooled
+	 * plus still in the ring.
+	 */
+	return in->spool_frames.load(std::memory_order_acquire) + ma_pcm_rb_available_read(&in->rb);
+}
+
+static inline ma_uint32 rec_input_read(rec_input* in, void* dst, ma_uint32 frames) {
+	/*
+	 * Oldest audio first: the spool holds
+	 * what was moved out of the ring, so it
+	 * is read before the ring.
+	 */
+	const size_t bpf = ma_get_bytes_per_frame(in->session->config.format, in->session->config.channels);
+	ma_uint8* out = (ma_uint8*)dst;
+	ma_uint32 done = 0;
+	std::lock_guard<std::mutex> guard(in->read_lock);
+	if (in->spool_ok && in->spool.frames > 0) {
+		done = rec_spool_pop(&in->spool, out, frames);
+		in->spool_frames.store(in->spool.frames, std::memory_order_release);
+		if (in->spool.frames > 0) return done;
+	}
+	while (done < frames) {
+		ma_uint32 got = frames - done;
+		void* src;
+		if (ma_pcm_rb_acquire_read(&in->rb, &got, &src) != MA_SUCCESS || got == 0) break;
+		memcpy(out + (size_t)done * bpf, src, (size_t)got * bpf);
+		ma_pcm_rb_commit_read(&in->rb, got);
+		done += got;
+	}
+	return done;
+}
+
+static inline void rec_spooler(rec_session* s) {
+	/*
+	 * Spool thread: keeps every ring below
+	 * the high-water mark while the writers
+	 * are held up, by moving the oldest audio
+	 * into the device's spool. Once the disk
+	 * recovers the writers drain the spool
+	 * first and it stays idle.
+	 */
+	while (!s->stopping.load(std::memory_order_acquire)) {
+		for (ma_uint32 i = 0; i < s->input_count; i++) {
+			rec_input* in = &s->inputs[i];
+			ma_uint32 cap = ma_pcm_rb_get_subbuffer_size(&in->rb);
+			if (ma_pcm_rb_available_read(&in->rb) <= cap / 8 * REC_SPOOL_HIGH) continue;
+			std::lock_guard<std::mutex> guard(in->read_lock);
+			ma_uint32 avail = ma_pcm_rb_available_read(&in->rb);
+			ma_uint32 low = cap / 8 * REC_SPOOL_LOW;
+			ma_uint32 move = avail > low ? avail - low : 0;
+			while (move > 0) {
+				ma_uint32 got = move;
+				void* src;
+				if (ma_pcm_rb_acquire_read(&in->rb, &got, &src) != MA_SUCCESS || got == 0) break;
+				got = rec_spool_push(&in->spool, src, got);
+				ma_pcm_rb_commit_read(&in->rb, got);
+				if (got == 0) break;
+				move -= got;
+			}
+			in->spool_frames.store(in->spool.frames, std::memory_order_release);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+static inline void rec_separate_consume(void* user, const rec_block* b) {
+	/*
+	 * File sink of a device's fan-out.
+	 */
+	rec_input* in = (rec_input*)user;
+	// This thread owns in->output, lag_peak included; b is still queued
+	double lag = (rec_input_available(in) + rec_fanout_queued(&in->fanout, 0)) / (double)in->session->config.sample_rate;
+	if (lag > in->output.lag_peak) in->output.lag_peak = lag;
+	if (rec_space_watch(in->session, &in->output, &in->path, 1)) rec_output_write(&in->output, b->data, b->frames);
+	else in->output.frames_skipped += b->frames;
+}
+
+static inline void rec_separate_writer(rec_input* in) {
+	/*
+	 * Writer thread for one device in
+	 * REC_LAYOUT_SEPARATE: drain the ring
+	 * into the device's own file, or with
+	 * taps, into fan-out blocks. Keeps
+	 * draining after stop until empty.
+	 */
+	rec_session* s = in->session;
+	const size_t bpf = ma_get_bytes_per_frame(s->config.format, s->config.channels);
+	rec_fanout* f = in->fanout_ok ? &in->fanout : NULL;
+	void* buf = ma_malloc((size_t)REC_WRITE_CHUNK * bpf, NULL);
+	if (buf == NULL) return;
+	for (;;) {
+		int stopping = s->stopping.load(std::memory_order_acquire);
+		rec_block* b = NULL;
+		ma_uint32 n = 0;
+		if (f == NULL) n = rec_input_read(in, buf, REC_WRITE_CHUNK);
+		else if (rec_input_available(in) > 0) {
+			b = rec_fanout_acquire(f);
+			n = rec_input_read(in, b->data, REC_WRITE_CHUNK);
+		}
+		if (n > 0) {
+			// Burst mode: the mirror, as captured, is written alongside
+			rec_dest_write(s, &in->mirror, b != NULL ? b->data : buf, n);
+			rec_chain_process(&in->chain, b != NULL ? b->data : buf, n);
+			rec_meter_push(&in->meter, b != NULL ? b->data : buf, n);
+			rec_preview_push(in->preview, b != NULL ? b->data : buf, n);
+			if (b != NULL) rec_fanout_publish(f, b, n);
+			else {
+				double lag = (rec_input_available(in) + n) / (double)s->config.sample_rate;
+				if (lag > in->output.lag_peak) in->output.lag_peak = lag;
+				if (rec_space_watch(s, &in->output, &in->path, 1)) rec_output_write(&in->output, buf, n);
+				else in->output.frames_skipped += n;
+			}
+			in->frames_written.fetch_add(n, std::memory_order_relaxed);
+			continue;
+		}
+		if (b != NULL) rec_fanout_release(f, b);
+		if (stopping) break;
+		if (in->index == 0) rec_update_drift(s);
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	ma_free(buf, NULL);
+}
+
+static inline void rec_scatter(const ma_uint8* src, ma_uint8* out, ma_uint32 frames, size_t frame_bytes, size_t stride) {
+	/*
+	 * Copies packed frames into every
+	 * stride bytes of out.
+	 */
+	for (ma_uint32 f = 0; f < frames; f++) {
+		memcpy(out + (size_t)f * stride, src + (size_t)f * frame_bytes, frame_bytes);
+	}
+}
+
+static inline void rec_merged_consume(void* user, const rec_block* b) {
+	/*
+	 * File sink of the merged fan-out.
+	 */
+	rec_session* s = (rec_session*)user;
+	// This thread owns merged_output, lag_peak included; b is still queued
+	double lag = (rec_input_available(&s->inputs[0]) + rec_fanout_queued(&s->merged_fanout, 0)) / (double)s->config.sample_rate;
+	if (lag > s->merged_output.lag_peak) s->merged_output.lag_peak = lag;
+	if (rec_space_watch(s, &s->merged_output, &s->inputs[0].path, 1)) rec_output_write(&s->merged_output, b->data, b->frames);
+	else s->merged_output.frames_skipped += b->frames;
+}
+
+static inline void rec_merged_writer(rec_session* s) {
+	/*
+	 * Writer thread for REC_LAYOUT_MERGED:
+	 * interleave every ring into one file,
+	 * device 0 on the lowest channels.
+	 *
+	 * Device 0 is the master clock. Without
+	 * drift compensation equal frame counts
+	 * are taken from each ring, and a device
+	 * running fast builds up backlog. With it,
+	 * the other devices go through an ASRC
+	 * whose ratio tracks their backlog, once
+	 * REC_DRIFT_SETTLE seconds have been
+	 * captured. Resampling is in float, other
+	 * formats converted on the way in and out.
+	 *
+	 * With taps, frames are interleaved
+	 * straight into fan-out blocks.
+	 *
+	 * At stop the rings rarely hold the same
+	 * amount. Whatever is left is still
+	 * written, the inputs that ran out padded
+	 * with silence, so no captured audio is
+	 * dropped.
+	 */
+	const ma_uint32 ch = s->config.channels;
+	const ma_uint32 total = ch * s->input_count;
+	const ma_uint32 bps = ma_get_bytes_per_sample(s->config.format);
+	const double sr = s->config.sample_rate;
+	const int asrc = s->input_count > 1 && s->inputs[1].asrc_ok;
+	const int widen = asrc && s->config.format != ma_format_f32;
+	rec_fanout* f = s->merged_fanout_ok ? &s->merged_fanout : NULL;
+	ma_uint64 master_frames = 0;
+	ma_uint8* out = (ma_uint8*)ma_malloc((size_t)REC_WRITE_CHUNK * total * bps, NULL);
+	ma_uint8* stage = (ma_uint8*)ma_malloc((size_t)REC_WRITE_CHUNK * ch * bps, NULL);
+	float* wide = widen ? (float*)ma_malloc((size_t)REC_WRITE_CHUNK * ch * sizeof(float), NULL) : NULL;
+	if (out == NULL || stage == NULL || (widen && wide == NULL)) {
+		ma_free(out, NULL);
+		ma_free(stage, NULL);
+		ma_free(wide, NULL);
+		return;
+	}
+	for (;;) {
+		int stopping = s->stopping.load(std::memory_order_acquire);
+		ma_uint32 n = REC_WRITE_CHUNK;
+		for (ma_uint32 i = 0; i < s->input_count; i++) {
+			rec_input* in = &s->inputs[i];
+			ma_uint64 queued = rec_input_available(in);
+			ma_uint32 avail = queued > REC_WRITE_CHUNK ? REC_WRITE_CHUNK : (ma_uint32)queued;
+			if (i > 0 && asrc) {
+				ma_uint32 room = rec_asrc_room(&in->asrc);
+				avail = rec_asrc_available(&in->asrc, avail < room ? avail : room);
+			}
+			if (avail < n) n = avail;
+		}
+		int draining = 0;
+		if (n == 0 && stopping) {
+			ma_uint64 left = 0;
+			for (ma_uint32 i = 0; i < s->input_count; i++) {
+				ma_uint64 queued = rec_input_available(&s->inputs[i]);
+				if (queued > left) left = queued;
+			}
+			n = left > REC_WRITE_CHUNK ? REC_WRITE_CHUNK : (ma_uint32)left;
+			draining = 1;
+		}
+		if (n == 0) {
+			if (stopping) break;
+			rec_update_drift(s);
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+		if (f == NULL) {
+			double lag = rec_input_available(&s->inputs[0]) / sr;
+			if (lag > s->merged_output.lag_peak) s->merged_output.lag_peak = lag;
+		}
+		rec_block* b = f != NULL ? rec_fanout_acquire(f) : NULL;
+		ma_uint8* dst = b != NULL ? b->data : out;
+		for (ma_uint32 i = 0; i < s->input_count; i++) {
+			rec_input* in = &s->inputs[i];
+			if (i > 0 && asrc) continue;
+			ma_uint32 got = rec_input_read(in, stage, n);
+			rec_chain_process(&in->chain, stage, got);
+			rec_meter_push(&in->meter, stage, got);
+			rec_preview_push(in->preview, stage, got);
+			if (got < n) {
+				ma_silence_pcm_frames(stage + (size_t)got * ch * bps, n - got, s->config.format, ch);
+				in->frames_padded += n - got;
+			}
+			rec_scatter(stage, dst + (size_t)i * ch * bps, n, (size_t)ch * bps, (size_t)total * bps);
+			in->frames_written.fetch_add(got, std::memory_order_relaxed);
+		}
+		master_frames += n;
+		for (ma_uint32 i = 1; i < s->input_count && asrc; i++) {
+			rec_input* in = &s->inputs[i];
+			ma_uint32 need = rec_asrc_needed(&in->asrc, n);
+			while (need > 0) {
+				ma_uint32 chunk = need > REC_WRITE_CHUNK ? REC_WRITE_CHUNK : need;
+				ma_uint32 got = rec_input_read(in, stage, chunk);
+				if (got == 0 && !draining) break;
+				if (got == 0) {
+					ma_silence_pcm_frames(widen ? (void*)wide : (void*)stage, chunk, ma_format_f32, ch);
+					rec_asrc_push(&in->asrc, widen ? wide : (const float*)stage, chunk);
+					in->frames_padded += chunk;
+					need -= chunk;
+					continue;
+				}
+				rec_chain_process(&in->chain, stage, got);
+				rec_meter_push(&in->meter, stage, got);
+				rec_preview_push(in->preview, stage, got);
+				if (widen) ma_pcm_convert(wide, ma_format_f32, stage, s->config.format, (ma_uint64)got * ch, ma_dither_mode_none);
+				rec_asrc_push(&in->asrc, widen ? wide : (const float*)stage, got);
+				in->frames_written.fetch_add(got, std::memory_order_relaxed);
+				need -= got;
+			}
+			if (widen) {
+				rec_asrc_process(&in->asrc, wide, n, ch);
+				ma_pcm_convert(stage, s->config.format, wide, ma_format_f32, (ma_uint64)n * ch, ma_dither_mode_triangle);
+				rec_scatter(stage, dst + (size_t)i * ch * bps, n, (size_t)ch * bps, (size_t)total * bps);
+			} else rec_asrc_process(&in->asrc, (float*)dst + (size_t)i * ch, n, total);
+			if (master_frames >= (ma_uint64)sr * REC_DRIFT_SETTLE) {
+				double backlog = (rec_input_available(in) + (in->asrc.frames - in->asrc.pos)) / sr
+					- rec_input_available(&s->inputs[0]) / sr;
+				rec_asrc_steer(&in->asrc, backlog, n / sr, in->drift_ppm.load(std::memory_order_relaxed));
+				in->asrc_ppm.store((in->asrc.ratio - 1.0) * 1e6, std::memory_order_relaxed);
+			}
+		}
+		// The mirror copies the block before it is handed on
+		if (s->merged_mirror.rb_ok) rec_dest_push(&s->merged_mirror, dst, n);
+		else rec_dest_write(s, &s->merged_mirror, dst, n);
+		if (b != NULL) rec_fanout_publish(f, b, n);
+		else if (rec_space_watch(s, &s->merged_output, &s->inputs[0].path, 1)) rec_output_write(&s->merged_output, out, n);
+		else s->merged_output.frames_skipped += n;
+	}
+	ma_free(out, NULL);
+	ma_free(stage, NULL);
+	ma_free(wide, NULL);
+}
+
+static inline int rec_session_fanned(const rec_config* config) {
+	/*
+	 * Whether the writers hand blocks to a
+	 * fan-out rather than write directly.
+	 */
+	return config->tap_count > 0 || config->proxy_rate > 0 || config->spectrum != NULL || config->loudness != NULL;
+}
+
+static inline ma_result rec_session_fanout(rec_session* s, rec_fanout* f, ma_uint32 source, size_t bpf, rec_consume_proc file, void* user, rec_proxy* proxy) {
+	/*
+	 * The file first, losing nothing, then
+	 * the proxy, which never holds up the
+	 * file, then the analyzer, which sheds
+	 * sooner still, then the taps with their
+	 * own policies.
+	 */
+	rec_fanout_init(f, source, bpf, REC_WRITE_CHUNK);
+	if (rec_fanout_add(f, "file", REC_DROP_NONE, REC_FILE_BLOCKS, file, user) < 0) return MA_OUT_OF_MEMORY;
+	if (proxy != NULL && rec_fanout_add(f, "proxy", REC_DROP_NEWEST, REC_FILE_BLOCKS, rec_proxy_consume, proxy) < 0) return MA_OUT_OF_MEMORY;
+	if (source == 0 && s->spectrum_ok && rec_fanout_add(f, "spectrum", REC_DROP_NEWEST, REC_SPECTRUM_DEPTH, rec_spectrum_consume, &s->spectrum) < 0) return MA_OUT_OF_MEMORY;
+	// Every frame counts towards a take's loudness
+	if (source < s->loudness_count && rec_fanout_add(f, "loudness", REC_DROP_NONE, REC_FILE_BLOCKS, rec_loudness_consume, &s->loudness[source]) < 0) return MA_OUT_OF_MEMORY;
+	for (ma_uint32 t = 0; t < s->config.tap_count; t++) {
+		const rec_tap* tap = &s->config.taps[t];
+		if (rec_fanout_add(f, tap->name, tap->policy, tap->depth, tap->consume, tap->user) < 0) return MA_OUT_OF_MEMORY;
+	}
+	return rec_fanout_start(f);
+}
+
+static inline void rec_session_start_writers(rec_session* s) {
+	/*
+	 * One writer per device file, or one for
+	 * the merged file. In burst mode this runs
+	 * at stop, and the per-device writers
+	 * flush their buffers in parallel.
+	 */
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		if (s->config.layout == REC_LAYOUT_SEPARATE) s->inputs[i].writer = std::thread(rec_separate_writer, &s->inputs[i]);
+	}
+	if (s->config.layout == REC_LAYOUT_MERGED) s->merged_writer = std::thread(rec_merged_writer, s);
+}
+
+static inline int rec_session_full(rec_session* s) {
+	/*
+	 * Burst mode: true once any device has
+	 * run out of its share of the budget.
+	 * Capture has stopped by then; what is
+	 * still delivered until the session is
+	 * stopped counts as dropped.
+	 */
+	return s->burst_full.load(std::memory_order_relaxed);
+}
+
+static inline rec_wave* rec_input_wave(rec_session* s, ma_uint32 i) {
+	if (s->config.waves != NULL) return &s->config.waves[i];
+	return s->inputs[i].wave_ok ? &s->inputs[i].wave : NULL;
+}
+
+static inline void rec_session_peaks(rec_session* s, rec_output* out, const char* path, ma_uint32 first, ma_uint32 lanes, ma_uint32 channels) {
+	/*
+	 * The sidecar of a closed file, from its
+	 * inputs' waves. None for a file that
+	 * failed, lost frames or was continued
+	 * elsewhere, as its overview wouldn't
+	 * match; opening it scans it instead.
+	 */
+	if (!s->config.peaks || out->result != MA_SUCCESS || out->rotated || out->frames_skipped > 0) return;
+	rec_wave* waves[REC_MAX_INPUTS];
+	for (ma_uint32 i = 0; i < lanes; i++) {
+		waves[i] = rec_input_wave(s, first + i);
+		if (waves[i] == NULL || waves[i]->full || waves[i]->frames == 0) return;
+		rec_wave_flush(waves[i]);
+	}
+	ma_result result = rec_peaks_write(path, waves, lanes, channels, s->config.sample_rate);
+	if (result != MA_SUCCESS) printf("Could not write %s: %s\n", rec_peaks_path(path).c_str(), ma_result_description(result));
+}
+
+static inline void rec_session_loudness(rec_output* out, const char* path, rec_loudness* l, int closed) {
+	/*
+	 * The take's loudness into its file: as
+	 * FLAC comments before it closes, or as a
+	 * WAV bext chunk after. Not into a file
+	 * that failed, lost frames or was
+	 * continued elsewhere, as the figures
+	 * wouldn't be its own.
+	 */
+	if (out->result != MA_SUCCESS || out->rotated || out->frames_skipped > 0 || l->final.position == 0) return;
+	ma_result result = MA_SUCCESS;
+	if (!closed && out->flac != NULL) result = rec_loudness_comments(&l->final, out->flac);
+	else if (closed && out->config.encodingFormat == ma_encoding_format_wav) result = rec_loudness_write_bext(path, &l->final);
+	if (result != MA_SUCCESS) printf("Could not add the loudness to %s: %s\n", path, ma_result_description(result));
+}
+
+static inline void rec_session_uninit(rec_session* s) {
+	/*
+	 * Stops devices first so nothing feeds
+	 * the rings, then lets the writers drain
+	 * them and finalizes the files.
+	 */
+	int flush = s->burst_pending;
+	s->burst_pending = 0;
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		if (s->inputs[i].device_ok) ma_device_stop(&s->inputs[i].device);
+		// Nothing feeds a device's mirror any more
+		rec_dest_stop(&s->inputs[i].mirror);
+	}
+	s->stopping.store(1, std::memory_order_release);
+	if (s->spooler.joinable()) s->spooler.join();
+	if (flush) {
+		printf("Flushing burst buffer...\n");
+		rec_session_start_writers(s);
+	}
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		if (s->inputs[i].writer.joinable()) s->inputs[i].writer.join();
+	}
+	if (s->merged_writer.joinable()) s->merged_writer.join();
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		rec_preview_close(s->inputs[i].preview);
+		if (s->inputs[i].fanout_ok) rec_fanout_uninit(&s->inputs[i].fanout);
+		s->inputs[i].fanout_ok = 0;
+	}
+	if (s->merged_fanout_ok) rec_fanout_uninit(&s->merged_fanout);
+	s->merged_fanout_ok = 0;
+	// Its sink has stopped with the fan-outs
+	if (s->spectrum_ok) rec_spectrum_uninit(&s->spectrum);
+	s->spectrum_ok = 0;
+	// So have the meters, and their figures are final
+	for (ma_uint32 i = 0; i < s->loudness_count; i++) rec_loudness_uninit(&s->loudness[i]);
+	rec_dest_stop(&s->merged_mirror);
+	rec_syncer_stop(&s->syncer);
+	rec_update_drift(s);
+	rec_proxy_close(&s->merged_proxy);
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		rec_input* in = &s->inputs[i];
+		if (in->device_ok) ma_device_uninit(&in->device);
+		// With a durability policy the finished header is synced too
+		int opened = in->output.ok;
+		if (opened && i < s->loudness_count) rec_session_loudness(&in->output, in->path.c_str(), &s->loudness[i], 0);
+		ma_result closed = rec_output_close(&in->output);
+		if (opened && i < s->loudness_count) rec_session_loudness(&in->output, in->path.c_str(), &s->loudness[i], 1);
+		if (closed == MA_SUCCESS && in->output.syncer != NULL) rec_sync_path(in->path.c_str());
+		if (opened) rec_session_peaks(s, &in->output, in->path.c_str(), i, 1, s->config.channels);
+		rec_dest_close(&in->mirror);
+		rec_proxy_close(&in->proxy);
+		if (in->rb_ok) ma_pcm_rb_uninit(&in->rb);
+		if (in->asrc_ok) rec_asrc_uninit(&in->asrc);
+		if (in->spool_ok) rec_spool_uninit(&in->spool);
+		rec_meter_uninit(&in->meter);
+		rec_chain_uninit(&in->chain);
+		in->device_ok = in->rb_ok = in->asrc_ok = in->spool_ok = 0;
+	}
+	int opened = s->merged_output.ok;
+	if (opened && s->loudness_count > 0) rec_session_loudness(&s->merged_output, s->inputs[0].path.c_str(), &s->loudness[0], 0);
+	ma_result closed = rec_output_close(&s->merged_output);
+	if (opened && s->loudness_count > 0) rec_session_loudness(&s->merged_output, s->inputs[0].path.c_str(), &s->loudness[0], 1);
+	if (closed == MA_SUCCESS && s->merged_output.syncer != NULL) rec_sync_path(s->inputs[0].path.c_str());
+	if (opened) rec_session_peaks(s, &s->merged_output, s->inputs[0].path.c_str(), 0, s->input_count, s->config.channels * s->input_count);
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		if (s->inputs[i].wave_ok) rec_wave_uninit(&s->inputs[i].wave);
+		s->inputs[i].wave_ok = 0;
+	}
+	rec_dest_close(&s->merged_mirror);
+	if (s->burst_mem != NULL) rec_burst_free(s->burst_mem, s->burst_size);
+	s->burst_mem = NULL;
+}
+
+static inline ma_result rec_session_start(rec_session* s, ma_context* context, const rec_config* config, const char* path) {
+	/*
+	 * Opens every device, ring and output
+	 * file, then starts the writers and the
+	 * devices. On failure everything opened
+	 * so far is torn down again.
+	 */
+	ma_result result;
+	ma_encoder_config encoderConfig;
+	if (config->input_count == 0 || config->input_count > REC_MAX_INPUTS || config->tap_count + (config->proxy_rate > 0) + (config->spectrum != NULL) + (config->loudness != NULL) > REC_MAX_TAPS) return MA_INVALID_ARGS;
+	if (config->encoding != ma_encoding_format_wav && config->encoding != ma_encoding_format_flac) return MA_INVALID_ARGS;
+	{
+		// What one file can hold
+		ma_uint32 file_channels = config->layout == REC_LAYOUT_MERGED ? config->channels * config->input_count : config->channels;
+		if (config->encoding == ma_encoding_format_flac) {
+			if (config->format != ma_format_u8 && config->format != ma_format_s16 && config->format != ma_format_s24) return MA_FORMAT_NOT_SUPPORTED;
+			if (file_channels > REC_FLAC_MAX_CHANNELS) return MA_FORMAT_NOT_SUPPORTED;
+		} else if (config->wav_codec == REC_WAV_IMA_ADPCM && file_channels > 2) return MA_FORMAT_NOT_SUPPORTED;
+	}
+	if (config->space_low_seconds > 0) {
+		// Refuse to start a recording that would stop at once
+		double seconds;
+		if (rec_space_preflight(config, path, &seconds) == MA_SUCCESS && seconds < config->space_low_seconds) return MA_NO_SPACE;
+	}
+	s->config = *config;
+	s->context = context;
+	s->input_count = config->input_count;
+	s->merged_output.ok = 0;
+	s->merged_output.syncer = NULL;
+	s->merged_output.rotated = 0;
+	s->merged_output.frames_skipped = 0;
+	s->merged_output.coded_bytes = 0;
+	s->merged_mirror.rb_ok = s->merged_mirror.output.ok = s->merged_mirror.deferred = 0;
+	s->merged_fanout_ok = 0;
+	s->spectrum_ok = 0;
+	s->loudness_count = 0;
+	s->merged_mirror.output.syncer = NULL;
+	rec_proxy_reset(&s->merged_proxy);
+	s->burst_mem = NULL;
+	s->burst_pending = 0;
+	s->burst_full.store(0);
+	s->stopping.store(0);
+	s->space_state.store(REC_SPACE_OK);
+	s->space_seconds.store(0);
+	s->rotations.store(0);
+	rec_syncer_init(&s->syncer, config->sync_policy, config->sync_interval_ms, config->sync_bytes);
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		s->inputs[i].device_ok = s->inputs[i].rb_ok = s->inputs[i].output.ok = s->inputs[i].asrc_ok = s->inputs[i].spool_ok = 0;
+		s->inputs[i].output.syncer = NULL;
+		s->inputs[i].output.rotated = 0;
+		s->inputs[i].output.frames_skipped = 0;
+		s->inputs[i].output.coded_bytes = 0;
+		s->inputs[i].mirror.rb_ok = s->inputs[i].mirror.output.ok = s->inputs[i].mirror.deferred = 0;
+		s->inputs[i].fanout_ok = 0;
+		s->inputs[i].meter.scratch = NULL;
+		s->inputs[i].chain.count = 0;
+		s->inputs[i].chain.scratch = s->inputs[i].chain.gains = NULL;
+		s->inputs[i].wave_ok = 0;
+		s->inputs[i].preview = NULL;
+		s->inputs[i].mirror.output.syncer = NULL;
+		rec_proxy_reset(&s->inputs[i].proxy);
+	}
+
+	if (config->burst_budget > 0) {
+		/*
+		 * Split the budget evenly; each share
+		 * must hold at least a second and fit
+		 * a ring buffer (just under 2 GiB).
+		 */
+		const size_t bpf = ma_get_bytes_per_frame(config->format, config->channels);
+		size_t share = config->burst_budget / config->input_count;
+		if (share > 0x7FFFFFC0) share = 0x7FFFFFC0;
+		share -= share % (bpf * 64);
+		if (share / bpf < config->sample_rate) return MA_OUT_OF_MEMORY;
+		s->burst_share = share;
+		s->burst_mem = rec_burst_alloc(share * config->input_count, &s->burst_size, &s->burst_huge);
+		if (s->burst_mem == NULL) return MA_OUT_OF_MEMORY;
+	}
+	if (config->spectrum != NULL) {
+		const ma_uint32 analyzed = config->layout == REC_LAYOUT_MERGED ? config->channels * config->input_count : config->channels;
+		result = rec_spectrum_init(&s->spectrum, config->spectrum, config->format, analyzed, config->sample_rate, REC_WRITE_CHUNK);
+		if (result != MA_SUCCESS) goto fail;
+		s->spectrum_ok = 1;
+	}
+	if (config->loudness != NULL) {
+		const ma_uint32 files = config->layout == REC_LAYOUT_MERGED ? 1 : config->input_count;
+		const ma_uint32 channels = config->layout == REC_LAYOUT_MERGED ? config->channels * config->input_count : config->channels;
+		for (ma_uint32 i = 0; i < files; i++) {
+			result = rec_loudness_init(&s->loudness[i], &config->loudness[i], config->format, channels, config->channels, config->sample_rate, REC_WRITE_CHUNK);
+			if (result != MA_SUCCESS) goto fail;
+			s->loudness_count = i + 1;
+		}
+	}
+	if (config->layout == REC_LAYOUT_MERGED) {
+		encoderConfig = ma_encoder_config_init(config->encoding, config->format, config->channels * config->input_count, config->sample_rate);
+		result = rec_output_open(&s->merged_output, path, &encoderConfig, config->wav_codec, config->archive_ms, config->sink);
+		if (result != MA_SUCCESS) goto fail;
+		if (config->mirror_dir != NULL) {
+			std::string mirror = rec_mirror_path(config->mirror_dir, path);
+			if (mirror == path) {
+				result = MA_INVALID_ARGS;
+				goto fail;
+			}
+			rec_dest_open(s, &s->merged_mirror, mirror.c_str(), &encoderConfig);
+		}
+		if (config->proxy_rate > 0) {
+			result = rec_proxy_open(s, &s->merged_proxy, path, config->channels * config->input_count);
+			if (result != MA_SUCCESS) goto fail;
+		}
+		if (rec_session_fanned(config)) {
+			s->merged_fanout_ok = 1;
+			result = rec_session_fanout(s, &s->merged_fanout, 0, ma_get_bytes_per_frame(config->format, config->channels * config->input_count), rec_merged_consume, s,
+				config->proxy_rate > 0 ? &s->merged_proxy : NULL);
+			if (result != MA_SUCCESS) goto fail;
+		}
+	}
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		rec_input* in = &s->inputs[i];
+		ma_device_config deviceConfig;
+		in->session = s;
+		in->index = i;
+		in->frames_captured.store(0);
+		in->frames_dropped.store(0);
+		in->frames_written.store(0);
+		in->drift_ppm.store(0);
+		in->rate_measured.store(0);
+		in->asrc_ppm.store(0);
+		in->cb_first_ns.store(0);
+		in->cb_last_ns.store(0);
+		in->cb_first_frames.store(0);
+		in->spool_frames.store(0);
+		in->frames_padded = 0;
+		if (s->burst_mem != NULL) {
+			result = ma_pcm_rb_init(config->format, config->channels, (ma_uint32)(s->burst_share / ma_get_bytes_per_frame(config->format, config->channels)),
+				(ma_uint8*)s->burst_mem + s->burst_share * i, NULL, &in->rb);
+		} else {
+			result = ma_pcm_rb_init(config->format, config->channels, config->sample_rate * REC_RING_SECONDS, NULL, NULL, &in->rb);
+		}
+		if (result != MA_SUCCESS) goto fail;
+		in->rb_ok = 1;
+		if (config->peaks && config->waves == NULL) {
+			result = rec_wave_init(&in->wave);
+			if (result != MA_SUCCESS) goto fail;
+			in->wave_ok = 1;
+		}
+		if (config->previews != NULL && config->previews[i].data != NULL) in->preview = &config->previews[i];
+		result = rec_chain_init(&in->chain, config->inserts, config->insert_count, config->format, config->channels, config->sample_rate, REC_WRITE_CHUNK);
+		if (result != MA_SUCCESS) goto fail;
+		result = rec_meter_init(&in->meter, config->levels != NULL ? &config->levels[i] : NULL, rec_input_wave(s, i), config->format, config->channels, config->sample_rate, REC_WRITE_CHUNK);
+		if (result != MA_SUCCESS) goto fail;
+		if (s->burst_mem == NULL && (config->spool_mem_cap > 0 || config->spill_dir != NULL)) {
+			rec_spool_init(&in->spool, ma_get_bytes_per_frame(config->format, config->channels), config->spool_mem_cap,
+				config->spill_dir != NULL ? rec_spill_path(config->spill_dir, path, i) : std::string());
+			in->spool_ok = 1;
+		}
+		if (i > 0 && config->layout == REC_LAYOUT_MERGED && config->drift_compensation) {
+			result = rec_asrc_init(&in->asrc, config->channels, REC_WRITE_CHUNK);
+			if (result != MA_SUCCESS) goto fail;
+			in->asrc_ok = 1;
+		}
+		if (config->layout == REC_LAYOUT_SEPARATE) {
+			in->path = rec_input_path(path, i, s->input_count);
+			encoderConfig = ma_encoder_config_init(config->encoding, config->format, config->channels, config->sample_rate);
+			result = rec_output_open(&in->output, in->path.c_str(), &encoderConfig, config->wav_codec, config->archive_ms, config->sink);
+			if (result != MA_SUCCESS) goto fail;
+			if (config->mirror_dir != NULL) {
+				std::string mirror = rec_mirror_path(config->mirror_dir, in->path.c_str());
+				if (mirror == in->path) {
+					result = MA_INVALID_ARGS;
+					goto fail;
+				}
+				rec_dest_open(s, &in->mirror, mirror.c_str(), &encoderConfig);
+			}
+			if (config->proxy_rate > 0) {
+				result = rec_proxy_open(s, &in->proxy, in->path.c_str(), config->channels);
+				if (result != MA_SUCCESS) goto fail;
+			}
+			if (rec_session_fanned(config)) {
+				in->fanout_ok = 1;
+				result = rec_session_fanout(s, &in->fanout, i, ma_get_bytes_per_frame(config->format, config->channels), rec_separate_consume, in,
+					config->proxy_rate > 0 ? &in->proxy : NULL);
+				if (result != MA_SUCCESS) goto fail;
+			}
+		} else in->path = path;
+		deviceConfig = ma_device_config_init(ma_device_type_capture);
+		deviceConfig.capture.pDeviceID = config->input_ids[i];
+		deviceConfig.capture.format = config->format;
+		deviceConfig.capture.channels = config->channels;
+		deviceConfig.sampleRate = config->sample_rate;
+		deviceConfig.dataCallback = rec_capture_callback;
+		deviceConfig.pUserData = in;
+		result = ma_device_init(context, &deviceConfig, &in->device);
+		if (result != MA_SUCCESS) goto fail;
+		in->device_ok = 1;
+		rec_output_durable(&in->output, &s->syncer);
+		rec_output_durable(&in->mirror.output, &s->syncer);
+		rec_output_durable(&in->proxy.output, &s->syncer);
+	}
+	rec_output_durable(&s->merged_output, &s->syncer);
+	rec_output_durable(&s->merged_mirror.output, &s->syncer);
+	rec_output_durable(&s->merged_proxy.output, &s->syncer);
+	if (s->burst_mem == NULL) rec_session_start_writers(s);
+	rec_syncer_start(&s->syncer);
+	if (s->inputs[0].spool_ok) s->spooler = std::thread(rec_spooler, s);
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		result = ma_device_start(&s->inputs[i].device);
+		if (result != MA_SUCCESS) goto fail;
+	}
+	s->burst_pending = s->burst_mem != NULL;
+	return MA_SUCCESS;
+fail:
+	rec_session_uninit(s);
+	return result;
+}
+
+static inline int rec_session_mirror_health(rec_session* s) {
+	/*
+	 * Worst rec_dest_health() of the
+	 * mirrors; 0 without mirroring.
+	 */
+	int worst = rec_dest_health(&s->merged_mirror);
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		int h = rec_dest_health(&s->inputs[i].mirror);
+		if (h > worst) worst = h;
+	}
+	return worst;
+}
+
+static inline int rec_session_space(rec_session* s) {
+	/*
+	 * A rec_space_state. At REC_SPACE_LOW
+	 * the session should be stopped.
+	 */
+	return s->space_state.load(std::memory_order_relaxed);
+}
+
+static inline int rec_session_rotations(rec_session* s) {
+	/*
+	 * How many files have continued in the
+	 * alternate directory; rises once per
+	 * file at most.
+	 */
+	return s->rotations.load(std::memory_order_relaxed);
+}
+
+static inline void rec_session_set_gain(rec_session* s, double db) {
+	/*
+	 * Any thread, while recording: every
+	 * input's gain inserts move to db.
+	 */
+	for (ma_uint32 i = 0; i < s->input_count; i++) rec_chain_set_gain(&s->inputs[i].chain, db);
+}
+
+static inline ma_uint32 rec_session_latency(const rec_session* s) {
+	/*
+	 * Frames the inserts delay a take by;
+	 * every input's chain is the same.
+	 */
+	return s->input_count > 0 ? rec_chain_latency(&s->inputs[0].chain) : 0;
+}
+
+static inline void rec_session_mark(rec_session* s) {
+	/*
+	 * A point worth keeping: syncs the
+	 * files now under REC_SYNC_MARKER (and
+	 * early under the other policies).
+	 */
+	rec_syncer_mark(&s->syncer);
+}
+
+static inline void rec_dest_report(const rec_dest* d, const rec_output* primary, const char* prefix) {
+	/*
+	 * Health of both copies of a mirrored
+	 * file, side by side.
+	 */
+	if (d->path.empty()) return;
+	printf("%sprimary lag peak %.2f s%s; mirror %s: lag peak %.2f s", prefix, primary->lag_peak,
+		primary->result != MA_SUCCESS || primary->frames_skipped > 0 ? ", FAILED" : "", d->path.c_str(), d->output.lag_peak);
+	if (d->frames_dropped.load() > 0) printf(", %llu frames lost (ring full)", (unsigned long long)d->frames_dropped.load());
+	if (d->output.frames_skipped > 0) printf(", %llu frames not written (disk full)", (unsigned long long)d->output.frames_skipped);
+	if (d->output.result != MA_SUCCESS) printf(", failed: %s", ma_result_description(d->output.result));
+	printf("\n");
+}
+
+static inline void rec_output_report(const rec_output* out, const char* prefix) {
+	/*
+	 * Size against the captured audio, for
+	 * our encoders.
+	 */
+	static const char* names[] = {"PCM", "IMA ADPCM", "mu-law", "A-law"};
+	if (out->coded_bytes == 0) return;
+	const char* name = out->archive_ms > 0 ? "Archive" : out->config.encodingFormat == ma_encoding_format_flac ? "FLAC" : names[out->codec];
+	printf("%s%s: %.1f%% of the PCM size", prefix, name,
+		out->pcm_bytes > 0 ? 100.0 * out->coded_bytes / out->pcm_bytes : 0.0);
+	if (out->coder_waits > 0) printf(", writer waited for the encoder %llu times", (unsigned long long)out->coder_waits);
+	printf("\n");
+}
+
+static inline void rec_session_report(rec_session* s) {
+	/*
+	 * Per-device summary, printed
+	 * after a session ends.
+	 */
+	if (s->burst_size > 0) {
+		printf("Burst buffer: %.1f MB%s\n", s->burst_size / 1048576.0, s->burst_huge ? ", huge pages" : "");
+	}
+	if (s->burst_full.load()) {
+		ma_uint64 lost = 0;
+		for (ma_uint32 i = 0; i < s->input_count; i++) lost += s->inputs[i].frames_dropped.load();
+		printf("Burst buffer full: capture stopped there, %.1f s of input lost until Stop\n", lost / (double)s->config.sample_rate / s->input_count);
+	}
+	for (ma_uint32 i = 0; i < s->input_count; i++) {
+		rec_input* in = &s->inputs[i];
+		printf("Input %u: %llu frames, %llu dropped, %.1f Hz measured, drift %+.1f ppm", i + 1,
+			(unsigned long long)in->frames_captured.load(), (unsigned long long)in->frames_dropped.load(),
+			in->rate_measured.load(), in->drift_ppm.load());
+		if (i > 0 && s->config.layout == REC_LAYOUT_MERGED && s->config.drift_compensation) printf(", compensated %+.1f ppm", in->asrc_ppm.load());
+		if (in->frames_padded > 0) printf(", ended %.3f s early, padded with silence", in->frames_padded / (double)s->config.sample_rate);
+		if (in->spool.peak_frames > 0) {
+			printf(", spooled up to %.1f s (%llu frames to scratch file", in->spool.peak_frames / (double)s->config.sample_rate,
+				(unsigned long long)in->spool.spilled_frames);
+			if (in->spool.lost_frames > 0) printf(", %llu lost", (unsigned long long)in->spool.lost_frames);
+			printf(")");
+		}
+		printf("\n");
+		if (in->output.rotated) printf("Input %u: continued in %s\n", i + 1, in->path.c_str());
+		if (in->output.frames_skipped > 0) printf("Input %u: %llu frames not written, disk full\n", i + 1, (unsigned long long)in->output.frames_skipped);
+		if (in->output.result != MA_SUCCESS) printf("Input %u: writing %s failed: %s\n", i + 1, in->path.c_str(), ma_result_description(in->output.result));
+		std::string prefix = "Input " + std::to_string(i + 1) + ": ";
+		rec_output_report(&in->output, prefix.c_str());
+		rec_chain_report(&in->chain, prefix.c_str());
+		if (s->config.layout == REC_LAYOUT_SEPARATE && i < s->loudness_count) rec_loudness_report(&s->loudness[i], prefix.c_str());
+		rec_dest_report(&in->mirror, &in->output, prefix.c_str());
+		rec_proxy_report(&in->proxy, prefix.c_str());
+		if (rec_session_fanned(&s->config) && s->config.layout == REC_LAYOUT_SEPARATE) rec_fanout_report(&in->fanout, prefix.c_str());
+	}
+	if (s->merged_output.rotated) printf("Continued in %s\n", s->inputs[0].path.c_str());
+	if (s->merged_output.frames_skipped > 0) printf("%llu frames not written, disk full\n", (unsigned long long)s->merged_output.frames_skipped);
+	rec_output_report(&s->merged_output, "");
+	if (s->config.layout == REC_LAYOUT_MERGED && s->loudness_count > 0) rec_loudness_report(&s->loudness[0], "");
+	rec_dest_report(&s->merged_mirror, &s->merged_output, "");
+	rec_proxy_report(&s->merged_proxy, "");
+	if (rec_session_fanned(&s->config) && s->config.layout == REC_LAYOUT_MERGED) rec_fanout_report(&s->merged_fanout, "");
+	rec_syncer_report(&s->syncer);
+	if (s->merged_output.result != MA_SUCCESS) printf("Writing %s failed: %s\n", s->inputs[0].path.c_str(), ma_result_description(s->merged_output.result));
+}
+
+#endif
@@ -0,0 +1,367 @@
+/*
+ * Spectrum analyzer for the UI.
+ *
+ * A fan-out sink of its own, at a lowered thread priority:
+ * the writer hands it each block by pointer and never
+ * waits, and a backlog is shed by the fan-out rather than
+ * delay the file. The sink downmixes a block to mono,
+ * decimates it by REC_SPECTRUM_DECIMATE into a history of
+ * its own, through a shorter filter than the proxy's, and
+ * analyzes REC_SPECTRUM_SIZE points at a time, Hann
+ * windowed and overlapping, at most REC_SPECTRUM_RATE times per second
+ * of audio however fast the capture. So its CPU use is
+ * fixed by the rate, not by what it is fed.
+ *
+ * The FFT is a real one, packed into a complex FFT of half
+ * the size whose butterflies run over contiguous twiddles
+ * per stage, so the compiler vectorizes every stage but
+ * the first few. Bins are folded into log-spaced bands,
+ * each the loudest bin it covers, and published as dBFS
+ * to a rec_spectrum_feed: a triple buffer like the level
+ * feed, which the UI reads without locks.
+ *
+ * Feeds belong to the caller, like level feeds.
+ */
+#ifndef REC_SPECTRUM_H
+#define REC_SPECTRUM_H
+
+#include <math.h>
+#include <string.h>
+#include <atomic>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Points per analysis, a power of 2
+#define REC_SPECTRUM_SIZE 4096
+#define REC_SPECTRUM_DECIMATE 2
+// Decimation filter: short, about 60 dB down, enough for a display
+#define REC_SPECTRUM_ZEROS 12
+#define REC_SPECTRUM_BETA 6.0
+// Most analyses per second of audio
+#define REC_SPECTRUM_RATE 30
+// Bands from REC_SPECTRUM_LOW_HZ up to the decimated Nyquist frequency
+#define REC_SPECTRUM_BANDS 60
+#define REC_SPECTRUM_LOW_HZ 20.0
+#define REC_SPECTRUM_FLOOR -120.0f
+// Fall of the held level, dB per second
+#define REC_SPECTRUM_RELEASE_DB 20.0
+// Blocks queued for the analyzer before the fan-out sheds them
+#define REC_SPECTRUM_DEPTH 4
+// Nice value of the analyzer's thread on Linux
+#define REC_SPECTRUM_NICE 10
+
+typedef struct rec_spectrum_frame {
+	ma_uint32 bands;	// 0 until the first analysis
+	ma_uint64 position;	// capture frames taken, at the end of the window
+	float low_hz;		// lower edge of the first band
+	float high_hz;		// upper edge of the last
+	// dBFS, a full-scale sine being 0
+	float level[REC_SPECTRUM_BANDS];
+	float held[REC_SPECTRUM_BANDS];
+	ma_uint64 shed;		// capture frames never analyzed
+} rec_spectrum_frame;
+
+typedef struct rec_spectrum_feed {
+	rec_spectrum_frame slots[3];
+	std::atomic<ma_uint32> middle;	// slot index, | REC_METER_FRESH when unread
+	ma_uint32 back;
+	ma_uint32 front;
+} rec_spectrum_feed;
+
+static inline void rec_spectrum_feed_init(rec_spectrum_feed* f) {
+	/*
+	 * Before any session feeds it, and never
+	 * while one does.
+	 */
+	memset(f->slots, 0, sizeof(f->slots));
+	f->back = 0;
+	f->middle.store(1);
+	f->front = 2;
+}
+
+static inline void rec_spectrum_feed_publish(rec_spectrum_feed* f) {
+	ma_uint32 old = f->middle.exchange(f->back | REC_METER_FRESH, std::memory_order_acq_rel);
+	f->back = old & 3;
+}
+
+static inline const rec_spectrum_frame* rec_spectrum_feed_read(rec_spectrum_feed* f) {
+	/*
+	 * Reader: the newest analysis published.
+	 * Valid until the next call.
+	 */
+	if (f->middle.load(std::memory_order_relaxed) & REC_METER_FRESH) {
+		ma_uint32 old = f->middle.exchange(f->front, std::memory_order_acq_rel);
+		f->front = old & 3;
+	}
+	return &f->slots[f->front];
+}
+
+/*
+ * The sink's side; only its thread touches it once the
+ * fan-out has started.
+ */
+typedef struct rec_spectrum {
+	rec_spectrum_feed* feed;
+	ma_format format;
+	ma_uint32 channels;
+	ma_uint32 rate;		// after decimation
+	rec_resampler rs;
+	int rs_ok;
+	float* mix;		// a block as f32, then mono at its front
+	float* dec;		// the block decimated
+	float* history;		// REC_SPECTRUM_SIZE decimated samples
+	ma_uint32 fill;
+	ma_uint32 hop;
+	float* window;
+	// The packed half-size FFT, and its tables
+	float* re;
+	float* im;
+	float* tw_re;		// per stage, half of them from index half - 1
+	float* tw_im;
+	float* split_re;	// unpacking into the real spectrum
+	float* split_im;
+	ma_uint32* rev;
+	float* power;
+	ma_uint32 band_lo[REC_SPECTRUM_BANDS];
+	ma_uint32 band_hi[REC_SPECTRUM_BANDS];
+	float held[REC_SPECTRUM_BANDS];
+	float release;		// dB per analysis
+	ma_uint64 position;	// capture frames taken
+	ma_uint64 shed;
+	ma_uint64 analyses;
+	int lowered;
+} rec_spectrum;
+
+static inline void rec_thread_lower_priority() {
+	/*
+	 * The calling thread only, best effort:
+	 * the analyzer must yield to the writers.
+	 */
+#if defined(_WIN32)
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+	// Threads have nice values of their own on Linux
+	setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), REC_SPECTRUM_NICE);
+#else
+	struct sched_param param;
+	int policy;
+	if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+		param.sched_priority = sched_get_priority_min(policy);
+		pthread_setschedparam(pthread_self(), policy, &param);
+	}
+#endif
+}
+
+static inline void rec_spectrum_uninit(rec_spectrum* a) {
+	if (a->rs_ok) rec_resampler_uninit(&a->rs);
+	a->rs_ok = 0;
+	float** tables[] = {&a->mix, &a->dec, &a->history, &a->window, &a->re, &a->im, &a->tw_re, &a->tw_im, &a->split_re, &a->split_im, &a->power};
+	for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+		ma_free(*tables[i], NULL);
+		*tables[i] = NULL;
+	}
+	ma_free(a->rev, NULL);
+	a->rev = NULL;
+}
+
+static inline ma_result rec_spectrum_init(rec_spectrum* a, rec_spectrum_feed* feed, ma_format format, ma_uint32 channels, ma_uint32 sample_rate, ma_uint32 max_frames) {
+	/*
+	 * Everything is allocated and tabulated
+	 * here. max_frames is the most one block
+	 * holds.
+	 */
+	const ma_uint32 n = REC_SPECTRUM_SIZE, m = n / 2;
+	memset(a, 0, sizeof(*a));
+	a->feed = feed;
+	a->format = format;
+	a->channels = channels;
+	a->rate = sample_rate / REC_SPECTRUM_DECIMATE;
+	ma_result result = rec_resampler_init_filter(&a->rs, sample_rate, a->rate, max_frames, REC_SPECTRUM_ZEROS, REC_SPECTRUM_BETA);
+	if (result != MA_SUCCESS) return result;
+	a->rs_ok = 1;
+	a->mix = (float*)ma_malloc((size_t)max_frames * channels * sizeof(float), NULL);
+	a->dec = (float*)ma_malloc((size_t)rec_resampler_max_out(&a->rs) * sizeof(float), NULL);
+	a->history = (float*)ma_malloc(n * sizeof(float), NULL);
+	a->window = (float*)ma_malloc(n * sizeof(float), NULL);
+	a->re = (float*)ma_malloc(m * sizeof(float), NULL);
+	a->im = (float*)ma_malloc(m * sizeof(float), NULL);
+	a->tw_re = (float*)ma_malloc(m * sizeof(float), NULL);
+	a->tw_im = (float*)ma_malloc(m * sizeof(float), NULL);
+	a->split_re = (float*)ma_malloc((m + 1) * sizeof(float), NULL);
+	a->split_im = (float*)ma_malloc((m + 1) * sizeof(float), NULL);
+	a->power = (float*)ma_malloc((m + 1) * sizeof(float), NULL);
+	a->rev = (ma_uint32*)ma_malloc(m * sizeof(ma_uint32), NULL);
+	if (a->mix == NULL || a->dec == NULL || a->history == NULL || a->window == NULL || a->re == NULL || a->im == NULL || a->tw_re == NULL ||
+		a->tw_im == NULL || a->split_re == NULL || a->split_im == NULL || a->power == NULL || a->rev == NULL) {
+		rec_spectrum_uninit(a);
+		return MA_OUT_OF_MEMORY;
+	}
+	const double pi = 3.14159265358979323846;
+	// Periodic Hann
+	for (ma_uint32 i = 0; i < n; i++) a->window[i] = (float)(0.5 - 0.5 * cos(2 * pi * i / n));
+	ma_uint32 bits = 0;
+	while ((1u << bits) < m) bits++;
+	for (ma_uint32 i = 0; i < m; i++) {
+		ma_uint32 r = 0;
+		for (ma_uint32 b = 0; b < bits; b++) r |= ((i >> b) & 1) << (bits - 1 - b);
+		a->rev[i] = r;
+	}
+	for (ma_uint32 half = 1; half < m; half *= 2) {
+		for (ma_uint32 j = 0; j < half; j++) {
+			a->tw_re[half - 1 + j] = (float)cos(-pi * j / half);
+			a->tw_im[half - 1 + j] = (float)sin(-pi * j / half);
+		}
+	}
+	for (ma_uint32 k = 0; k <= m; k++) {
+		a->split_re[k] = (float)cos(-2 * pi * k / n);
+		a->split_im[k] = (float)sin(-2 * pi * k / n);
+	}
+	/*
+	 * Log-spaced band edges, as bins. Low
+	 * bands narrower than a bin share it.
+	 */
+	const double high = a->rate / 2.0, ratio = high / REC_SPECTRUM_LOW_HZ;
+	for (ma_uint32 b = 0; b < REC_SPECTRUM_BANDS; b++) {
+		double lo = REC_SPECTRUM_LOW_HZ * pow(ratio, (double)b / REC_SPECTRUM_BANDS) * n / a->rate;
+		double hi = REC_SPECTRUM_LOW_HZ * pow(ratio, (double)(b + 1) / REC_SPECTRUM_BANDS) * n / a->rate;
+		a->band_lo[b] = (ma_uint32)(lo + 0.5);
+		a->band_hi[b] = (ma_uint32)(hi + 0.5);
+		if (a->band_lo[b] > m) a->band_lo[b] = m;
+		if (a->band_hi[b] > m + 1) a->band_hi[b] = m + 1;
+		if (a->band_hi[b] <= a->band_lo[b]) a->band_hi[b] = a->band_lo[b] + 1;
+		a->held[b] = REC_SPECTRUM_FLOOR;
+	}
+	a->hop = a->rate / REC_SPECTRUM_RATE;
+	if (a->hop < n / 4) a->hop = n / 4;
+	if (a->hop > n) a->hop = n;
+	a->release = (float)(REC_SPECTRUM_RELEASE_DB * a->hop / a->rate);
+	return MA_SUCCESS;
+}
+
+static inline void rec_spectrum_fft(rec_spectrum* a) {
+	/*
+	 * In place on re and im, already in
+	 * bit-reversed order. Each stage's inner
+	 * loop is contiguous in data and twiddles.
+	 */
+	const ma_uint32 m = REC_SPECTRUM_SIZE / 2;
+	for (ma_uint32 half = 1; half < m; half *= 2) {
+		const float* wr = a->tw_re + half - 1;
+		const float* wi = a->tw_im + half - 1;
+		for (ma_uint32 base = 0; base < m; base += 2 * half) {
+			float* ar = a->re + base;
+			float* ai = a->im + base;
+			float* br = ar + half;
+			float* bi = ai + half;
+			for (ma_uint32 j = 0; j < half; j++) {
+				float tr = br[j] * wr[j] - bi[j] * wi[j];
+				float ti = br[j] * wi[j] + bi[j] * wr[j];
+				br[j] = ar[j] - tr;
+				bi[j] = ai[j] - ti;
+				ar[j] += tr;
+				ai[j] += ti;
+			}
+		}
+	}
+}
+
+static inline void rec_spectrum_analyze(rec_spectrum* a) {
+	/*
+	 * The history, full: windowed, packed as
+	 * even and odd samples, transformed,
+	 * unpacked to power per bin, then folded
+	 * into bands and published.
+	 */
+	const ma_uint32 n = REC_SPECTRUM_SIZE, m = n / 2;
+	for (ma_uint32 i = 0; i < m; i++) {
+		a->re[a->rev[i]] = a->history[2 * i] * a->window[2 * i];
+		a->im[a->rev[i]] = a->history[2 * i + 1] * a->window[2 * i + 1];
+	}
+	rec_spectrum_fft(a);
+	for (ma_uint32 k = 0; k <= m; k++) {
+		const ma_uint32 i = k % m, j = (m - k) % m;
+		const float er = (a->re[i] + a->re[j]) * 0.5f, ei = (a->im[i] - a->im[j]) * 0.5f;
+		const float or_ = (a->im[i] + a->im[j]) * 0.5f, oi = (a->re[j] - a->re[i]) * 0.5f;
+		const float xr = er + a->split_re[k] * or_ - a->split_im[k] * oi;
+		const float xi = ei + a->split_re[k] * oi + a->split_im[k] * or_;
+		a->power[k] = xr * xr + xi * xi;
+	}
+	// A full-scale sine peaks at n / 4 through the window
+	const float scale = 16.0f / ((float)n * n);
+	rec_spectrum_frame* out = a->feed != NULL ? &a->feed->slots[a->feed->back] : NULL;
+	for (ma_uint32 b = 0; b < REC_SPECTRUM_BANDS; b++) {
+		float peak = 0;
+		for (ma_uint32 k = a->band_lo[b]; k < a->band_hi[b]; k++) peak = a->power[k] > peak ? a->power[k] : peak;
+		float db = peak * scale > 1e-12f ? 10.0f * log10f(peak * scale) : REC_SPECTRUM_FLOOR;
+		if (db < REC_SPECTRUM_FLOOR) db = REC_SPECTRUM_FLOOR;
+		a->held[b] = db > a->held[b] - a->release ? db : a->held[b] - a->release;
+		if (out != NULL) {
+			out->level[b] = db;
+			out->held[b] = a->held[b];
+		}
+	}
+	a->analyses++;
+	if (out == NULL) return;
+	out->bands = REC_SPECTRUM_BANDS;
+	out->position = a->position;
+	out->low_hz = (float)REC_SPECTRUM_LOW_HZ;
+	out->high_hz = a->rate / 2.0f;
+	out->shed = a->shed;
+	rec_spectrum_feed_publish(a->feed);
+}
+
+static inline void rec_spectrum_consume(void* user, const rec_block* b) {
+	/*
+	 * Analyzer sink. Blocks the fan-out shed
+	 * leave a gap, after which the history
+	 * and the decimator's filter start over,
+	 * so no window spans it.
+	 */
+	rec_spectrum* a = (rec_spectrum*)user;
+	const ma_uint32 ch = a->channels;
+	if (!a->lowered) {
+		rec_thread_lower_priority();
+		a->lowered = 1;
+	}
+	if (b->position > a->position) {
+		a->shed += b->position - a->position;
+		a->fill = 0;
+		rec_resampler_reset(&a->rs);
+	}
+	a->position = b->position + b->frames;
+	ma_pcm_convert(a->mix, ma_format_f32, b->data, a->format, (ma_uint64)b->frames * ch, ma_dither_mode_none);
+	if (ch > 1) {
+		const float gain = 1.0f / ch;
+		for (ma_uint32 f = 0; f < b->frames; f++) {
+			const float* x = a->mix + (size_t)f * ch;
+			float sum = 0;
+			for (ma_uint32 c = 0; c < ch; c++) sum += x[c];
+			a->mix[f] = sum * gain;
+		}
+	}
+	ma_uint32 count = rec_resampler_process(&a->rs, a->mix, b->frames, a->dec);
+	const float* src = a->dec;
+	while (count > 0) {
+		ma_uint32 take = REC_SPECTRUM_SIZE - a->fill;
+		if (take > count) take = count;
+		memcpy(a->history + a->fill, src, take * sizeof(float));
+		a->fill += take;
+		src += take;
+		count -= take;
+		if (a->fill < REC_SPECTRUM_SIZE) break;
+		rec_spectrum_analyze(a);
+		memmove(a->history, a->history + a->hop, (REC_SPECTRUM_SIZE - a->hop) * sizeof(float));
+		a->fill = REC_SPECTRUM_SIZE - a->hop;
+	}
+}
+
+#endif
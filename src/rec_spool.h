@@ -0,0 +1,208 @@
+/*
+ * Overflow storage for a device's ring buffer.
+ *
+ * When the disk stalls, the writer stops draining and the
+ * ring fills. The session's spool thread then moves the
+ * oldest audio out of the ring into a FIFO of fixed-size
+ * memory pages, in the spirit of ma_paged_audio_buffer, up
+ * to a memory cap. Past the cap, audio goes to a scratch
+ * file, ideally on another volume. The writer reads the
+ * spool before the ring, so the file stays in order and
+ * nothing is dropped while either tier has room.
+ *
+ * Not thread-safe: the session serializes access.
+ */
+#ifndef REC_SPOOL_H
+#define REC_SPOOL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#define REC_SPOOL_PAGE_FRAMES 16384
+
+typedef struct rec_spool_page {
+	struct rec_spool_page* next;
+	ma_uint32 frames;	// valid frames
+	ma_uint32 read;		// frames already consumed
+	ma_uint8 data[1];
+} rec_spool_page;
+
+typedef struct rec_spool {
+	size_t bpf;
+	// Memory tier, oldest page first
+	rec_spool_page* head;
+	rec_spool_page* tail;
+	rec_spool_page* free_pages;
+	size_t mem_bytes;	// pages allocated, in use or free
+	size_t mem_cap;
+	// File tier, always newer than the memory tier
+	FILE* file;
+	std::string path;
+	ma_uint64 file_read;	// bytes
+	ma_uint64 file_write;
+	int file_failed;
+	// Frames lost to a failed scratch file read
+	ma_uint64 lost_frames;
+	// Frames queued in both tiers
+	ma_uint64 frames;
+	ma_uint64 peak_frames;
+	ma_uint64 spilled_frames;
+} rec_spool;
+
+static inline size_t rec_spool_page_bytes(const rec_spool* sp) {
+	return sizeof(rec_spool_page) + (size_t)REC_SPOOL_PAGE_FRAMES * sp->bpf;
+}
+
+static inline void rec_spool_init(rec_spool* sp, size_t bpf, size_t mem_cap, const std::string& path) {
+	/*
+	 * path is the scratch file; empty means
+	 * no file tier. The file is only created
+	 * the first time the memory tier fills.
+	 */
+	sp->bpf = bpf;
+	sp->head = sp->tail = sp->free_pages = NULL;
+	sp->mem_bytes = 0;
+	sp->mem_cap = mem_cap;
+	sp->file = NULL;
+	sp->path = path;
+	sp->file_read = sp->file_write = 0;
+	sp->file_failed = 0;
+	sp->lost_frames = 0;
+	sp->frames = sp->peak_frames = sp->spilled_frames = 0;
+}
+
+static inline void rec_spool_uninit(rec_spool* sp) {
+	rec_spool_page* lists[2] = { sp->head, sp->free_pages };
+	for (int l = 0; l < 2; l++) {
+		for (rec_spool_page* p = lists[l]; p != NULL; ) {
+			rec_spool_page* next = p->next;
+			ma_free(p, NULL);
+			p = next;
+		}
+	}
+	sp->head = sp->tail = sp->free_pages = NULL;
+	if (sp->file != NULL) {
+		fclose(sp->file);
+		remove(sp->path.c_str());
+	}
+	sp->file = NULL;
+}
+
+static inline int rec_spool_seek(FILE* f, ma_uint64 offset) {
+#if defined(_WIN32)
+	return _fseeki64(f, (__int64)offset, SEEK_SET);
+#else
+	return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static inline ma_uint64 rec_spool_file_frames(const rec_spool* sp) {
+	return (sp->file_write - sp->file_read) / sp->bpf;
+}
+
+static inline rec_spool_page* rec_spool_new_page(rec_spool* sp) {
+	/*
+	 * Recycled page if there is one,
+	 * else a new one within the cap.
+	 */
+	rec_spool_page* p = sp->free_pages;
+	if (p != NULL) {
+		sp->free_pages = p->next;
+	} else {
+		if (sp->mem_bytes + rec_spool_page_bytes(sp) > sp->mem_cap) return NULL;
+		p = (rec_spool_page*)ma_malloc(rec_spool_page_bytes(sp), NULL);
+		if (p == NULL) return NULL;
+		sp->mem_bytes += rec_spool_page_bytes(sp);
+	}
+	p->next = NULL;
+	p->frames = p->read = 0;
+	return p;
+}
+
+static inline ma_uint32 rec_spool_push(rec_spool* sp, const void* src, ma_uint32 frames) {
+	/*
+	 * Appends up to frames frames; returns
+	 * how many fit. Memory only takes audio
+	 * while the file tier is empty, so reads
+	 * (memory first, then file) stay in order.
+	 */
+	const ma_uint8* in = (const ma_uint8*)src;
+	ma_uint32 done = 0;
+	while (done < frames && rec_spool_file_frames(sp) == 0) {
+		if (sp->tail == NULL || sp->tail->frames == REC_SPOOL_PAGE_FRAMES) {
+			rec_spool_page* p = rec_spool_new_page(sp);
+			if (p == NULL) break;
+			if (sp->tail != NULL) sp->tail->next = p;
+			else sp->head = p;
+			sp->tail = p;
+		}
+		ma_uint32 n = REC_SPOOL_PAGE_FRAMES - sp->tail->frames;
+		if (n > frames - done) n = frames - done;
+		memcpy(sp->tail->data + (size_t)sp->tail->frames * sp->bpf, in + (size_t)done * sp->bpf, (size_t)n * sp->bpf);
+		sp->tail->frames += n;
+		done += n;
+	}
+	if (done < frames && !sp->path.empty() && !sp->file_failed) {
+		if (sp->file == NULL) sp->file = fopen(sp->path.c_str(), "w+b");
+		size_t bytes = (size_t)(frames - done) * sp->bpf;
+		if (sp->file == NULL || rec_spool_seek(sp->file, sp->file_write) != 0
+			|| fwrite(in + (size_t)done * sp->bpf, 1, bytes, sp->file) != bytes) {
+			sp->file_failed = 1;
+		} else {
+			sp->file_write += bytes;
+			sp->spilled_frames += frames - done;
+			done = frames;
+		}
+	}
+	sp->frames += done;
+	if (sp->frames > sp->peak_frames) sp->peak_frames = sp->frames;
+	return done;
+}
+
+static inline ma_uint32 rec_spool_pop(rec_spool* sp, void* dst, ma_uint32 frames) {
+	/*
+	 * Takes up to frames of the oldest
+	 * audio; returns how many were read.
+	 */
+	ma_uint8* out = (ma_uint8*)dst;
+	ma_uint32 done = 0;
+	while (done < frames && sp->head != NULL) {
+		rec_spool_page* p = sp->head;
+		ma_uint32 n = p->frames - p->read;
+		if (n > frames - done) n = frames - done;
+		memcpy(out + (size_t)done * sp->bpf, p->data + (size_t)p->read * sp->bpf, (size_t)n * sp->bpf);
+		p->read += n;
+		done += n;
+		if (p->read == p->frames) {
+			sp->head = p->next;
+			if (sp->head == NULL) sp->tail = NULL;
+			p->next = sp->free_pages;
+			sp->free_pages = p;
+		}
+	}
+	if (done < frames && sp->head == NULL && rec_spool_file_frames(sp) > 0) {
+		ma_uint64 avail = rec_spool_file_frames(sp);
+		ma_uint32 n = frames - done;
+		if (n > avail) n = (ma_uint32)avail;
+		size_t bytes = (size_t)n * sp->bpf;
+		if (rec_spool_seek(sp->file, sp->file_read) == 0 && fread(out + (size_t)done * sp->bpf, 1, bytes, sp->file) == bytes) {
+			sp->file_read += bytes;
+			done += n;
+		} else {
+			/*
+			 * Unreadable scratch file: give up on
+			 * what it holds rather than stall.
+			 */
+			sp->file_failed = 1;
+			sp->lost_frames += avail;
+			sp->frames -= avail;
+			sp->file_read = sp->file_write;
+		}
+		if (sp->file_read == sp->file_write) sp->file_read = sp->file_write = 0;
+	}
+	sp->frames -= done;
+	return done;
+}
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * Durability for recordings in progress.
+ *
+ * Without it nothing is forced to stable storage until
+ * the files are closed, so a power cut can lose a whole
+ * session. Syncing from the writers would stall them for
+ * as long as the disk takes. Instead a background thread
+ * issues fdatasync() (FlushFileBuffers() on Windows) on
+ * every output file when the policy asks for it. Requests
+ * that arrive while a sync is running are served by one
+ * more sync, not one each.
+ *
+ * What gets synced is what has reached the kernel; the
+ * asynchronous sinks hold back at most one block per
+ * file. The WAV header is only final once the file is
+ * closed, so after a crash the audio is on disk but the
+ * header still reads as empty.
+ *
+ * Every sync's latency goes into a log2 histogram, so the
+ * policy can be chosen from measurements on the target
+ * machine.
+ */
+#ifndef REC_SYNC_H
+#define REC_SYNC_H
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Files one syncer tracks; a session sizes it for all its outputs
+#ifndef REC_SYNC_MAX_FILES
+#define REC_SYNC_MAX_FILES 64
+#endif
+// Bucket b counts syncs taking [2^b, 2^(b+1)) microseconds
+#define REC_SYNC_BUCKETS 24
+// How often the size policy looks at the byte count, ms
+#define REC_SYNC_POLL 10
+
+typedef enum rec_sync_policy {
+	REC_SYNC_NONE,		// only at close
+	REC_SYNC_INTERVAL,	// every interval_ms
+	REC_SYNC_BYTES,		// every bytes written, all files together
+	REC_SYNC_MARKER		// when rec_syncer_mark() is called
+} rec_sync_policy;
+
+#if defined(_WIN32)
+typedef HANDLE rec_sync_handle;
+#else
+typedef int rec_sync_handle;
+#endif
+
+typedef struct rec_syncer {
+	rec_sync_policy policy;
+	ma_uint32 interval_ms;
+	ma_uint64 bytes;
+	rec_sync_handle files[REC_SYNC_MAX_FILES];
+	ma_uint32 file_count;
+	ma_uint32 untracked;	// files that didn't fit, never synced
+	// Held across a round, so files can come and go while recording
+	std::mutex files_lock;
+	// Bumped by the writers, read by the sync thread
+	std::atomic<ma_uint64> written;
+	std::atomic<ma_uint64> marks;
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable cv;
+	int quit;
+	/*
+	 * Sync thread only; read once it has
+	 * been joined.
+	 */
+	ma_uint64 requests;	// reasons to sync seen
+	ma_uint64 rounds;	// times every file was synced
+	ma_uint64 syncs;	// individual file syncs
+	ma_uint64 failures;
+	ma_uint64 hist[REC_SYNC_BUCKETS];
+	double total_ms;
+	double max_ms;
+} rec_syncer;
+
+static inline void rec_syncer_init(rec_syncer* y, rec_sync_policy policy, ma_uint32 interval_ms, ma_uint64 bytes) {
+	y->policy = policy;
+	y->interval_ms = interval_ms > 0 ? interval_ms : 1;
+	y->bytes = bytes > 0 ? bytes : 1;
+	y->file_count = y->untracked = 0;
+	y->written.store(0);
+	y->marks.store(0);
+	y->quit = 0;
+	y->requests = y->rounds = y->syncs = y->failures = 0;
+	memset(y->hist, 0, sizeof(y->hist));
+	y->total_ms = y->max_ms = 0;
+}
+
+static inline ma_result rec_syncer_add(rec_syncer* y, rec_sync_handle file) {
+	std::lock_guard<std::mutex> guard(y->files_lock);
+	if (y->file_count == REC_SYNC_MAX_FILES) {
+		y->untracked++;
+		return MA_OUT_OF_RANGE;
+	}
+	y->files[y->file_count++] = file;
+	return MA_SUCCESS;
+}
+
+static inline int rec_sync_file(rec_sync_handle file) {
+#if defined(_WIN32)
+	return FlushFileBuffers(file) ? 0 : -1;
+#elif defined(__APPLE__)
+	return fsync(file);
+#else
+	return fdatasync(file);
+#endif
+}
+
+static inline void rec_syncer_remove(rec_syncer* y, rec_sync_handle file) {
+	/*
+	 * For a file about to be closed while
+	 * recording. Waits out a round in progress.
+	 */
+	std::lock_guard<std::mutex> guard(y->files_lock);
+	for (ma_uint32 i = 0; i < y->file_count; i++) {
+		if (y->files[i] != file) continue;
+		y->files[i] = y->files[--y->file_count];
+		break;
+	}
+}
+
+static inline void rec_syncer_round(rec_syncer* y) {
+	std::lock_guard<std::mutex> guard(y->files_lock);
+	for (ma_uint32 i = 0; i < y->file_count; i++) {
+		auto t0 = std::chrono::steady_clock::now();
+		int err = rec_sync_file(y->files[i]);
+		double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+		int b = 0;
+		while (b + 1 < REC_SYNC_BUCKETS && us >= (double)(2ull << b)) b++;
+		y->hist[b]++;
+		y->syncs++;
+		y->total_ms += us / 1000.0;
+		if (us / 1000.0 > y->max_ms) y->max_ms = us / 1000.0;
+		if (err != 0) y->failures++;
+	}
+	y->rounds++;
+}
+
+static inline void rec_syncer_thread(rec_syncer* y) {
+	/*
+	 * Waits for a reason to sync, then syncs
+	 * every file once. Whatever piles up in
+	 * the meantime is one reason.
+	 */
+	ma_uint64 synced_bytes = 0;
+	ma_uint64 synced_marks = 0;
+	auto next = std::chrono::steady_clock::now() + std::chrono::milliseconds(y->interval_ms);
+	std::unique_lock<std::mutex> guard(y->lock);
+	while (!y->quit) {
+		if (y->policy == REC_SYNC_INTERVAL) y->cv.wait_until(guard, next);
+		else if (y->policy == REC_SYNC_BYTES) y->cv.wait_for(guard, std::chrono::milliseconds(REC_SYNC_POLL));
+		else y->cv.wait(guard);
+		if (y->quit) break;
+		int due = 0;
+		if (y->policy == REC_SYNC_INTERVAL && std::chrono::steady_clock::now() >= next) {
+			due = 1;
+			next += std::chrono::milliseconds(y->interval_ms);
+			// Fell behind: don't fire a backlog of syncs
+			if (next < std::chrono::steady_clock::now()) next = std::chrono::steady_clock::now() + std::chrono::milliseconds(y->interval_ms);
+		}
+		ma_uint64 written = y->written.load(std::memory_order_relaxed);
+		if (y->policy == REC_SYNC_BYTES && written - synced_bytes >= y->bytes) {
+			y->requests += (written - synced_bytes) / y->bytes - 1;
+			due = 1;
+			synced_bytes = written;
+		}
+		ma_uint64 marks = y->marks.load(std::memory_order_relaxed);
+		if (marks != synced_marks) {
+			y->requests += marks - synced_marks - 1;
+			due = 1;
+			synced_marks = marks;
+		}
+		if (!due) continue;
+		y->requests++;
+		guard.unlock();
+		rec_syncer_round(y);
+		guard.lock();
+	}
+}
+
+static inline void rec_syncer_wrote(rec_syncer* y, ma_uint64 bytes) {
+	/*
+	 * Writer threads: never blocks.
+	 */
+	y->written.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+static inline void rec_syncer_mark(rec_syncer* y) {
+	/*
+	 * Asks for a sync now. Also honoured
+	 * by the timed and size policies.
+	 */
+	if (y->policy == REC_SYNC_NONE) return;
+	std::lock_guard<std::mutex> guard(y->lock);
+	y->marks.fetch_add(1, std::memory_order_relaxed);
+	y->cv.notify_all();
+}
+
+static inline void rec_syncer_start(rec_syncer* y) {
+	if (y->policy != REC_SYNC_NONE && y->file_count > 0) y->thread = std::thread(rec_syncer_thread, y);
+}
+
+static inline void rec_syncer_stop(rec_syncer* y) {
+	/*
+	 * Before any of the files is closed.
+	 */
+	if (!y->thread.joinable()) return;
+	{
+		std::lock_guard<std::mutex> guard(y->lock);
+		y->quit = 1;
+		y->cv.notify_all();
+	}
+	y->thread.join();
+}
+
+static inline int rec_sync_path(const char* path) {
+	/*
+	 * Makes a closed file durable, header
+	 * and all.
+	 */
+#if defined(_WIN32)
+	HANDLE h = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (h == INVALID_HANDLE_VALUE) return -1;
+	int err = rec_sync_file(h);
+	CloseHandle(h);
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+	int err = fsync(fd);
+	close(fd);
+#endif
+	return err;
+}
+
+static inline double rec_syncer_percentile(const rec_syncer* y, double p) {
+	/*
+	 * Upper edge of the bucket holding the
+	 * p-th percentile, in ms, or the worst
+	 * case if that is lower.
+	 */
+	ma_uint64 seen = 0;
+	for (int b = 0; b < REC_SYNC_BUCKETS; b++) {
+		seen += y->hist[b];
+		if (seen > 0 && seen >= p * y->syncs) return (double)(2ull << b) / 1000.0 < y->max_ms ? (double)(2ull << b) / 1000.0 : y->max_ms;
+	}
+	return y->max_ms;
+}
+
+static inline void rec_syncer_report(const rec_syncer* y) {
+	if (y->untracked > 0) printf("Sync: %u files not synced, more than %d open\n", y->untracked, REC_SYNC_MAX_FILES);
+	if (y->syncs == 0) return;
+	printf("Sync: %llu rounds for %llu requests, %llu file syncs (%llu failed), mean %.2f ms, p50 < %.2f ms, p99 < %.2f ms, max %.2f ms\n",
+		(unsigned long long)y->rounds, (unsigned long long)y->requests, (unsigned long long)y->syncs, (unsigned long long)y->failures,
+		y->total_ms / y->syncs, rec_syncer_percentile(y, 0.5), rec_syncer_percentile(y, 0.99), y->max_ms);
+	for (int b = 0; b < REC_SYNC_BUCKETS; b++) {
+		if (y->hist[b] == 0) continue;
+		printf("  %10.3f - %10.3f ms: %llu\n", (b == 0 ? 0 : (double)(1ull << b)) / 1000.0, (double)(2ull << b) / 1000.0, (unsigned long long)y->hist[b]);
+	}
+}
+
+#endif
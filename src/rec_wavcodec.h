@@ -0,0 +1,362 @@
+/*
+ * Compact WAV codecs for voice archiving.
+ *
+ * ma_encoder writes only PCM WAV. This writer produces the
+ * three compressed WAV formats that every player reads:
+ * IMA ADPCM (4 bits per sample, 4:1 against 16-bit) and the
+ * two G.711 companders, mu-law and A-law (8 bits, 2:1).
+ *
+ * Input in any miniaudio format is first brought to 16-bit.
+ * G.711 is then a single lookup per sample in a table of
+ * every 14-bit (mu-law) or 13-bit (A-law) input. IMA ADPCM
+ * codes each channel's block in turn. The loop body has no
+ * data-dependent branches, so the compiler can turn it into
+ * selects; the one serial dependency, the predictor, is
+ * per channel.
+ *
+ * The header is written first and patched at close with
+ * the data size and the fact chunk's frame count, which
+ * non-PCM WAV files need to give their exact length.
+ */
+#ifndef REC_WAVCODEC_H
+#define REC_WAVCODEC_H
+
+#include <string.h>
+
+// Format tags for the fmt chunk
+#define REC_WAVE_FORMAT_ALAW 0x0006
+#define REC_WAVE_FORMAT_MULAW 0x0007
+#define REC_WAVE_FORMAT_IMA_ADPCM 0x0011
+// Frames converted to 16-bit at a time
+#define REC_WAVC_CHUNK 1024
+
+typedef enum rec_wav_codec {
+	REC_WAV_PCM = 0,	// ma_encoder, in the capture format
+	REC_WAV_IMA_ADPCM,
+	REC_WAV_MULAW,
+	REC_WAV_ALAW
+} rec_wav_codec;
+
+typedef ma_result (*rec_wavc_write_proc)(void* user, const void* data, size_t bytes);
+// Only ever seeks back into the header
+typedef ma_result (*rec_wavc_seek_proc)(void* user, ma_uint64 offset);
+
+typedef struct rec_wavc {
+	rec_wavc_write_proc on_write;
+	rec_wavc_seek_proc on_seek;
+	void* user;
+	rec_wav_codec codec;
+	ma_format format;	// of the input
+	ma_uint32 channels;
+	ma_uint32 sample_rate;
+	ma_int16* pcm;		// REC_WAVC_CHUNK frames, converted
+	ma_uint8* out;		// coded bytes on their way out
+	/*
+	 * IMA ADPCM: a block of block_frames
+	 * frames, block_fill of them so far, and
+	 * every channel's step index. A block's
+	 * first frame goes in its header as is.
+	 */
+	ma_uint32 block_align;
+	ma_uint32 block_frames;
+	ma_int16* block;
+	ma_uint32 block_fill;
+	ma_uint8* codes;	// one nibble per byte, planar
+	ma_int32* index;
+	size_t header_bytes;
+	ma_uint64 frames;
+	ma_uint64 bytes_written;	// data chunk so far
+	ma_result result;
+} rec_wavc;
+
+typedef struct rec_g711_tables {
+	ma_uint8 mulaw[1 << 14];	// by sample >> 2
+	ma_uint8 alaw[1 << 13];		// by sample >> 3
+	rec_g711_tables() {
+		/*
+		 * The reference compander of G.711
+		 * (as in Sun's g711.c), run once for
+		 * every input it can tell apart.
+		 */
+		static const ma_int32 uend[8] = {0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF};
+		static const ma_int32 aend[8] = {0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+		for (ma_int32 i = 0; i < (1 << 14); i++) {
+			ma_int32 v = i - (1 << 13);
+			ma_int32 mask = 0xFF;
+			if (v < 0) {
+				v = -v;
+				mask = 0x7F;
+			}
+			if (v > 8159) v = 8159;
+			v += 33;
+			ma_int32 seg = 0;
+			while (seg < 8 && v > uend[seg]) seg++;
+			mulaw[i] = (ma_uint8)((seg >= 8 ? 0x7F : (seg << 4) | ((v >> (seg + 1)) & 0xF)) ^ mask);
+		}
+		for (ma_int32 i = 0; i < (1 << 13); i++) {
+			ma_int32 v = i - (1 << 12);
+			ma_int32 mask = 0xD5;
+			if (v < 0) {
+				v = -v - 1;
+				mask = 0x55;
+			}
+			ma_int32 seg = 0;
+			while (seg < 8 && v > aend[seg]) seg++;
+			ma_int32 a = seg >= 8 ? 0x7F : (seg << 4) | ((seg < 2 ? v >> 1 : v >> seg) & 0xF);
+			alaw[i] = (ma_uint8)(a ^ mask);
+		}
+	}
+} rec_g711_tables;
+
+static inline const rec_g711_tables* rec_g711() {
+	static const rec_g711_tables tables;
+	return &tables;
+}
+
+static inline void rec_mulaw_encode(const ma_int16* in, size_t count, ma_uint8* out) {
+	const ma_uint8* t = rec_g711()->mulaw;
+	for (size_t i = 0; i < count; i++) out[i] = t[(in[i] >> 2) + (1 << 13)];
+}
+
+static inline void rec_alaw_encode(const ma_int16* in, size_t count, ma_uint8* out) {
+	const ma_uint8* t = rec_g711()->alaw;
+	for (size_t i = 0; i < count; i++) out[i] = t[(in[i] >> 3) + (1 << 12)];
+}
+
+static const ma_int32 rec_ima_steps[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const ma_int32 rec_ima_adjust[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+static inline ma_int32 rec_ima_encode(const ma_int16* x, size_t stride, ma_uint32 n, ma_int32 pred, ma_int32* index, ma_uint8* codes) {
+	/*
+	 * Codes n samples of one channel after
+	 * the predictor pred, tracking the step
+	 * index. The decoder's reconstruction is
+	 * followed exactly, so errors don't
+	 * accumulate. Returns the last prediction.
+	 */
+	ma_int32 idx = *index;
+	for (ma_uint32 i = 0; i < n; i++) {
+		ma_int32 step = rec_ima_steps[idx];
+		ma_int32 diff = x[i * stride] - pred;
+		ma_int32 sign = diff < 0 ? 8 : 0;
+		diff = diff < 0 ? -diff : diff;
+		ma_int32 code = 0;
+		ma_int32 vp = step >> 3;
+		ma_int32 b = diff >= step;
+		code |= b << 2;
+		diff -= b ? step : 0;
+		vp += b ? step : 0;
+		b = diff >= (step >> 1);
+		code |= b << 1;
+		diff -= b ? step >> 1 : 0;
+		vp += b ? step >> 1 : 0;
+		b = diff >= (step >> 2);
+		code |= b;
+		vp += b ? step >> 2 : 0;
+		pred += sign ? -vp : vp;
+		pred = pred > 32767 ? 32767 : pred < -32768 ? -32768 : pred;
+		idx += rec_ima_adjust[code];
+		idx = idx < 0 ? 0 : idx > 88 ? 88 : idx;
+		codes[i] = (ma_uint8)(code | sign);
+	}
+	*index = idx;
+	return pred;
+}
+
+static inline void rec_wavc_block(rec_wavc* w) {
+	/*
+	 * Codes and writes the block, padded
+	 * with silence if it is the short last
+	 * one: a header per channel, then each
+	 * channel's nibbles in turns of 8
+	 * samples, low nibble first.
+	 */
+	const ma_uint32 ch = w->channels, n = w->block_frames;
+	if (w->block_fill < n) memset(w->block + (size_t)w->block_fill * ch, 0, (size_t)(n - w->block_fill) * ch * sizeof(ma_int16));
+	ma_uint8* p = w->out;
+	for (ma_uint32 c = 0; c < ch; c++) {
+		// The header has the state the block starts from
+		ma_int16 first = w->block[c];
+		*p++ = (ma_uint8)first;
+		*p++ = (ma_uint8)((ma_uint16)first >> 8);
+		*p++ = (ma_uint8)w->index[c];
+		*p++ = 0;
+		rec_ima_encode(w->block + ch + c, ch, n - 1, first, &w->index[c], w->codes + (size_t)c * n);
+	}
+	for (ma_uint32 i = 0; i < n - 1; i += 8) {
+		for (ma_uint32 c = 0; c < ch; c++) {
+			const ma_uint8* k = w->codes + (size_t)c * n + i;
+			for (int j = 0; j < 8; j += 2) *p++ = (ma_uint8)(k[j] | (k[j + 1] << 4));
+		}
+	}
+	ma_result result = w->on_write(w->user, w->out, w->block_align);
+	if (result != MA_SUCCESS && w->result == MA_SUCCESS) w->result = result;
+	w->bytes_written += w->block_align;
+	w->block_fill = 0;
+}
+
+static inline size_t rec_wavc_put(ma_uint8* p, size_t pos, ma_uint32 value, int bytes) {
+	for (int i = 0; i < bytes; i++) p[pos++] = (ma_uint8)(value >> (8 * i));
+	return pos;
+}
+
+static inline size_t rec_wavc_header(const rec_wavc* w, ma_uint8* p) {
+	/*
+	 * RIFF, fmt, fact and the data chunk's
+	 * header. Always the same length, so it
+	 * can be rewritten at close.
+	 */
+	const int ima = w->codec == REC_WAV_IMA_ADPCM;
+	const ma_uint32 fmt_size = ima ? 20 : 18;
+	const ma_uint32 data = (ma_uint32)(w->bytes_written + (w->bytes_written & 1));
+	const ma_uint32 block_align = ima ? w->block_align : w->channels;
+	const ma_uint32 avg = ima ? (ma_uint32)((ma_uint64)w->sample_rate * w->block_align / w->block_frames) : w->sample_rate * w->channels;
+	const ma_uint32 tag = ima ? REC_WAVE_FORMAT_IMA_ADPCM : w->codec == REC_WAV_MULAW ? REC_WAVE_FORMAT_MULAW : REC_WAVE_FORMAT_ALAW;
+	size_t pos = 0;
+	memcpy(p, "RIFF", 4);
+	pos = rec_wavc_put(p, 4, 4 + (8 + fmt_size) + (8 + 4) + 8 + data, 4);
+	memcpy(p + pos, "WAVEfmt ", 8);
+	pos = rec_wavc_put(p, pos + 8, fmt_size, 4);
+	pos = rec_wavc_put(p, pos, tag, 2);
+	pos = rec_wavc_put(p, pos, w->channels, 2);
+	pos = rec_wavc_put(p, pos, w->sample_rate, 4);
+	pos = rec_wavc_put(p, pos, avg, 4);
+	pos = rec_wavc_put(p, pos, block_align, 2);
+	pos = rec_wavc_put(p, pos, ima ? 4 : 8, 2);
+	// Extra fmt bytes: IMA has the frames per block
+	pos = rec_wavc_put(p, pos, ima ? 2 : 0, 2);
+	if (ima) pos = rec_wavc_put(p, pos, w->block_frames, 2);
+	memcpy(p + pos, "fact", 4);
+	pos = rec_wavc_put(p, pos + 4, 4, 4);
+	pos = rec_wavc_put(p, pos, (ma_uint32)w->frames, 4);
+	memcpy(p + pos, "data", 4);
+	pos = rec_wavc_put(p, pos + 4, (ma_uint32)w->bytes_written, 4);
+	return pos;
+}
+
+static inline ma_result rec_wavc_uninit(rec_wavc* w);
+
+static inline ma_result rec_wavc_init(rec_wavc* w, rec_wavc_write_proc on_write, rec_wavc_seek_proc on_seek, void* user,
+	rec_wav_codec codec, ma_format format, ma_uint32 channels, ma_uint32 sample_rate) {
+	/*
+	 * Writes the provisional header. IMA
+	 * blocks are sized as is usual for the
+	 * rate: 256, 512 or 1024 bytes per
+	 * channel.
+	 */
+	memset(w, 0, sizeof(*w));
+	w->on_write = on_write;
+	w->on_seek = on_seek;
+	w->user = user;
+	w->codec = codec;
+	w->format = format;
+	w->channels = channels;
+	w->sample_rate = sample_rate;
+	w->result = MA_SUCCESS;
+	if (codec == REC_WAV_PCM || channels == 0 || channels > 0xFFFF || sample_rate == 0) return MA_INVALID_ARGS;
+	size_t out_bytes = (size_t)REC_WAVC_CHUNK * channels;
+	if (codec == REC_WAV_IMA_ADPCM) {
+		ma_uint32 per_channel = sample_rate <= 11025 ? 256 : sample_rate <= 22050 ? 512 : 1024;
+		w->block_align = per_channel * channels;
+		w->block_frames = (per_channel - 4) * 2 + 1;
+		w->block = (ma_int16*)ma_malloc((size_t)w->block_frames * channels * sizeof(ma_int16), NULL);
+		w->codes = (ma_uint8*)ma_malloc((size_t)w->block_frames * channels, NULL);
+		w->index = (ma_int32*)ma_calloc(channels * sizeof(ma_int32), NULL);
+		out_bytes = w->block_align;
+		if (w->block == NULL || w->codes == NULL || w->index == NULL) {
+			rec_wavc_uninit(w);
+			return MA_OUT_OF_MEMORY;
+		}
+	}
+	w->pcm = (ma_int16*)ma_malloc((size_t)REC_WAVC_CHUNK * channels * sizeof(ma_int16), NULL);
+	w->out = (ma_uint8*)ma_malloc(out_bytes, NULL);
+	if (w->pcm == NULL || w->out == NULL) {
+		rec_wavc_uninit(w);
+		return MA_OUT_OF_MEMORY;
+	}
+	// Tables are built on first use, not on the writer's first block
+	if (codec != REC_WAV_IMA_ADPCM) rec_g711();
+	ma_uint8 header[64];
+	w->header_bytes = rec_wavc_header(w, header);
+	w->result = on_write(user, header, w->header_bytes);
+	if (w->result != MA_SUCCESS) {
+		ma_result result = w->result;
+		rec_wavc_uninit(w);
+		return result;
+	}
+	return MA_SUCCESS;
+}
+
+static inline ma_result rec_wavc_write(rec_wavc* w, const void* frames, ma_uint64 count) {
+	/*
+	 * Interleaved frames in the input
+	 * format. Conversion to 16-bit is
+	 * dithered, as for the proxy.
+	 */
+	const ma_uint32 ch = w->channels;
+	const size_t bpf = ma_get_bytes_per_frame(w->format, ch);
+	const ma_uint8* src = (const ma_uint8*)frames;
+	while (count > 0) {
+		ma_uint32 n = count < REC_WAVC_CHUNK ? (ma_uint32)count : REC_WAVC_CHUNK;
+		if (w->codec == REC_WAV_IMA_ADPCM && n > w->block_frames - w->block_fill) n = w->block_frames - w->block_fill;
+		// ADPCM converts straight into the block
+		ma_int16* pcm = w->codec == REC_WAV_IMA_ADPCM ? w->block + (size_t)w->block_fill * ch : w->pcm;
+		if (w->format == ma_format_s16) memcpy(pcm, src, (size_t)n * bpf);
+		else ma_pcm_convert(pcm, ma_format_s16, src, w->format, (ma_uint64)n * ch, ma_dither_mode_triangle);
+		if (w->codec == REC_WAV_IMA_ADPCM) {
+			w->block_fill += n;
+			if (w->block_fill == w->block_frames) rec_wavc_block(w);
+		} else {
+			if (w->codec == REC_WAV_MULAW) rec_mulaw_encode(pcm, (size_t)n * ch, w->out);
+			else rec_alaw_encode(pcm, (size_t)n * ch, w->out);
+			ma_result result = w->on_write(w->user, w->out, (size_t)n * ch);
+			if (result != MA_SUCCESS && w->result == MA_SUCCESS) w->result = result;
+			w->bytes_written += (size_t)n * ch;
+		}
+		w->frames += n;
+		src += (size_t)n * bpf;
+		count -= n;
+	}
+	return w->result;
+}
+
+static inline ma_result rec_wavc_uninit(rec_wavc* w) {
+	/*
+	 * Codes the last, short ADPCM block,
+	 * pads the data chunk to even length
+	 * and rewrites the header. Returns the
+	 * first error seen.
+	 */
+	if (w->out != NULL && w->header_bytes > 0 && w->result == MA_SUCCESS) {
+		if (w->block_fill > 0) rec_wavc_block(w);
+		if (w->bytes_written & 1) {
+			ma_uint8 pad = 0;
+			ma_result result = w->on_write(w->user, &pad, 1);
+			if (result != MA_SUCCESS && w->result == MA_SUCCESS) w->result = result;
+		}
+		ma_uint8 header[64];
+		size_t size = rec_wavc_header(w, header);
+		if (w->result == MA_SUCCESS) w->result = w->on_seek(w->user, 0);
+		if (w->result == MA_SUCCESS) w->result = w->on_write(w->user, header, size);
+	}
+	ma_free(w->pcm, NULL);
+	ma_free(w->out, NULL);
+	ma_free(w->block, NULL);
+	ma_free(w->codes, NULL);
+	ma_free(w->index, NULL);
+	w->pcm = NULL;
+	w->out = NULL;
+	w->block = NULL;
+	w->codes = NULL;
+	w->index = NULL;
+	return w->result;
+}
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ * Waveform overview of a recording as it grows.
+ *
+ * A rec_wave is a min/max/RMS pyramid: level 0 has a
+ * bucket for every REC_WAVE_BASE frames, and each level
+ * above folds REC_WAVE_FACTOR buckets of the one below.
+ * The writer thread appends to it as it meters each
+ * chunk, every channel of the input folded together, so
+ * a display picks the level nearest its zoom and draws in
+ * time proportional to its width, however long the take.
+ *
+ * Buckets live in pages that are never moved or freed
+ * while recording. Each level publishes its count of
+ * complete buckets last, so a reader on another thread
+ * may look at any bucket below the count it loads.
+ *
+ * Waves belong to the caller, like level feeds, so the UI
+ * can keep showing one after its session is gone.
+ */
+#ifndef REC_WAVE_H
+#define REC_WAVE_H
+
+#include <math.h>
+#include <string.h>
+#include <atomic>
+
+// Frames in a level 0 bucket
+#define REC_WAVE_BASE 1024
+#define REC_WAVE_FACTOR 4
+#define REC_WAVE_LEVELS 8
+// Buckets per page
+#define REC_WAVE_PAGE 4096
+// Pages for level 0, about 99 hours at 48 kHz; each level above needs a quarter as many
+#define REC_WAVE_PAGES 4096
+
+// Full scale is 32767
+typedef struct rec_wave_bucket {
+	ma_int16 min;
+	ma_int16 max;
+	ma_int16 rms;
+} rec_wave_bucket;
+
+typedef struct rec_wave_level {
+	rec_wave_bucket** pages;	// a share of the wave's page table
+	ma_uint32 page_limit;
+	std::atomic<ma_uint64> count;	// complete buckets
+	// The bucket being built; writer only
+	float min, max;
+	double sum_sq;
+	ma_uint32 fill;		// frames at level 0, buckets above
+} rec_wave_level;
+
+typedef struct rec_wave {
+	rec_wave_level levels[REC_WAVE_LEVELS];
+	rec_wave_bucket** page_table;
+	ma_uint32 channels;	// as last pushed
+	ma_uint64 frames;	// pushed; writer only
+	int full;		// out of pages or memory; the overview stops growing
+} rec_wave;
+
+static inline ma_uint64 rec_wave_bucket_frames(ma_uint32 level) {
+	return (ma_uint64)REC_WAVE_BASE << (2 * level);
+}
+
+static inline ma_result rec_wave_init(rec_wave* w) {
+	/*
+	 * Empty, and not yet fed. Pages are
+	 * allocated as the buckets reach them.
+	 */
+	ma_uint32 total = 0;
+	for (ma_uint32 k = 0; k < REC_WAVE_LEVELS; k++) {
+		ma_uint32 limit = REC_WAVE_PAGES >> (2 * k);
+		total += limit > 0 ? limit : 1;
+	}
+	w->page_table = (rec_wave_bucket**)ma_malloc(total * sizeof(rec_wave_bucket*), NULL);
+	if (w->page_table == NULL) return MA_OUT_OF_MEMORY;
+	memset(w->page_table, 0, total * sizeof(rec_wave_bucket*));
+	rec_wave_bucket** pages = w->page_table;
+	for (ma_uint32 k = 0; k < REC_WAVE_LEVELS; k++) {
+		rec_wave_level* l = &w->levels[k];
+		ma_uint32 limit = REC_WAVE_PAGES >> (2 * k);
+		l->pages = pages;
+		l->page_limit = limit > 0 ? limit : 1;
+		pages += l->page_limit;
+		l->count.store(0);
+		l->min = l->max = 0;
+		l->sum_sq = 0;
+		l->fill = 0;
+	}
+	w->channels = 0;
+	w->frames = 0;
+	w->full = 0;
+	return MA_SUCCESS;
+}
+
+static inline void rec_wave_uninit(rec_wave* w) {
+	/*
+	 * Not while a session feeds it or a
+	 * reader looks.
+	 */
+	if (w->page_table == NULL) return;
+	for (ma_uint32 k = 0; k < REC_WAVE_LEVELS; k++) {
+		rec_wave_level* l = &w->levels[k];
+		for (ma_uint32 p = 0; p < l->page_limit; p++) ma_free(l->pages[p], NULL);
+		l->count.store(0);
+	}
+	ma_free(w->page_table, NULL);
+	w->page_table = NULL;
+}
+
+static inline ma_int16 rec_wave_quantize(float level) {
+	if (level > 1.0f) level = 1.0f;
+	if (level < -1.0f) level = -1.0f;
+	return (ma_int16)lrintf(level * 32767.0f);
+}
+
+static inline int rec_wave_append(rec_wave* w, ma_uint32 k, const rec_wave_bucket* bucket) {
+	/*
+	 * Publishes a bucket at level k alone.
+	 * Returns 0, and marks the wave full, if
+	 * there's no room.
+	 */
+	rec_wave_level* l = &w->levels[k];
+	ma_uint64 n = l->count.load(std::memory_order_relaxed);
+	ma_uint32 page = (ma_uint32)(n / REC_WAVE_PAGE);
+	if (page >= l->page_limit) {
+		w->full = 1;
+		return 0;
+	}
+	if (l->pages[page] == NULL) {
+		l->pages[page] = (rec_wave_bucket*)ma_malloc(REC_WAVE_PAGE * sizeof(rec_wave_bucket), NULL);
+		if (l->pages[page] == NULL) {
+			w->full = 1;
+			return 0;
+		}
+	}
+	l->pages[page][n % REC_WAVE_PAGE] = *bucket;
+	l->count.store(n + 1, std::memory_order_release);
+	return 1;
+}
+
+static inline void rec_wave_emit(rec_wave* w, ma_uint32 k, float min, float max, float rms) {
+	/*
+	 * Appends a bucket to level k and folds
+	 * it into the one being built above,
+	 * which may complete in turn.
+	 */
+	while (k < REC_WAVE_LEVELS) {
+		rec_wave_bucket b;
+		b.min = rec_wave_quantize(min);
+		b.max = rec_wave_quantize(max);
+		b.rms = rec_wave_quantize(rms);
+		if (!rec_wave_append(w, k, &b)) return;
+		if (++k == REC_WAVE_LEVELS) return;
+		rec_wave_level* up = &w->levels[k];
+		if (up->fill == 0 || min < up->min) up->min = min;
+		if (up->fill == 0 || max > up->max) up->max = max;
+		up->sum_sq += (double)rms * rms;
+		if (++up->fill < REC_WAVE_FACTOR) return;
+		min = up->min;
+		max = up->max;
+		rms = (float)sqrt(up->sum_sq / REC_WAVE_FACTOR);
+		up->sum_sq = 0;
+		up->fill = 0;
+	}
+}
+
+static inline void rec_wave_kernel(const float* x, ma_uint32 samples, float* min, float* max, double* sum_sq) {
+	/*
+	 * Over 8 lanes, for the compiler to
+	 * vectorize, then the remainder.
+	 */
+	float lane_min[8], lane_max[8], lane_sq[8];
+	for (ma_uint32 j = 0; j < 8; j++) {
+		lane_min[j] = *min;
+		lane_max[j] = *max;
+		lane_sq[j] = 0;
+	}
+	ma_uint32 i = 0;
+	for (; i + 8 <= samples; i += 8) {
+		for (ma_uint32 j = 0; j < 8; j++) {
+			float v = x[i + j];
+			lane_min[j] = v < lane_min[j] ? v : lane_min[j];
+			lane_max[j] = v > lane_max[j] ? v : lane_max[j];
+			lane_sq[j] += v * v;
+		}
+	}
+	for (; i < samples; i++) {
+		if (x[i] < lane_min[0]) lane_min[0] = x[i];
+		if (x[i] > lane_max[0]) lane_max[0] = x[i];
+		lane_sq[0] += x[i] * x[i];
+	}
+	for (ma_uint32 j = 0; j < 8; j++) {
+		if (lane_min[j] < *min) *min = lane_min[j];
+		if (lane_max[j] > *max) *max = lane_max[j];
+		*sum_sq += lane_sq[j];
+	}
+}
+
+static inline void rec_wave_push(rec_wave* w, const float* x, ma_uint32 frames, ma_uint32 channels) {
+	/*
+	 * Writer thread: interleaved f32 frames
+	 * of channels each.
+	 */
+	if (w == NULL) return;
+	w->frames += frames;
+	w->channels = channels;
+	if (w->full) return;
+	rec_wave_level* l = &w->levels[0];
+	while (frames > 0) {
+		ma_uint32 n = REC_WAVE_BASE - l->fill;
+		if (n > frames) n = frames;
+		if (l->fill == 0) l->min = l->max = x[0];
+		rec_wave_kernel(x, n * channels, &l->min, &l->max, &l->sum_sq);
+		l->fill += n;
+		x += (size_t)n * channels;
+		frames -= n;
+		if (l->fill < REC_WAVE_BASE) continue;
+		float rms = (float)sqrt(l->sum_sq / ((double)REC_WAVE_BASE * channels));
+		l->sum_sq = 0;
+		l->fill = 0;
+		rec_wave_emit(w, 0, l->min, l->max, rms);
+		if (w->full) return;
+	}
+}
+
+static inline void rec_wave_flush(rec_wave* w) {
+	/*
+	 * Writer, at the end of the take: the
+	 * buckets still being built become the
+	 * last of each level.
+	 */
+	rec_wave_level* l = &w->levels[0];
+	if (l->fill > 0 && !w->full) {
+		float rms = (float)sqrt(l->sum_sq / ((double)l->fill * w->channels));
+		l->fill = 0;
+		l->sum_sq = 0;
+		rec_wave_emit(w, 0, l->min, l->max, rms);
+	}
+	for (ma_uint32 k = 1; k < REC_WAVE_LEVELS && !w->full; k++) {
+		l = &w->levels[k];
+		if (l->fill == 0) continue;
+		float rms = (float)sqrt(l->sum_sq / l->fill);
+		l->fill = 0;
+		l->sum_sq = 0;
+		rec_wave_emit(w, k, l->min, l->max, rms);
+	}
+}
+
+static inline ma_uint64 rec_wave_count(rec_wave* w, ma_uint32 level) {
+	/*
+	 * Buckets complete at a level, which a
+	 * reader may use.
+	 */
+	return w->levels[level].count.load(std::memory_order_acquire);
+}
+
+static inline ma_uint64 rec_wave_frames(rec_wave* w) {
+	return rec_wave_count(w, 0) * REC_WAVE_BASE;
+}
+
+static inline const rec_wave_bucket* rec_wave_at(rec_wave* w, ma_uint32 level, ma_uint64 i) {
+	return &w->levels[level].pages[i / REC_WAVE_PAGE][i % REC_WAVE_PAGE];
+}
+
+static inline ma_uint32 rec_wave_level_for(ma_uint64 frames_per_point) {
+	/*
+	 * The coarsest level whose buckets are no
+	 * wider than a point of the display.
+	 */
+	ma_uint32 k = 0;
+	while (k + 1 < REC_WAVE_LEVELS && rec_wave_bucket_frames(k + 1) <= frames_per_point) k++;
+	return k;
+}
+
+static inline int rec_wave_fold(rec_wave* w, ma_uint32 level, ma_uint64 first, ma_uint64 last, ma_uint64 count, rec_wave_bucket* out) {
+	/*
+	 * Buckets first to last, exclusive, of
+	 * the count loaded, as one. Returns 0 if
+	 * none are complete.
+	 */
+	if (last > count) last = count;
+	if (first >= last) return 0;
+	const rec_wave_bucket* b = rec_wave_at(w, level, first);
+	int min = b->min, max = b->max;
+	double sum_sq = (double)b->rms * b->rms;
+	for (ma_uint64 i = first + 1; i < last; i++) {
+		b = rec_wave_at(w, level, i);
+		if (b->min < min) min = b->min;
+		if (b->max > max) max = b->max;
+		sum_sq += (double)b->rms * b->rms;
+	}
+	out->min = (ma_int16)min;
+	out->max = (ma_int16)max;
+	out->rms = (ma_int16)sqrt(sum_sq / (double)(last - first));
+	return 1;
+}
+
+#endif
@@ -0,0 +1,455 @@
+/*
+ * Widgets for the main window that redraw only what
+ * changed.
+ *
+ * All are fed from timeout_cb and compare what they are
+ * given with what they last drew, in pixels, text or
+ * frames. Only a difference marks damage, and only over
+ * the part that differs, so a tick with nothing new draws
+ * nothing and the rest of the window is never touched.
+ *
+ * Included from main_win.cxx after the FLTK headers and
+ * rec_session.h.
+ */
+#ifndef REC_WIDGETS_H
+#define REC_WIDGETS_H
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <FL/Fl_Widget.H>
+#include <FL/fl_draw.H>
+
+// Every channel of every input
+#define REC_LEVEL_BARS (REC_MAX_INPUTS * REC_METER_CHANNELS)
+// Left edge of the meter scale, dBFS
+#define REC_LEVEL_FLOOR -60.0f
+// Width of the clip lamp at the right of each bar
+#define REC_LEVEL_LAMP 4
+#define REC_WAVE_NO_HEAD (~(ma_uint64)0)
+// Bottom of the spectrum's scale, dBFS
+#define REC_SPECTRUM_VIEW_FLOOR -96.0f
+// True peak above which the loudness line turns red, dBTP (EBU R128's ceiling)
+#define REC_LOUDNESS_VIEW_CEILING -1.0f
+
+/*
+ * Horizontal bars, one per channel: the period's peak,
+ * filled green, yellow above -18 dBFS and red above -6;
+ * the held peak as a tick; and a lamp that stays lit once
+ * the channel has clipped.
+ */
+class rec_level_meter : public Fl_Widget {
+	int count;
+	// Wanted and drawn, as pixel lengths and lamp states
+	short peak_px[REC_LEVEL_BARS];
+	short held_px[REC_LEVEL_BARS];
+	char lamp[REC_LEVEL_BARS];
+	short drawn_peak[REC_LEVEL_BARS];
+	short drawn_held[REC_LEVEL_BARS];
+	char drawn_lamp[REC_LEVEL_BARS];
+
+	int span() const {
+		return w() - 2 - REC_LEVEL_LAMP - 1;
+	}
+
+	int bar_y(int i) const {
+		return y() + 1 + (h() - 2) * i / count;
+	}
+
+	int bar_h(int i) const {
+		// Bars touch when there are many; otherwise a line apart
+		int height = bar_y(i + 1) - bar_y(i);
+		return height > 3 ? height - 1 : height;
+	}
+
+	int length(float level) const {
+		float db = rec_level_db(level);
+		if (db <= REC_LEVEL_FLOOR) return 0;
+		if (db >= 0) return span();
+		return (int)((db - REC_LEVEL_FLOOR) / -REC_LEVEL_FLOOR * span() + 0.5f);
+	}
+
+	void draw_bar(int i) {
+		/*
+		 * The zones are fixed points on the
+		 * scale; each is filled as far as the
+		 * peak reaches into it.
+		 */
+		const int X = x() + 1, Y = bar_y(i), H = bar_h(i), n = span();
+		const int yellow = (int)((-18.0f - REC_LEVEL_FLOOR) / -REC_LEVEL_FLOOR * n);
+		const int red = (int)((-6.0f - REC_LEVEL_FLOOR) / -REC_LEVEL_FLOOR * n);
+		const int p = peak_px[i];
+		fl_rectf(X, Y, n, H, FL_BLACK);
+		if (p > 0) fl_rectf(X, Y, p < yellow ? p : yellow, H, FL_GREEN);
+		if (p > yellow) fl_rectf(X + yellow, Y, (p < red ? p : red) - yellow, H, FL_YELLOW);
+		if (p > red) fl_rectf(X + red, Y, p - red, H, FL_RED);
+		if (held_px[i] > 0) fl_rectf(X + held_px[i] - 1, Y, 1, H, FL_WHITE);
+		fl_rectf(X + n + 1, Y, REC_LEVEL_LAMP, H, lamp[i] ? FL_RED : FL_DARK3);
+		drawn_peak[i] = peak_px[i];
+		drawn_held[i] = held_px[i];
+		drawn_lamp[i] = lamp[i];
+	}
+
+public:
+	rec_level_meter(int X, int Y, int W, int H, const char* L = 0) : Fl_Widget(X, Y, W, H, L) {
+		count = 0;
+		memset(peak_px, 0, sizeof(peak_px));
+		memset(held_px, 0, sizeof(held_px));
+		memset(lamp, 0, sizeof(lamp));
+		memset(drawn_peak, 0, sizeof(drawn_peak));
+		memset(drawn_held, 0, sizeof(drawn_held));
+		memset(drawn_lamp, 0, sizeof(drawn_lamp));
+		box(FL_FLAT_BOX);
+		color(FL_DARK3);
+	}
+
+	void bars(int n) {
+		/*
+		 * At most one per pixel row; channels
+		 * beyond that aren't shown.
+		 */
+		if (n > h() - 2) n = h() - 2;
+		if (n > REC_LEVEL_BARS) n = REC_LEVEL_BARS;
+		if (n < 0) n = 0;
+		if (n == count) return;
+		count = n;
+		for (int i = 0; i < count; i++) {
+			peak_px[i] = held_px[i] = drawn_peak[i] = drawn_held[i] = 0;
+			lamp[i] = drawn_lamp[i] = 0;
+		}
+		damage(FL_DAMAGE_ALL);
+	}
+
+	int bars() const {
+		return count;
+	}
+
+	void level(int i, float peak, float held, int clipped) {
+		/*
+		 * Damages the bar only if it would
+		 * draw differently.
+		 */
+		if (i >= count) return;
+		peak_px[i] = (short)length(peak);
+		held_px[i] = (short)length(held);
+		lamp[i] = clipped != 0;
+		if (peak_px[i] != drawn_peak[i] || held_px[i] != drawn_held[i] || lamp[i] != drawn_lamp[i]) {
+			damage(FL_DAMAGE_USER1, x(), bar_y(i), w(), bar_h(i));
+		}
+	}
+
+	void draw() {
+		/*
+		 * Everything after an expose or a new
+		 * bar count; otherwise only the bars
+		 * that changed.
+		 */
+		if (damage() & ~FL_DAMAGE_USER1) {
+			draw_box();
+			for (int i = 0; i < count; i++) draw_bar(i);
+			return;
+		}
+		for (int i = 0; i < count; i++) {
+			if (peak_px[i] != drawn_peak[i] || held_px[i] != drawn_held[i] || lamp[i] != drawn_lamp[i]) draw_bar(i);
+		}
+	}
+};
+
+/*
+ * Elapsed time as h:mm:ss.t, red on request. The text is
+ * kept in a fixed buffer; only a new tenth redraws it.
+ */
+class rec_time_display : public Fl_Widget {
+	char text[32];
+	char drawn[32];
+	int alert;
+	int drawn_alert;
+
+public:
+	rec_time_display(int X, int Y, int W, int H, const char* L = 0) : Fl_Widget(X, Y, W, H, L) {
+		text[0] = drawn[0] = 0;
+		alert = drawn_alert = 0;
+		box(FL_DOWN_BOX);
+		color(FL_WHITE);
+		value(0, 0);
+	}
+
+	void value(double seconds, int red) {
+		if (seconds < 0) seconds = 0;
+		ma_uint64 tenths = (ma_uint64)(seconds * 10);
+		snprintf(text, sizeof(text), "%u:%02u:%02u.%u", (unsigned)(tenths / 36000), (unsigned)(tenths / 600 % 60),
+			(unsigned)(tenths / 10 % 60), (unsigned)(tenths % 10));
+		alert = red;
+		if (strcmp(text, drawn) != 0 || alert != drawn_alert) damage(FL_DAMAGE_USER1);
+	}
+
+	void draw() {
+		draw_box();
+		fl_font(FL_COURIER, 14);
+		fl_color(alert ? FL_RED : FL_FOREGROUND_COLOR);
+		fl_draw(text, x() + 4, y(), w() - 8, h(), FL_ALIGN_LEFT | FL_ALIGN_INSIDE);
+		memcpy(drawn, text, sizeof(text));
+		drawn_alert = alert;
+	}
+};
+
+/*
+ * The waveform of each input as it records, in lanes top
+ * to bottom: min to max dark, RMS bright. Shows the whole
+ * take, or scrolls with the last span frames; the mouse
+ * wheel zooms. Every column folds a handful of buckets
+ * from the level of the pyramid nearest the zoom. A
+ * playhead can be marked, and a click does the callback
+ * with the frame under the mouse in picked().
+ */
+class rec_wave_view : public Fl_Widget {
+	rec_wave* waves;
+	int count;
+	ma_uint64 span;		// 0 for the whole take
+	ma_uint64 drawn_frames;
+	ma_uint64 head;		// REC_WAVE_NO_HEAD for none
+	int drawn_head;		// column, or -1
+	ma_uint64 pick;
+
+	ma_uint64 frames() const {
+		ma_uint64 total = 0;
+		for (int i = 0; i < count; i++) {
+			ma_uint64 n = rec_wave_frames(&waves[i]);
+			if (n > total) total = n;
+		}
+		return total;
+	}
+
+public:
+	rec_wave_view(int X, int Y, int W, int H, const char* L = 0) : Fl_Widget(X, Y, W, H, L) {
+		waves = NULL;
+		count = 0;
+		span = 0;
+		drawn_frames = 0;
+		head = REC_WAVE_NO_HEAD;
+		drawn_head = -1;
+		pick = 0;
+		box(FL_FLAT_BOX);
+		color(FL_BLACK);
+	}
+
+	// Frames shown, and the first of them
+	void view(ma_uint64* start, ma_uint64* shown) const {
+		*shown = span == 0 || span > drawn_frames ? drawn_frames : span;
+		*start = drawn_frames - *shown;
+	}
+
+	int column(ma_uint64 frame) const {
+		ma_uint64 start, shown;
+		view(&start, &shown);
+		if (frame == REC_WAVE_NO_HEAD || shown == 0 || frame < start || frame > start + shown) return -1;
+		return (int)((frame - start) * (ma_uint64)(w() - 1) / shown);
+	}
+
+	void playhead(ma_uint64 frame) {
+		head = frame;
+		if (column(head) != drawn_head) damage(FL_DAMAGE_USER1);
+	}
+
+	ma_uint64 picked() const {
+		return pick;
+	}
+
+	void update(rec_wave* w, int n) {
+		/*
+		 * Damaged when the inputs change or a
+		 * bucket completes.
+		 */
+		if (w != waves || n != count) {
+			waves = w;
+			count = n;
+			damage(FL_DAMAGE_ALL);
+			return;
+		}
+		if (frames() != drawn_frames) damage(FL_DAMAGE_USER1);
+	}
+
+	int handle(int event) {
+		if (event == FL_PUSH && drawn_frames > 0) {
+			ma_uint64 start, shown;
+			view(&start, &shown);
+			int px = Fl::event_x() - x();
+			pick = start + shown * (ma_uint64)(px > 0 ? px : 0) / w();
+			do_callback();
+			return 1;
+		}
+		if (event != FL_MOUSEWHEEL) return Fl_Widget::handle(event);
+		ma_uint64 total = frames();
+		ma_uint64 least = (ma_uint64)w() * REC_WAVE_BASE / REC_WAVE_FACTOR;
+		if (Fl::event_dy() > 0) {
+			span *= 2;
+			if (span >= total) span = 0;
+		} else if (Fl::event_dy() < 0) {
+			span = (span == 0 ? total : span) / 2;
+			if (span < least) span = least;
+		}
+		damage(FL_DAMAGE_ALL);
+		return 1;
+	}
+
+	void draw() {
+		draw_box();
+		drawn_frames = frames();
+		drawn_head = -1;
+		if (count == 0 || drawn_frames == 0) return;
+		ma_uint64 start, shown;
+		view(&start, &shown);
+		const int W = w(), lane = h() / count;
+		const ma_uint32 level = rec_wave_level_for(shown / W);
+		const ma_uint64 bucket = rec_wave_bucket_frames(level);
+		for (int i = 0; i < count; i++) {
+			const ma_uint64 buckets = rec_wave_count(&waves[i], level);
+			const int top = y() + i * lane, mid = top + lane / 2, half = lane / 2 - 1;
+			fl_color(FL_DARK3);
+			fl_xyline(x(), mid, x() + W - 1);
+			for (int px = 0; px < W; px++) {
+				ma_uint64 first = (start + shown * px / W) / bucket;
+				ma_uint64 last = (start + shown * (px + 1) / W + bucket - 1) / bucket;
+				if (last <= first) last = first + 1;
+				rec_wave_bucket b;
+				if (!rec_wave_fold(&waves[i], level, first, last, buckets, &b)) break;
+				fl_color(FL_DARK_GREEN);
+				fl_yxline(x() + px, mid - b.max * half / 32767, mid - b.min * half / 32767);
+				fl_color(FL_GREEN);
+				fl_yxline(x() + px, mid - b.rms * half / 32767, mid + b.rms * half / 32767);
+			}
+		}
+		drawn_head = column(head);
+		if (drawn_head >= 0) {
+			fl_color(FL_WHITE);
+			fl_yxline(x() + drawn_head, y(), y() + h() - 1);
+		}
+	}
+};
+
+/*
+ * The spectrum of the input as it records: a bar per band,
+ * low to high, filled up to the latest level, with the
+ * held level as a tick. The scale runs from
+ * REC_SPECTRUM_VIEW_FLOOR at the bottom to 0 dBFS.
+ */
+class rec_spectrum_view : public Fl_Widget {
+	int count;
+	short level_px[REC_SPECTRUM_BANDS];
+	short held_px[REC_SPECTRUM_BANDS];
+	short drawn_level[REC_SPECTRUM_BANDS];
+	short drawn_held[REC_SPECTRUM_BANDS];
+
+	int band_x(int b) const {
+		return x() + 1 + (w() - 2) * b / count;
+	}
+
+	int height(float db) const {
+		if (db <= REC_SPECTRUM_VIEW_FLOOR) return 0;
+		if (db >= 0) return h() - 2;
+		return (int)((db - REC_SPECTRUM_VIEW_FLOOR) / -REC_SPECTRUM_VIEW_FLOOR * (h() - 2) + 0.5f);
+	}
+
+	void draw_band(int b) {
+		const int X = band_x(b), W = band_x(b + 1) - X, Y = y() + 1, H = h() - 2;
+		// A pixel between bands when there's room
+		const int bar = W > 2 ? W - 1 : W;
+		fl_rectf(X, Y, W, H, FL_BLACK);
+		if (level_px[b] > 0) fl_rectf(X, Y + H - level_px[b], bar, level_px[b], FL_CYAN);
+		if (held_px[b] > 0) fl_rectf(X, Y + H - held_px[b], bar, 1, FL_WHITE);
+		drawn_level[b] = level_px[b];
+		drawn_held[b] = held_px[b];
+	}
+
+public:
+	rec_spectrum_view(int X, int Y, int W, int H, const char* L = 0) : Fl_Widget(X, Y, W, H, L) {
+		count = 0;
+		memset(level_px, 0, sizeof(level_px));
+		memset(held_px, 0, sizeof(held_px));
+		memset(drawn_level, 0, sizeof(drawn_level));
+		memset(drawn_held, 0, sizeof(drawn_held));
+		box(FL_FLAT_BOX);
+		color(FL_BLACK);
+	}
+
+	void update(const rec_spectrum_frame* f) {
+		/*
+		 * Damages only the bands that would
+		 * draw differently; none until the
+		 * first analysis.
+		 */
+		int n = f != NULL ? (int)f->bands : 0;
+		if (n > w() - 2) n = w() - 2;
+		if (n != count) {
+			count = n;
+			for (int b = 0; b < count; b++) level_px[b] = held_px[b] = drawn_level[b] = drawn_held[b] = 0;
+			damage(FL_DAMAGE_ALL);
+		}
+		for (int b = 0; b < count; b++) {
+			level_px[b] = (short)height(f->level[b]);
+			held_px[b] = (short)height(f->held[b]);
+			if (level_px[b] != drawn_level[b] || held_px[b] != drawn_held[b]) damage(FL_DAMAGE_USER1, band_x(b), y(), band_x(b + 1) - band_x(b), h());
+		}
+	}
+
+	void draw() {
+		if (damage() & ~FL_DAMAGE_USER1) {
+			draw_box();
+			for (int b = 0; b < count; b++) draw_band(b);
+			return;
+		}
+		for (int b = 0; b < count; b++) {
+			if (level_px[b] != drawn_level[b] || held_px[b] != drawn_held[b]) draw_band(b);
+		}
+	}
+};
+
+/*
+ * A line of loudness figures for the take: momentary,
+ * short-term and integrated LUFS, and the true peak, red
+ * once that is over REC_LOUDNESS_VIEW_CEILING. Blank
+ * without a meter; dashes for what needs more audio.
+ */
+class rec_loudness_display : public Fl_Widget {
+	char text[64];
+	char drawn[64];
+	int alert;
+	int drawn_alert;
+
+	static int figure(char* out, size_t size, const char* name, float value) {
+		if (!isfinite(value)) return snprintf(out, size, "%s --.-", name);
+		return snprintf(out, size, "%s %.1f", name, value);
+	}
+
+public:
+	rec_loudness_display(int X, int Y, int W, int H, const char* L = 0) : Fl_Widget(X, Y, W, H, L) {
+		text[0] = drawn[0] = 0;
+		alert = drawn_alert = 0;
+		box(FL_FLAT_BOX);
+	}
+
+	void update(const rec_loudness_frame* f) {
+		if (f == NULL) {
+			text[0] = 0;
+			alert = 0;
+		} else {
+			int n = figure(text, sizeof(text), "M", f->momentary);
+			n += figure(text + n, sizeof(text) - n, "  S", f->short_term);
+			n += figure(text + n, sizeof(text) - n, "  I", f->integrated);
+			figure(text + n, sizeof(text) - n, "  TP", f->true_peak);
+			alert = f->true_peak > REC_LOUDNESS_VIEW_CEILING;
+		}
+		if (strcmp(text, drawn) != 0 || alert != drawn_alert) damage(FL_DAMAGE_USER1);
+	}
+
+	void draw() {
+		draw_box();
+		fl_font(FL_COURIER, 11);
+		fl_color(alert ? FL_RED : FL_FOREGROUND_COLOR);
+		fl_draw(text, x() + 2, y(), w() - 4, h(), FL_ALIGN_LEFT | FL_ALIGN_INSIDE);
+		memcpy(drawn, text, sizeof(text));
+		drawn_alert = alert;
+	}
+};
+
+#endif